@@ -30,9 +30,9 @@
 #define NOCRYPT 
 
 // --- 生产环境限制参数 ---
-// 注意：MAX_CONNECTIONS 必须小于 FD_SETSIZE
+// [Mod] 转发阶段由 WSAPoll 事件循环驱动，MAX_CONNECTIONS 不再受 FD_SETSIZE 限制
 #ifndef MAX_CONNECTIONS
-#define MAX_CONNECTIONS 512
+#define MAX_CONNECTIONS 8192
 #endif
 
 #define IO_BUFFER_SIZE 16384 
@@ -120,11 +120,17 @@
 // [New] 定义最大规则数与内容长度
 #define MAX_RULES 64
 #define MAX_RULE_CONTENT_LEN 256
+#define MAX_RULE_PROVIDERS 16 // [New] 外部规则集数量上限
 
 // --- 结构体定义 ---
 typedef struct { 
     SOCKET sock; 
     SSL *ssl; 
+    BIO *net_bio; // [New] 内存 BIO 引擎的网络端 (NULL = SSL 直接绑定 Socket)
+    int ktls;     // [New] kTLS 卸载状态 (TLS_KTLS_* 位，见 crypto.h)
+    char *early_buf;  // [New] 待随 ClientHello 发出的 0-RTT 数据 (发出后释放)
+    int early_len;
+    int early_state;  // TLS_EARLY_* (见 crypto.h)
 } TLSContext;
 
 typedef struct {
@@ -147,6 +153,18 @@ typedef struct {
     int contentCount;
 } RoutingRule;
 
+// [New] 外部规则集 (routing.providers)：大型域名 / CIDR 列表，编译为二进制文件后内存映射
+#define RULE_PROVIDER_DOMAIN 0
+#define RULE_PROVIDER_IPCIDR 1
+typedef struct {
+    char tag[32];           // 规则集名称 (同时决定编译文件名)
+    char outboundTag[32];   // 命中后的策略
+    int type;               // RULE_PROVIDER_*
+    char source[512];       // 本地路径或 http(s) 地址
+    BOOL isUrl;
+    int interval;           // 订阅地址的更新间隔 (秒)
+} RuleProvider;
+
 // --- 全局变量声明 ---
 extern ProxyConfig g_proxyConfig;
 extern volatile BOOL g_proxyRunning;
@@ -188,11 +206,23 @@ extern int g_uaPlatformIndex;
 extern char g_userAgentStr[512];
 
 extern BOOL g_enableECH;
+extern BOOL g_enableKTLS; // [New] 内核 TLS 卸载 (仅 INI 开关，默认关闭)
+extern BOOL g_enableMux;  // [New] 隧道多路复用 (仅 INI 开关，默认关闭)
+extern int g_muxMaxConnections; // 每个节点的复用隧道数
+extern int g_muxMaxStreams;     // 每条隧道的并发流上限
+extern int g_warmPoolSize;       // [New] 每个节点 (每个事件循环) 预建的空闲连接数，0 = 关闭
+extern int g_warmPoolMaxIdle;    // 预建连接的最长空闲时间 (秒)
+extern BOOL g_enableTlsResume;   // [New] 上游 TLS 会话恢复 (票据缓存，保存到磁盘)
+extern BOOL g_enableEarlyData;   // [New] 会话恢复时以 0-RTT 发送首个请求 (需同时开启会话恢复)
+extern int g_dnsMode;            // [New] 域名解析后端: 0=系统解析器, 1=UDP, 2=DoH (RFC 8484)
+extern char g_dnsServer[256];    // UDP: 逗号分隔的 IPv4 服务器 (空=系统配置)；DoH: 查询 URL (空=沿用 ECHServer)
 extern char g_echConfigServer[256]; 
 extern char g_echPublicName[256];   
 
 extern RoutingRule g_routingRules[MAX_RULES];
 extern int g_routingRuleCount;
+extern RuleProvider g_ruleProviders[MAX_RULE_PROVIDERS];
+extern int g_ruleProviderCount;
 
 extern const wchar_t* UA_PLATFORMS[];
 extern const char* UA_TEMPLATES[];
@@ -95,6 +95,9 @@ void ToggleTrayIcon();
 // [New] 跨模块通用的安全字符串复制函数
 void ConfigSafeStrCpy(char* dest, size_t destSize, const char* src);
 
+// [New] 解析 config.json 中的 routing.rules 到 g_routingRules (需在 g_configLock 内调用)
+void ParseRoutingRules(cJSON* root);
+
 // --- 节点管理 (config_nodes.c) ---
 void ParseTags();
 void SwitchNode(const wchar_t* tag);
@@ -52,15 +52,98 @@ void BIO_set_params(BIO *b, const CryptoSettings *s);
 
 // --- TLS 连接相关 (crypto_tls.c) ---
 int tls_init_connect(TLSContext *ctx, const char* target_sni, const char* target_host, const CryptoSettings* settings, BOOL allowInsecure);
+// [New] 非阻塞握手 (供事件循环逐步推进)
+#define TLS_STEP_WANT_READ  0
+#define TLS_STEP_DONE       1
+#define TLS_STEP_WANT_WRITE 2
+int tls_connect_begin(TLSContext *ctx, const char* target_sni, const char* target_host, const CryptoSettings* settings, BOOL allowInsecure);
+int tls_connect_step(TLSContext *ctx);
+int tls_connect_wait(TLSContext *ctx);
 const char* tls_get_alpn_selected(TLSContext *ctx);
+// [New] 0-RTT early data (TLSContext.early_state)
+#define TLS_EARLY_NONE     0
+#define TLS_EARLY_PENDING  1 // 已排队，随 ClientHello 发出
+#define TLS_EARLY_SENT     2 // 已发出，等待握手结果
+#define TLS_EARLY_ACCEPTED 3
+#define TLS_EARLY_REJECTED 4 // 服务端拒绝，调用者须在握手后重新发送
+// 在 tls_connect_begin 之后、首次 tls_connect_step 之前调用：恢复的会话允许 early data 且 ALPN 为 alpn 时排队。
+// 返回 1=已排队, 0=不可用 (照常在握手后发送)
+int tls_set_early_data(TLSContext *ctx, const char *alpn, const char *data, int len);
+// 握手完成后：early data 是否已被服务端接受 (接受时无需重发)
+BOOL tls_early_data_accepted(const TLSContext *ctx);
+// [New] kTLS 卸载状态 (TLSContext.ktls)
+#define TLS_KTLS_REQUESTED 0x1 // 已请求 (g_enableKTLS)
+#define TLS_KTLS_TX        0x2 // 发送方向已由内核加密
+#define TLS_KTLS_RX        0x4 // 接收方向已由内核解密
+// 返回 "off" / "not engaged" / "tx" / "rx" / "tx+rx"
+const char* tls_ktls_status(const TLSContext *ctx);
 int tls_write(TLSContext *ctx, const char *data, int len);
+// [New] 非阻塞写入：返回已接受的字节数 (可能为 0)，-1=错误
+int tls_write_nb(TLSContext *ctx, const char *data, int len);
+// [New] 非阻塞排空待发密文：0=已发完, 1=Socket 写满, -1=错误
+int tls_flush_nb(TLSContext *ctx);
+// [New] 半关闭：发送 close_notify，之后仍可读取
+int tls_shutdown_write(TLSContext *ctx);
 int tls_read(TLSContext *ctx, char *out, int max);
 int tls_read_exact(TLSContext *ctx, char *buf, int len);
 void tls_close(TLSContext *ctx);
+int tls_pending(TLSContext *ctx);
+
+// --- TLS 会话缓存 (crypto_session.c) ---
+// 注册新会话回调 (CreateNewSSLContext 调用)
+void TlsSession_InitCtx(SSL_CTX *ctx);
+// 为连接设置缓存键并尝试恢复会话 (握手开始前调用，sock 必须已连接)
+void TlsSession_Apply(SSL *ssl, SOCKET sock, const char *sni, const char *host, BOOL allowInsecure);
+// 本连接能否发送 len 字节 early data (会话允许、ALPN 一致且票据未用于 0-RTT)。返回 1 时票据标记为已使用
+int TlsSession_ClaimEarlyData(SSL *ssl, const char *alpn, int len);
+void TlsSession_Clear(void);
+void TlsSession_Save(void);    // 写入 tls_sessions.dat (DPAPI 加密)
+void TlsSession_Cleanup(void);
+
+// --- 内存 BIO TLS 引擎 (crypto_tls_engine.c) ---
+// SSL 运行在 BIO pair 之上，密文由调用者在 Socket 与引擎之间搬运
+int TlsEngine_Attach(TLSContext *ctx);
+void TlsEngine_Detach(TLSContext *ctx);
+BOOL TlsEngine_IsActive(const TLSContext *ctx);
+int TlsEngine_CipherInSpace(TLSContext *ctx, char **ptr);   // 零拷贝写入位置
+int TlsEngine_CipherInCommit(TLSContext *ctx, int len);
+int TlsEngine_Feed(TLSContext *ctx, const char *data, int len);
+int TlsEngine_CipherOutPending(TLSContext *ctx);
+int TlsEngine_CipherOut(TLSContext *ctx, char **ptr);       // 零拷贝读取位置
+void TlsEngine_CipherOutConsume(TLSContext *ctx, int len);
+int TlsEngine_Drain(TLSContext *ctx, char *out, int max);
+int TlsEngine_Handshake(TLSContext *ctx);
+int TlsEngine_Read(TLSContext *ctx, char *out, int max);
+int TlsEngine_Write(TLSContext *ctx, const char *data, int len);
+int TlsEngine_Buffered(TLSContext *ctx);
+int TlsEngine_FlushToSocket(TLSContext *ctx);
+int TlsEngine_FillFromSocket(TLSContext *ctx);
 
 // --- WebSocket 辅助 (crypto_ws.c) ---
 int build_ws_frame(const char *in, int len, char *out);
+// [New] 原地封帧 (帧头写入载荷前的预留空间)。载荷前至少需要 WS_FRAME_HEADROOM 字节
+#define WS_FRAME_HEADROOM 14
+int ws_frame_header_len(int payload_len);
+char* build_ws_frame_inplace(char *payload, int len, int *frame_len);
 long long check_ws_frame(unsigned char *in, int len, int *head_len, int *payload_len);
+// [New] 仅解析帧头 (载荷可未到齐)，帧头可分布在两段内存中 (环形缓冲回绕)
+typedef struct {
+    int opcode;
+    int masked;
+    unsigned char mask[4];
+    int header_len;
+    long long payload_len;
+} WsFrameHeader;
+// 返回: 帧头长度 (>0)，0 = 帧头不完整，-1 = 协议错误 (含载荷超过 MAX_WS_FRAME_SIZE)
+int ws_parse_header_split(const unsigned char *a, int alen, const unsigned char *b, int blen, WsFrameHeader *out);
 int ws_read_payload_exact(TLSContext *tls, char *out_buf, int expected_len);
 
+// --- WebSocket 掩码内核 (crypto_ws_mask.c) ---
+// 按 CPU 特性选择 SSE2/AVX2/NEON/64 位标量实现 (init_crypto_global 调用；未初始化时首次使用自动选择)
+void ws_mask_init(void);
+const char* ws_mask_impl_name(void);
+// dst[i] = src[i] ^ mask[(offset + i) % 4]；dst 可与 src 相同。offset 为该段在帧载荷中的起始位置
+void ws_mask_copy(unsigned char *dst, const unsigned char *src, size_t len, const unsigned char mask[4], size_t offset);
+void ws_mask_inplace(unsigned char *buf, size_t len, const unsigned char mask[4], size_t offset);
+
 #endif // CRYPTO_H
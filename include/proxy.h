@@ -10,6 +10,15 @@ extern volatile BOOL g_needReloadRoutes;
 // [New] 重载路由规则 (从 config.json 读取并更新 g_routingRules)
 void ReloadRoutingRules();
 
+// [New] 将 g_routingRules 编译为路由匹配器并原子发布 (proxy_router.c，不可在 g_configLock 内调用)
+void Router_Rebuild(void);
+
+// [New] 更新外部规则集 (proxy_rule_provider.c)：重新编译缺失、源文件已变化或订阅已到期的规则集，
+// 有更新时重建路由匹配器。会阻塞 (下载 / 编译)，返回更新的数量
+int RuleProvider_Refresh(BOOL force);
+// 在线程池中执行 RuleProvider_Refresh(FALSE) (已在执行时忽略)
+void RuleProvider_RefreshAsync(void);
+
 // 启动/停止代理核心
 void StartProxyCore();
 void StopProxyCore();
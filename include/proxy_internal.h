@@ -55,17 +55,173 @@ ssize_t h2_data_provider_read(nghttp2_session *session, int32_t stream_id, uint8
 // ============================================================================
 int session_init(ProxySession* s, ClientContext* ctx);
 void session_free(ProxySession* s);
-int step_handshake_browser(ProxySession* s);
-int step_connect_upstream(ProxySession* s);
-int step_handshake_ws(ProxySession* s);
-int step_send_proxy_request(ProxySession* s);
-int step_respond_to_browser(ProxySession* s);
+
+// [New] step_* 拆分出的非阻塞报文构造/解析函数 (proxy_fsm.c 使用)
+// [Fix] 2026-10-17: 阻塞的 step_* 握手链已移除，握手只经 Session_StartAsync
+int inbound_parse_socks5_request(ProxySession* s); // 0=CONNECT, 1=UDP ASSOCIATE 已应答, -1=错误
+int inbound_parse_http_request(ProxySession* s);
+int inbound_apply_routing(ProxySession* s);
+void outbound_log_connecting(ProxySession* s);
+SOCKET outbound_open_socket(ProxySession* s, int family, int socktype, int protocol); // 返回新 Socket，不写入 s->remoteSock
+int outbound_tls_begin(ProxySession* s);
+int tunnel_send_payload(ProxySession* s, const char* data, int len); // 0=已写入或排队, -1=错误
+int tunnel_build_ws_upgrade(ProxySession* s);
+int tunnel_check_ws_upgrade(ProxySession* s, int hlen);
+int tunnel_h2_open_stream(ProxySession* s);
+int tunnel_h2_submit_request(ProxySession* s); // 在 s->h2_sess 上提交隧道请求 (流用户数据 = s)
+int tunnel_build_socks_addr(const char* host, int port, unsigned char* out); // [ATYP][地址][端口]，out 至少 262 字节
+int tunnel_build_proxy_header(ProxySession* s, unsigned char* out); // 0=需要 SOCKS5 子握手
+int tunnel_socks5_build_greeting(ProxySession* s, unsigned char* out);
+int tunnel_socks5_build_auth(ProxySession* s, unsigned char* out);
+int tunnel_socks5_build_connect(ProxySession* s, unsigned char* out);
+
+// ============================================================================
+// proxy_h2_pool.c - 共享 HTTP/2 上游连接 (每个循环按节点保持少量长连接，每个浏览器连接占用一个流)
+// ============================================================================
+// 流状态变化 (响应头到达、流关闭、连接失败) 后在循环线程上回调流的持有者
+typedef void (*H2StreamNotify)(ProxySession* s);
+
+// 在 loop 上已有的同节点连接中开流，成功后 s->h2_sess/h2_stream_id 可用。返回 -1 表示无可复用连接
+int H2Pool_Attach(ProxySession* s, int loop, H2StreamNotify notify);
+// 接管 s 已完成 TLS 握手 (ALPN=h2) 的上游连接，创建共享连接并开流；失败时连接已关闭
+int H2Pool_Adopt(ProxySession* s, int loop, H2StreamNotify notify);
+void H2Pool_SetNotify(ProxySession* s, H2StreamNotify notify);
+int H2Pool_GetLoop(ProxySession* s);
+// 冲刷连接上待发送的帧。返回 -1 表示连接已失败 (稍后通过 notify 通知所有流)
+int H2Pool_Flush(ProxySession* s);
+// 浏览器已接收 n 字节下行数据，归还流控窗口
+void H2Pool_Consume(ProxySession* s, int n);
+// 关闭流并解除与连接的关联 (由 session_free 调用)
+void H2Pool_Detach(ProxySession* s);
+
+// ============================================================================
+// proxy_mux.c - 多路复用隧道 (sing-box mux 协议 / yamux，每个浏览器连接占用隧道上的一个流)
+// ============================================================================
+// 流状态变化 (下行数据入队、窗口更新、对端结束、隧道失败) 后在循环线程上回调流的持有者
+typedef void (*MuxStreamNotify)(ProxySession* s);
+
+// 该会话是否走多路复用 (设置已开启、协议支持且节点未被判定为不支持)
+BOOL MuxPool_IsEligible(ProxySession* s, int loop);
+// 在 loop 上已有的同节点隧道中开流。返回 -1 表示无可复用隧道
+int MuxPool_Attach(ProxySession* s, int loop);
+// 接管 s 已完成 TLS (及 WS 升级) 的上游连接作为新隧道并开流；失败时连接已关闭
+int MuxPool_Adopt(ProxySession* s, int loop);
+void MuxPool_SetNotify(ProxySession* s, MuxStreamNotify notify);
+int MuxPool_GetLoop(ProxySession* s);
+// 当前可写入的字节数 (0 = 对端窗口耗尽、隧道写满或流已结束)
+int MuxPool_Writable(ProxySession* s);
+// 写入上行数据 (len 不得超过 MuxPool_Writable)
+int MuxPool_Write(ProxySession* s, const char* data, int len);
+// 上行结束 (FIN)，下行继续
+void MuxPool_CloseWrite(ProxySession* s);
+// 浏览器已接收 n 字节下行数据，累计归还流控窗口
+void MuxPool_Consume(ProxySession* s, int n);
+// 返回: 0=正常, 1=对端已结束下行, -1=流被重置或隧道已断开
+int MuxPool_Status(ProxySession* s);
+// 关闭流并解除与隧道的关联 (由 session_free 调用)
+void MuxPool_Detach(ProxySession* s);
+// [New] 构造隧道头 (代理协议头 + sing-mux 会话请求) 写入 out (至少 MUX_PREAMBLE_MAX 字节)，返回长度，-1=协议不支持
+#define MUX_PREAMBLE_MAX (2048 + 2)
+int MuxPool_BuildPreamble(ProxySession* s, unsigned char* out);
+
+// ============================================================================
+// proxy_warm.c - 预建上游连接池 (按节点保持已完成 TCP + TLS 握手的空闲连接)
+// ============================================================================
+// 取出 loop 上同节点的一条预建连接，成功后 s->remoteSock / s->tls 可用 (TLS 已完成，ALPN 已协商)。
+// 未命中返回 -1，同时登记节点并在后台补充
+int WarmPool_Take(ProxySession* s, int loop);
+
+// ============================================================================
+// proxy_fsm.c - 事件驱动的会话握手状态机 (替代 step_* 阻塞调用链)
+// ============================================================================
+// 接管 ctx->clientSock，握手在 Reactor 上异步推进，完成后自动进入转发阶段
+// 这是唯一的会话入口；当前 proxy.c 运行于 Sing-box 外壳模式，尚无本地监听调用此函数
+int Session_StartAsync(ClientContext* ctx);
+LONG Session_GetHandshakingCount(void);
+
+// ============================================================================
+// proxy_reactor.c - 共享事件循环 (WSAPoll 后端，无 FD_SETSIZE 限制)
+// ============================================================================
+#define REACTOR_EV_READ  0x01
+#define REACTOR_EV_WRITE 0x02
+#define REACTOR_EV_ERROR 0x04
+#define REACTOR_EV_TIMER 0x08
+
+typedef struct ReactorHandle ReactorHandle;
+
+// 回调总是在句柄所属的循环线程上执行
+typedef void (*ReactorCallback)(ReactorHandle* h, int events, void* arg);
+
+int Reactor_Init(int loop_count); // loop_count <= 0 表示按 CPU 核心数
+void Reactor_Shutdown(void);
+BOOL Reactor_IsRunning(void);
+int Reactor_PickLoop(void);
+int Reactor_Post(int loop_idx, void (*fn)(void*), void* arg);
+ReactorHandle* Reactor_Add(int loop_idx, SOCKET s, int events, ReactorCallback cb, void* arg);
+void Reactor_SetEvents(ReactorHandle* h, int events);
+void Reactor_SetTimer(ReactorHandle* h, int delay_ms); // 0 = 取消 (分层时间轮，精度约 16ms)
+ULONGLONG Reactor_Now(void); // [New] 粗粒度时钟：回调内读取本轮缓存的时间，避免热路径反复调用 GetTickCount64
+BOOL Reactor_IsLoopThread(void); // [New] 当前线程是否为事件循环线程 (循环线程上不得阻塞)
+void Reactor_Rearm(ReactorHandle* h);
+void Reactor_Remove(ReactorHandle* h); // 调用后不得再访问 h
+int Reactor_GetLoop(ReactorHandle* h);
 
 // ============================================================================
 // proxy_loop.c - 数据传输循环
 // ============================================================================
-void step_transfer_loop_h1(ProxySession* s);
-void step_transfer_loop_h2(ProxySession* s);
-void step_transfer_loop_udp_direct(ProxySession* s);
+typedef enum {
+    RELAY_MODE_TCP_DIRECT = 0, // 纯 TCP 透传
+    RELAY_MODE_TLS,            // TLS (+ 可选 WebSocket) 隧道
+    RELAY_MODE_H2,             // HTTP/2 隧道
+    RELAY_MODE_UDP,            // SOCKS5 UDP Associate 直连
+    RELAY_MODE_MUX             // [New] 多路复用隧道上的流
+} RelayMode;
+
+typedef void (*RelayDoneCallback)(ProxySession* s, void* arg);
+
+// 异步启动转发，结束时在循环线程上回调 on_done (由其负责 session_free)
+int Relay_Start(ProxySession* s, RelayMode mode, RelayDoneCallback on_done, void* arg);
+int Relay_SendToClient(ProxySession* s, const char* data, int len);
+LONG Relay_GetActiveCount(void);
+
+// ============================================================================
+// proxy_rio.c - Registered I/O 数据面 (TCP 直连透传，批量提交)
+// ============================================================================
+BOOL Rio_IsAvailable(void);
+// 系统支持 RIO 时以 WSA_FLAG_REGISTERED_IO 创建 Socket，否则等同 socket()
+SOCKET Rio_CreateSocket(int af, int type, int protocol);
+// 成功后 Socket 由 RIO 后端负责关闭；失败 (-1) 时调用者应回退到 Reactor 路径
+int Rio_StartDirect(ProxySession* s, RelayDoneCallback on_done, void* arg);
+void Rio_Shutdown(void);
+
+// ============================================================================
+// proxy_router.c - 编译后的路由匹配器 (无锁查找，Router_Rebuild 声明于 proxy.h)
+// ============================================================================
+// host 为域名或 IP 字面量。命中时写入规则的 outboundTag 与命中条目原文 (均可为 NULL)，返回规则序号；未命中返回 -1
+int Router_Match(const char* host, char* out_tag, int tag_len, char* out_entry, int entry_len);
+// 路由规则代数：每次发布新的匹配器后递增
+LONG Router_GetGeneration(void);
+
+// ============================================================================
+// proxy_route_cache.c - 路由决策缓存 (host -> 命中规则，有界 LRU，规则代数变化时整体失效)
+// ============================================================================
+// 与 Router_Match 相同的参数与返回值
+int RouteCache_Match(const char* host, char* out_tag, int tag_len, char* out_entry, int entry_len);
+// 累计命中 / 未命中次数与当前条目数 (均可为 NULL)
+void RouteCache_GetStats(LONG* hits, LONG* misses, int* entries);
+
+// ============================================================================
+// proxy_rule_provider.c - 外部规则集的编译文件 (rules\<tag>.mrs，只读内存映射)
+// ============================================================================
+typedef struct RuleSet RuleSet;
+
+// 映射规则集的编译文件；文件不存在、已损坏或与配置不符时返回 NULL
+RuleSet* RuleSet_Open(const RuleProvider* p);
+void RuleSet_Close(RuleSet* rs);
+int RuleSet_Count(const RuleSet* rs);
+// lower_host 为小写域名，按标签边界做后缀匹配
+BOOL RuleSet_MatchDomain(const RuleSet* rs, const char* lower_host);
+// addr 为网络字节序的 4 / 16 字节地址
+BOOL RuleSet_MatchIp(const RuleSet* rs, const unsigned char* addr, int family);
 
 #endif // PROXY_INTERNAL_H
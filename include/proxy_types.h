@@ -14,6 +14,15 @@ typedef struct {
     CryptoSettings cryptoSettings; 
 } ClientContext;
 
+// [New] 转发阶段的事件循环上下文 (定义于 proxy_loop.c)
+typedef struct RelayCtx RelayCtx;
+
+// [New] 共享 HTTP/2 连接上的一个流 (定义于 proxy_h2_pool.c)
+typedef struct H2Stream H2Stream;
+
+// [New] 多路复用隧道上的一个流 (定义于 proxy_mux.c)
+typedef struct MuxStream MuxStream;
+
 // [Refactor] 代理会话上下文 - 核心状态机结构体
 typedef struct {
     // 核心资源
@@ -27,6 +36,10 @@ typedef struct {
     // [Fix] 增加 volatile 修饰，防止编译器优化循环检测
     volatile int h2_handshake_done; // 0=Pending, 1=Success, -1=Fail
     volatile int h2_status_code;    // 记录握手响应的状态码
+    // [New] 非 NULL 表示流位于共享连接上 (h2_sess 归连接池所有，会话结束时只关闭自己的流)
+    H2Stream *h2_stream;
+    // [New] 非 NULL 表示流位于多路复用隧道上 (上游 Socket / TLS 归隧道所有)
+    MuxStream *mux_stream;
     
     // 配置信息
     ProxyConfig config;
@@ -49,6 +62,7 @@ typedef struct {
     // H2 专用：浏览器数据暂存区 (用于 nghttp2 data provider 回调)
     char *h2_browser_buf; 
     int h2_browser_len;
+    int h2_browser_eof; // [New] 浏览器已 FIN：暂存区发完后随最后的 DATA 帧发送 END_STREAM
     
     // 解析出的目标信息
     char method[16];
@@ -78,6 +92,9 @@ typedef struct {
     // [New] Keep-Alive (心跳保活) 状态
     ULONGLONG last_keepalive_tick; // 上一次发送心跳或有数据传输的时间
     int next_keepalive_interval;   // 下一次心跳的随机间隔 (毫秒)
+
+    // [New] 转发阶段挂载的 Reactor 上下文 (NULL = 未进入事件循环)
+    RelayCtx* relay;
 } ProxySession;
 
 #endif // PROXY_TYPES_H
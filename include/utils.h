@@ -45,9 +45,18 @@ BOOL WriteBufferToFile(const wchar_t* filename, const char* buffer);
 // 简单的 HTTPS GET 请求 (用于 ECH 获取等)
 char* Utils_HttpGet(const char* url);
 
+// [New] 可指定超时与大小上限的版本 (如大型规则集)，out_len 可为 NULL
+char* Utils_HttpGetEx(const char* url, int timeout_ms, size_t max_size, size_t* out_len);
+
 // 获取域名的 ECH 配置 (DoH)
 unsigned char* FetchECHConfig(const char* domain, const char* doh_server, size_t* out_len);
 
+// [New] 缓存中是否已有该域名的 ECH 配置 (不发起请求)
+BOOL IsECHConfigCached(const char* domain);
+
+// [New] RFC 8484 DoH 查询：req 为 DNS 报文，返回应答报文 (调用者 free)
+unsigned char* DohQuery(const char* doh_server, const unsigned char* req, int req_len, int timeout_ms, size_t* out_len);
+
 // [New] IP/CIDR 通用工具
 BOOL IsIpStr(const char* s);
 BOOL IsValidCidrOrIp(const char* input);
@@ -69,6 +78,79 @@ void GetNodeDetailInfo(const wchar_t* nodeTag, char* outType, int typeLen, char*
 // 获取节点纯地址和端口
 void GetNodeAddressInfo(const wchar_t* nodeTag, char* outAddr, int addrLen, int* outPort);
 
+// --------------------------------------------------------------------------
+// 停止通知 (utils_cancel.c)
+// --------------------------------------------------------------------------
+
+// Cancel_Wait 的事件掩码
+#define CANCEL_WAIT_READ  0x01
+#define CANCEL_WAIT_WRITE 0x02
+#define CANCEL_WAIT_ERROR 0x04 // 仅作为返回值 (如非阻塞 connect 失败)
+
+// 发出停止信号：所有 Cancel_Wait 立即返回 -1 (停止代理时调用)
+void Cancel_Signal(void);
+
+// 清除停止信号 (启动代理时调用)
+void Cancel_Reset(void);
+
+BOOL Cancel_IsSignaled(void);
+
+// 等待 Socket 就绪或停止信号，timeout_ms < 0 表示不限时
+// 返回: >0 就绪的事件掩码, 0=超时, -1=已停止或 select 错误
+int Cancel_Wait(SOCKET sock, int events, int timeout_ms);
+
+// [New] 在调用者准备好的集合上 select，同时监听停止信号 (无通知套接字时最多等待 100ms 即返回)
+// 返回: >=0 select 结果, -1=已停止或 select 错误
+int Cancel_Select(fd_set* rfds, fd_set* wfds, fd_set* efds, int timeout_ms);
+
+// 释放通知套接字 (程序退出前调用)
+void Cancel_Cleanup(void);
+
+// --------------------------------------------------------------------------
+// [New] DNS 解析器 (utils_dns.c)
+// --------------------------------------------------------------------------
+
+// 解析 host (IP 字面量直接返回)，结果链表的端口已填为 port，用 Dns_FreeAddrs 释放 (不可用 freeaddrinfo)
+// timeout_ms = 0 时只查缓存、从不阻塞，未命中时在后台发起解析并返回 -1
+// 返回: 0=成功, -1=失败 / 否定缓存 / 超时
+int Dns_Resolve(const char* host, int port, int timeout_ms, struct addrinfo** out);
+
+void Dns_FreeAddrs(struct addrinfo* res);
+
+// 清空缓存 (如网络环境变化后)
+void Dns_Flush(void);
+
+// 停止 UDP 收包线程 (程序退出前调用)
+void Dns_Cleanup(void);
+
+// [New] url 是否为 RFC 8484 查询地址 (路径含 /dns-query)；DnsMode=2 时不是则回退到系统解析器
+BOOL Dns_IsDohUrl(const char* url);
+
+// --------------------------------------------------------------------------
+// [New] 连接竞速 (utils_dial.c)
+// --------------------------------------------------------------------------
+
+#define DIAL_ATTEMPT_DELAY_MS 250 // RFC 8305 Connection Attempt Delay
+#define DIAL_MAX_CANDIDATES   16
+#define DIAL_CANCELLABLE      0x01 // 停止代理 (Cancel_Signal) 时立即放弃；代理未运行时也要用的场景 (如 GUI 测速) 不要设置
+
+// 创建 Socket 的回调 (为 NULL 时使用 socket())，返回 INVALID_SOCKET 表示跳过该地址
+typedef SOCKET (*DialOpenFn)(int family, int socktype, int protocol, void* arg);
+
+// 候选地址排序：两族交替，首个地址族取 key 上次胜出的地址族 (无记录时 IPv6 优先)。返回写入 out 的数量
+int Dial_SortAddrs(const struct addrinfo* res, const char* key, const struct addrinfo** out, int max);
+
+// 记录 key (通常为 "host:port") 本次胜出的地址族
+void Dial_RecordWinner(const char* key, int family);
+
+// 对已解析的地址竞速连接，timeout_ms 为总时限。成功返回已连接的非阻塞 Socket，失败返回 INVALID_SOCKET
+// connect_ms 可为 NULL，写入胜出连接自身的 TCP 握手耗时 (不含等待间隔)
+SOCKET Dial_Race(const struct addrinfo* res, const char* key, int timeout_ms, int flags,
+                 DialOpenFn open_fn, void* open_arg, int* connect_ms);
+
+// 经 Dns_Resolve 解析 host 后调用 Dial_Race (会阻塞，请勿在 UI 线程直接调用)
+SOCKET Dial_Connect(const char* host, int port, int timeout_ms, int flags, int* connect_ms);
+
 // --------------------------------------------------------------------------
 // 系统工具 (utils_sys.c)
 // --------------------------------------------------------------------------
@@ -101,6 +183,38 @@ void* Pool_Alloc_16K();
 // 释放 16KB 内存块
 void Pool_Free_16K(void* ptr);
 
+// 归还当前线程的缓存块 (线程退出前调用)
+void Pool_Thread_Cleanup();
+
+// --------------------------------------------------------------------------
+// 线程池 (utils_threadpool.c)
+// --------------------------------------------------------------------------
+
+// 初始化工作线程池 (max_workers <= 0 时按 CPU 核心数自动选择；首次提交时也会自动初始化)
+void ThreadPool_Init(int max_workers);
+
+// 提交任务。cleanup (可为 NULL) 在任务结束、被取消或被拒绝时恰好调用一次
+// 返回 FALSE 表示队列已满或线程池已停止 (此时 cleanup 已被调用)
+BOOL ThreadPool_Submit(void (*func)(void*), void* arg, void (*cleanup)(void*));
+
+// 提交带取消标签的任务 (标签通常为调用模块的某个静态变量地址)
+BOOL ThreadPool_SubmitTagged(void (*func)(void*), void* arg, void (*cleanup)(void*), const void* tag);
+
+// [New] 提交后台任务 (GUI 测速、下载等阻塞 I/O，tag 可为 NULL)：由独立的 I/O 线程执行，不占用数据面工作线程
+BOOL ThreadPool_SubmitBackground(void (*func)(void*), void* arg, void (*cleanup)(void*), const void* tag);
+
+// 取消同标签的任务：排队中的直接移除 (调用 cleanup)，执行中的置取消标记。返回移除的数量
+int ThreadPool_Cancel(const void* tag);
+
+// 在任务内部调用：当前任务是否已被取消 (或线程池正在停止)
+BOOL ThreadPool_IsCancelled(void);
+
+// 排队中 (尚未开始执行) 的任务数
+LONG ThreadPool_GetQueuedCount(void);
+
+// 停止线程池：等待执行中的任务结束，丢弃排队任务 (仅调用 cleanup)
+void ThreadPool_Shutdown();
+
 #ifdef __cplusplus
 }
 #endif
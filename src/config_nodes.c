@@ -1,10 +1,12 @@
 /* src/config_nodes.c */
 // [Fix] 恢复核心节点解析函数 ParseTags 和 ParseNodeConfigToGlobal
 // [Fix] 添加 ReloadRoutingRules 桩代码以解决链接错误
+// [Mod] 2026-10-16: ReloadRoutingRules 重新读取 routing.rules 并重建路由匹配器
 
 #include "config.h"
 #include "common.h"
 #include "utils.h"
+#include "proxy.h"
 #include "cJSON.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -163,7 +165,21 @@ void ParseTags() {
     LeaveCriticalSection(&g_configLock);
 }
 
-// 路由规则重载桩 (解决链接错误)
+// [Mod] 2026-10-16: 路由规则重载 (GUI 修改路由后调用，不可在 g_configLock 内调用)
 void ReloadRoutingRules(void) {
-    // 外壳模式下无需重载内存中的路由表，配置完全由 Sing-box 接管
+    char* buffer = NULL;
+    long size = 0;
+    if (!ReadFileToBuffer(CONFIG_FILE, &buffer, &size)) return;
+
+    cJSON* root = cJSON_Parse(buffer);
+    free(buffer);
+    if (!root) return;
+
+    EnterCriticalSection(&g_configLock);
+    ParseRoutingRules(root);
+    LeaveCriticalSection(&g_configLock);
+    cJSON_Delete(root);
+
+    Router_Rebuild();
+    RuleProvider_RefreshAsync(); // 新增或修改的规则集在后台编译，完成后再次重建
 }
@@ -4,10 +4,19 @@
 // [Refactor] 2026-01-29: 实现原子文件写入 (Write-Replace)，防止配置文件损坏
 // [Fix] 2026-01-29: 增强 JSON 解析容错与备份机制
 // [Refactor] 2026: 增加 Sing-box 核心路径的保存与加载
+// [New] 2026-10-16: 读写 EnableKTLS (内核 TLS 卸载开关)
+// [New] 2026-10-16: 读写 EnableMux / MuxMaxConnections / MuxMaxStreams (多路复用隧道)
+// [New] 2026-10-16: 读写 WarmPoolSize / WarmPoolMaxIdle (预建上游连接池)
+// [New] 2026-10-16: 读写 EnableTLSResume / EnableEarlyData (上游 TLS 会话恢复与 0-RTT)
+// [New] 2026-10-16: 读写 DnsMode / DnsServer (共享 DNS 解析器)
+// [Refactor] 2026-10-16: 路由规则解析拆分为 ParseRoutingRules，加载后编译路由匹配器
+// [New] 2026-10-16: 解析 routing.providers (外部规则集)
+// [Fix] 2026-10-17: DnsMode=2 而 DoH 地址不含 /dns-query 时加载后给出警告 (此时解析回退到系统解析器)
 
 #include "config.h"
 #include "utils.h"
 #include "common.h"
+#include "proxy.h"
 #include "cJSON.h" 
 #include <stdio.h>
 #include <stdlib.h>
@@ -78,6 +87,98 @@ static char* ReadFileContent(const wchar_t* path) {
 
 // --- JSON 配置处理 (纯内存操作) ---
 
+// [New] 解析路由规则 (Routing Rules)
+// [Refactor] 2026-10-16: 从 ApplyJsonConfig 拆出，供 ReloadRoutingRules 复用 (需在 g_configLock 内调用)
+// 修改 g_routingRules 后需在锁外调用 Router_Rebuild 重新编译匹配器
+void ParseRoutingRules(cJSON* root) {
+    g_routingRuleCount = 0;
+    cJSON* routing = cJSON_GetObjectItem(root, "routing");
+    cJSON* rules = routing ? cJSON_GetObjectItem(routing, "rules") : NULL;
+    
+    if (rules && cJSON_IsArray(rules)) {
+        int count = cJSON_GetArraySize(rules);
+        if (count > MAX_RULES) count = MAX_RULES; // 限制最大规则数防止溢出
+
+        for (int i = 0; i < count; i++) {
+            cJSON* item = cJSON_GetArrayItem(rules, i);
+            if (!item) continue;
+
+            cJSON* cTag = cJSON_GetObjectItem(item, "outboundTag");
+            cJSON* cDomains = cJSON_GetObjectItem(item, "domain");
+            cJSON* cIPs = cJSON_GetObjectItem(item, "ip");
+            
+            // 仅当存在 tag 且有 domain 或 ip 内容时才加载
+            if (cTag && cTag->valuestring && ((cDomains && cJSON_IsArray(cDomains)) || (cIPs && cJSON_IsArray(cIPs)))) {
+                RoutingRule* r = &g_routingRules[g_routingRuleCount];
+                memset(r, 0, sizeof(RoutingRule));
+
+                // 1. 读取策略 (block/direct/proxy)
+                ConfigSafeStrCpy(r->outboundTag, 32, cTag->valuestring);
+                
+                // 2. 读取域名列表
+                if (cDomains) {
+                    int dCount = cJSON_GetArraySize(cDomains);
+                    for (int j = 0; j < dCount; j++) {
+                        if (r->contentCount >= 16) break; // 每个规则最多16个条目
+                        cJSON* val = cJSON_GetArrayItem(cDomains, j);
+                        if (val && val->valuestring) {
+                            ConfigSafeStrCpy(r->contents[r->contentCount], MAX_RULE_CONTENT_LEN, val->valuestring);
+                            r->contentCount++;
+                        }
+                    }
+                }
+                
+                // 3. 读取 IP 列表
+                if (cIPs) {
+                     int iCount = cJSON_GetArraySize(cIPs);
+                     for (int j = 0; j < iCount; j++) {
+                        if (r->contentCount >= 16) break;
+                        cJSON* val = cJSON_GetArrayItem(cIPs, j);
+                        if (val && val->valuestring) {
+                            ConfigSafeStrCpy(r->contents[r->contentCount], MAX_RULE_CONTENT_LEN, val->valuestring);
+                            r->contentCount++;
+                        }
+                     }
+                }
+
+                if (r->contentCount > 0) {
+                    g_routingRuleCount++;
+                }
+            }
+        }
+    }
+
+    // [New] 2026-10-16: 外部规则集 (routing.providers)，在内联规则之后按顺序匹配
+    // { "tag": "ads", "type": "domain" | "ipcidr", "outboundTag": "block", "url": "https://..." | "path": "...", "interval": 86400 }
+    g_ruleProviderCount = 0;
+    cJSON* providers = routing ? cJSON_GetObjectItem(routing, "providers") : NULL;
+    if (providers && cJSON_IsArray(providers)) {
+        int count = cJSON_GetArraySize(providers);
+        for (int i = 0; i < count && g_ruleProviderCount < MAX_RULE_PROVIDERS; i++) {
+            cJSON* item = cJSON_GetArrayItem(providers, i);
+            cJSON* cTag = cJSON_GetObjectItem(item, "tag");
+            cJSON* cOut = cJSON_GetObjectItem(item, "outboundTag");
+            cJSON* cType = cJSON_GetObjectItem(item, "type");
+            cJSON* cUrl = cJSON_GetObjectItem(item, "url");
+            cJSON* cPath = cJSON_GetObjectItem(item, "path");
+            cJSON* cInterval = cJSON_GetObjectItem(item, "interval");
+            if (!cJSON_IsString(cTag) || !cJSON_IsString(cOut) || !cTag->valuestring[0]) continue;
+            if (!cJSON_IsString(cUrl) && !cJSON_IsString(cPath)) continue;
+
+            RuleProvider* p = &g_ruleProviders[g_ruleProviderCount];
+            memset(p, 0, sizeof(RuleProvider));
+            ConfigSafeStrCpy(p->tag, sizeof(p->tag), cTag->valuestring);
+            ConfigSafeStrCpy(p->outboundTag, sizeof(p->outboundTag), cOut->valuestring);
+            p->type = (cJSON_IsString(cType) && stricmp(cType->valuestring, "ipcidr") == 0) ? RULE_PROVIDER_IPCIDR : RULE_PROVIDER_DOMAIN;
+            p->isUrl = cJSON_IsString(cUrl);
+            ConfigSafeStrCpy(p->source, sizeof(p->source), p->isUrl ? cUrl->valuestring : cPath->valuestring);
+            p->interval = cJSON_IsNumber(cInterval) ? cInterval->valueint : 86400;
+            if (p->interval < 600) p->interval = 600;
+            g_ruleProviderCount++;
+        }
+    }
+}
+
 // [Refactor] 仅解析内存中的 JSON，应用到全局变量 (需在锁内调用)
 static void ApplyJsonConfig(const char* jsonContent) {
     if (!jsonContent) return;
@@ -109,64 +210,8 @@ static void ApplyJsonConfig(const char* jsonContent) {
             MultiByteToWideChar(CP_UTF8, 0, jNode->valuestring, -1, currentNode, 256);
         }
 
-        // [New] 解析路由规则 (Routing Rules)
-        // 注意：此函数在 LoadSettings 的锁内调用，直接修改全局变量是安全的
-        g_routingRuleCount = 0;
-        cJSON* routing = cJSON_GetObjectItem(root, "routing");
-        cJSON* rules = routing ? cJSON_GetObjectItem(routing, "rules") : NULL;
-        
-        if (rules && cJSON_IsArray(rules)) {
-            int count = cJSON_GetArraySize(rules);
-            if (count > MAX_RULES) count = MAX_RULES; // 限制最大规则数防止溢出
-
-            for (int i = 0; i < count; i++) {
-                cJSON* item = cJSON_GetArrayItem(rules, i);
-                if (!item) continue;
-
-                cJSON* cTag = cJSON_GetObjectItem(item, "outboundTag");
-                cJSON* cDomains = cJSON_GetObjectItem(item, "domain");
-                cJSON* cIPs = cJSON_GetObjectItem(item, "ip");
-                
-                // 仅当存在 tag 且有 domain 或 ip 内容时才加载
-                if (cTag && cTag->valuestring && ((cDomains && cJSON_IsArray(cDomains)) || (cIPs && cJSON_IsArray(cIPs)))) {
-                    RoutingRule* r = &g_routingRules[g_routingRuleCount];
-                    memset(r, 0, sizeof(RoutingRule));
-
-                    // 1. 读取策略 (block/direct/proxy)
-                    ConfigSafeStrCpy(r->outboundTag, 32, cTag->valuestring);
-                    
-                    // 2. 读取域名列表
-                    if (cDomains) {
-                        int dCount = cJSON_GetArraySize(cDomains);
-                        for (int j = 0; j < dCount; j++) {
-                            if (r->contentCount >= 16) break; // 每个规则最多16个条目
-                            cJSON* val = cJSON_GetArrayItem(cDomains, j);
-                            if (val && val->valuestring) {
-                                ConfigSafeStrCpy(r->contents[r->contentCount], MAX_RULE_CONTENT_LEN, val->valuestring);
-                                r->contentCount++;
-                            }
-                        }
-                    }
-                    
-                    // 3. 读取 IP 列表
-                    if (cIPs) {
-                         int iCount = cJSON_GetArraySize(cIPs);
-                         for (int j = 0; j < iCount; j++) {
-                            if (r->contentCount >= 16) break;
-                            cJSON* val = cJSON_GetArrayItem(cIPs, j);
-                            if (val && val->valuestring) {
-                                ConfigSafeStrCpy(r->contents[r->contentCount], MAX_RULE_CONTENT_LEN, val->valuestring);
-                                r->contentCount++;
-                            }
-                         }
-                    }
-
-                    if (r->contentCount > 0) {
-                        g_routingRuleCount++;
-                    }
-                }
-            }
-        }
+        // [Refactor] 2026-10-16: 路由规则解析拆分为 ParseRoutingRules，ReloadRoutingRules 共用
+        ParseRoutingRules(root);
         
         cJSON_Delete(root);
     }
@@ -278,6 +323,17 @@ void LoadSettings() {
     int uaIdx = GetPrivateProfileIntW(L"Settings", L"UAPlatform", 0, g_iniFilePath);
 
     int enableECH = GetPrivateProfileIntW(L"Settings", L"EnableECH", 0, g_iniFilePath);
+    int enableKTLS = GetPrivateProfileIntW(L"Settings", L"EnableKTLS", 0, g_iniFilePath);
+    int enableMux = GetPrivateProfileIntW(L"Settings", L"EnableMux", 0, g_iniFilePath);
+    int muxConns = GetPrivateProfileIntW(L"Settings", L"MuxMaxConnections", 2, g_iniFilePath);
+    int muxStreams = GetPrivateProfileIntW(L"Settings", L"MuxMaxStreams", 32, g_iniFilePath);
+    int warmSize = GetPrivateProfileIntW(L"Settings", L"WarmPoolSize", 0, g_iniFilePath);
+    int warmIdle = GetPrivateProfileIntW(L"Settings", L"WarmPoolMaxIdle", 30, g_iniFilePath);
+    int enableResume = GetPrivateProfileIntW(L"Settings", L"EnableTLSResume", 0, g_iniFilePath);
+    int enableEarly = GetPrivateProfileIntW(L"Settings", L"EnableEarlyData", 0, g_iniFilePath);
+    int dnsMode = GetPrivateProfileIntW(L"Settings", L"DnsMode", 0, g_iniFilePath);
+    wchar_t wDnsServer[256] = {0};
+    GetPrivateProfileStringW(L"Settings", L"DnsServer", L"", wDnsServer, 256, g_iniFilePath);
     wchar_t wEchServer[256] = {0}, wEchPub[256] = {0};
     GetPrivateProfileStringW(L"Settings", L"ECHServer", L"https://dns.alidns.com/dns-query", wEchServer, 256, g_iniFilePath);
     GetPrivateProfileStringW(L"Settings", L"ECHPublicName", L"cloudflare-ech.com", wEchPub, 256, g_iniFilePath);
@@ -365,7 +421,23 @@ void LoadSettings() {
     if (g_padSizeMin < 0) g_padSizeMin = 0; if (g_padSizeMax < g_padSizeMin) g_padSizeMax = g_padSizeMin;
 
     g_enableECH = enableECH;
+    g_enableKTLS = enableKTLS;
+    g_enableMux = enableMux;
+    g_muxMaxConnections = (muxConns < 1) ? 1 : (muxConns > 8 ? 8 : muxConns);
+    g_muxMaxStreams = (muxStreams < 1) ? 1 : (muxStreams > 128 ? 128 : muxStreams);
+    g_warmPoolSize = (warmSize < 0) ? 0 : (warmSize > 8 ? 8 : warmSize);
+    g_warmPoolMaxIdle = (warmIdle < 5) ? 5 : (warmIdle > 300 ? 300 : warmIdle);
+    g_enableTlsResume = enableResume;
+    g_enableEarlyData = enableEarly;
+    g_dnsMode = (dnsMode < 0 || dnsMode > 2) ? 0 : dnsMode;
+    WideCharToMultiByte(CP_UTF8, 0, wDnsServer, -1, g_dnsServer, sizeof(g_dnsServer), NULL, NULL);
     WideCharToMultiByte(CP_UTF8, 0, wEchServer, -1, g_echConfigServer, sizeof(g_echConfigServer), NULL, NULL);
+    // DoH 地址为空时沿用 ECHServer，与 utils_dns.c 的选择一致；日志在锁外输出
+    char dohUrl[256] = {0};
+    BOOL checkDoh = (g_dnsMode == 2);
+    if (checkDoh) {
+        ConfigSafeStrCpy(dohUrl, sizeof(dohUrl), strlen(g_dnsServer) > 0 ? g_dnsServer : g_echConfigServer);
+    }
     WideCharToMultiByte(CP_UTF8, 0, wEchPub, -1, g_echPublicName, sizeof(g_echPublicName), NULL, NULL);
 
     g_uaPlatformIndex = uaIdx;
@@ -394,6 +466,14 @@ void LoadSettings() {
     }
 
     LeaveCriticalSection(&g_configLock);
+
+    if (checkDoh && !Dns_IsDohUrl(dohUrl)) {
+        LOG_WARN("[DNS] DnsMode=2 but DoH URL \"%s\" has no /dns-query path, falling back to system resolver", dohUrl);
+    }
+
+    // [New] 2026-10-16: 编译路由匹配器 (需在 g_configLock 之外调用)，并在后台更新过期的外部规则集
+    Router_Rebuild();
+    RuleProvider_RefreshAsync();
 }
 
 void SaveSettings() {
@@ -415,6 +495,13 @@ void SaveSettings() {
     int s_uaIdx = g_uaPlatformIndex;
     
     int s_enableECH = g_enableECH;
+    int s_enableKTLS = g_enableKTLS;
+    int s_enableMux = g_enableMux;
+    int s_muxConns = g_muxMaxConnections; int s_muxStreams = g_muxMaxStreams;
+    int s_warmSize = g_warmPoolSize; int s_warmIdle = g_warmPoolMaxIdle;
+    int s_enableResume = g_enableTlsResume; int s_enableEarly = g_enableEarlyData;
+    int s_dnsMode = g_dnsMode;
+    char s_dnsServer[256]; memcpy(s_dnsServer, g_dnsServer, sizeof(s_dnsServer));
     char s_echServer[256]; memcpy(s_echServer, g_echConfigServer, sizeof(s_echServer));
     char s_echPub[256]; memcpy(s_echPub, g_echPublicName, sizeof(s_echPub));
     
@@ -476,6 +563,18 @@ void SaveSettings() {
     swprintf_s(buffer, 32, L"%d", s_uaIdx); WritePrivateProfileStringW(L"Settings", L"UAPlatform", buffer, g_iniFilePath);
     
     swprintf_s(buffer, 32, L"%d", s_enableECH); WritePrivateProfileStringW(L"Settings", L"EnableECH", buffer, g_iniFilePath);
+    swprintf_s(buffer, 32, L"%d", s_enableKTLS); WritePrivateProfileStringW(L"Settings", L"EnableKTLS", buffer, g_iniFilePath);
+    swprintf_s(buffer, 32, L"%d", s_enableMux); WritePrivateProfileStringW(L"Settings", L"EnableMux", buffer, g_iniFilePath);
+    swprintf_s(buffer, 32, L"%d", s_muxConns); WritePrivateProfileStringW(L"Settings", L"MuxMaxConnections", buffer, g_iniFilePath);
+    swprintf_s(buffer, 32, L"%d", s_muxStreams); WritePrivateProfileStringW(L"Settings", L"MuxMaxStreams", buffer, g_iniFilePath);
+    swprintf_s(buffer, 32, L"%d", s_warmSize); WritePrivateProfileStringW(L"Settings", L"WarmPoolSize", buffer, g_iniFilePath);
+    swprintf_s(buffer, 32, L"%d", s_warmIdle); WritePrivateProfileStringW(L"Settings", L"WarmPoolMaxIdle", buffer, g_iniFilePath);
+    swprintf_s(buffer, 32, L"%d", s_enableResume); WritePrivateProfileStringW(L"Settings", L"EnableTLSResume", buffer, g_iniFilePath);
+    swprintf_s(buffer, 32, L"%d", s_enableEarly); WritePrivateProfileStringW(L"Settings", L"EnableEarlyData", buffer, g_iniFilePath);
+    swprintf_s(buffer, 32, L"%d", s_dnsMode); WritePrivateProfileStringW(L"Settings", L"DnsMode", buffer, g_iniFilePath);
+    wchar_t wDnsServerOut[256] = {0};
+    MultiByteToWideChar(CP_UTF8, 0, s_dnsServer, -1, wDnsServerOut, 256);
+    WritePrivateProfileStringW(L"Settings", L"DnsServer", wDnsServerOut, g_iniFilePath);
     
     wchar_t wEchServerOut[256] = {0}, wEchPubOut[256] = {0};
     MultiByteToWideChar(CP_UTF8, 0, s_echServer, -1, wEchServerOut, 256);
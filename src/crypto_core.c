@@ -1,5 +1,7 @@
 /* src/crypto_core.c */
 // [Refactor] 2026-01-11: 采用 Swap 模式重构 SSL 上下文重载，缩短锁持有时间，防止服务中断
+// [New] 2026-10-16: 初始化时选择 WebSocket 掩码向量化内核
+// [New] 2026-10-16: 注册 TLS 会话缓存回调 (crypto_session.c)，退出时保存票据；ClearSSLCache 同时清空票据
 
 #include "crypto.h"
 #include "common.h"
@@ -45,8 +47,10 @@ static SSL_CTX* CreateNewSSLContext() {
          log_msg("[Warn] Failed to set TLS 1.3 ciphersuites");
     }
 
+    // 默认不发送票据扩展；开启会话恢复时由 TlsSession_Apply 逐连接清除 SSL_OP_NO_TICKET
     SSL_CTX_set_options(ctx, SSL_OP_NO_COMPRESSION | SSL_OP_NO_SESSION_RESUMPTION_ON_RENEGOTIATION | SSL_OP_ENABLE_MIDDLEBOX_COMPAT | SSL_OP_NO_TICKET);
-    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    // [Mod] 会话由 crypto_session.c 按节点缓存 (仅回调，不使用内部缓存)
+    TlsSession_InitCtx(ctx);
     
     unsigned char sid_ctx[32];
     if (RAND_bytes(sid_ctx, sizeof(sid_ctx)) == 1) {
@@ -98,6 +102,10 @@ static void InitCryptoLibrary() {
 void init_crypto_global() {
     InitializeCriticalSection(&g_sslLock);
     InitCryptoLibrary();
+
+    // [New] 选择 WebSocket 掩码内核
+    ws_mask_init();
+    log_msg("[System] WebSocket mask kernel: %s", ws_mask_impl_name());
     
     // 初始创建，直接赋值
     g_ssl_ctx = CreateNewSSLContext();
@@ -137,6 +145,8 @@ void ReloadSSLContext() {
 }
 
 void cleanup_crypto_global() {
+    TlsSession_Save();
+    TlsSession_Cleanup();
     DeleteCriticalSection(&g_sslLock);
     if (g_ssl_ctx) { SSL_CTX_free(g_ssl_ctx); g_ssl_ctx = NULL; }
 }
@@ -156,6 +166,7 @@ void ClearSSLCache() {
         #endif
     }
     LeaveCriticalSection(&g_sslLock);
+    TlsSession_Clear();
     log_msg("[System] SSL Session Cache Cleared");
 }
 
@@ -0,0 +1,342 @@
+/* src/crypto_session.c */
+// [New] 2026-10-16: 上游 TLS 会话缓存 (会话恢复 / 0-RTT)，重启后仍然有效
+// 设计要点:
+// 1. 按节点缓存 (SNI + 主机 + 端口 + 证书校验方式 + ECH)，每个节点只保留服务端最新下发的票据；
+//    SSL_CTX 只开启客户端回调 (NO_INTERNAL_STORE)，票据由本模块以 DER 形式保存，任何线程都可以查找
+// 2. 允许跳过证书校验 (allowInsecure) 的连接与严格校验的连接使用不同的键，恢复会话不会绕过校验
+// 3. 每张票据最多用于一次 0-RTT：重复使用的票据会被服务端的防重放机制拒绝 early data，白白浪费一次发送
+// 4. 缓存延迟加载 (首次握手时，设置已读取)，程序退出时保存到 set.ini 同目录的 tls_sessions.dat；
+//    票据相当于会话密钥，文件内容以 DPAPI (CryptProtectData，当前用户) 加密，过期条目不写入
+// 5. 总开关 g_enableTlsResume 关闭时保持原有行为：不发送票据扩展，也不保存新会话
+
+#include "crypto.h"
+#include "common.h"
+#include "utils.h"
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <wincrypt.h>
+#include <ws2tcpip.h>
+#include <stdio.h>
+#include <time.h>
+
+#define TLS_SESSION_MAX      128
+#define TLS_SESSION_KEY_LEN  600
+#define TLS_SESSION_MAX_DER  (16 * 1024)
+#define TLS_SESSION_FILE     L"tls_sessions.dat"
+#define TLS_SESSION_MAGIC    0x4353544D // "MTSC"
+#define TLS_SESSION_VERSION  1
+
+typedef struct {
+    char key[TLS_SESSION_KEY_LEN];
+    unsigned char* der;
+    int der_len;
+    long long expires;      // 墙钟时间 (秒)，跨重启比较
+    ULONGLONG last_used;
+    BOOL early_used;        // 该票据已用于一次 0-RTT
+} TlsSessionEntry;
+
+static TlsSessionEntry s_entries[TLS_SESSION_MAX];
+static CRITICAL_SECTION s_sessLock;
+static BOOL s_dirty = FALSE;
+static int s_exIndex = -1;
+
+// 0=Uninit, 1=Initializing, 2=Ready
+static volatile LONG s_sessState = 0;
+
+// --- 辅助函数 ---
+
+static void entry_clear(TlsSessionEntry* e) {
+    if (e->der) { OPENSSL_cleanse(e->der, e->der_len); free(e->der); }
+    memset(e, 0, sizeof(TlsSessionEntry));
+}
+
+static TlsSessionEntry* entry_find(const char* key) {
+    for (int i = 0; i < TLS_SESSION_MAX; i++) {
+        if (s_entries[i].der && strcmp(s_entries[i].key, key) == 0) return &s_entries[i];
+    }
+    return NULL;
+}
+
+// 空位或最久未使用的条目
+static TlsSessionEntry* entry_slot(void) {
+    TlsSessionEntry* victim = &s_entries[0];
+    for (int i = 0; i < TLS_SESSION_MAX; i++) {
+        if (!s_entries[i].der) return &s_entries[i];
+        if (s_entries[i].last_used < victim->last_used) victim = &s_entries[i];
+    }
+    entry_clear(victim);
+    return victim;
+}
+
+static void GetSessionFilePath(wchar_t* path, size_t size) {
+    path[0] = 0;
+    if (wcslen(g_iniFilePath) > 0) {
+        wcscpy_s(path, size, g_iniFilePath);
+        wchar_t *slash = wcsrchr(path, L'\\');
+        if (slash) *(slash + 1) = L'\0';
+        else path[0] = 0;
+    }
+    wcscat_s(path, size, TLS_SESSION_FILE);
+}
+
+static void ex_key_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp) {
+    if (ptr) free(ptr);
+}
+
+// --- 持久化 ---
+
+static void put_u32(unsigned char* p, unsigned int v) { memcpy(p, &v, 4); }
+static unsigned int get_u32(const unsigned char* p) { unsigned int v; memcpy(&v, p, 4); return v; }
+
+// 解析明文: [magic][version][count] + count * ([key_len u16][key][expires i64][der_len u32][der])
+static void load_entries(const unsigned char* p, DWORD len) {
+    if (len < 12 || get_u32(p) != TLS_SESSION_MAGIC || get_u32(p + 4) != TLS_SESSION_VERSION) return;
+    unsigned int count = get_u32(p + 8);
+    DWORD off = 12;
+    long long now = (long long)time(NULL);
+    int loaded = 0;
+
+    for (unsigned int i = 0; i < count && loaded < TLS_SESSION_MAX; i++) {
+        if (off + 2 > len) break;
+        unsigned short klen;
+        memcpy(&klen, p + off, 2); off += 2;
+        if (klen == 0 || klen >= TLS_SESSION_KEY_LEN || off + klen + 12 > len) break;
+        const char* key = (const char*)p + off; off += klen;
+        long long expires;
+        memcpy(&expires, p + off, 8); off += 8;
+        unsigned int dlen = get_u32(p + off); off += 4;
+        if (dlen == 0 || dlen > TLS_SESSION_MAX_DER || off + dlen > len) break;
+
+        if (expires > now) {
+            TlsSessionEntry* e = &s_entries[loaded];
+            e->der = (unsigned char*)malloc(dlen);
+            if (!e->der) break;
+            memcpy(e->key, key, klen);
+            e->key[klen] = 0;
+            memcpy(e->der, p + off, dlen);
+            e->der_len = (int)dlen;
+            e->expires = expires;
+            e->early_used = TRUE; // 上次运行期间可能已用于 0-RTT
+            loaded++;
+        }
+        off += dlen;
+    }
+    if (loaded > 0) log_msg("[TLS] Loaded %d cached session(s) for resumption", loaded);
+}
+
+static void session_load_file(void) {
+    wchar_t path[MAX_PATH];
+    GetSessionFilePath(path, MAX_PATH);
+
+    char* raw = NULL; long size = 0;
+    if (!ReadFileToBuffer(path, &raw, &size)) return;
+
+    DATA_BLOB in, out;
+    in.pbData = (BYTE*)raw;
+    in.cbData = (DWORD)size;
+    memset(&out, 0, sizeof(out));
+    if (size > 0 && CryptUnprotectData(&in, NULL, NULL, NULL, NULL, CRYPTPROTECT_UI_FORBIDDEN, &out)) {
+        load_entries(out.pbData, out.cbData);
+        SecureZeroMemory(out.pbData, out.cbData);
+        LocalFree(out.pbData);
+    } else {
+        log_msg("[TLS] Session cache file unreadable, ignored");
+    }
+    free(raw);
+}
+
+static void session_init_once(void) {
+    if (InterlockedCompareExchange(&s_sessState, 1, 0) != 0) {
+        while (s_sessState == 1) Sleep(1);
+        return;
+    }
+    InitializeCriticalSection(&s_sessLock);
+    session_load_file();
+    InterlockedExchange(&s_sessState, 2);
+}
+
+// --- 对外接口 ---
+
+// OpenSSL 在握手完成 (TLS 1.2) 或收到 NewSessionTicket (TLS 1.3) 时回调
+static int on_new_session(SSL* ssl, SSL_SESSION* sess) {
+    if (!g_enableTlsResume || s_exIndex < 0 || s_sessState != 2) return 0;
+    const char* key = (const char*)SSL_get_ex_data(ssl, s_exIndex);
+    if (!key || !SSL_SESSION_is_resumable(sess)) return 0;
+
+    int len = i2d_SSL_SESSION(sess, NULL);
+    if (len <= 0 || len > TLS_SESSION_MAX_DER) return 0;
+    unsigned char* der = (unsigned char*)malloc(len);
+    if (!der) return 0;
+    unsigned char* p = der;
+    i2d_SSL_SESSION(sess, &p);
+
+    EnterCriticalSection(&s_sessLock);
+    TlsSessionEntry* e = entry_find(key);
+    if (!e) {
+        e = entry_slot();
+        strncpy(e->key, key, sizeof(e->key) - 1);
+    } else if (e->der) {
+        OPENSSL_cleanse(e->der, e->der_len);
+        free(e->der);
+    }
+    e->der = der;
+    e->der_len = len;
+    e->expires = (long long)SSL_SESSION_get_time(sess) + (long long)SSL_SESSION_get_timeout(sess);
+    e->last_used = GetTickCount64();
+    e->early_used = FALSE;
+    s_dirty = TRUE;
+    LeaveCriticalSection(&s_sessLock);
+    return 0; // 未持有 sess 的引用
+}
+
+void TlsSession_InitCtx(SSL_CTX* ctx) {
+    if (!ctx) return;
+    if (s_exIndex < 0) s_exIndex = SSL_get_ex_new_index(0, "tls session key", NULL, NULL, ex_key_free);
+    // 只回调，不使用 OpenSSL 内部缓存 (客户端内部缓存不参与查找)
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, on_new_session);
+}
+
+void TlsSession_Apply(SSL* ssl, SOCKET sock, const char* sni, const char* host, BOOL allowInsecure) {
+    if (!g_enableTlsResume || !ssl || s_exIndex < 0) return;
+    if (s_sessState != 2) session_init_once();
+
+    // 端口取自已连接的 Socket (tls_connect_begin 不感知节点端口)，同一主机的不同节点不会互相使用票据
+    struct sockaddr_storage peer;
+    int plen = sizeof(peer);
+    unsigned int port = 0;
+    if (getpeername(sock, (struct sockaddr*)&peer, &plen) == 0) {
+        port = (peer.ss_family == AF_INET6) ? ntohs(((struct sockaddr_in6*)&peer)->sin6_port)
+                                            : ntohs(((struct sockaddr_in*)&peer)->sin_port);
+    }
+
+    char key[TLS_SESSION_KEY_LEN];
+    snprintf(key, sizeof(key), "%s|%s|%u|%d|%d", sni ? sni : "", host ? host : "", port,
+             allowInsecure ? 1 : 0, g_enableECH ? 1 : 0);
+    char* owned = _strdup(key);
+    if (!owned) return;
+    SSL_set_ex_data(ssl, s_exIndex, owned);
+    SSL_clear_options(ssl, SSL_OP_NO_TICKET);
+
+    SSL_SESSION* sess = NULL;
+    EnterCriticalSection(&s_sessLock);
+    TlsSessionEntry* e = entry_find(key);
+    if (e) {
+        if (e->expires <= (long long)time(NULL)) {
+            entry_clear(e);
+            s_dirty = TRUE;
+        } else {
+            const unsigned char* p = e->der;
+            sess = d2i_SSL_SESSION(NULL, &p, e->der_len);
+            e->last_used = GetTickCount64();
+        }
+    }
+    LeaveCriticalSection(&s_sessLock);
+
+    if (sess) {
+        if (SSL_set_session(ssl, sess) != 1) ERR_clear_error();
+        SSL_SESSION_free(sess);
+    }
+}
+
+int TlsSession_ClaimEarlyData(SSL* ssl, const char* alpn, int len) {
+    if (!g_enableTlsResume || !g_enableEarlyData || !ssl || s_exIndex < 0 || s_sessState != 2) return 0;
+    SSL_SESSION* sess = SSL_get_session(ssl);
+    if (!sess || (int)SSL_SESSION_get_max_early_data(sess) < len) return 0;
+
+    // 服务端只接受与原会话相同 ALPN 的 early data
+    const unsigned char* sel = NULL;
+    size_t sel_len = 0;
+    SSL_SESSION_get0_alpn_selected(sess, &sel, &sel_len);
+    size_t want = alpn ? strlen(alpn) : 0;
+    if (sel_len > 0 && (sel_len != want || memcmp(sel, alpn, want) != 0)) return 0;
+
+    const char* key = (const char*)SSL_get_ex_data(ssl, s_exIndex);
+    if (!key) return 0;
+
+    int ok = 0;
+    EnterCriticalSection(&s_sessLock);
+    TlsSessionEntry* e = entry_find(key);
+    if (e && !e->early_used) {
+        e->early_used = TRUE;
+        ok = 1;
+    }
+    LeaveCriticalSection(&s_sessLock);
+    return ok;
+}
+
+void TlsSession_Clear(void) {
+    // 未加载时同样加载一次，使退出时的保存删除磁盘上的旧票据
+    if (s_sessState != 2) session_init_once();
+    EnterCriticalSection(&s_sessLock);
+    for (int i = 0; i < TLS_SESSION_MAX; i++) {
+        if (s_entries[i].der) entry_clear(&s_entries[i]);
+    }
+    s_dirty = TRUE;
+    LeaveCriticalSection(&s_sessLock);
+}
+
+void TlsSession_Save(void) {
+    if (s_sessState != 2) return;
+
+    EnterCriticalSection(&s_sessLock);
+    if (!s_dirty) { LeaveCriticalSection(&s_sessLock); return; }
+
+    size_t cap = 12;
+    for (int i = 0; i < TLS_SESSION_MAX; i++) {
+        if (s_entries[i].der) cap += 2 + strlen(s_entries[i].key) + 12 + s_entries[i].der_len;
+    }
+    unsigned char* buf = (unsigned char*)malloc(cap);
+    if (!buf) { LeaveCriticalSection(&s_sessLock); return; }
+
+    long long now = (long long)time(NULL);
+    size_t off = 12;
+    unsigned int count = 0;
+    for (int i = 0; i < TLS_SESSION_MAX; i++) {
+        TlsSessionEntry* e = &s_entries[i];
+        if (!e->der || e->expires <= now) continue;
+        unsigned short klen = (unsigned short)strlen(e->key);
+        memcpy(buf + off, &klen, 2); off += 2;
+        memcpy(buf + off, e->key, klen); off += klen;
+        memcpy(buf + off, &e->expires, 8); off += 8;
+        put_u32(buf + off, (unsigned int)e->der_len); off += 4;
+        memcpy(buf + off, e->der, e->der_len); off += e->der_len;
+        count++;
+    }
+    s_dirty = FALSE;
+    LeaveCriticalSection(&s_sessLock);
+
+    put_u32(buf, TLS_SESSION_MAGIC);
+    put_u32(buf + 4, TLS_SESSION_VERSION);
+    put_u32(buf + 8, count);
+
+    wchar_t path[MAX_PATH];
+    GetSessionFilePath(path, MAX_PATH);
+
+    DATA_BLOB in, out;
+    in.pbData = buf;
+    in.cbData = (DWORD)off;
+    memset(&out, 0, sizeof(out));
+    if (count == 0) {
+        DeleteFileW(path);
+    } else if (CryptProtectData(&in, L"MandalaECH TLS sessions", NULL, NULL, NULL, CRYPTPROTECT_UI_FORBIDDEN, &out)) {
+        FILE* fp = _wfopen(path, L"wb");
+        if (fp) {
+            fwrite(out.pbData, 1, out.cbData, fp);
+            fclose(fp);
+        }
+        LocalFree(out.pbData);
+    } else {
+        log_msg("[TLS] Failed to protect session cache (%lu), not saved", GetLastError());
+    }
+    SecureZeroMemory(buf, off);
+    free(buf);
+}
+
+void TlsSession_Cleanup(void) {
+    if (InterlockedCompareExchange(&s_sessState, 0, 2) != 2) return;
+    for (int i = 0; i < TLS_SESSION_MAX; i++) {
+        if (s_entries[i].der) entry_clear(&s_entries[i]);
+    }
+    DeleteCriticalSection(&s_sessLock);
+}
@@ -2,6 +2,14 @@
 // [Refactor] 2026-01-22: 优化 ECH 触发逻辑，跳过 IP 直连的无效查询，减少首包延迟
 // [Fix] 2026-01-17: 优化 TLS 轮询间隔 (50ms -> 1ms) 以消除传输波动
 // [Security] 2026-01-29: 强化主机名验证失败时的连接终止逻辑
+// [New] 2026-10-16: 未启用分片时改用内存 BIO 引擎 (crypto_tls_engine.c)，大块收发密文
+// [Refactor] 2026-10-16: 握手拆分为 tls_connect_begin / tls_connect_step，可由事件循环非阻塞推进
+// [New] 2026-10-16: 可选 kTLS 卸载 (g_enableKTLS)，握手完成后探测并记录每个连接是否真正生效
+// [New] 2026-10-16: 新增 tls_write_nb / tls_flush_nb，供事件循环非阻塞写入 (不再在循环线程中等待可写)
+// [New] 2026-10-16: 新增 tls_shutdown_write，发送 close_notify 实现半关闭 (之后仍可继续读取)
+// [Refactor] 2026-10-16: 阻塞等待改用 Cancel_Wait，按剩余超时休眠并由停止通知唤醒，移除 1ms select 轮询
+// [New] 2026-10-16: 握手前按节点恢复缓存的会话 (crypto_session.c)；可选 0-RTT，首个请求随 ClientHello 发出
+// [Fix] 2026-10-16: 仅在 OpenSSL 支持 kTLS 时才为其绕过内存 BIO 引擎 (Windows 版 OpenSSL 定义 OPENSSL_NO_KTLS，EnableKTLS 不再生效)
 
 #include "crypto.h"
 #include "config.h" 
@@ -23,9 +31,10 @@ extern volatile BOOL g_proxyRunning;
 #define WRITE_TIMEOUT_MS     8000
 #define READ_TIMEOUT_MS      8000
 
-// [Fix] 将短轮询间隔从 50ms 降低到 1ms，保证高负载下的响应速度，消除锯齿波
-// 这允许 socket 在 I/O 就绪时几乎立即被处理，而不是等待下一个 tick
-#define SELECT_WAIT_MS       1     
+// OpenSSL 以 enable-ktls 构建 (仅 Linux / FreeBSD) 时才存在内核卸载路径
+#if !defined(OPENSSL_NO_KTLS) && defined(SSL_OP_ENABLE_KTLS)
+#define TLS_HAVE_KTLS 1
+#endif
 
 static BOOL is_ip_address(const char* host) {
     if (!host) return FALSE;
@@ -36,6 +45,37 @@ static BOOL is_ip_address(const char* host) {
     return FALSE;
 }
 
+// [New] 引擎模式：排空密文并在 Socket 写满时等待，直到全部发出或超时
+static int engine_flush_blocking(TLSContext *ctx, ULONGLONG deadline) {
+    while (TRUE) {
+        int r = TlsEngine_FlushToSocket(ctx);
+        if (r <= 0) return r;
+        ULONGLONG now = GetTickCount64();
+        if (!g_proxyRunning || now > deadline) return -1;
+        if (Cancel_Wait(ctx->sock, CANCEL_WAIT_WRITE, (int)(deadline - now)) < 0) return -1;
+    }
+}
+
+// [New] 引擎模式读取：一次 recv 尽可能多的密文，再由 SSL 逐条解密
+static int engine_read(TLSContext *ctx, char *out, int max) {
+    BOOL eof = FALSE;
+    while (TRUE) {
+        int ret = TlsEngine_Read(ctx, out, max);
+        // 读取过程中可能产生需要回送的记录 (如 KeyUpdate)，尽力发出
+        if (TlsEngine_CipherOutPending(ctx) > 0 && TlsEngine_FlushToSocket(ctx) < 0) return -1;
+        if (ret != 0) return ret;
+        if (eof) return -1;
+
+        int got = TlsEngine_FillFromSocket(ctx);
+        if (got == 0) return 0;
+        if (got < 0) {
+            // 对端已关闭，但缓冲中可能仍有完整记录
+            if (TlsEngine_Buffered(ctx) <= 0) return -1;
+            eof = TRUE;
+        }
+    }
+}
+
 // [Helper] 设置浏览器加密套件
 static void ApplyBrowserCiphers(SSL* ssl, int browserType, const char* customCiphers) {
     const char *ciphers = NULL;
@@ -81,7 +121,8 @@ static void ApplyBrowserCiphers(SSL* ssl, int browserType, const char* customCip
     ERR_clear_error();
 }
 
-int tls_init_connect(TLSContext *ctx, const char* target_sni, const char* target_host, const CryptoSettings* settings, BOOL allowInsecure) {
+// 创建 SSL 并绑定 BIO，不做任何网络 I/O。Socket 必须已连接且为非阻塞模式
+int tls_connect_begin(TLSContext *ctx, const char* target_sni, const char* target_host, const CryptoSettings* settings, BOOL allowInsecure) {
     if (ctx->sock == INVALID_SOCKET) {
         log_msg("[Fatal] Invalid socket handle.");
         return -1;
@@ -92,6 +133,19 @@ int tls_init_connect(TLSContext *ctx, const char* target_sni, const char* target
         log_msg("[Fatal] SSL_new failed");
         return -1;
     }
+
+    ctx->early_buf = NULL;
+    ctx->early_len = 0;
+    ctx->early_state = TLS_EARLY_NONE;
+
+    // [New] kTLS: 握手完成后由 OpenSSL 把会话密钥装入内核，之后 SSL_read/SSL_write 退化为普通 recv/send
+    ctx->ktls = 0;
+    if (g_enableKTLS) {
+        ctx->ktls = TLS_KTLS_REQUESTED;
+#ifdef TLS_HAVE_KTLS
+        SSL_set_options(ctx->ssl, SSL_OP_ENABLE_KTLS);
+#endif
+    }
     
     if (settings) {
         ApplyBrowserCiphers(ctx->ssl, settings->browserType, settings->customCiphers);
@@ -102,6 +156,9 @@ int tls_init_connect(TLSContext *ctx, const char* target_sni, const char* target
         SSL_set_tlsext_host_name(ctx->ssl, sni_name);
     }
 
+    // [New] 会话恢复：命中缓存时省去证书交换与签名验证，TLS 1.3 下还可携带 0-RTT 数据
+    TlsSession_Apply(ctx->ssl, ctx->sock, sni_name, target_host, allowInsecure);
+
     // ALPN 设置
     int mode = g_alpnMode;
     if (settings && settings->alpnOverride > 0) mode = settings->alpnOverride; 
@@ -158,86 +215,231 @@ int tls_init_connect(TLSContext *ctx, const char* target_sni, const char* target
     }
 
     // 绑定 BIO
-    BIO *internal_bio = BIO_new_socket((int)ctx->sock, BIO_NOCLOSE);
-    if (!internal_bio) { SSL_free(ctx->ssl); ctx->ssl = NULL; return -1; }
-
-    BIO_METHOD *frag_method = BIO_f_fragment();
-    if (frag_method && !g_enableECH) {
-        BIO *frag_bio = BIO_new(frag_method);
-        if (frag_bio) {
-            BIO_set_params(frag_bio, settings);
-            BIO_push(frag_bio, internal_bio); 
-            SSL_set_bio(ctx->ssl, frag_bio, frag_bio);
+    // [New] 未启用分片/填充 (或 ECH 模式跳过分片) 时使用内存 BIO 引擎，OpenSSL 不直接触碰 Socket
+    // kTLS 需要 SSL 直接绑定 Socket BIO，仅在 OpenSSL 实际支持卸载时为其放弃引擎
+    BOOL use_engine = g_enableECH || !settings || (!settings->enableFragment && !settings->enablePadding);
+#ifdef TLS_HAVE_KTLS
+    if (ctx->ktls & TLS_KTLS_REQUESTED) use_engine = FALSE;
+#endif
+    if (use_engine && TlsEngine_Attach(ctx) != 0) use_engine = FALSE;
+
+    if (!use_engine) {
+        BIO *internal_bio = BIO_new_socket((int)ctx->sock, BIO_NOCLOSE);
+        if (!internal_bio) { SSL_free(ctx->ssl); ctx->ssl = NULL; return -1; }
+
+        BIO_METHOD *frag_method = BIO_f_fragment();
+        if (frag_method && !g_enableECH) {
+            BIO *frag_bio = BIO_new(frag_method);
+            if (frag_bio) {
+                BIO_set_params(frag_bio, settings);
+                BIO_push(frag_bio, internal_bio); 
+                SSL_set_bio(ctx->ssl, frag_bio, frag_bio);
+            } else {
+                SSL_set_bio(ctx->ssl, internal_bio, internal_bio);
+            }
         } else {
             SSL_set_bio(ctx->ssl, internal_bio, internal_bio);
         }
+    }
+    return 0;
+}
+
+// 打印握手失败原因 (含证书验证详情)
+static void report_handshake_error(TLSContext *ctx) {
+    unsigned long ssl_err = ERR_get_error();
+    if (ssl_err == 0) return;
+    char err_buf[256];
+    ERR_error_string_n(ssl_err, err_buf, sizeof(err_buf));
+    log_msg("[TLS] Handshake failed: %s", err_buf);
+
+    // [Added 2026-01-29] 打印详细验证结果，辅助排查证书问题
+    long verify_res = SSL_get_verify_result(ctx->ssl);
+    if (verify_res != X509_V_OK) {
+        const char* reason = X509_verify_cert_error_string(verify_res);
+        // Code 62 = Hostname Mismatch, Code 20 = Untrusted Issuer
+        log_msg("[TLS] Verify Detail: Code %ld (%s)", verify_res, reason);
+    }
+}
+
+// 握手完成后查询密钥是否已装入内核 (OpenSSL 未启用 kTLS 或系统不支持时保持未生效)
+static void probe_ktls(TLSContext *ctx) {
+    if (!(ctx->ktls & TLS_KTLS_REQUESTED)) return;
+#if defined(TLS_HAVE_KTLS) && defined(BIO_get_ktls_send)
+    if (BIO_get_ktls_send(SSL_get_wbio(ctx->ssl))) ctx->ktls |= TLS_KTLS_TX;
+    if (BIO_get_ktls_recv(SSL_get_rbio(ctx->ssl))) ctx->ktls |= TLS_KTLS_RX;
+#endif
+}
+
+const char* tls_ktls_status(const TLSContext *ctx) {
+    if (!ctx || !(ctx->ktls & TLS_KTLS_REQUESTED)) return "off";
+    int dirs = ctx->ktls & (TLS_KTLS_TX | TLS_KTLS_RX);
+    if (dirs == (TLS_KTLS_TX | TLS_KTLS_RX)) return "tx+rx";
+    if (dirs == TLS_KTLS_TX) return "tx";
+    if (dirs == TLS_KTLS_RX) return "rx";
+    return "not engaged";
+}
+
+static void early_data_release(TLSContext *ctx) {
+    if (ctx->early_buf) {
+        OPENSSL_cleanse(ctx->early_buf, ctx->early_len);
+        free(ctx->early_buf);
+        ctx->early_buf = NULL;
+    }
+    ctx->early_len = 0;
+}
+
+// [New] 排队 0-RTT 数据 (复制一份，发出后释放)
+int tls_set_early_data(TLSContext *ctx, const char *alpn, const char *data, int len) {
+    if (!ctx || !ctx->ssl || !data || len <= 0 || ctx->early_state != TLS_EARLY_NONE) return 0;
+    if (g_enableECH) return 0; // ECH 与 early data 的组合不稳定，保持 1-RTT
+    if (!TlsSession_ClaimEarlyData(ctx->ssl, alpn, len)) return 0;
+
+    ctx->early_buf = (char*)malloc(len);
+    if (!ctx->early_buf) return 0;
+    memcpy(ctx->early_buf, data, len);
+    ctx->early_len = len;
+    ctx->early_state = TLS_EARLY_PENDING;
+    return 1;
+}
+
+BOOL tls_early_data_accepted(const TLSContext *ctx) {
+    return ctx && ctx->early_state == TLS_EARLY_ACCEPTED;
+}
+
+// 写出排队的 early data (同时产生 ClientHello)。返回: TLS_STEP_DONE=已写出, TLS_STEP_WANT_*, -1=失败
+static int early_data_step(TLSContext *ctx) {
+    size_t written = 0;
+    ERR_clear_error();
+    int ret = SSL_write_early_data(ctx->ssl, ctx->early_buf, (size_t)ctx->early_len, &written);
+    if (ret == 1) {
+        early_data_release(ctx);
+        ctx->early_state = TLS_EARLY_SENT;
+        return TLS_STEP_DONE;
+    }
+    int err = SSL_get_error(ctx->ssl, ret);
+    if (err == SSL_ERROR_WANT_READ) return TLS_STEP_WANT_READ;
+    if (err == SSL_ERROR_WANT_WRITE) return TLS_STEP_WANT_WRITE;
+    return -1;
+}
+
+// 握手完成：记录服务端是否接受了 early data
+static void early_data_finish(TLSContext *ctx) {
+    if (ctx->early_state != TLS_EARLY_SENT) return;
+    if (SSL_get_early_data_status(ctx->ssl) == SSL_EARLY_DATA_ACCEPTED) {
+        ctx->early_state = TLS_EARLY_ACCEPTED;
     } else {
-        SSL_set_bio(ctx->ssl, internal_bio, internal_bio);
+        ctx->early_state = TLS_EARLY_REJECTED;
+        log_msg("[TLS] 0-RTT early data rejected by server, resending after handshake");
     }
-    
-    // 非阻塞握手循环
-    int ret = -1;
-    ULONGLONG start_time = GetTickCount64();
-    
-    while (g_proxyRunning) {
-        ULONGLONG now = GetTickCount64();
-        if (now - start_time > HANDSHAKE_TIMEOUT_MS) {
-            log_msg("[TLS] Handshake timeout");
-            break;
-        }
+}
 
-        ERR_clear_error(); 
-        ret = SSL_connect(ctx->ssl);
-        
-        if (ret == 1) return 0; // Success
+static void handshake_release(TLSContext *ctx) {
+    early_data_release(ctx);
+    if (ctx->ssl) {
+        SSL_free(ctx->ssl);
+        ctx->ssl = NULL;
+    }
+    TlsEngine_Detach(ctx);
+}
 
-        int err_code = SSL_get_error(ctx->ssl, ret);
-        if (err_code == SSL_ERROR_WANT_READ || err_code == SSL_ERROR_WANT_WRITE) {
-            fd_set fds; 
-            FD_ZERO(&fds); 
-            FD_SET(ctx->sock, &fds);
-            
-            struct timeval tv;
-            tv.tv_sec = 0; 
-            // 保持 1ms 的极短轮询，确保握手阶段最快响应
-            tv.tv_usec = SELECT_WAIT_MS * 1000; 
-
-            int n;
-            // 根据需要等待读或写
-            if (err_code == SSL_ERROR_WANT_READ) n = select(0, &fds, NULL, NULL, &tv);
-            else n = select(0, NULL, &fds, NULL, &tv);
-            
-            if (n < 0) {
-                log_msg("[TLS] Handshake select error: %d", WSAGetLastError());
-                break;
-            }
-            // n=0 (Timeout) continue to loop
-        } else {
-            unsigned long ssl_err = ERR_get_error();
-            if (ssl_err != 0) {
-                char err_buf[256];
-                ERR_error_string_n(ssl_err, err_buf, sizeof(err_buf));
-                log_msg("[TLS] Handshake failed: %s", err_buf);
-                
-                // [Added 2026-01-29] 打印详细验证结果，辅助排查证书问题
-                long verify_res = SSL_get_verify_result(ctx->ssl);
-                if (verify_res != X509_V_OK) {
-                    const char* reason = X509_verify_cert_error_string(verify_res);
-                    // Code 62 = Hostname Mismatch, Code 20 = Untrusted Issuer
-                    log_msg("[TLS] Verify Detail: Code %ld (%s)", verify_res, reason);
+// 推进一次握手，不阻塞
+// 返回: TLS_STEP_DONE / TLS_STEP_WANT_READ / TLS_STEP_WANT_WRITE，-1 = 失败 (SSL 已释放)
+int tls_connect_step(TLSContext *ctx) {
+    if (!ctx || !ctx->ssl) return -1;
+
+    if (TlsEngine_IsActive(ctx)) {
+        while (TRUE) {
+            // [New] 0-RTT：early data 与 ClientHello 一起进入引擎，随后的 flush 合并为一次 send
+            if (ctx->early_state == TLS_EARLY_PENDING) {
+                int er = early_data_step(ctx);
+                if (er < 0) { report_handshake_error(ctx); break; }
+                if (er != TLS_STEP_DONE && TlsEngine_FlushToSocket(ctx) < 0) break;
+                if (er == TLS_STEP_WANT_WRITE) return TLS_STEP_WANT_WRITE;
+                if (er == TLS_STEP_WANT_READ) {
+                    int got = TlsEngine_FillFromSocket(ctx);
+                    if (got > 0) continue;
+                    if (got < 0) { log_msg("[TLS] Handshake failed: connection closed by peer"); break; }
+                    return TLS_STEP_WANT_READ;
                 }
             }
-            break; 
+            int ret = TlsEngine_Handshake(ctx);
+            // 握手消息 (含多条记录) 合并为一次 send
+            int fr = TlsEngine_FlushToSocket(ctx);
+            if (fr < 0) {
+                log_msg("[TLS] Handshake failed: send error %d", WSAGetLastError());
+                break;
+            }
+            if (ret < 0) { report_handshake_error(ctx); break; }
+            // 最后一段 (如 Finished) 未发完时先等待可写，下次调用再确认完成
+            if (fr == 1) return TLS_STEP_WANT_WRITE;
+            if (ret == 1) { early_data_finish(ctx); return TLS_STEP_DONE; }
+
+            int got = TlsEngine_FillFromSocket(ctx);
+            if (got > 0) continue;
+            if (got < 0) { log_msg("[TLS] Handshake failed: connection closed by peer"); break; }
+            return TLS_STEP_WANT_READ;
         }
+        handshake_release(ctx);
+        return -1;
     }
 
-    if (ctx->ssl) {
-        SSL_free(ctx->ssl);
-        ctx->ssl = NULL;
+    if (ctx->early_state == TLS_EARLY_PENDING) {
+        int er = early_data_step(ctx);
+        if (er < 0) {
+            report_handshake_error(ctx);
+            handshake_release(ctx);
+            return -1;
+        }
+        if (er != TLS_STEP_DONE) return er;
+    }
+
+    ERR_clear_error();
+    int ret = SSL_connect(ctx->ssl);
+    if (ret == 1) {
+        early_data_finish(ctx);
+        probe_ktls(ctx);
+        return TLS_STEP_DONE;
+    }
+
+    int err_code = SSL_get_error(ctx->ssl, ret);
+    if (err_code == SSL_ERROR_WANT_READ) return TLS_STEP_WANT_READ;
+    if (err_code == SSL_ERROR_WANT_WRITE) return TLS_STEP_WANT_WRITE;
+
+    report_handshake_error(ctx);
+    handshake_release(ctx);
+    return -1;
+}
+
+// 同步等待 tls_connect_begin 之后的握手完成，超时 HANDSHAKE_TIMEOUT_MS
+int tls_connect_wait(TLSContext *ctx) {
+    ULONGLONG start_time = GetTickCount64();
+    while (g_proxyRunning) {
+        int ret = tls_connect_step(ctx);
+        if (ret == TLS_STEP_DONE) return 0; // Success
+        if (ret < 0) return -1;
+
+        ULONGLONG elapsed = GetTickCount64() - start_time;
+        if (elapsed > HANDSHAKE_TIMEOUT_MS) {
+            log_msg("[TLS] Handshake timeout");
+            break;
+        }
+
+        // 根据需要等待读或写，I/O 就绪或停止信号到达时立即返回
+        int n = Cancel_Wait(ctx->sock, (ret == TLS_STEP_WANT_READ) ? CANCEL_WAIT_READ : CANCEL_WAIT_WRITE,
+                            (int)(HANDSHAKE_TIMEOUT_MS - elapsed));
+        if (n < 0) break; // 已停止或 select 错误
+        // n=0 (Timeout) 由循环顶部判定
     }
+
+    handshake_release(ctx);
     return -1;
 }
 
+int tls_init_connect(TLSContext *ctx, const char* target_sni, const char* target_host, const CryptoSettings* settings, BOOL allowInsecure) {
+    if (tls_connect_begin(ctx, target_sni, target_host, settings, allowInsecure) != 0) return -1;
+    return tls_connect_wait(ctx);
+}
+
 const char* tls_get_alpn_selected(TLSContext *ctx) {
     if (!ctx || !ctx->ssl) return NULL;
     const unsigned char *data = NULL;
@@ -256,12 +458,34 @@ int tls_write(TLSContext *ctx, const char *data, int len) {
     int written = 0;
     ULONGLONG start_tick = GetTickCount64();
 
+    // [New] 引擎模式：明文先加密进 BIO 缓冲，满了才 send，多条记录合并为一次系统调用
+    if (TlsEngine_IsActive(ctx)) {
+        while (written < len) {
+            if (!g_proxyRunning) return -1;
+            int n = TlsEngine_Write(ctx, data + written, len - written);
+            if (n < 0) return -1;
+            if (n > 0) {
+                written += n;
+                start_tick = GetTickCount64();
+                continue;
+            }
+            // 输出缓冲已满，先排空
+            if (engine_flush_blocking(ctx, start_tick + WRITE_TIMEOUT_MS) < 0) {
+                log_msg("[TLS] Write timeout");
+                return -1;
+            }
+        }
+        if (engine_flush_blocking(ctx, start_tick + WRITE_TIMEOUT_MS) < 0) return -1;
+        return written;
+    }
+
     ERR_clear_error();
     
     while (written < len) {
         if (!g_proxyRunning) return -1;
 
-        if (GetTickCount64() - start_tick > WRITE_TIMEOUT_MS) {
+        ULONGLONG elapsed = GetTickCount64() - start_tick;
+        if (elapsed > WRITE_TIMEOUT_MS) {
             log_msg("[TLS] Write timeout");
             return -1;
         }
@@ -274,21 +498,11 @@ int tls_write(TLSContext *ctx, const char *data, int len) {
         } else {
             int err = SSL_get_error(ctx->ssl, ret);
             if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) { 
-                int sock = SSL_get_fd(ctx->ssl);
-                fd_set rfds, wfds;
-                struct timeval tv;
-                tv.tv_sec = 0; tv.tv_usec = SELECT_WAIT_MS * 1000; // 1ms
-                
-                FD_ZERO(&rfds); FD_ZERO(&wfds);
-
-                // 根据 SSL 需求设置 FD_SET
-                if (err == SSL_ERROR_WANT_READ) FD_SET(sock, &rfds);
-                else FD_SET(sock, &wfds);
-                
-                int n = select(0, &rfds, &wfds, NULL, &tv);
-                
-                if (n < 0) return -1; // Select 错误
-                // 如果 n==0 (超时)，循环继续检查 g_proxyRunning
+                // 根据 SSL 需求等待读或写 (停止信号到达时立即返回)
+                int n = Cancel_Wait(ctx->sock, (err == SSL_ERROR_WANT_READ) ? CANCEL_WAIT_READ : CANCEL_WAIT_WRITE,
+                                    (int)(WRITE_TIMEOUT_MS - elapsed));
+                if (n < 0) return -1; // 已停止或 select 错误
+                // 如果 n==0 (超时)，由循环顶部判定
             } else {
                 return -1; // 致命错误
             }
@@ -297,12 +511,54 @@ int tls_write(TLSContext *ctx, const char *data, int len) {
     return written;
 }
 
+// [New] 非阻塞写入 (事件循环使用)：只写入当前能接受的部分，从不等待 Socket 可写
+// 返回: >=0 已接受的明文字节数 (可能少于 len，剩余部分由调用者排队后重试), -1=错误
+int tls_write_nb(TLSContext *ctx, const char *data, int len) {
+    if (!ctx || !ctx->ssl) return -1;
+    if (len <= 0) return 0;
+    int written = 0;
+
+    if (TlsEngine_IsActive(ctx)) {
+        while (written < len) {
+            int n = TlsEngine_Write(ctx, data + written, len - written);
+            if (n < 0) return -1;
+            if (n > 0) { written += n; continue; }
+            // 引擎输出缓冲已满，尽力排空一次；Socket 也写满时停止
+            int fr = TlsEngine_FlushToSocket(ctx);
+            if (fr < 0) return -1;
+            if (fr > 0) break;
+        }
+        if (TlsEngine_FlushToSocket(ctx) < 0) return -1;
+        return written;
+    }
+
+    // Socket BIO：允许部分写入；WANT_WRITE 后调用者从排队缓冲重试，缓冲地址可能已变化
+    SSL_set_mode(ctx->ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    ERR_clear_error();
+    while (written < len) {
+        int ret = SSL_write(ctx->ssl, data + written, len - written);
+        if (ret > 0) { written += ret; continue; }
+        int err = SSL_get_error(ctx->ssl, ret);
+        if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) break;
+        return -1;
+    }
+    return written;
+}
+
+// [New] 排空引擎中已加密未发出的密文 (非引擎模式无此缓冲)
+// 返回: 0=已全部发出, 1=Socket 写满 (需等待可写), -1=错误
+int tls_flush_nb(TLSContext *ctx) {
+    if (!ctx || !TlsEngine_IsActive(ctx)) return 0;
+    return TlsEngine_FlushToSocket(ctx);
+}
+
 // 返回值: 
 // > 0: 读取字节数
 // 0: 暂无数据 (Retry)
 // -1: EOF 或 错误
 int tls_read(TLSContext *ctx, char *out, int max) {
     if (!ctx || !ctx->ssl) return -1;
+    if (TlsEngine_IsActive(ctx)) return engine_read(ctx, out, max);
     ERR_clear_error();
     int ret = SSL_read(ctx->ssl, out, max);
     
@@ -328,7 +584,8 @@ int tls_read_exact(TLSContext *ctx, char *buf, int len) {
     while (total < len) {
         if (!g_proxyRunning) return 0;
         
-        if (GetTickCount64() - start_tick > READ_TIMEOUT_MS) {
+        ULONGLONG elapsed = GetTickCount64() - start_tick;
+        if (elapsed > READ_TIMEOUT_MS) {
             return 0;
         }
 
@@ -337,22 +594,22 @@ int tls_read_exact(TLSContext *ctx, char *buf, int len) {
         if (ret < 0) return 0; // EOF or Error
         
         if (ret == 0) { 
-            // 暂无数据，使用 select 等待
-            int sock = SSL_get_fd(ctx->ssl);
-            
+            // 暂无数据，等待 Socket 就绪
             // 如果 SSL 缓冲区里有数据，立即重试 (OpenSSL Internal Buffering)
-            if (SSL_pending(ctx->ssl) > 0) continue; 
+            if (tls_pending(ctx) > 0) continue; 
             
-            fd_set rfds, wfds; 
-            FD_ZERO(&rfds); FD_ZERO(&wfds);
-            
-            if (SSL_want_read(ctx->ssl)) FD_SET(sock, &rfds);
-            if (SSL_want_write(ctx->ssl)) FD_SET(sock, &wfds);
+            int events = 0;
+            if (TlsEngine_IsActive(ctx)) {
+                // 引擎模式：密文由我们搬运，等待 Socket 可读；仍有待发密文时同时等待可写
+                events = CANCEL_WAIT_READ;
+                if (TlsEngine_CipherOutPending(ctx) > 0) events |= CANCEL_WAIT_WRITE;
+            } else {
+                if (SSL_want_read(ctx->ssl)) events |= CANCEL_WAIT_READ;
+                if (SSL_want_write(ctx->ssl)) events |= CANCEL_WAIT_WRITE;
+                if (!events) events = CANCEL_WAIT_READ;
+            }
             
-            struct timeval tv;
-            tv.tv_sec = 0; tv.tv_usec = SELECT_WAIT_MS * 1000; 
-
-            int n = select(0, &rfds, &wfds, NULL, &tv);
+            int n = Cancel_Wait(ctx->sock, events, (int)(READ_TIMEOUT_MS - elapsed));
             if (n < 0) return 0;
             
             continue; 
@@ -364,11 +621,33 @@ int tls_read_exact(TLSContext *ctx, char *buf, int len) {
     return 1; 
 }
 
+// [New] 半关闭：发出 close_notify 后不再写入，但仍可继续读取对端数据
+// 非阻塞，密文未能立即发出时留在引擎中，由 tls_flush_nb 继续排空。返回 0=成功, -1=错误
+int tls_shutdown_write(TLSContext *ctx) {
+    if (!ctx || !ctx->ssl) return -1;
+    if (SSL_get_shutdown(ctx->ssl) & SSL_SENT_SHUTDOWN) return 0;
+    ERR_clear_error();
+    int ret = SSL_shutdown(ctx->ssl);
+    if (ret < 0) {
+        int err = SSL_get_error(ctx->ssl, ret);
+        if (err != SSL_ERROR_WANT_WRITE && err != SSL_ERROR_WANT_READ) return -1;
+    }
+    return (tls_flush_nb(ctx) < 0) ? -1 : 0;
+}
+
 void tls_close(TLSContext *ctx) {
+    early_data_release(ctx);
     if (ctx->ssl) { 
         // 快速关闭，不等待对端响应 (Quiet Shutdown)
         SSL_set_shutdown(ctx->ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
         SSL_free(ctx->ssl); 
         ctx->ssl = NULL; 
     }
+    TlsEngine_Detach(ctx);
+}
+
+// [New] 无需 Socket I/O 即可读出的数据量 (替代直接调用 SSL_pending，兼容引擎模式)
+int tls_pending(TLSContext *ctx) {
+    if (!ctx || !ctx->ssl) return 0;
+    return TlsEngine_Buffered(ctx);
 }
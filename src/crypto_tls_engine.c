@@ -0,0 +1,180 @@
+/* src/crypto_tls_engine.c */
+// [New] 2026-10-16: 内存 BIO TLS 引擎 (与 Socket 解耦)
+// 设计要点:
+// 1. SSL 对象挂接在 BIO pair 的内部端，OpenSSL 不再直接读写 Socket
+// 2. 调用者负责搬运密文：从 Socket 一次性读入大块数据喂给引擎 (可包含多个 TLS 记录)，
+//    或把引擎产出的多个记录一次性 send 出去，减少系统调用
+// 3. 提供 nwrite0/nread0 风格的零拷贝接口，任何事件循环 / 完成端口后端均可直接驱动
+// 注意: 分片 BIO (crypto_bio.c) 依赖逐段 send 的时序，开启分片时仍使用 Socket BIO
+
+#include "crypto.h"
+#include "common.h"
+#include "utils.h"
+#include <openssl/ssl.h>
+#include <openssl/bio.h>
+#include <openssl/err.h>
+
+// 两个方向各 2 个满尺寸记录的缓冲 (16K 明文 + 记录开销)
+#define TLS_ENGINE_BIO_SIZE (2 * (16384 + 512))
+#define TLS_RECORD_HEADER_LEN 5
+#define TLS_MAX_RECORD_LEN    (16384 + 2048)
+
+int TlsEngine_Attach(TLSContext *ctx) {
+    if (!ctx || !ctx->ssl || ctx->net_bio) return -1;
+
+    BIO *int_bio = NULL, *net_bio = NULL;
+    if (!BIO_new_bio_pair(&int_bio, TLS_ENGINE_BIO_SIZE, &net_bio, TLS_ENGINE_BIO_SIZE)) {
+        return -1;
+    }
+    SSL_set_bio(ctx->ssl, int_bio, int_bio);
+    // 允许部分写入：BIO 缓冲满时 SSL_write 返回已接受的字节数，而不是整体失败
+    SSL_set_mode(ctx->ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    ctx->net_bio = net_bio;
+    return 0;
+}
+
+void TlsEngine_Detach(TLSContext *ctx) {
+    // 内部端随 SSL_free 释放，这里只释放网络端
+    if (ctx && ctx->net_bio) {
+        BIO_free(ctx->net_bio);
+        ctx->net_bio = NULL;
+    }
+}
+
+BOOL TlsEngine_IsActive(const TLSContext *ctx) {
+    return ctx && ctx->net_bio != NULL;
+}
+
+// --- 密文输入 (Socket -> 引擎) ---
+
+int TlsEngine_CipherInSpace(TLSContext *ctx, char **ptr) {
+    if (!TlsEngine_IsActive(ctx)) return -1;
+    int n = BIO_nwrite0(ctx->net_bio, ptr);
+    return (n > 0) ? n : 0;
+}
+
+int TlsEngine_CipherInCommit(TLSContext *ctx, int len) {
+    if (!TlsEngine_IsActive(ctx) || len <= 0) return 0;
+    char *ptr = NULL;
+    return BIO_nwrite(ctx->net_bio, &ptr, len);
+}
+
+int TlsEngine_Feed(TLSContext *ctx, const char *data, int len) {
+    if (!TlsEngine_IsActive(ctx)) return -1;
+    if (len <= 0) return 0;
+    int n = BIO_write(ctx->net_bio, data, len);
+    return (n > 0) ? n : 0;
+}
+
+// --- 密文输出 (引擎 -> Socket) ---
+
+int TlsEngine_CipherOutPending(TLSContext *ctx) {
+    if (!TlsEngine_IsActive(ctx)) return 0;
+    return (int)BIO_ctrl_pending(ctx->net_bio);
+}
+
+int TlsEngine_CipherOut(TLSContext *ctx, char **ptr) {
+    if (!TlsEngine_IsActive(ctx)) return -1;
+    int n = BIO_nread0(ctx->net_bio, ptr);
+    return (n > 0) ? n : 0;
+}
+
+void TlsEngine_CipherOutConsume(TLSContext *ctx, int len) {
+    if (!TlsEngine_IsActive(ctx) || len <= 0) return;
+    char *ptr = NULL;
+    BIO_nread(ctx->net_bio, &ptr, len);
+}
+
+int TlsEngine_Drain(TLSContext *ctx, char *out, int max) {
+    if (!TlsEngine_IsActive(ctx)) return -1;
+    int n = BIO_read(ctx->net_bio, out, max);
+    return (n > 0) ? n : 0;
+}
+
+// --- 明文接口 ---
+
+// 返回: 1=握手完成, 0=需要更多 I/O, -1=失败
+int TlsEngine_Handshake(TLSContext *ctx) {
+    ERR_clear_error();
+    int ret = SSL_do_handshake(ctx->ssl);
+    if (ret == 1) return 1;
+    int err = SSL_get_error(ctx->ssl, ret);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) return 0;
+    return -1;
+}
+
+// 返回: >0 明文字节数, 0=需要更多密文, -1=EOF 或错误
+int TlsEngine_Read(TLSContext *ctx, char *out, int max) {
+    ERR_clear_error();
+    int ret = SSL_read(ctx->ssl, out, max);
+    if (ret > 0) return ret;
+    int err = SSL_get_error(ctx->ssl, ret);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) return 0;
+    return -1;
+}
+
+// 返回: >0 已接受的明文字节数, 0=输出缓冲已满 (需先排空密文), -1=错误
+int TlsEngine_Write(TLSContext *ctx, const char *data, int len) {
+    ERR_clear_error();
+    int ret = SSL_write(ctx->ssl, data, len);
+    if (ret > 0) return ret;
+    int err = SSL_get_error(ctx->ssl, ret);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) return 0;
+    return -1;
+}
+
+// 无需 Socket I/O 即可继续产出的数据量：已解密未读取的明文，或已喂入且至少含一条完整记录的密文
+// (只含半条记录时返回 0，避免调用者空转)
+int TlsEngine_Buffered(TLSContext *ctx) {
+    if (!ctx || !ctx->ssl) return 0;
+    int n = SSL_pending(ctx->ssl);
+    if (n > 0 || !TlsEngine_IsActive(ctx)) return n;
+
+    BIO *rbio = SSL_get_rbio(ctx->ssl);
+    int avail = (int)BIO_ctrl_pending(rbio);
+    if (avail < TLS_RECORD_HEADER_LEN) return 0;
+
+    char *peek = NULL;
+    int contiguous = BIO_nread0(rbio, &peek); // 只查看，不消费
+    if (contiguous >= TLS_RECORD_HEADER_LEN) {
+        int rec_len = TLS_RECORD_HEADER_LEN + (((unsigned char)peek[3] << 8) | (unsigned char)peek[4]);
+        return (avail >= rec_len) ? avail : 0;
+    }
+    // 记录头跨越环形缓冲边界，保守地按最大记录长度判断
+    return (avail >= TLS_RECORD_HEADER_LEN + TLS_MAX_RECORD_LEN) ? avail : 0;
+}
+
+// --- Socket 驱动辅助 (供同步路径与事件循环使用) ---
+
+// 排空密文到 Socket。返回: 0=全部发出, 1=Socket 写满 (需等待可写), -1=错误
+int TlsEngine_FlushToSocket(TLSContext *ctx) {
+    char *ptr = NULL;
+    int avail;
+    while ((avail = TlsEngine_CipherOut(ctx, &ptr)) > 0) {
+        int n = send(ctx->sock, ptr, avail, 0);
+        if (n > 0) {
+            TlsEngine_CipherOutConsume(ctx, n);
+            continue;
+        }
+        int err = WSAGetLastError();
+        if (err == WSAEWOULDBLOCK) return 1;
+        if (err == WSAEINTR) continue;
+        return -1;
+    }
+    return (avail < 0) ? -1 : 0;
+}
+
+// 从 Socket 一次性读入尽可能多的密文。返回: >0 读入字节数, 0=暂无数据或缓冲已满, -1=EOF 或错误
+int TlsEngine_FillFromSocket(TLSContext *ctx) {
+    char *ptr = NULL;
+    int space = TlsEngine_CipherInSpace(ctx, &ptr);
+    if (space <= 0) return (space < 0) ? -1 : 0;
+
+    int n = recv(ctx->sock, ptr, space, 0);
+    if (n > 0) {
+        TlsEngine_CipherInCommit(ctx, n);
+        return n;
+    }
+    if (n == 0) return -1;
+    return (WSAGetLastError() == WSAEWOULDBLOCK) ? 0 : -1;
+}
@@ -4,6 +4,9 @@
 // [Security] 2026-01-29: 使用 RAND_bytes 替代 rand() 生成掩码，增强抗识别能力
 // [Refactor] 2026-01-29: 新增 ws_read_frame 支持读取完整帧，修复 SOCKS5 握手过严导致的断连
 // [Fix] 2026-01-29: 修正 Strict Aliasing 潜在风险
+// [Mod] 2026-10-16: 掩码 / 解掩码改用向量化内核 (crypto_ws_mask.c)，接收端原地解掩码
+// [New] 2026-10-16: 新增 build_ws_frame_inplace，利用载荷前的预留空间写帧头，省去整块拷贝
+// [New] 2026-10-16: 新增 ws_parse_header_split，单独解析 (可能跨越环形缓冲回绕点的) 帧头，支持流式转发
 
 #include "crypto.h"
 #include "common.h"
@@ -33,60 +36,78 @@
 // |                     Payload Data continued ...                |
 // +---------------------------------------------------------------+
 
-// [Refactor] 构建 WebSocket 帧 (客户端模式：必须 Mask)
-// 返回: 帧总长度 (Header + Mask + Payload)
-int build_ws_frame(const char* data, int len, char* out_buf) {
-    if (!data || !out_buf || len < 0) return -1;
-
+// 写入帧头 (FIN + Binary + Mask 位 + 长度 + 4 字节掩码)，返回帧头长度
+static int ws_write_header(unsigned char* out, int len, unsigned char mask[4]) {
     int header_len = 0;
     
     // FIN=1, RSV=0, Opcode=1 (Text) or 2 (Binary)
     // 这里默认使用 Binary (0x82) 用于代理传输
-    out_buf[0] = (char)0x82;
+    out[0] = 0x82;
 
     // Mask=1 (Client MUST mask)
     if (len < 126) {
-        out_buf[1] = (char)(0x80 | len);
+        out[1] = (unsigned char)(0x80 | len);
         header_len = 2;
     } else if (len <= 65535) {
-        out_buf[1] = (char)(0x80 | 126);
-        out_buf[2] = (len >> 8) & 0xFF;
-        out_buf[3] = len & 0xFF;
+        out[1] = 0x80 | 126;
+        out[2] = (len >> 8) & 0xFF;
+        out[3] = len & 0xFF;
         header_len = 4;
     } else {
-        out_buf[1] = (char)(0x80 | 127);
+        out[1] = 0x80 | 127;
         // 64-bit length (Network Byte Order)
         // 假设 size_t 不超过 64位且这里只处理 int 范围，高位补0
-        out_buf[2] = 0; out_buf[3] = 0; out_buf[4] = 0; out_buf[5] = 0;
-        out_buf[6] = (len >> 24) & 0xFF;
-        out_buf[7] = (len >> 16) & 0xFF;
-        out_buf[8] = (len >> 8) & 0xFF;
-        out_buf[9] = len & 0xFF;
+        out[2] = 0; out[3] = 0; out[4] = 0; out[5] = 0;
+        out[6] = (len >> 24) & 0xFF;
+        out[7] = (len >> 16) & 0xFF;
+        out[8] = (len >> 8) & 0xFF;
+        out[9] = len & 0xFF;
         header_len = 10;
     }
 
     // Generate Masking Key
-    unsigned char mask[4];
     if (RAND_bytes(mask, 4) != 1) {
         // Fallback if RAND fails (unlikely)
         int r = rand();
         memcpy(mask, &r, 4);
     }
 
-    memcpy(out_buf + header_len, mask, 4);
-    header_len += 4;
+    memcpy(out + header_len, mask, 4);
+    return header_len + 4;
+}
+
+int ws_frame_header_len(int len) {
+    return (len < 126) ? 6 : ((len <= 65535) ? 8 : 14);
+}
+
+// [Refactor] 构建 WebSocket 帧 (客户端模式：必须 Mask)
+// 返回: 帧总长度 (Header + Mask + Payload)
+int build_ws_frame(const char* data, int len, char* out_buf) {
+    if (!data || !out_buf || len < 0) return -1;
+
+    unsigned char mask[4];
+    int header_len = ws_write_header((unsigned char*)out_buf, len, mask);
 
     // Payload Masking (XOR)
-    const unsigned char* src = (const unsigned char*)data;
-    unsigned char* dst = (unsigned char*)(out_buf + header_len);
-    
-    for (int i = 0; i < len; i++) {
-        dst[i] = src[i] ^ mask[i % 4];
-    }
+    ws_mask_copy((unsigned char*)(out_buf + header_len), (const unsigned char*)data, (size_t)len, mask, 0);
 
     return header_len + len;
 }
 
+// [New] 原地封帧：payload 之前须预留 WS_FRAME_HEADROOM 字节，帧头写在载荷前方，掩码原地完成
+// 返回: 帧起始地址 (位于 payload 之前)，*frame_len 为帧总长度
+char* build_ws_frame_inplace(char* payload, int len, int* frame_len) {
+    if (!payload || len < 0 || !frame_len) return NULL;
+
+    unsigned char mask[4];
+    unsigned char* frame = (unsigned char*)payload - ws_frame_header_len(len);
+    int header_len = ws_write_header(frame, len, mask);
+    ws_mask_inplace((unsigned char*)payload, (size_t)len, mask, 0);
+
+    *frame_len = header_len + len;
+    return (char*)frame;
+}
+
 // [Helper] 检查接收到的 WS 帧 (用于 Loop 中被动接收)
 // 返回: 帧总长度 (Header + Payload)，0表示不完整，-1表示错误
 long long check_ws_frame(unsigned char* buf, int len, int* header_len, int* payload_len) {
@@ -135,6 +156,44 @@ long long check_ws_frame(unsigned char* buf, int len, int* header_len, int* payl
     return h_len + p_len;
 }
 
+// [New] 2026-10-16: 仅解析帧头 (不要求载荷已到齐)，供流式转发使用
+// 帧头可能跨越环形缓冲回绕点，分布在 a / b 两段中；只拼接帧头 (最多 14 字节)，不移动载荷
+// 返回: 帧头长度 (>0)，0 表示帧头不完整，-1 表示协议错误
+int ws_parse_header_split(const unsigned char* a, int alen, const unsigned char* b, int blen, WsFrameHeader* out) {
+    unsigned char hdr[14];
+    int n = 0;
+    for (int i = 0; i < alen && n < (int)sizeof(hdr); i++) hdr[n++] = a[i];
+    for (int i = 0; i < blen && n < (int)sizeof(hdr); i++) hdr[n++] = b[i];
+    if (n < 2) return 0;
+
+    int h_len = 2;
+    long long p_len = hdr[1] & 0x7F;
+    if (p_len == 126) {
+        if (n < 4) return 0;
+        p_len = (hdr[2] << 8) | hdr[3];
+        h_len = 4;
+    } else if (p_len == 127) {
+        if (n < 10) return 0;
+        if (hdr[2] & 0x80) return -1; // 最高位必须为 0
+        p_len = 0;
+        for (int i = 0; i < 8; i++) p_len = (p_len << 8) | hdr[2 + i];
+        h_len = 10;
+    }
+
+    out->masked = (hdr[1] & 0x80) != 0;
+    if (out->masked) {
+        if (n < h_len + 4) return 0;
+        memcpy(out->mask, hdr + h_len, 4);
+        h_len += 4;
+    }
+    if (p_len > MAX_WS_FRAME_SIZE) return -1;
+
+    out->opcode = hdr[0] & 0x0F;
+    out->header_len = h_len;
+    out->payload_len = p_len;
+    return h_len;
+}
+
 // [New] 读取并解包一个完整的 WebSocket 帧
 // 功能：自动处理控制帧(Ping/Pong)，返回下一个数据帧的 Payload 长度
 // 返回: 实际读取的 payload 长度，-1 表示错误/关闭
@@ -186,11 +245,7 @@ int ws_read_frame(TLSContext *tls, char *out_buf, int max_len) {
         if (payload_len > 0) {
             if (tls_read_exact(tls, out_buf, (int)payload_len) != 1) return -1;
             
-            if (masked) {
-                for (uint64_t i = 0; i < payload_len; i++) {
-                    out_buf[i] ^= mask_key[i % 4];
-                }
-            }
+            if (masked) ws_mask_inplace((unsigned char*)out_buf, (size_t)payload_len, mask_key, 0);
         }
         
         return (int)payload_len;
@@ -244,11 +299,7 @@ int ws_read_payload_exact(TLSContext *tls, char *out_buf, int expect_len) {
 
         if (payload_len > 0) {
             if (tls_read_exact(tls, out_buf + total_collected, (int)payload_len) != 1) return 0;
-            if (masked) {
-                for (uint64_t i = 0; i < payload_len; i++) {
-                    out_buf[total_collected + i] ^= mask_key[i % 4];
-                }
-            }
+            if (masked) ws_mask_inplace((unsigned char*)out_buf + total_collected, (size_t)payload_len, mask_key, 0);
             total_collected += (int)payload_len;
         }
     }
@@ -0,0 +1,178 @@
+/* src/crypto_ws_mask.c */
+// [New] 2026-10-16: WebSocket 掩码 / 解掩码向量化内核
+// 设计要点:
+// 1. 4 字节掩码扩展为 8/16/32 字节的重复模式，按块异或；块长均为 4 的倍数，相位在块间保持不变
+// 2. 启动时按 CPU 特性选择实现 (AVX2 > SSE2 > 64 位标量；ARM 使用 NEON)，之后只走函数指针
+// 3. dst == src 时即为原地解掩码，接收路径无需第二块缓冲
+// 4. offset 参数表示当前字节在帧载荷中的位置，用于分段处理同一帧
+
+#include "crypto.h"
+#include "common.h"
+#include "utils.h"
+#include <string.h>
+#include <stdint.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    #define WS_MASK_X86 1
+    #include <emmintrin.h>
+    #include <immintrin.h>
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+        #define WS_TARGET_AVX2
+    #else
+        #define WS_TARGET_AVX2 __attribute__((target("avx2")))
+    #endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+    #define WS_MASK_NEON 1
+    #include <arm_neon.h>
+#endif
+
+typedef void (*WsMaskFn)(unsigned char* dst, const unsigned char* src, size_t len, const unsigned char key[4]);
+
+// --- 64 位标量 (所有平台的兜底实现，也负责各向量内核的尾部) ---
+
+static void ws_mask_scalar64(unsigned char* dst, const unsigned char* src, size_t len, const unsigned char key[4]) {
+    uint32_t k32;
+    memcpy(&k32, key, 4);
+    uint64_t k64 = ((uint64_t)k32 << 32) | k32;
+
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v;
+        memcpy(&v, src + i, 8);
+        v ^= k64;
+        memcpy(dst + i, &v, 8);
+    }
+    for (; i < len; i++) dst[i] = src[i] ^ key[i & 3];
+}
+
+#if defined(WS_MASK_X86)
+
+static void ws_mask_sse2(unsigned char* dst, const unsigned char* src, size_t len, const unsigned char key[4]) {
+    int32_t k32;
+    memcpy(&k32, key, 4);
+    __m128i k = _mm_set1_epi32(k32);
+
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(src + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*)(src + i + 48));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(a, k));
+        _mm_storeu_si128((__m128i*)(dst + i + 16), _mm_xor_si128(b, k));
+        _mm_storeu_si128((__m128i*)(dst + i + 32), _mm_xor_si128(c, k));
+        _mm_storeu_si128((__m128i*)(dst + i + 48), _mm_xor_si128(d, k));
+    }
+    for (; i + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(a, k));
+    }
+    ws_mask_scalar64(dst + i, src + i, len - i, key);
+}
+
+WS_TARGET_AVX2
+static void ws_mask_avx2(unsigned char* dst, const unsigned char* src, size_t len, const unsigned char key[4]) {
+    int32_t k32;
+    memcpy(&k32, key, 4);
+    __m256i k = _mm256_set1_epi32(k32);
+
+    size_t i = 0;
+    for (; i + 128 <= len; i += 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(src + i + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(src + i + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(src + i + 96));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(a, k));
+        _mm256_storeu_si256((__m256i*)(dst + i + 32), _mm256_xor_si256(b, k));
+        _mm256_storeu_si256((__m256i*)(dst + i + 64), _mm256_xor_si256(c, k));
+        _mm256_storeu_si256((__m256i*)(dst + i + 96), _mm256_xor_si256(d, k));
+    }
+    for (; i + 32 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(a, k));
+    }
+    ws_mask_scalar64(dst + i, src + i, len - i, key);
+}
+
+// AVX2 需要 CPU 支持且操作系统保存 YMM 状态
+static BOOL cpu_has_avx2(void) {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return FALSE;
+    __cpuid(info, 1);
+    BOOL osxsave = (info[2] & (1 << 27)) != 0;
+    BOOL avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx) return FALSE;
+    if ((_xgetbv(0) & 0x6) != 0x6) return FALSE;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? TRUE : FALSE;
+#endif
+}
+
+#elif defined(WS_MASK_NEON)
+
+static void ws_mask_neon(unsigned char* dst, const unsigned char* src, size_t len, const unsigned char key[4]) {
+    uint32_t k32;
+    memcpy(&k32, key, 4);
+    uint8x16_t k = vreinterpretq_u8_u32(vdupq_n_u32(k32));
+
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        uint8x16_t a = vld1q_u8(src + i);
+        uint8x16_t b = vld1q_u8(src + i + 16);
+        uint8x16_t c = vld1q_u8(src + i + 32);
+        uint8x16_t d = vld1q_u8(src + i + 48);
+        vst1q_u8(dst + i, veorq_u8(a, k));
+        vst1q_u8(dst + i + 16, veorq_u8(b, k));
+        vst1q_u8(dst + i + 32, veorq_u8(c, k));
+        vst1q_u8(dst + i + 48, veorq_u8(d, k));
+    }
+    for (; i + 16 <= len; i += 16) {
+        vst1q_u8(dst + i, veorq_u8(vld1q_u8(src + i), k));
+    }
+    ws_mask_scalar64(dst + i, src + i, len - i, key);
+}
+
+#endif
+
+// --- 运行时分派 ---
+
+static volatile WsMaskFn s_maskFn = NULL;
+static const char* s_maskName = "scalar64";
+
+void ws_mask_init(void) {
+    WsMaskFn fn = ws_mask_scalar64;
+    const char* name = "scalar64";
+#if defined(WS_MASK_X86)
+    if (cpu_has_avx2()) { fn = ws_mask_avx2; name = "avx2"; }
+    else { fn = ws_mask_sse2; name = "sse2"; } // x64 基线即包含 SSE2
+#elif defined(WS_MASK_NEON)
+    fn = ws_mask_neon; name = "neon";
+#endif
+    s_maskName = name;
+    s_maskFn = fn; // 指针写入是原子的，重复初始化结果相同
+}
+
+const char* ws_mask_impl_name(void) {
+    if (!s_maskFn) ws_mask_init();
+    return s_maskName;
+}
+
+void ws_mask_copy(unsigned char* dst, const unsigned char* src, size_t len, const unsigned char mask[4], size_t offset) {
+    if (len == 0) return;
+    if (!s_maskFn) ws_mask_init();
+
+    // 按载荷偏移旋转掩码，内核统一按相位 0 处理
+    unsigned char key[4];
+    for (int i = 0; i < 4; i++) key[i] = mask[(offset + i) & 3];
+    s_maskFn(dst, src, len, key);
+}
+
+void ws_mask_inplace(unsigned char* buf, size_t len, const unsigned char mask[4], size_t offset) {
+    ws_mask_copy(buf, buf, len, mask, offset);
+}
@@ -4,6 +4,12 @@
 // 2. 增加 g_localAddr 定义
 // [Mod] 2026: 增加 g_needReloadRoutes 全局变量
 // [Refactor] 2026: 增加 Sing-box 驱动所需的全局变量定义
+// [New] 2026-10-16: 增加 g_enableKTLS
+// [New] 2026-10-16: 增加多路复用设置 g_enableMux / g_muxMaxConnections / g_muxMaxStreams
+// [New] 2026-10-16: 增加预建连接池设置 g_warmPoolSize / g_warmPoolMaxIdle
+// [New] 2026-10-16: 增加 g_enableTlsResume / g_enableEarlyData
+// [New] 2026-10-16: 增加 g_dnsMode / g_dnsServer
+// [New] 2026-10-16: 增加外部规则集 g_ruleProviders
 
 #include "common.h"
 #include "proxy.h"
@@ -76,10 +82,35 @@ BOOL g_enableECH = FALSE;
 char g_echConfigServer[256] = "https://dns.alidns.com/dns-query"; 
 char g_echPublicName[256] = "cloudflare-ech.com";   
 
+// [New] kTLS 卸载 (需 OpenSSL 以 enable-ktls 构建且系统支持，否则握手后报告未生效)
+// Windows 版 OpenSSL 不含 kTLS：开启后照常使用内存 BIO 引擎，仅报告未生效
+BOOL g_enableKTLS = FALSE;
+
+// [New] 多路复用 (sing-box mux 协议，yamux)：同节点的 WS / TLS 隧道承载多个浏览器连接
+BOOL g_enableMux = FALSE;
+int g_muxMaxConnections = 2;
+int g_muxMaxStreams = 32;
+
+// [New] 预建连接池：按节点提前完成 TCP + TLS 握手，新连接直接取用 (0 = 关闭)
+int g_warmPoolSize = 0;
+int g_warmPoolMaxIdle = 30;
+
+// [New] 上游 TLS 会话恢复 (票据按节点缓存并保存到 tls_sessions.dat) 与 0-RTT
+BOOL g_enableTlsResume = FALSE;
+BOOL g_enableEarlyData = FALSE;
+
+// [New] 共享 DNS 解析器后端 (0=系统, 1=UDP, 2=DoH) 与服务器
+int g_dnsMode = 0;
+char g_dnsServer[256] = "";
+
 // [New] 路由规则全局变量
 RoutingRule g_routingRules[MAX_RULES];
 int g_routingRuleCount = 0;
 
+// [New] 外部规则集 (编译与匹配见 proxy_rule_provider.c)
+RuleProvider g_ruleProviders[MAX_RULE_PROVIDERS];
+int g_ruleProviderCount = 0;
+
 // [New] 路由热重载标志
 volatile BOOL g_needReloadRoutes = FALSE;
 
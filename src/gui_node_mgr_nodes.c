@@ -5,6 +5,7 @@
 // [Bug Fix] 2026: 修复全选删除后列表不刷新的问题 (移除 LVSICF_NOINVALIDATEALL)
 // [UI] 2026: 为当前选中节点增加背景高亮 (NM_CUSTOMDRAW 修复版 - 天蓝色)
 // [Logic] 点击测速 -> 锁定UI -> 入队 -> Timer轮询 -> 保持20并发 -> 全部完成 -> 解锁UI
+// [Mod] 2026-10-16: 测速任务改由共享工作线程池执行，关闭窗口时可撤回排队任务
 
 #include "gui_node_mgr_private.h"
 #include <commctrl.h>
@@ -240,17 +241,17 @@ typedef struct {
     int port;
 } WorkerTaskArgs;
 
-// --- Worker Thread ---
-static DWORD WINAPI PingWorkerThread(LPVOID lpParam) {
-    WorkerTaskArgs* args = (WorkerTaskArgs*)lpParam;
-    if (!args) {
-        InterlockedDecrement(&s_activeWorkers);
-        return 0;
-    }
+// --- Worker Task ---
+// [Mod] 2026-10-16: 测速任务改为提交到共享线程池，不再为每个节点创建线程
+static void PingWorkerTask(void* arg) {
+    WorkerTaskArgs* args = (WorkerTaskArgs*)arg;
 
     // 执行测速 (阻塞)
     int latency = TcpPing(args->address, args->port, 3000); 
     UpdateNodeLatency(args->tag, latency);
+
+    // 窗口已关闭 (任务被取消)，不再触碰列表缓存
+    if (ThreadPool_IsCancelled()) return;
     
     // 更新 UI 缓存
     // [Safety] 仅更新数据，不计算索引，避免因排序造成的索引偏差
@@ -277,12 +278,12 @@ static DWORD WINAPI PingWorkerThread(LPVOID lpParam) {
     if (updateIndex != -1 && IsWindow(hListNodes)) {
         ListView_RedrawItems(hListNodes, updateIndex, updateIndex);
     }
+}
 
-    free(args);
-    
-    // 任务完成，减少计数器
+// 任务完成 / 被取消 / 被拒绝时均会调用：释放参数并减少计数器
+static void PingWorkerCleanup(void* arg) {
+    free(arg);
     InterlockedDecrement(&s_activeWorkers);
-    return 0;
 }
 
 // --- 任务调度器 (Timer Callback) ---
@@ -307,13 +308,8 @@ VOID CALLBACK SchedulerTimerProc(HWND hwnd, UINT uMsg, UINT_PTR idEvent, DWORD d
             args->port = task->port;
             
             InterlockedIncrement(&s_activeWorkers);
-            HANDLE hThread = CreateThread(NULL, 0, PingWorkerThread, args, 0, NULL);
-            if (hThread) {
-                CloseHandle(hThread);
-            } else {
-                InterlockedDecrement(&s_activeWorkers);
-                free(args);
-            }
+            // 提交失败时 PingWorkerCleanup 已被调用 (释放参数并回退计数)
+            ThreadPool_SubmitBackground(PingWorkerTask, args, PingWorkerCleanup, (const void*)&s_activeWorkers);
         }
 
         free(task);
@@ -777,4 +773,7 @@ void CleanupNodeManagerNodes() {
     }
     s_pPendingTail = NULL;
     LeaveCriticalSection(&s_csPendingQueue);
+
+    // [New] 撤回线程池中尚未开始的测速任务，执行中的任务完成后不再更新列表
+    ThreadPool_Cancel((const void*)&s_activeWorkers);
 }
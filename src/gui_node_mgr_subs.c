@@ -2,8 +2,11 @@
 // 描述: 订阅管理 UI、编辑、更新线程逻辑
 // [Fix] 2026: 优化 RefreshSubList，修正 ES_AUTOHSCROLL 拼写错误并解决闪烁问题
 // [Mod] 2026: 增加右键菜单（全选/删除），支持批量删除
+// [Mod] 2026-10-16: 手动更新订阅改由共享线程池执行
+// [Mod] 2026-10-16: 自动更新线程顺带更新外部规则集
 
 #include "gui_node_mgr_private.h"
+#include "proxy.h"
 #include <commctrl.h>
 
 // 定义右键菜单命令 ID
@@ -26,11 +29,11 @@ static void GetCycleStr(int cycle, int interval, wchar_t* buf, int size) {
     else wcscpy_s(buf, size, L"每天");
 }
 
-static DWORD WINAPI ManualUpdateThread(LPVOID param) {
+// [Mod] 2026-10-16: 手动更新改为线程池任务
+static void ManualUpdateTask(void* param) {
     HWND hWnd = (HWND)param;
     int count = UpdateAllSubscriptions(TRUE, FALSE); 
     if (IsWindow(hWnd)) PostMessage(hWnd, WM_UPDATE_FINISH, (WPARAM)count, 0);
-    return 0;
 }
 
 DWORD WINAPI AutoUpdateThread(LPVOID lpParam) {
@@ -43,6 +46,8 @@ DWORD WINAPI AutoUpdateThread(LPVOID lpParam) {
                 PostMessage(hMgr, WM_REFRESH_NODELIST, 0, 0);
             }
         }
+        // [New] 2026-10-16: 顺带更新到期的外部规则集 (routing.providers)
+        RuleProvider_Refresh(FALSE);
         Sleep(60000); 
     }
     return 0;
@@ -373,7 +378,9 @@ BOOL HandleSubCommand(HWND hWnd, int id, int code) {
         SaveSettings(); 
         SetWindowTextW(hSubBtnUpd, L"更新中...");
         EnableWindow(hSubBtnUpd, FALSE);
-        CreateThread(NULL, 0, ManualUpdateThread, (LPVOID)hWnd, 0, NULL);
+        if (!ThreadPool_SubmitBackground(ManualUpdateTask, (void*)hWnd, NULL, NULL)) {
+            PostMessage(hWnd, WM_UPDATE_FINISH, 0, 0); // 提交失败，恢复按钮状态
+        }
         return TRUE;
     }
     return FALSE;
@@ -3,10 +3,12 @@
 #include "gui_utils.h"
 #include "config.h"
 #include "proxy.h"
+#include "utils.h"
 #include "common.h"
 #include "resource.h"
 #include <stdio.h>
 #include <commctrl.h>
+#include <process.h>
 
 // 定义控件 ID
 #define ID_COMBO_BROWSER 3001
@@ -18,7 +20,17 @@
 
 static HWND hSettingsWnd = NULL;
 
-DWORD WINAPI SettingsApplyThread(LPVOID lpParam) {
+// [Mod] 2026-10-16: 设置保存与核心重启移出 GUI 线程
+// [Fix] 2026-10-17: 改用独立线程，不在后台 I/O 队列中排在批量测速之后；
+// 参数为上一次应用线程的句柄 (可为 NULL)，等待其结束后再执行，连续保存时按顺序重启核心
+static HANDLE hApplyThread = NULL;
+
+static unsigned __stdcall SettingsApplyThread(void* arg) {
+    HANDLE hPrev = (HANDLE)arg;
+    if (hPrev) {
+        WaitForSingleObject(hPrev, INFINITE);
+        CloseHandle(hPrev);
+    }
     SaveSettings();
     if (g_proxyRunning) {
         StopProxyCore();
@@ -297,7 +309,14 @@ LRESULT CALLBACK SettingsWndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lPar
                 }
                 LeaveCriticalSection(&g_configLock);
 
-                CreateThread(NULL, 0, SettingsApplyThread, NULL, 0, NULL);
+                {
+                    HANDLE hPrev = hApplyThread;
+                    hApplyThread = (HANDLE)_beginthreadex(NULL, 0, SettingsApplyThread, (void*)hPrev, 0, NULL);
+                    if (!hApplyThread) {
+                        hApplyThread = hPrev;
+                        SaveSettings(); // 线程创建失败时至少保证配置落盘
+                    }
+                }
                 DestroyWindow(hWnd);
             } else if (LOWORD(wParam) == IDCANCEL) DestroyWindow(hWnd);
             break;
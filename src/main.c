@@ -2,6 +2,7 @@
 // [Refactor] 2026-01-29: 紧急修复 - 恢复 GetRealTagFromDisplay 调用
 // [Fix] 修复因移除 GetRealTagFromDisplay 导致的节点切换失效问题
 // [Fix] 保持字符串操作的安全性 (wcscpy_s)
+// [Mod] 2026-10-16: 退出时停止工作线程池
 
 #include "gui.h"
 #include "gui_utils.h" // 包含 GetRealTagFromDisplay
@@ -557,10 +558,15 @@ int WINAPI wWinMain(HINSTANCE hInst, HINSTANCE hPrev, LPWSTR lpCmdLine, int nSho
     if (!SafeWaitAndCloseThread(&hConfigMonitorThread, 2000)) bSafe = FALSE;
     if (!SafeWaitAndCloseThread(&hAutoUpdateThread, 5000)) bSafe = FALSE;
     
+    // [New] 停止工作线程池 (测速 / DNS / ECH 任务)，排队中的任务只做清理
+    ThreadPool_Shutdown();
+    
     if (g_hExitEvent) CloseHandle(g_hExitEvent);
     
     if (bSafe) { 
+        Dns_Cleanup(); 
         CleanupUtilsNet(); 
+        Cancel_Cleanup(); 
         cleanup_crypto_global(); 
         CleanupMemoryPool(); 
         DeleteGlobalLocks(); 
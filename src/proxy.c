@@ -3,6 +3,7 @@
 #include <windows.h>
 #include <process.h>
 #include "proxy.h"
+#include "proxy_internal.h" // [New] Reactor_Shutdown / Rio_Shutdown
 #include "driver_singbox.h" // 引入驱动层接口
 #include "config.h"         // 引入全局配置与节点定义
 #include "utils.h"
@@ -93,6 +94,7 @@ void StartProxyCore() {
     if (g_proxyRunning) return;
     
     LOG_INFO("[Proxy] Starting proxy service (Driver Mode)...");
+    Cancel_Reset(); // [New] 清除上次停止留下的通知
     g_proxyRunning = TRUE;
     
     // 设置虚拟连接数，让 GUI 显示“运行中”状态
@@ -105,6 +107,7 @@ void StartProxyCore() {
     if (!hProxyThread) {
         LOG_ERROR("[Proxy] Failed to create monitor thread!");
         g_proxyRunning = FALSE;
+        Cancel_Signal();
         InterlockedExchange(&g_active_connections, 0);
     }
 }
@@ -114,6 +117,7 @@ void StopProxyCore() {
 
     LOG_INFO("[Proxy] Stopping proxy service...");
     g_proxyRunning = FALSE; // 通知线程退出
+    Cancel_Signal();        // [New] 唤醒所有阻塞在 Cancel_Wait 中的等待
     
     // 等待监控线程结束
     if (hProxyThread) {
@@ -124,6 +128,10 @@ void StopProxyCore() {
     
     // 再次确保核心被终止 (双重保险)
     singbox_stop();
+
+    // [New] 停止共享事件循环 (未启动时为空操作)，仍在转发的会话会收到错误事件并自行清理
+    Reactor_Shutdown();
+    Rio_Shutdown();
     
     InterlockedExchange(&g_active_connections, 0);
     LOG_INFO("[Proxy] Service stopped.");
@@ -144,11 +152,4 @@ void CloseAllActiveSockets() { /* No-op */ }
 // [Fix] ReloadRoutingRules 已在 config_nodes.c 中定义，此处移除
 // void ReloadRoutingRules(void) { } 
 
-// ThreadPool Stub
-void ThreadPool_Init(int max_workers) { /* No-op */ }
-BOOL ThreadPool_Submit(void (*func)(void*), void* arg, void (*cleanup)(void*)) { 
-    // 直接执行清理，避免内存泄漏
-    if (cleanup && arg) cleanup(arg);
-    return FALSE; 
-}
-void ThreadPool_Shutdown() { /* No-op */ }
+// [Mod] 2026-10-16: ThreadPool_* 已迁移至 utils_threadpool.c (工作窃取线程池)
@@ -0,0 +1,999 @@
+/* src/proxy_fsm.c */
+// [New] 2026-10-16: 事件驱动的会话握手状态机，替代 step_* 阻塞调用链
+// 设计要点:
+// 1. 会话从接入到进入转发阶段的每一步都是显式状态，遇到 I/O 未就绪即返回，由 Reactor 事件恢复执行
+// 2. 报文构造/解析复用 proxy_step_*.c 中拆分出的纯函数
+// 3. 唯一的阻塞操作 (getaddrinfo 及 ECH 配置预取) 提交到共享线程池 (utils_threadpool.c)，结果通过 Reactor_Post 投递回会话所属循环
+//    [Mod] 2026-10-16: 解析改经共享解析器 (utils_dns.c)；地址已在缓存中且无需预取 ECH 时直接在循环上继续，不经过线程池
+// 4. 每个阶段的超时由客户端句柄上的定时器实现，不再逐会话轮询；少量线程即可同时推进数千个握手
+// 5. 握手完成后原地交给 Relay_Start，会话内存直到转发结束才释放
+// [New] 2026-10-16: H2 隧道改用共享连接池 (proxy_h2_pool.c)：同节点已有可用连接时直接开流，跳过解析 / 连接 / TLS；
+// 新连接完成 TLS 后交给连接池管理，响应头由连接句柄读取后通知状态机
+// [New] 2026-10-16: HTTP/1.1 (WS) 隧道支持多路复用 (proxy_mux.c)：同节点已有隧道时直接开流进入转发，
+// 否则照常建立隧道，WS 升级完成后交给隧道池并在其上开第一个流
+// [New] 2026-10-16: 新建连接前先从预建连接池 (proxy_warm.c) 取已完成 TLS 的连接，直接从 ALPN 分支继续；
+// 预建连接在 WS 升级 / H2 开流时被发现已失效时改为新建连接
+// [New] 2026-10-16: 恢复的 TLS 会话允许 0-RTT 时，WS 升级请求作为 early data 随 ClientHello 发出，
+// 服务端拒绝时在握手后照常发送
+// [New] 2026-10-16: 上游连接按 Happy Eyeballs (RFC 8305) 竞速：候选地址两族交替，每隔 DIAL_ATTEMPT_DELAY_MS
+// 或上一个尝试失败时发起下一个，第一个连通者胜出，其余立即关闭；排序与胜出地址族记录与 TcpPing 等同步调用者共用 utils_dial.c
+// [Fix] 2026-10-16: 握手阶段的写入 (SOCKS5 应答、WS 升级、代理协议头、浏览器应答) 改为非阻塞：
+// 写不完的部分按连接排队并关注可写，全部发出后才交给转发阶段；写入失败即结束会话。SOCKS5 问候与请求收全后才解析
+// [Fix] 2026-10-17: 阻塞的 step_* 握手链已移除，本状态机是唯一的握手路径 (H2 连接池、多路复用、预建连接、0-RTT、
+// 连接竞速均只在此实现)。入口 Session_StartAsync 目前没有调用者：proxy.c 运行于 Sing-box 外壳模式，
+// 恢复本地监听时应把接入的 Socket 交给 Session_StartAsync
+
+#include "proxy_internal.h"
+#include "utils.h"
+#include "config.h"
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <stdio.h>
+
+// 各阶段超时 (毫秒)，沿用原阻塞路径的取值
+#define FSM_BROWSER_TIMEOUT_MS   10000
+#define FSM_RESOLVE_TIMEOUT_MS   10000
+#define FSM_CONNECT_TIMEOUT_MS   5000
+#define FSM_TLS_TIMEOUT_MS       10000
+#define FSM_WS_UPGRADE_TIMEOUT   10000
+#define FSM_H2_STATUS_WAIT_MS    500
+#define FSM_SOCKS5_OUT_TIMEOUT   8000
+#define FSM_FLUSH_TIMEOUT_MS     10000
+#define FSM_RETRY_DELAY_MS       200
+#define FSM_CONNECT_RETRIES      3
+#define FSM_OUT_MAX              (256 * 1024) // 单个方向排队数据上限
+
+typedef enum {
+    FSM_BROWSER_HEADER = 0, // 读取浏览器首包 (SOCKS5 问候或 HTTP 头)
+    FSM_SOCKS5_REQUEST,     // 已回复 05 00，等待 SOCKS5 请求
+    FSM_RESOLVE,            // 后台线程解析上游地址
+    FSM_CONNECT,            // 非阻塞 connect 进行中
+    FSM_RETRY_WAIT,         // 全部地址失败，等待下一轮重试
+    FSM_TLS,                // TLS 握手
+    FSM_WS_UPGRADE,         // 等待 HTTP/1.1 101 响应
+    FSM_H2_STATUS,          // 等待 H2 响应头
+    FSM_SOCKS5_OUT,         // SOCKS5 出站子握手
+    FSM_FLUSH,              // [New] 握手已完成，等待排队的应答 / 负载发完后进入转发
+    FSM_RELAY,              // 已交给转发阶段
+    FSM_FAILED              // 已失败，等待后台任务归还引用
+} FsmState;
+
+// [New] 一个在途的连接尝试 (句柄定时器先作发起下一个候选的间隔，之后作本尝试的连接超时)
+typedef struct {
+    struct SessionFsm* f;
+    SOCKET sock;
+    ReactorHandle* h;
+    int family;
+    BOOL staggered;         // 已发起过下一个候选
+} FsmAttempt;
+
+// [New] 握手阶段一个方向上未写完的数据
+typedef struct {
+    char* buf;
+    int len, off, cap;
+    BOOL blocked;           // 等待 Socket 可写 (含 TLS 引擎中未发出的密文)
+} FsmOut;
+
+typedef struct SessionFsm {
+    ProxySession s;         // 必须为首成员：转发回调只持有 ProxySession*
+    FsmState state;
+    int loop;
+    ReactorHandle* hc;      // 客户端句柄 (兼作阶段定时器)
+    ReactorHandle* hr;      // 上游句柄
+    volatile LONG refs;     // 循环线程 1 个 + 每个在途后台任务 1 个
+
+    struct addrinfo* addrs;
+    const struct addrinfo* cands[DIAL_MAX_CANDIDATES]; // [New] 本轮按地址族交替排好的候选
+    FsmAttempt att[DIAL_MAX_CANDIDATES];               // 与 cands 一一对应
+    int cand_count;
+    int cand_next;          // 下一个要发起的候选
+    int att_active;         // 在途的连接尝试数
+    char dial_key[300];     // 地址族记录的键 ("host:port")
+    int retry;
+
+    int rx_len;             // 握手阶段 ws_read_buf 中的已读字节
+    int socks_step;         // SOCKS5 出站: 0=问候, 1=认证, 2=CONNECT
+    BOOL h2_reused;         // [New] 流开在连接池已有的连接上 (连接失效时改为新建连接，而不是降级)
+    BOOL mux;               // [New] 本会话走多路复用隧道
+    BOOL warm;              // [New] 上游连接取自预建连接池，尚未确认可用
+    BOOL early_upgrade;     // [New] WS 升级请求已作为 0-RTT 数据排队
+    FsmOut out_c;           // [New] 发往浏览器的排队数据
+    FsmOut out_r;           // [New] 发往上游的排队数据 (直连为明文，否则为 TLS 明文)
+    RelayMode relay_mode;   // [New] FSM_FLUSH 结束后使用的转发模式
+} SessionFsm;
+
+typedef struct {
+    SessionFsm* f;
+    int loop;
+    char host[256];
+    int port;
+    char ech_domain[256];   // 非空时顺带预取 ECH 配置 (写入 utils_net.c 缓存)
+    struct addrinfo* res;
+    int rc;
+    BOOL ran;               // 任务是否已执行 (被线程池拒绝或丢弃时为 FALSE)
+} FsmResolveJob;
+
+static volatile LONG s_fsmActive = 0;
+
+static void fsm_advance_upstream(SessionFsm* f);
+static void fsm_try_connect(SessionFsm* f);
+static void fsm_on_remote(ReactorHandle* h, int events, void* arg);
+static void fsm_on_h2_stream(ProxySession* s);
+static void fsm_start_relay(SessionFsm* f);
+
+// --- 生命周期 ---
+
+static void fsm_release(SessionFsm* f) {
+    if (InterlockedDecrement(&f->refs) == 0) {
+        if (f->addrs) Dns_FreeAddrs(f->addrs);
+        free(f->out_c.buf);
+        free(f->out_r.buf);
+        free(f);
+    }
+}
+
+static void fsm_drop_attempt(SessionFsm* f, FsmAttempt* a) {
+    if (a->h) { Reactor_Remove(a->h); a->h = NULL; }
+    if (a->sock != INVALID_SOCKET) { closesocket(a->sock); a->sock = INVALID_SOCKET; f->att_active--; }
+}
+
+// 关闭所有在途的连接尝试 (竞速已有胜者或会话结束)
+static void fsm_cancel_attempts(SessionFsm* f) {
+    for (int i = 0; i < f->cand_next; i++) fsm_drop_attempt(f, &f->att[i]);
+    f->att_active = 0;
+}
+
+static void fsm_remove_handles(SessionFsm* f) {
+    fsm_cancel_attempts(f);
+    if (f->hr) { Reactor_Remove(f->hr); f->hr = NULL; }
+    if (f->hc) { Reactor_Remove(f->hc); f->hc = NULL; }
+}
+
+static void fsm_fail(SessionFsm* f) {
+    if (f->state == FSM_FAILED || f->state == FSM_RELAY) return;
+    f->state = FSM_FAILED;
+    fsm_remove_handles(f);
+    session_free(&f->s);
+    InterlockedDecrement(&s_fsmActive);
+    fsm_release(f);
+}
+
+static void fsm_on_relay_done(ProxySession* s, void* arg) {
+    SessionFsm* f = (SessionFsm*)arg;
+    session_free(s);
+    fsm_release(f);
+}
+
+// 关闭当前上游连接 (失败重试或 H2 降级前调用)
+static void fsm_close_remote(SessionFsm* f) {
+    ProxySession* s = &f->s;
+    if (f->hr) { Reactor_Remove(f->hr); f->hr = NULL; }
+    if (s->h2_stream) H2Pool_Detach(s); // 共享连接只关闭自己的流
+    if (s->mux_stream) MuxPool_Detach(s);
+    else if (s->h2_sess) { nghttp2_session_del(s->h2_sess); s->h2_sess = NULL; }
+    tls_close(&s->tls);
+    if (s->remoteSock != INVALID_SOCKET) { closesocket(s->remoteSock); s->remoteSock = INVALID_SOCKET; }
+    f->out_r.len = f->out_r.off = 0;
+    f->out_r.blocked = FALSE;
+}
+
+static void fsm_set_stage(SessionFsm* f, FsmState state, int timeout_ms) {
+    f->state = state;
+    Reactor_SetTimer(f->hc, timeout_ms);
+}
+
+// --- 握手阶段输出 ---
+
+static int fsm_out_append(FsmOut* q, const char* data, int len) {
+    if (q->len + len > q->cap) {
+        if (q->off > 0) {
+            memmove(q->buf, q->buf + q->off, q->len - q->off);
+            q->len -= q->off;
+            q->off = 0;
+        }
+        if (q->len + len > q->cap) {
+            int cap = q->cap ? q->cap : 4096;
+            while (cap < q->len + len) cap *= 2;
+            if (cap > FSM_OUT_MAX) return -1;
+            char* nb = (char*)realloc(q->buf, cap);
+            if (!nb) return -1;
+            q->buf = nb;
+            q->cap = cap;
+        }
+    }
+    memcpy(q->buf + q->len, data, len);
+    q->len += len;
+    return 0;
+}
+
+// 按当前阶段与排队情况设置一侧句柄的关注事件
+static void fsm_watch_output(SessionFsm* f, BOOL remote) {
+    if (remote) {
+        if (!f->hr) return;
+        int ev = (f->state == FSM_FLUSH) ? 0 : REACTOR_EV_READ;
+        Reactor_SetEvents(f->hr, ev | (f->out_r.blocked ? REACTOR_EV_WRITE : 0));
+    } else {
+        if (!f->hc) return;
+        int ev = (f->state == FSM_BROWSER_HEADER || f->state == FSM_SOCKS5_REQUEST) ? REACTOR_EV_READ : 0;
+        Reactor_SetEvents(f->hc, ev | (f->out_c.blocked ? REACTOR_EV_WRITE : 0));
+    }
+}
+
+// 尽量写出一侧的排队数据 (上游非直连时经 TLS)。返回: 0=已全部发出, 1=等待可写, -1=错误
+static int fsm_out_pump(SessionFsm* f, BOOL remote) {
+    ProxySession* s = &f->s;
+    FsmOut* q = remote ? &f->out_r : &f->out_c;
+    BOOL tls = remote && _stricmp(s->config.type, "direct") != 0;
+    int r = 0;
+
+    while (q->off < q->len) {
+        int n;
+        if (tls) {
+            n = tls_write_nb(&s->tls, q->buf + q->off, q->len - q->off);
+        } else {
+            n = send(remote ? s->remoteSock : s->clientSock, q->buf + q->off, q->len - q->off, 0);
+            if (n == SOCKET_ERROR) n = (WSAGetLastError() == WSAEWOULDBLOCK) ? 0 : -1;
+        }
+        if (n < 0) return -1;
+        if (n == 0) { r = 1; break; }
+        q->off += n;
+    }
+    if (q->off == q->len) q->off = q->len = 0;
+    if (r == 0 && tls) r = tls_flush_nb(&s->tls);
+    if (r < 0) return -1;
+
+    q->blocked = (r == 1);
+    fsm_watch_output(f, remote);
+    return r;
+}
+
+// 排队并立即尝试写出，写不完的部分等待可写事件。返回: 0=已写出或排队, -1=错误
+static int fsm_write(SessionFsm* f, BOOL remote, const char* data, int len) {
+    if (len <= 0) return 0;
+    if (fsm_out_append(remote ? &f->out_r : &f->out_c, data, len) != 0) return -1;
+    return (fsm_out_pump(f, remote) < 0) ? -1 : 0;
+}
+
+// 上行负载：直连原样写出，WS 隧道封装为帧，H2 / 多路复用交给各自的连接池排队
+static int fsm_send_tunnel(SessionFsm* f, const char* data, int len) {
+    ProxySession* s = &f->s;
+    if (len <= 0) return 0;
+    if (_stricmp(s->config.type, "direct") == 0) return fsm_write(f, TRUE, data, len);
+    if (s->mux_stream || s->alpn_is_h2) return tunnel_send_payload(s, data, len);
+    int flen = build_ws_frame(data, len, s->ws_send_buf);
+    return fsm_write(f, TRUE, s->ws_send_buf, flen);
+}
+
+// --- 转发交接 ---
+
+// 转发前的浏览器应答与首包负载 (不阻塞循环)
+static int fsm_respond_to_browser(SessionFsm* f) {
+    ProxySession* s = &f->s;
+    if (!g_proxyRunning) return -1;
+
+    if (s->is_socks5) {
+        static const char s5_ok[10] = {0x05, 0x00, 0x00, 0x01, 0,0,0,0, 0,0};
+        return fsm_write(f, FALSE, s5_ok, sizeof(s5_ok));
+    }
+
+    const char* data = s->c_buf;
+    int len = s->browser_header_len;
+    if (s->is_connect_method) {
+        const char* ok = "HTTP/1.1 200 Connection Established\r\n\r\n";
+        if (fsm_write(f, FALSE, ok, (int)strlen(ok)) != 0) return -1;
+        data += s->header_len;
+        len -= s->header_len;
+    }
+    return fsm_send_tunnel(f, data, len);
+}
+
+// 转发阶段不接手握手阶段的排队数据：先等其发完 (FSM_FLUSH)，再交给 Relay_Start
+static void fsm_relay_when_flushed(SessionFsm* f) {
+    if (f->out_c.blocked || f->out_r.blocked) {
+        fsm_set_stage(f, FSM_FLUSH, FSM_FLUSH_TIMEOUT_MS);
+        fsm_watch_output(f, FALSE);
+        fsm_watch_output(f, TRUE);
+        return;
+    }
+    fsm_start_relay(f);
+}
+
+static void fsm_enter_relay(SessionFsm* f) {
+    ProxySession* s = &f->s;
+    if (fsm_respond_to_browser(f) != 0) { fsm_fail(f); return; }
+
+    if (_stricmp(s->config.type, "direct") == 0) f->relay_mode = RELAY_MODE_TCP_DIRECT;
+    else if (s->mux_stream) f->relay_mode = RELAY_MODE_MUX;
+    else if (s->alpn_is_h2) f->relay_mode = RELAY_MODE_H2;
+    else f->relay_mode = RELAY_MODE_TLS;
+
+    fsm_relay_when_flushed(f);
+}
+
+static void fsm_start_relay(SessionFsm* f) {
+    ProxySession* s = &f->s;
+
+    // 转发阶段在自己的句柄上注册，这里先撤销握手阶段的句柄
+    fsm_remove_handles(f);
+    f->state = FSM_RELAY;
+    InterlockedDecrement(&s_fsmActive);
+
+    if (Relay_Start(s, f->relay_mode, fsm_on_relay_done, f) != 0) {
+        session_free(s);
+        fsm_release(f);
+    }
+}
+
+// UDP ASSOCIATE 已在解析时应答，直接进入转发
+static void fsm_enter_udp_relay(SessionFsm* f) {
+    log_msg("[Conn-%d] Entering UDP Direct Relay", f->s.clientSock);
+    f->relay_mode = RELAY_MODE_UDP;
+    fsm_relay_when_flushed(f);
+}
+
+// --- 上游读取辅助 ---
+
+// 把 TLS 中当前可读的明文追加到 ws_read_buf。返回: >=0 本次读入字节数, -1=EOF 或错误
+static int fsm_tls_fill(SessionFsm* f) {
+    ProxySession* s = &f->s;
+    int total = 0;
+    while (f->rx_len < s->ws_read_buf_cap - 1) {
+        int n = tls_read(&s->tls, s->ws_read_buf + f->rx_len, s->ws_read_buf_cap - 1 - f->rx_len);
+        if (n < 0) return -1;
+        if (n == 0) break;
+        f->rx_len += n;
+        total += n;
+    }
+    s->ws_read_buf[f->rx_len] = 0;
+    // 缓冲已满但 SSL 内仍有数据时，下一轮再取
+    if (tls_pending(&s->tls) > 0 && f->hr) Reactor_Rearm(f->hr);
+    return total;
+}
+
+// 从 ws_read_buf 中取出下一个数据帧 (跳过 Ping/Pong)
+// 返回: >=0 payload 长度 (已拷贝到 out), -2=数据不足, -1=错误或 Close
+static int fsm_take_ws_frame(SessionFsm* f, char* out, int max) {
+    ProxySession* s = &f->s;
+    while (TRUE) {
+        int hl = 0, pl = 0;
+        long long total = check_ws_frame((unsigned char*)s->ws_read_buf, f->rx_len, &hl, &pl);
+        if (total == 0) return -2;
+        if (total < 0) return -1;
+
+        unsigned char opcode = (unsigned char)s->ws_read_buf[0] & 0x0F;
+        BOOL masked = ((unsigned char)s->ws_read_buf[1] & 0x80) != 0;
+        int ret = -2;
+
+        if (opcode == 0x8) return -1; // Close
+        if (opcode < 0x8) {
+            if (pl > max) return -1;
+            if (masked) {
+                const unsigned char* mk = (const unsigned char*)s->ws_read_buf + hl - 4;
+                ws_mask_copy((unsigned char*)out, (const unsigned char*)s->ws_read_buf + hl, (size_t)pl, mk, 0);
+            } else {
+                memcpy(out, s->ws_read_buf + hl, pl);
+            }
+            ret = pl;
+        }
+
+        f->rx_len -= (int)total;
+        if (f->rx_len > 0) memmove(s->ws_read_buf, s->ws_read_buf + total, f->rx_len);
+        if (ret >= 0) return ret;
+    }
+}
+
+static int fsm_send_ws(SessionFsm* f, const unsigned char* data, int len) {
+    if (len <= 0) return -1;
+    int flen = build_ws_frame((const char*)data, len, f->s.ws_send_buf);
+    return fsm_write(f, TRUE, f->s.ws_send_buf, flen);
+}
+
+// --- 隧道握手 (Step 3/4) ---
+
+static void fsm_send_proxy_request(SessionFsm* f) {
+    ProxySession* s = &f->s;
+    if (_stricmp(s->config.type, "direct") == 0) { fsm_enter_relay(f); return; }
+
+    log_msg("[Conn-%d] Sending proxy protocol header (%s)...", s->clientSock, s->config.type);
+
+    unsigned char proto_buf[2048];
+    int proto_len = tunnel_build_proxy_header(s, proto_buf);
+    if (proto_len < 0) { fsm_fail(f); return; }
+    if (proto_len > 0) {
+        if (fsm_send_tunnel(f, (char*)proto_buf, proto_len) != 0) { fsm_fail(f); return; }
+        fsm_enter_relay(f);
+        return;
+    }
+
+    // SOCKS5 出站：逐轮交互，响应在 fsm_on_socks5_out 中处理
+    unsigned char req[512];
+    if (fsm_send_ws(f, req, tunnel_socks5_build_greeting(s, req)) != 0) { fsm_fail(f); return; }
+    f->socks_step = 0;
+    f->rx_len = s->ws_buf_len; // 101 响应之后可能已附带数据帧
+    s->ws_buf_len = 0;
+    fsm_set_stage(f, FSM_SOCKS5_OUT, FSM_SOCKS5_OUT_TIMEOUT);
+    fsm_watch_output(f, TRUE);
+    if (f->rx_len > 0) Reactor_Rearm(f->hr);
+}
+
+static void fsm_on_socks5_out(SessionFsm* f) {
+    ProxySession* s = &f->s;
+    if (fsm_tls_fill(f) < 0) { fsm_fail(f); return; }
+
+    char resp[512];
+    unsigned char req[512];
+    int rn;
+    while ((rn = fsm_take_ws_frame(f, resp, sizeof(resp))) != -2) {
+        if (rn < 0) { fsm_fail(f); return; }
+
+        if (f->socks_step == 0) {
+            if (rn < 2) { fsm_fail(f); return; }
+            if (resp[1] == 0x02) {
+                if (fsm_send_ws(f, req, tunnel_socks5_build_auth(s, req)) != 0) { fsm_fail(f); return; }
+                f->socks_step = 1;
+                continue;
+            }
+        } else if (f->socks_step == 1) {
+            if (rn < 2 || resp[1] != 0x00) { fsm_fail(f); return; }
+        } else {
+            if (rn < 4 || resp[1] != 0x00) { fsm_fail(f); return; }
+            // 剩余字节留给转发阶段解析
+            s->ws_buf_len = f->rx_len;
+            fsm_enter_relay(f);
+            return;
+        }
+
+        int req_len = tunnel_socks5_build_connect(s, req);
+        if (req_len < 0 || fsm_send_ws(f, req, req_len) != 0) { fsm_fail(f); return; }
+        f->socks_step = 2;
+    }
+}
+
+// H2 失败时降级为 HTTP/1.1 重新连接 (仅一次)
+static void fsm_h2_fallback(SessionFsm* f) {
+    ProxySession* s = &f->s;
+    if (s->fallback_state != 0) { fsm_fail(f); return; }
+
+    log_msg("[Conn-%d] [Fallback] H2 failed. Downgrading to HTTP/1.1...", s->clientSock);
+    fsm_close_remote(f);
+    s->fallback_state = 1;
+    s->alpn_is_h2 = 0;
+    s->h2_handshake_done = 0;
+    fsm_advance_upstream(f);
+}
+
+// [New] 预建连接在首次使用时才发现已被对端关闭：改为新建连接 (不计入重试与降级)
+static BOOL fsm_warm_retry(SessionFsm* f) {
+    ProxySession* s = &f->s;
+    if (!f->warm) return FALSE;
+    log_msg("[Conn-%d] [Warm] Pre-connected upstream is stale, reconnecting...", s->clientSock);
+    f->warm = FALSE;
+    fsm_close_remote(f);
+    s->alpn_is_h2 = 0;
+    s->h2_handshake_done = 0;
+    s->is_ws_transport = 0;
+    fsm_advance_upstream(f);
+    return TRUE;
+}
+
+// [Mod] 2026-10-16: 响应头由共享连接读取，流状态变化时回调 (s 为 SessionFsm 首成员)
+static void fsm_on_h2_stream(ProxySession* s) {
+    SessionFsm* f = (SessionFsm*)s;
+    if (f->state != FSM_H2_STATUS) return;
+
+    if (s->h2_status_code > 0) {
+        if (s->h2_status_code >= 400) { fsm_h2_fallback(f); return; }
+        s->h2_handshake_done = 1;
+        fsm_send_proxy_request(f);
+    } else if (s->h2_handshake_done == -1) {
+        if (f->h2_reused) {
+            // 复用的连接在响应前失效 (如服务端已关闭空闲连接)：重新建立连接
+            f->h2_reused = FALSE;
+            fsm_close_remote(f);
+            s->alpn_is_h2 = 0;
+            s->h2_handshake_done = 0;
+            fsm_advance_upstream(f);
+            return;
+        }
+        fsm_h2_fallback(f); // 流被重置或连接失败
+    }
+}
+
+// 最多等待 500ms 响应头，超时视为成功
+static void fsm_wait_h2_status(SessionFsm* f) {
+    fsm_set_stage(f, FSM_H2_STATUS, FSM_H2_STATUS_WAIT_MS);
+}
+
+// [New] 隧道已就绪：交给多路复用隧道池，流请求代替逐连接的代理协议头
+static void fsm_start_mux(SessionFsm* f) {
+    ProxySession* s = &f->s;
+    Reactor_Remove(f->hr); f->hr = NULL;
+    if (MuxPool_Adopt(s, f->loop) != 0) { fsm_fail(f); return; }
+    fsm_enter_relay(f);
+}
+
+static void fsm_on_ws_upgrade(SessionFsm* f) {
+    ProxySession* s = &f->s;
+    if (fsm_tls_fill(f) < 0) {
+        if (f->rx_len == 0 && fsm_warm_retry(f)) return;
+        fsm_fail(f);
+        return;
+    }
+
+    BOOL full = (f->rx_len >= s->ws_read_buf_cap - 1);
+    if (!strstr(s->ws_read_buf, "\r\n\r\n") && !full) return; // 响应头未收全
+
+    int hlen = f->rx_len;
+    f->rx_len = 0;
+    if (tunnel_check_ws_upgrade(s, hlen) != 0) { fsm_fail(f); return; }
+    f->warm = FALSE;
+    if (f->mux) { fsm_start_mux(f); return; }
+    fsm_send_proxy_request(f);
+}
+
+static void fsm_start_tunnel(SessionFsm* f) {
+    ProxySession* s = &f->s;
+    log_msg("[Conn-%d] TLS Success. Selected Protocol: %s", s->clientSock, tls_get_alpn_selected(&s->tls));
+    Reactor_SetEvents(f->hr, REACTOR_EV_READ);
+
+    const char* alpn = tls_get_alpn_selected(&s->tls);
+    if (alpn && strcmp(alpn, "h2") == 0) {
+        s->alpn_is_h2 = 1;
+        // 上游连接交给连接池，此后由连接句柄负责读写
+        Reactor_Remove(f->hr); f->hr = NULL;
+        if (H2Pool_Adopt(s, f->loop, fsm_on_h2_stream) != 0) {
+            if (!fsm_warm_retry(f)) fsm_h2_fallback(f);
+            return;
+        }
+        // 预建连接与复用连接相同：开流失败时重新建立连接而不是降级
+        f->h2_reused = f->warm;
+        f->warm = FALSE;
+        fsm_wait_h2_status(f);
+        return;
+    }
+
+    s->alpn_is_h2 = 0;
+    if (f->early_upgrade && tls_early_data_accepted(&s->tls)) {
+        log_msg("[Conn-%d] WebSocket Handshake sent as 0-RTT early data.", s->clientSock);
+    } else {
+        log_msg("[Conn-%d] Starting HTTP/1.1 WebSocket Handshake...", s->clientSock);
+        int offset = tunnel_build_ws_upgrade(s);
+        if (offset <= 0 || fsm_write(f, TRUE, s->ws_send_buf, offset) != 0) {
+            if (offset > 0 && fsm_warm_retry(f)) return;
+            fsm_fail(f);
+            return;
+        }
+    }
+    f->early_upgrade = FALSE;
+
+    f->rx_len = 0;
+    fsm_set_stage(f, FSM_WS_UPGRADE, FSM_WS_UPGRADE_TIMEOUT);
+    if (tls_pending(&s->tls) > 0) Reactor_Rearm(f->hr);
+}
+
+// --- 上游连接 (Step 2) ---
+
+// [Mod] 2026-10-16: 胜出连接的 TLS 失败时，继续竞速本轮尚未发起的候选
+static void fsm_next_address(SessionFsm* f) {
+    fsm_close_remote(f);
+    fsm_try_connect(f);
+}
+
+static void fsm_tls_step(SessionFsm* f) {
+    int r = tls_connect_step(&f->s.tls);
+    if (r == TLS_STEP_DONE) { fsm_start_tunnel(f); return; }
+    if (r < 0) {
+        log_msg("[Conn-%d] TLS Handshake Failed.", f->s.clientSock);
+        fsm_next_address(f);
+        return;
+    }
+    Reactor_SetEvents(f->hr, (r == TLS_STEP_WANT_WRITE) ? REACTOR_EV_WRITE : REACTOR_EV_READ);
+}
+
+static void fsm_on_connected(SessionFsm* f) {
+    ProxySession* s = &f->s;
+    if (_stricmp(s->config.type, "direct") == 0) {
+        log_msg("[Conn-%d] [Direct] TCP Connected.", s->clientSock);
+        fsm_enter_relay(f);
+        return;
+    }
+    if (outbound_tls_begin(s) != 0) {
+        log_msg("[Conn-%d] TLS Handshake Failed.", s->clientSock);
+        fsm_next_address(f);
+        return;
+    }
+    // [New] 0-RTT：会话恢复命中且 ALPN 为 HTTP/1.1 时，WS 升级请求 (幂等的 GET) 随 ClientHello 发出
+    f->early_upgrade = FALSE;
+    if (g_enableEarlyData) {
+        int offset = tunnel_build_ws_upgrade(s);
+        if (offset > 0 && tls_set_early_data(&s->tls, "http/1.1", s->ws_send_buf, offset) == 1) f->early_upgrade = TRUE;
+    }
+    fsm_set_stage(f, FSM_TLS, FSM_TLS_TIMEOUT_MS);
+    fsm_tls_step(f);
+}
+
+// 新一轮竞速：按上次胜出的地址族重新排序候选
+static void fsm_begin_round(SessionFsm* f) {
+    fsm_cancel_attempts(f);
+    f->cand_count = Dial_SortAddrs(f->addrs, f->dial_key, f->cands, DIAL_MAX_CANDIDATES);
+    f->cand_next = 0;
+    fsm_try_connect(f);
+}
+
+static void fsm_attempt_won(SessionFsm* f, FsmAttempt* a) {
+    ProxySession* s = &f->s;
+    s->remoteSock = a->sock;
+    a->sock = INVALID_SOCKET;
+    f->att_active--;
+    fsm_cancel_attempts(f); // 连同本尝试的句柄一起撤销，败者立即关闭
+    Dial_RecordWinner(f->dial_key, a->family);
+
+    f->hr = Reactor_Add(f->loop, s->remoteSock, REACTOR_EV_WRITE, fsm_on_remote, f);
+    if (!f->hr) { fsm_fail(f); return; }
+    fsm_on_connected(f);
+}
+
+static void fsm_on_attempt(ReactorHandle* h, int events, void* arg) {
+    FsmAttempt* a = (FsmAttempt*)arg;
+    SessionFsm* f = a->f;
+    if (f->state != FSM_CONNECT || a->sock == INVALID_SOCKET) return;
+
+    if (events & REACTOR_EV_TIMER) {
+        if (!a->staggered) {
+            // 间隔到点仍未连通：发起下一个候选，本尝试继续等待到自身超时
+            a->staggered = TRUE;
+            Reactor_SetTimer(a->h, FSM_CONNECT_TIMEOUT_MS - DIAL_ATTEMPT_DELAY_MS);
+            fsm_try_connect(f);
+            return;
+        }
+        fsm_drop_attempt(f, a);
+        fsm_try_connect(f);
+        return;
+    }
+
+    int err = 0, len = sizeof(err);
+    if ((events & REACTOR_EV_ERROR) ||
+        getsockopt(a->sock, SOL_SOCKET, SO_ERROR, (char*)&err, &len) < 0 || err != 0) {
+        // RFC 8305: 尝试失败时立即发起下一个，不等间隔
+        fsm_drop_attempt(f, a);
+        fsm_try_connect(f);
+        return;
+    }
+    if (events & REACTOR_EV_WRITE) fsm_attempt_won(f, a);
+}
+
+// [Mod] 2026-10-16: 发起下一个候选 (立即失败的跳过)；没有候选且没有在途尝试时本轮失败
+static void fsm_try_connect(SessionFsm* f) {
+    ProxySession* s = &f->s;
+
+    while (f->cand_next < f->cand_count) {
+        const struct addrinfo* ai = f->cands[f->cand_next];
+        FsmAttempt* a = &f->att[f->cand_next++];
+        a->f = f;
+        a->h = NULL;
+        a->family = ai->ai_family;
+        a->staggered = (f->cand_next >= f->cand_count); // 最后一个候选没有下一个可发起
+        a->sock = outbound_open_socket(s, ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (a->sock == INVALID_SOCKET) continue;
+
+        u_long nb = 1;
+        ioctlsocket(a->sock, FIONBIO, &nb);
+
+        int res = connect(a->sock, ai->ai_addr, (int)ai->ai_addrlen);
+        if (res == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK) {
+            closesocket(a->sock); a->sock = INVALID_SOCKET;
+            continue;
+        }
+
+        f->att_active++;
+        a->h = Reactor_Add(f->loop, a->sock, REACTOR_EV_WRITE, fsm_on_attempt, a);
+        if (!a->h) { fsm_fail(f); return; }
+        Reactor_SetTimer(a->h, a->staggered ? FSM_CONNECT_TIMEOUT_MS : DIAL_ATTEMPT_DELAY_MS);
+        fsm_set_stage(f, FSM_CONNECT, 0); // 超时由各尝试自己的定时器负责
+        return;
+    }
+    if (f->att_active > 0) return; // 仍有在途尝试
+
+    // 本轮地址全部失败
+    if (++f->retry >= FSM_CONNECT_RETRIES || !g_proxyRunning) { fsm_fail(f); return; }
+    log_msg("[Conn-%d] Connection retry %d...", s->clientSock, f->retry);
+    fsm_set_stage(f, FSM_RETRY_WAIT, FSM_RETRY_DELAY_MS);
+}
+
+static void fsm_on_resolved(void* arg) {
+    FsmResolveJob* job = (FsmResolveJob*)arg;
+    SessionFsm* f = job->f;
+
+    if (f->state != FSM_RESOLVE) {
+        // 会话已在解析期间失败
+        if (job->res) Dns_FreeAddrs(job->res);
+    } else if (job->rc != 0 || !job->res) {
+        log_msg("[Conn-%d] Failed to resolve upstream %s", f->s.clientSock, job->host);
+        fsm_fail(f);
+    } else {
+        f->addrs = job->res;
+        f->retry = 0;
+        fsm_begin_round(f);
+    }
+    free(job);
+    fsm_release(f);
+}
+
+static void Task_FsmResolve(void* arg) {
+    FsmResolveJob* job = (FsmResolveJob*)arg;
+
+    job->rc = Dns_Resolve(job->host, job->port, FSM_RESOLVE_TIMEOUT_MS, &job->res);
+    job->ran = TRUE;
+
+    // 预取 ECH 配置，握手开始时直接命中缓存，不在事件循环中发起 DoH 请求
+    if (job->rc == 0 && job->ech_domain[0] && !ThreadPool_IsCancelled()) {
+        size_t ech_len = 0;
+        unsigned char* ech = FetchECHConfig(job->ech_domain, g_echConfigServer, &ech_len);
+        if (ech) free(ech);
+    }
+}
+
+// 线程池 cleanup: 任务执行完、被拒绝或被丢弃时都经由这里把结果投递回会话所属循环
+static void Task_FsmResolveDone(void* arg) {
+    FsmResolveJob* job = (FsmResolveJob*)arg;
+    if (!job->ran) job->rc = EAI_AGAIN;
+
+    if (Reactor_Post(job->loop, fsm_on_resolved, job) != 0) {
+        // 事件循环已停止，会话由退出流程释放
+        if (job->res) Dns_FreeAddrs(job->res);
+        SessionFsm* f = job->f;
+        free(job);
+        fsm_release(f);
+    }
+}
+
+static void fsm_advance_upstream(SessionFsm* f) {
+    ProxySession* s = &f->s;
+    outbound_log_connecting(s);
+
+    fsm_cancel_attempts(f);
+    if (f->addrs) { Dns_FreeAddrs(f->addrs); f->addrs = NULL; }
+    f->cand_count = f->cand_next = 0;
+    snprintf(f->dial_key, sizeof(f->dial_key), "%s:%d", s->config.host, s->config.port);
+
+    FsmResolveJob* job = (FsmResolveJob*)calloc(1, sizeof(FsmResolveJob));
+    if (!job) { fsm_fail(f); return; }
+    job->f = f;
+    job->loop = f->loop;
+    strncpy(job->host, s->config.host, sizeof(job->host) - 1);
+    job->port = s->config.port;
+
+    if (g_enableECH && _stricmp(s->config.type, "direct") != 0) {
+        const char* sni = (strlen(s->config.sni) > 0) ? s->config.sni : s->config.host;
+        if (!IsIpStr(sni)) {
+            const char* query = (strlen(g_echPublicName) > 0) ? g_echPublicName : sni;
+            strncpy(job->ech_domain, query, sizeof(job->ech_domain) - 1);
+        }
+    }
+
+    // [New] 快速路径：缓存命中 (含过期待刷新的记录) 且 ECH 配置已就绪时不经过线程池
+    if (!job->ech_domain[0] || IsECHConfigCached(job->ech_domain)) {
+        struct addrinfo* res = NULL;
+        if (Dns_Resolve(job->host, job->port, 0, &res) == 0) {
+            free(job);
+            f->addrs = res;
+            f->retry = 0;
+            fsm_begin_round(f);
+            return;
+        }
+    }
+
+    f->state = FSM_RESOLVE;
+    Reactor_SetTimer(f->hc, 0); // 解析耗时由 FSM_RESOLVE_TIMEOUT_MS 约束
+
+    // 引用由 Task_FsmResolveDone 投递的 fsm_on_resolved 释放；提交被拒绝时同样经由该路径以失败结束
+    InterlockedIncrement(&f->refs);
+    ThreadPool_Submit(Task_FsmResolve, job, Task_FsmResolveDone);
+}
+
+// --- 浏览器握手 (Step 1) ---
+
+static void fsm_after_browser(SessionFsm* f) {
+    ProxySession* s = &f->s;
+    // 上游握手期间不再关心客户端可读，只保留错误通知与阶段定时器 (及尚未发完的应答)
+    Reactor_SetEvents(f->hc, f->out_c.blocked ? REACTOR_EV_WRITE : 0);
+
+    // [New] 同节点已有可用的 H2 连接时直接开流 (强制 HTTP/1.1 时不参与)
+    int alpn_mode = (s->cryptoSettings.alpnOverride > 0) ? s->cryptoSettings.alpnOverride : g_alpnMode;
+    if (_stricmp(s->config.type, "direct") != 0 && s->fallback_state == 0 && alpn_mode != 1 &&
+        H2Pool_Attach(s, f->loop, fsm_on_h2_stream) == 0) {
+        f->h2_reused = TRUE;
+        fsm_wait_h2_status(f);
+        return;
+    }
+    // [New] 多路复用：同节点已有隧道时直接开流，跳过解析 / 连接 / TLS / WS 升级
+    if (s->fallback_state == 0 && MuxPool_IsEligible(s, f->loop)) {
+        f->mux = TRUE;
+        if (MuxPool_Attach(s, f->loop) == 0) { fsm_enter_relay(f); return; }
+    }
+    // [New] 预建连接池命中时跳过解析 / 连接 / TLS，从 ALPN 分支继续
+    if (WarmPool_Take(s, f->loop) == 0) {
+        f->hr = Reactor_Add(f->loop, s->remoteSock, REACTOR_EV_READ, fsm_on_remote, f);
+        if (!f->hr) { fsm_fail(f); return; }
+        f->warm = TRUE;
+        fsm_start_tunnel(f);
+        return;
+    }
+    fsm_advance_upstream(f);
+}
+
+// [New] c_buf 中 SOCKS5 请求 (VER CMD RSV ATYP ADDR PORT) 的完整长度，0=尚未收全
+static int fsm_socks5_request_len(ProxySession* s) {
+    const unsigned char* b = (const unsigned char*)s->c_buf;
+    int have = s->browser_header_len;
+    if (have < 5) return 0;
+
+    int need;
+    switch (b[3]) {
+        case 0x01: need = 4 + 4 + 2; break;
+        case 0x03: need = 4 + 1 + b[4] + 2; break;
+        case 0x04: need = 4 + 16 + 2; break;
+        default:   return have; // 未知地址类型交给解析函数报错
+    }
+    return (have >= need) ? need : 0;
+}
+
+static void fsm_on_browser_data(SessionFsm* f) {
+    ProxySession* s = &f->s;
+    int space = IO_BUFFER_SIZE - 1 - s->browser_header_len;
+    int n = recv(s->clientSock, s->c_buf + s->browser_header_len, space, 0);
+    if (n == 0 || (n < 0 && WSAGetLastError() != WSAEWOULDBLOCK)) { fsm_fail(f); return; }
+    if (n < 0) return;
+
+    s->browser_header_len += n;
+    s->c_buf[s->browser_header_len] = 0;
+    BOOL full = (s->browser_header_len >= IO_BUFFER_SIZE - 1);
+
+    if (f->state == FSM_BROWSER_HEADER && s->c_buf[0] == 0x05) {
+        // 问候 (VER NMETHODS METHODS...) 可能分多次到达，收全后才应答
+        if (s->browser_header_len < 2) return;
+        int greet_len = 2 + (unsigned char)s->c_buf[1];
+        if (s->browser_header_len < greet_len) return;
+
+        s->is_socks5 = 1;
+        f->state = FSM_SOCKS5_REQUEST;
+        // 客户端未等应答就发出的请求字节保留下来
+        s->browser_header_len -= greet_len;
+        memmove(s->c_buf, s->c_buf + greet_len, s->browser_header_len);
+        if (fsm_write(f, FALSE, "\x05\x00", 2) != 0) { fsm_fail(f); return; }
+    }
+
+    if (f->state == FSM_SOCKS5_REQUEST) {
+        // 请求同样可能被拆开，按地址类型确定长度，收全后才解析
+        if (fsm_socks5_request_len(s) == 0) return;
+        int ret = inbound_parse_socks5_request(s);
+        if (ret < 0) { fsm_fail(f); return; }
+        if (ret > 0) { fsm_enter_udp_relay(f); return; }
+        if (inbound_apply_routing(s) != 0) { fsm_fail(f); return; }
+        fsm_after_browser(f);
+        return;
+    }
+
+    if (!strstr(s->c_buf, "\r\n\r\n") && !full) return; // 请求头未收全
+    if (inbound_parse_http_request(s) != 0 || inbound_apply_routing(s) != 0) { fsm_fail(f); return; }
+    fsm_after_browser(f);
+}
+
+// --- 事件分发 ---
+
+static void fsm_on_timer(SessionFsm* f) {
+    ProxySession* s = &f->s;
+    switch (f->state) {
+        case FSM_RETRY_WAIT:
+            fsm_begin_round(f);
+            break;
+        case FSM_H2_STATUS:
+            s->h2_handshake_done = 1;
+            fsm_send_proxy_request(f);
+            break;
+        case FSM_TLS:
+            log_msg("[TLS] Handshake timeout");
+            log_msg("[Conn-%d] TLS Handshake Failed.", s->clientSock);
+            fsm_next_address(f);
+            break;
+        default:
+            log_msg("[Conn-%d] Handshake timeout (stage %d)", s->clientSock, (int)f->state);
+            fsm_fail(f);
+            break;
+    }
+}
+
+// [New] 一侧可写：继续写出排队数据，FSM_FLUSH 阶段两侧都发完后进入转发
+// 返回 FALSE 表示会话已结束或已交给转发阶段
+static BOOL fsm_on_writable(SessionFsm* f, BOOL remote) {
+    if (fsm_out_pump(f, remote) < 0) { fsm_fail(f); return FALSE; }
+    if (f->state == FSM_FLUSH) {
+        if (!f->out_c.blocked && !f->out_r.blocked) fsm_start_relay(f);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void fsm_on_client(ReactorHandle* h, int events, void* arg) {
+    SessionFsm* f = (SessionFsm*)arg;
+    if (events & REACTOR_EV_ERROR) { fsm_fail(f); return; }
+    if (events & REACTOR_EV_TIMER) { fsm_on_timer(f); return; }
+    if ((events & REACTOR_EV_WRITE) && f->out_c.blocked && !fsm_on_writable(f, FALSE)) return;
+    if ((events & REACTOR_EV_READ) && (f->state == FSM_BROWSER_HEADER || f->state == FSM_SOCKS5_REQUEST)) {
+        fsm_on_browser_data(f);
+    }
+}
+
+static void fsm_on_remote(ReactorHandle* h, int events, void* arg) {
+    SessionFsm* f = (SessionFsm*)arg;
+
+    if (events & REACTOR_EV_ERROR) {
+        if (f->state == FSM_WS_UPGRADE && f->rx_len == 0 && fsm_warm_retry(f)) return;
+        if (f->state == FSM_TLS) {
+            log_msg("[Conn-%d] TLS Handshake Failed.", f->s.clientSock);
+            fsm_next_address(f);
+        } else {
+            fsm_fail(f);
+        }
+        return;
+    }
+
+    // TLS 握手期间的可写事件属于握手本身
+    if ((events & REACTOR_EV_WRITE) && f->state != FSM_TLS && f->out_r.blocked && !fsm_on_writable(f, TRUE)) return;
+
+    switch (f->state) {
+        case FSM_TLS:        fsm_tls_step(f); break;
+        case FSM_WS_UPGRADE: fsm_on_ws_upgrade(f); break;
+        case FSM_SOCKS5_OUT: fsm_on_socks5_out(f); break;
+        default: break;
+    }
+}
+
+static void fsm_register(void* arg) {
+    SessionFsm* f = (SessionFsm*)arg;
+    f->hc = Reactor_Add(f->loop, f->s.clientSock, REACTOR_EV_READ, fsm_on_client, f);
+    if (!f->hc) { fsm_fail(f); return; }
+    fsm_set_stage(f, FSM_BROWSER_HEADER, FSM_BROWSER_TIMEOUT_MS);
+}
+
+// --- 对外接口 ---
+
+// 接管 ctx->clientSock 并异步完成全部握手，随后进入转发阶段；ctx 在返回后即可释放
+int Session_StartAsync(ClientContext* ctx) {
+    if (!ctx || ctx->clientSock == INVALID_SOCKET) return -1;
+    if (!Reactor_IsRunning() && Reactor_Init(0) != 0) return -1;
+
+    if (InterlockedIncrement(&s_fsmActive) > MAX_CONNECTIONS) {
+        InterlockedDecrement(&s_fsmActive);
+        log_msg("[Conn-%d] Handshake rejected: too many pending sessions (%d)", ctx->clientSock, MAX_CONNECTIONS);
+        return -1;
+    }
+
+    SessionFsm* f = (SessionFsm*)calloc(1, sizeof(SessionFsm));
+    if (!f) { InterlockedDecrement(&s_fsmActive); return -1; }
+    if (session_init(&f->s, ctx) != 0) {
+        // session_init 失败时已关闭 clientSock
+        InterlockedDecrement(&s_fsmActive);
+        free(f);
+        return -1;
+    }
+    f->refs = 1;
+    f->loop = Reactor_PickLoop();
+
+    int flag = 1;
+    u_long nb = 1;
+    setsockopt(f->s.clientSock, IPPROTO_TCP, TCP_NODELAY, (char *)&flag, sizeof(int));
+    ioctlsocket(f->s.clientSock, FIONBIO, &nb);
+
+    if (Reactor_Post(f->loop, fsm_register, f) != 0) {
+        session_free(&f->s);
+        InterlockedDecrement(&s_fsmActive);
+        free(f);
+        return -1;
+    }
+    return 0;
+}
+
+LONG Session_GetHandshakingCount(void) {
+    return s_fsmActive;
+}
@@ -2,6 +2,12 @@
 // [Refactor] 2026-01-29: 优化 HTTP/2 发送逻辑，消除界面卡顿
 // [Fix] 2026-01-29: 将 send_blocking_retry 超时从 2s 降至 1ms 轮询，支持快速退出
 // [Fix] 2026-01-29: 增强 h2_send_callback 的非阻塞错误码映射
+// [Mod] 2026-10-16: 转发阶段的 DATA 回调改为写入 Relay 待发送队列
+// [Mod] 2026-10-16: 转发阶段 h2_send_callback 改用 tls_write_nb，写满时返回 WOULDBLOCK 由事件循环等待可写
+// [Refactor] 2026-10-16: send_blocking_retry 改用 Cancel_Wait 等待可写，不再 1ms 轮询
+// [Fix] 2026-10-16: h2_send_callback 在任何事件循环线程上都只做非阻塞写入，阻塞写入仅留给同步路径
+// [Fix] 2026-10-17: 浏览器半关闭时 data provider 在暂存数据发完后置 EOF (END_STREAM)，下行照常接收
+// [Refactor] 2026-10-16: 流相关回调改为按流用户数据查找会话，同一 nghttp2 会话可承载多个浏览器连接 (proxy_h2_pool.c)
 
 #include "proxy_internal.h"
 #include "utils.h" 
@@ -9,11 +15,8 @@
 
 extern volatile BOOL g_proxyRunning; 
 
-// [Config] 微秒级轮询间隔，与 crypto_tls.c 保持一致
-#define H2_SELECT_WAIT_MS 1 
-
 // [Helper] 针对非阻塞 Socket 的健壮发送函数
-// [Fix] 使用短超时循环，确保能及时响应 g_proxyRunning 退出信号
+// [Fix] 等待可写时同时等待停止通知，确保能及时响应退出信号
 static int send_blocking_retry(SOCKET sock, const char* data, int len) {
     int sent = 0;
     while (sent < len && g_proxyRunning) {
@@ -25,21 +28,11 @@ static int send_blocking_retry(SOCKET sock, const char* data, int len) {
         } else {
             int err = WSAGetLastError();
             if (err == WSAEWOULDBLOCK) {
-                fd_set wfd;
-                FD_ZERO(&wfd);
-                FD_SET(sock, &wfd);
-                
-                // [Fix] 1ms 超时，快速循环以检查 g_proxyRunning
-                struct timeval tv;
-                tv.tv_sec = 0;
-                tv.tv_usec = H2_SELECT_WAIT_MS * 1000; 
-                
-                int res = select(0, NULL, &wfd, NULL, &tv);
-                if (res < 0) {
-                    log_msg("[Conn-%d] [H2] Select error: %d", sock, WSAGetLastError());
+                // 不限时等待可写；停止代理时 Cancel_Wait 立即返回 -1
+                if (Cancel_Wait(sock, CANCEL_WAIT_WRITE, -1) < 0) {
+                    if (g_proxyRunning) log_msg("[Conn-%d] [H2] Select error: %d", sock, WSAGetLastError());
                     return -1;
                 }
-                // res == 0 (Timeout) -> Continue loop to check g_proxyRunning
                 continue;
             } else if (err == WSAEINTR) {
                 continue;
@@ -59,6 +52,14 @@ ssize_t h2_send_callback(nghttp2_session *session, const uint8_t *data, size_t l
     ProxySession *s = (ProxySession*)user_data;
     if (!g_proxyRunning) return NGHTTP2_ERR_CALLBACK_FAILURE; 
     
+    // 转发阶段运行在事件循环线程上，不能等待 Socket 可写：只写入能接受的部分
+    // [Fix] 握手阶段在循环线程上调用时同样不阻塞，写满时由 nghttp2 保留数据等下次发送
+    if (s->relay || Reactor_IsLoopThread()) {
+        int n = tls_write_nb(&s->tls, (const char*)data, (int)length);
+        if (n < 0) return NGHTTP2_ERR_CALLBACK_FAILURE;
+        return (n > 0) ? (ssize_t)n : NGHTTP2_ERR_WOULDBLOCK;
+    }
+
     // tls_write 内部已处理了部分重试，但如果底层 SSLbuffer 满，仍可能返回 -1
     int ret = tls_write(&s->tls, (const char*)data, (int)length);
     
@@ -75,7 +76,8 @@ ssize_t h2_send_callback(nghttp2_session *session, const uint8_t *data, size_t l
 }
 
 int h2_on_header_callback(nghttp2_session *session, const nghttp2_frame *frame, const uint8_t *name, size_t namelen, const uint8_t *value, size_t valuelen, uint8_t flags, void *user_data) {
-    ProxySession *s = (ProxySession*)user_data;
+    ProxySession *s = (ProxySession*)nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+    if (!s) return 0; // 连接级帧或已解除关联的流
     
     // 仅处理属于当前流的 Headers
     if (frame->hd.type == NGHTTP2_HEADERS && frame->hd.stream_id == s->h2_stream_id) {
@@ -93,7 +95,8 @@ int h2_on_header_callback(nghttp2_session *session, const nghttp2_frame *frame,
 }
 
 int h2_on_frame_recv_callback(nghttp2_session *session, const nghttp2_frame *frame, void *user_data) {
-    ProxySession *s = (ProxySession*)user_data;
+    ProxySession *s = (ProxySession*)nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+    if (!s) return 0;
     
     // 监听 HEADERS 帧结束，判断握手是否成功
     if (frame->hd.type == NGHTTP2_HEADERS && frame->hd.stream_id == s->h2_stream_id) {
@@ -110,29 +113,36 @@ int h2_on_frame_recv_callback(nghttp2_session *session, const nghttp2_frame *fra
 }
 
 int h2_on_data_chunk_recv_callback(nghttp2_session *session, uint8_t flags, int32_t stream_id, const uint8_t *data, size_t len, void *user_data) {
-    ProxySession *s = (ProxySession*)user_data;
+    ProxySession *s = (ProxySession*)nghttp2_session_get_stream_user_data(session, stream_id);
+    if (!s) return 0;
     
     // 收到上游数据 -> 转发给浏览器
     if (stream_id == s->h2_stream_id && len > 0) {
-        if (send_blocking_retry(s->clientSock, (const char*)data, (int)len) < 0) {
+        // [New] 处于 Reactor 转发阶段时以非阻塞方式排队，避免阻塞共享事件循环
+        int ret = s->relay ? Relay_SendToClient(s, (const char*)data, (int)len)
+                           : send_blocking_retry(s->clientSock, (const char*)data, (int)len);
+        if (ret < 0) {
             // 发送失败通常意味着浏览器断开了连接
             // log_msg("[Conn-%d] [H2] Failed to forward data to browser", s->clientSock);
             return NGHTTP2_ERR_CALLBACK_FAILURE;
         }
+        // 共享连接关闭了自动窗口更新：阻塞路径已全部写出，立即归还窗口 (转发阶段由 Relay_SendToClient 处理)
+        if (!s->relay && s->h2_stream) H2Pool_Consume(s, (int)len);
     }
     return 0;
 }
 
 int h2_on_stream_close_callback(nghttp2_session *session, int32_t stream_id, uint32_t error_code, void *user_data) {
-    ProxySession *s = (ProxySession*)user_data;
-    if (stream_id == s->h2_stream_id) {
+    ProxySession *s = (ProxySession*)nghttp2_session_get_stream_user_data(session, stream_id);
+    if (s && stream_id == s->h2_stream_id) {
         s->h2_handshake_done = -1; // 标记流结束，通知主循环退出
     }
     return 0;
 }
 
 ssize_t h2_data_provider_read(nghttp2_session *session, int32_t stream_id, uint8_t *buf, size_t length, uint32_t *data_flags, nghttp2_data_source *source, void *user_data) {
-    ProxySession *s = (ProxySession*)user_data;
+    ProxySession *s = (ProxySession*)nghttp2_session_get_stream_user_data(session, stream_id);
+    if (!s) return NGHTTP2_ERR_DEFERRED; // 会话已解除关联，流即将被 RST
     
     // 将浏览器发来的数据 (已存入 h2_browser_buf) 提供给 nghttp2 发送
     if (s->h2_browser_len > 0) {
@@ -149,10 +159,17 @@ ssize_t h2_data_provider_read(nghttp2_session *session, int32_t stream_id, uint8
             s->h2_browser_len = 0;
         }
         
-        // 注意：不设置 NGHTTP2_DATA_FLAG_EOF，因为这是一个长连接隧道
+        // 隧道为长连接，只有浏览器已半关闭且暂存区发完时才设置 EOF
+        if (s->h2_browser_len == 0 && s->h2_browser_eof) *data_flags |= NGHTTP2_DATA_FLAG_EOF;
         return (ssize_t)copy_len;
     }
     
+    // 浏览器已半关闭：以空 DATA 帧结束上行 (END_STREAM)，流的下行方向不受影响
+    if (s->h2_browser_eof) {
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+        return 0;
+    }
+    
     // 如果没有数据，返回 DEFERRED，暂停 DATA 帧发送
     // 当 proxy_loop.c 收到新数据时，会调用 nghttp2_session_resume_data 唤醒
     return NGHTTP2_ERR_DEFERRED;
@@ -0,0 +1,506 @@
+/* src/proxy_h2_pool.c */
+// [New] 2026-10-16: 共享 HTTP/2 上游连接池，替代"每个浏览器连接一条 TLS + 一个 nghttp2 会话"
+// 设计要点:
+// 1. 每个事件循环各自维护连接链表，连接与其上的全部流都只在该循环线程上访问，无需加锁
+// 2. 同一节点 (类型/地址/端口/SNI/路径/mode) 最多保持 H2POOL_MAX_CONNS 条长连接，每条最多 H2POOL_MAX_STREAMS 个流；
+//    新的浏览器连接直接在已验证的连接上开流 (POST / 扩展 CONNECT)，跳过 DNS、TCP 与 TLS 握手
+// 3. 首个流在握手阶段 (proxy_fsm.c) 接管刚完成 TLS 的连接；响应头为 2xx/3xx 后连接才允许复用，失败则不再复用
+// 4. 关闭自动窗口更新：下行数据写给浏览器后才归还流控窗口 (H2Pool_Consume)，一个慢速浏览器只会阻塞自己的流
+// 5. 流相关回调 (proxy_h2.c) 按流用户数据找到会话；连接读写由本模块的句柄驱动，状态变化后通知流的持有者
+// 6. 连接级 PING 保活；空闲超过 H2POOL_IDLE_TIMEOUT、收到 GOAWAY 或流 ID 用尽后不再开流，流全部结束后关闭
+
+#include "proxy_internal.h"
+#include "utils.h"
+#include "common.h"
+#include <stdio.h>
+
+#define H2POOL_MAX_LOOPS      16        // 不小于 proxy_reactor.c 的 REACTOR_MAX_LOOPS
+#define H2POOL_MAX_CONNS      2         // 每个循环、每个节点的长连接数
+#define H2POOL_MAX_STREAMS    64        // 每条连接的并发流上限 (另受服务端 MAX_CONCURRENT_STREAMS 约束)
+#define H2POOL_STREAM_WINDOW  (256 * 1024)
+#define H2POOL_CONN_WINDOW    (8 * 1024 * 1024)
+#define H2POOL_TICK_MS        15000     // 保活 / 空闲检查周期
+#define H2POOL_PING_INTERVAL  30000     // 连接无下行数据超过该时间时发送 PING
+#define H2POOL_IDLE_TIMEOUT   60000     // 无流的连接保留时间
+#define H2POOL_MAX_BURST      32
+#define H2POOL_KEY_LEN        1024
+
+#ifndef NGHTTP2_SETTINGS_ENABLE_CONNECT_PROTOCOL
+#define NGHTTP2_SETTINGS_ENABLE_CONNECT_PROTOCOL 0x08
+#endif
+
+typedef struct H2Conn {
+    struct H2Conn* next;        // 所属循环的连接链表
+    int loop;
+    char key[H2POOL_KEY_LEN];
+    char label[300];            // 日志用 host:port
+
+    SOCKET sock;
+    TLSContext tls;
+    nghttp2_session* sess;
+    ReactorHandle* h;
+
+    H2Stream* streams;          // 活动流 (双向链表)
+    int stream_count;
+    int busy;                   // 正在派发事件 / 通知流，期间推迟释放
+
+    BOOL listed;                // 在连接链表中，可被复用 (超出每节点上限的连接为独占连接)
+    BOOL verified;              // 已有流收到成功响应，可复用
+    BOOL draining;              // GOAWAY / 流 ID 用尽 / 路径不可用：不再开流
+    BOOL failed;                // 连接错误，等待下一轮派发时通知所有流
+    BOOL dead;                  // 已关闭，等待流全部解除关联后释放
+
+    ULONGLONG last_rx;
+    ULONGLONG idle_since;       // 最后一个流结束的时间
+} H2Conn;
+
+struct H2Stream {
+    H2Conn* conn;
+    ProxySession* s;
+    H2StreamNotify notify;
+    H2Stream* prev;
+    H2Stream* next;
+    int unconsumed;             // 已收到但浏览器尚未接收的 DATA 字节 (尚未归还的窗口)
+    BOOL closed;                // nghttp2 已关闭该流
+    BOOL dirty;                 // 有状态变化，待通知持有者
+};
+
+static H2Conn* s_pool[H2POOL_MAX_LOOPS];
+
+static void h2conn_on_event(ReactorHandle* h, int events, void* arg);
+
+// --- 辅助函数 ---
+
+static void h2pool_make_key(const ProxySession* s, char* out, int cap) {
+    snprintf(out, cap, "%s|%s|%d|%s|%s|%s|%d", s->config.type, s->config.host, s->config.port,
+             s->config.sni, s->config.path, s->config.mode, s->config.allowInsecure ? 1 : 0);
+}
+
+static void h2conn_update_interest(H2Conn* c) {
+    if (c->dead || !c->h) return;
+    int ev = REACTOR_EV_READ;
+    if (nghttp2_session_want_write(c->sess) || TlsEngine_CipherOutPending(&c->tls) > 0) ev |= REACTOR_EV_WRITE;
+    Reactor_SetEvents(c->h, ev);
+}
+
+static int h2conn_stream_limit(H2Conn* c) {
+    uint32_t peer = nghttp2_session_get_remote_settings(c->sess, NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS);
+    return (peer < H2POOL_MAX_STREAMS) ? (int)peer : H2POOL_MAX_STREAMS;
+}
+
+static void h2conn_unlist(H2Conn* c) {
+    if (!c->listed) return;
+    H2Conn** pp = &s_pool[c->loop];
+    while (*pp && *pp != c) pp = &(*pp)->next;
+    if (*pp) *pp = c->next;
+    c->next = NULL;
+    c->listed = FALSE;
+}
+
+// 关闭传输层 (流仍可能引用 sess，会话对象在释放时删除)
+static void h2conn_close(H2Conn* c) {
+    if (c->dead) return;
+    c->dead = TRUE;
+    h2conn_unlist(c);
+    if (c->h) { Reactor_Remove(c->h); c->h = NULL; }
+    tls_close(&c->tls);
+    if (c->sock != INVALID_SOCKET) { closesocket(c->sock); c->sock = INVALID_SOCKET; }
+}
+
+static void h2conn_maybe_free(H2Conn* c) {
+    if (c->busy > 0 || c->stream_count > 0 || !c->dead) return;
+    if (c->sess) nghttp2_session_del(c->sess);
+    free(c);
+}
+
+// 无流时：不可复用的连接立即关闭，其余保留到空闲超时
+static void h2conn_on_idle(H2Conn* c) {
+    if (c->dead || c->stream_count > 0) return;
+    if (!c->listed || c->draining || !c->verified) {
+        nghttp2_session_terminate_session(c->sess, NGHTTP2_NO_ERROR);
+        nghttp2_session_send(c->sess);
+        tls_flush_nb(&c->tls); // 尽力发出 GOAWAY
+        log_msg("[H2Pool] Connection to %s released", c->label);
+        h2conn_close(c);
+        h2conn_maybe_free(c);
+        return;
+    }
+    c->idle_since = Reactor_Now();
+}
+
+// 通知有状态变化的流 (all = TRUE 时通知全部)。持有者可能在回调中解除关联
+static void h2conn_notify_streams(H2Conn* c, BOOL all) {
+    H2Stream* st = c->streams;
+    while (st) {
+        H2Stream* next = st->next;
+        if (all || st->dirty) {
+            st->dirty = FALSE;
+            if (st->notify) st->notify(st->s);
+        }
+        st = next;
+    }
+}
+
+static void h2conn_fail(H2Conn* c, const char* reason) {
+    if (!c->dead) log_msg("[H2Pool] Connection to %s closed: %s (%d stream(s))", c->label, reason, c->stream_count);
+    h2conn_close(c);
+    for (H2Stream* st = c->streams; st; st = st->next) {
+        st->closed = TRUE;
+        st->s->h2_handshake_done = -1;
+    }
+    c->busy++;
+    h2conn_notify_streams(c, TRUE);
+    c->busy--;
+    h2conn_maybe_free(c);
+}
+
+// --- nghttp2 回调 (user_data = H2Conn) ---
+
+static ssize_t h2conn_send_cb(nghttp2_session* session, const uint8_t* data, size_t length, int flags, void* user_data) {
+    H2Conn* c = (H2Conn*)user_data;
+    if (c->dead) return NGHTTP2_ERR_CALLBACK_FAILURE;
+    int n = tls_write_nb(&c->tls, (const char*)data, (int)length);
+    if (n < 0) return NGHTTP2_ERR_CALLBACK_FAILURE;
+    return (n > 0) ? (ssize_t)n : NGHTTP2_ERR_WOULDBLOCK;
+}
+
+static int h2conn_on_frame_recv_cb(nghttp2_session* session, const nghttp2_frame* frame, void* user_data) {
+    H2Conn* c = (H2Conn*)user_data;
+
+    if (frame->hd.type == NGHTTP2_GOAWAY) {
+        if (!c->draining) log_msg("[H2Pool] GOAWAY from %s (last stream %d), no new streams", c->label, frame->goaway.last_stream_id);
+        c->draining = TRUE;
+        h2conn_unlist(c);
+        return 0;
+    }
+
+    int rv = h2_on_frame_recv_callback(session, frame, user_data);
+    ProxySession* s = (ProxySession*)nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+    if (s && s->h2_stream && frame->hd.type == NGHTTP2_HEADERS) {
+        s->h2_stream->dirty = TRUE;
+        if (s->h2_status_code >= 200 && s->h2_status_code < 400) {
+            c->verified = TRUE;
+        } else if (s->h2_status_code >= 400 && !c->verified) {
+            c->draining = TRUE; // 节点不接受该路径，不要让后续连接再尝试
+        }
+    }
+    return rv;
+}
+
+static int h2conn_on_data_chunk_cb(nghttp2_session* session, uint8_t flags, int32_t stream_id, const uint8_t* data, size_t len, void* user_data) {
+    ProxySession* s = (ProxySession*)nghttp2_session_get_stream_user_data(session, stream_id);
+    if (!s || !s->h2_stream) {
+        // 会话已解除关联：直接归还连接窗口
+        nghttp2_session_consume_connection(session, len);
+        return 0;
+    }
+    s->h2_stream->unconsumed += (int)len;
+    s->h2_stream->dirty = TRUE;
+    if (h2_on_data_chunk_recv_callback(session, flags, stream_id, data, len, user_data) != 0) {
+        // 浏览器侧写入失败只重置该流，不能让整个共享会话失败
+        s->h2_handshake_done = -1;
+        nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_CANCEL);
+    }
+    return 0;
+}
+
+static int h2conn_on_stream_close_cb(nghttp2_session* session, int32_t stream_id, uint32_t error_code, void* user_data) {
+    ProxySession* s = (ProxySession*)nghttp2_session_get_stream_user_data(session, stream_id);
+    h2_on_stream_close_callback(session, stream_id, error_code, user_data);
+    if (s && s->h2_stream) {
+        s->h2_stream->closed = TRUE;
+        s->h2_stream->dirty = TRUE;
+        // 流已不存在，未归还的窗口只需在连接级归还
+        if (s->h2_stream->unconsumed > 0) {
+            nghttp2_session_consume_connection(session, s->h2_stream->unconsumed);
+            s->h2_stream->unconsumed = 0;
+        }
+    }
+    return 0;
+}
+
+static nghttp2_session* h2conn_new_session(H2Conn* c) {
+    nghttp2_session_callbacks* cbs;
+    nghttp2_option* opt;
+    nghttp2_session* sess = NULL;
+
+    if (nghttp2_session_callbacks_new(&cbs) != 0) return NULL;
+    nghttp2_session_callbacks_set_send_callback(cbs, h2conn_send_cb);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(cbs, h2conn_on_frame_recv_cb);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(cbs, h2conn_on_data_chunk_cb);
+    nghttp2_session_callbacks_set_on_stream_close_callback(cbs, h2conn_on_stream_close_cb);
+    nghttp2_session_callbacks_set_on_header_callback(cbs, h2_on_header_callback);
+
+    if (nghttp2_option_new(&opt) == 0) {
+        nghttp2_option_set_no_auto_window_update(opt, 1);
+        nghttp2_session_client_new2(&sess, cbs, c, opt);
+        nghttp2_option_del(opt);
+    }
+    nghttp2_session_callbacks_del(cbs);
+    if (!sess) return NULL;
+
+    nghttp2_settings_entry iv[] = {
+        { NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, 100 },
+        { NGHTTP2_SETTINGS_ENABLE_CONNECT_PROTOCOL, 1 },
+        { NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, H2POOL_STREAM_WINDOW }
+    };
+    if (nghttp2_submit_settings(sess, NGHTTP2_FLAG_NONE, iv, 3) != 0 ||
+        nghttp2_session_set_local_window_size(sess, NGHTTP2_FLAG_NONE, 0, H2POOL_CONN_WINDOW) != 0) {
+        nghttp2_session_del(sess);
+        return NULL;
+    }
+    return sess;
+}
+
+// --- 连接读写 ---
+
+// 读取所有可用的密文并交给 nghttp2。返回 -1 表示连接已断开
+static int h2conn_pump(H2Conn* c) {
+    char* buf = (char*)Pool_Alloc_16K();
+    if (!buf) return -1;
+
+    int ret = 0;
+    for (int i = 0; i < H2POOL_MAX_BURST; i++) {
+        int n = tls_read(&c->tls, buf, IO_BUFFER_SIZE);
+        if (n < 0) { ret = -1; break; }
+        if (n == 0) break;
+        c->last_rx = Reactor_Now();
+
+        ssize_t rv = nghttp2_session_mem_recv(c->sess, (const uint8_t*)buf, (size_t)n);
+        if (rv < 0) {
+            log_msg("[H2Pool] mem_recv error: %s", nghttp2_strerror((int)rv));
+            ret = -1;
+            break;
+        }
+        if (tls_pending(&c->tls) <= 0) break;
+    }
+    Pool_Free_16K(buf);
+
+    if (ret == 0 && tls_pending(&c->tls) > 0) Reactor_Rearm(c->h);
+    return ret;
+}
+
+static int h2conn_send(H2Conn* c) {
+    if (!nghttp2_session_want_write(c->sess)) return 0;
+    int rv = nghttp2_session_send(c->sess);
+    return (rv != 0 && rv != NGHTTP2_ERR_WOULDBLOCK) ? -1 : 0;
+}
+
+static void h2conn_on_timer(H2Conn* c) {
+    ULONGLONG now = Reactor_Now();
+    if (c->stream_count == 0 && now - c->idle_since >= H2POOL_IDLE_TIMEOUT) {
+        c->draining = TRUE;
+        h2conn_on_idle(c);
+        return;
+    }
+    if (now - c->last_rx >= H2POOL_PING_INTERVAL) nghttp2_submit_ping(c->sess, NGHTTP2_FLAG_NONE, NULL);
+    Reactor_SetTimer(c->h, H2POOL_TICK_MS);
+}
+
+static void h2conn_on_event(ReactorHandle* h, int events, void* arg) {
+    H2Conn* c = (H2Conn*)arg;
+    if (c->dead) return;
+    if (c->failed || (events & REACTOR_EV_ERROR)) { h2conn_fail(c, "socket error"); return; }
+
+    c->busy++;
+    if (events & REACTOR_EV_TIMER) h2conn_on_timer(c);
+    if (!c->dead && (events & REACTOR_EV_WRITE) && tls_flush_nb(&c->tls) < 0) c->failed = TRUE;
+    if (!c->dead && !c->failed && (events & REACTOR_EV_READ) && h2conn_pump(c) < 0) c->failed = TRUE;
+    if (!c->dead && !c->failed && h2conn_send(c) < 0) c->failed = TRUE;
+    c->busy--;
+
+    if (c->dead) { h2conn_maybe_free(c); return; }
+    if (c->failed) { h2conn_fail(c, "upstream closed"); return; }
+
+    c->busy++;
+    h2conn_notify_streams(c, FALSE);
+    c->busy--;
+
+    if (c->dead) { h2conn_maybe_free(c); return; }
+    if (c->stream_count == 0) {
+        h2conn_on_idle(c); // 通知期间最后一个流已解除关联
+        if (c->dead) return;
+    }
+    h2conn_update_interest(c);
+}
+
+// --- 流管理 ---
+
+static int h2conn_open_stream(H2Conn* c, ProxySession* s, H2StreamNotify notify) {
+    H2Stream* st = (H2Stream*)calloc(1, sizeof(H2Stream));
+    if (!st) return -1;
+
+    s->h2_sess = c->sess;
+    s->h2_handshake_done = 0;
+    if (tunnel_h2_submit_request(s) != 0) {
+        // 通常为流 ID 用尽：该连接不再开流
+        c->draining = TRUE;
+        h2conn_unlist(c);
+        s->h2_sess = NULL;
+        s->h2_stream_id = 0;
+        free(st);
+        return -1;
+    }
+
+    st->conn = c;
+    st->s = s;
+    st->notify = notify;
+    st->next = c->streams;
+    if (c->streams) c->streams->prev = st;
+    c->streams = st;
+    c->stream_count++;
+    s->h2_stream = st;
+    s->alpn_is_h2 = 1;
+
+    if (h2conn_send(c) < 0) {
+        c->failed = TRUE;
+        Reactor_Rearm(c->h); // 下一轮派发时统一通知
+    }
+    h2conn_update_interest(c);
+    return 0;
+}
+
+// --- 对外接口 ---
+
+int H2Pool_Attach(ProxySession* s, int loop, H2StreamNotify notify) {
+    if (!s || loop < 0 || loop >= H2POOL_MAX_LOOPS) return -1;
+
+    char key[H2POOL_KEY_LEN];
+    h2pool_make_key(s, key, sizeof(key));
+
+    // 选择流最少的可用连接
+    H2Conn* best = NULL;
+    for (H2Conn* c = s_pool[loop]; c; c = c->next) {
+        if (c->dead || c->failed || c->draining || !c->verified) continue;
+        if (strcmp(c->key, key) != 0) continue;
+        if (c->stream_count >= h2conn_stream_limit(c)) continue;
+        if (!best || c->stream_count < best->stream_count) best = c;
+    }
+    if (!best) return -1;
+
+    if (h2conn_open_stream(best, s, notify) != 0) return -1;
+    log_msg("[Conn-%d] [H2Pool] Reusing connection to %s (stream %d, %d active)",
+            s->clientSock, best->label, s->h2_stream_id, best->stream_count);
+    return 0;
+}
+
+int H2Pool_Adopt(ProxySession* s, int loop, H2StreamNotify notify) {
+    if (!s || !s->tls.ssl || s->remoteSock == INVALID_SOCKET) return -1;
+
+    H2Conn* c = (H2Conn*)calloc(1, sizeof(H2Conn));
+    if (!c) return -1;
+
+    // 传输层所有权转移到连接 (TLSContext 不含自引用，可直接按值移动)
+    c->loop = loop;
+    c->sock = s->remoteSock;
+    c->tls = s->tls;
+    s->remoteSock = INVALID_SOCKET;
+    memset(&s->tls, 0, sizeof(TLSContext));
+    c->tls.sock = c->sock;
+
+    h2pool_make_key(s, c->key, sizeof(c->key));
+    snprintf(c->label, sizeof(c->label), "%s:%d", s->config.host, s->config.port);
+    c->last_rx = c->idle_since = Reactor_Now();
+
+    u_long nb = 1;
+    ioctlsocket(c->sock, FIONBIO, &nb);
+
+    c->sess = h2conn_new_session(c);
+    c->h = c->sess ? Reactor_Add(loop, c->sock, REACTOR_EV_READ, h2conn_on_event, c) : NULL;
+    if (!c->h) {
+        h2conn_close(c);
+        h2conn_maybe_free(c);
+        return -1;
+    }
+    Reactor_SetTimer(c->h, H2POOL_TICK_MS);
+
+    // 超出每节点上限时作为独占连接使用，流结束后关闭
+    if (loop >= 0 && loop < H2POOL_MAX_LOOPS) {
+        int same = 0;
+        for (H2Conn* o = s_pool[loop]; o; o = o->next) {
+            if (!o->dead && !o->draining && strcmp(o->key, c->key) == 0) same++;
+        }
+        if (same < H2POOL_MAX_CONNS) {
+            c->next = s_pool[loop];
+            s_pool[loop] = c;
+            c->listed = TRUE;
+        }
+    }
+
+    if (h2conn_open_stream(c, s, notify) != 0) {
+        h2conn_close(c);
+        h2conn_maybe_free(c);
+        return -1;
+    }
+    // 握手期间可能已收到服务端 SETTINGS
+    Reactor_Rearm(c->h);
+    log_msg("[H2Pool] New %s connection to %s (loop %d)", c->listed ? "shared" : "dedicated", c->label, loop);
+    return 0;
+}
+
+void H2Pool_SetNotify(ProxySession* s, H2StreamNotify notify) {
+    if (s && s->h2_stream) s->h2_stream->notify = notify;
+}
+
+int H2Pool_GetLoop(ProxySession* s) {
+    return (s && s->h2_stream) ? s->h2_stream->conn->loop : -1;
+}
+
+int H2Pool_Flush(ProxySession* s) {
+    if (!s || !s->h2_stream) return -1;
+    H2Conn* c = s->h2_stream->conn;
+    if (c->dead || c->failed) return -1;
+
+    if (h2conn_send(c) < 0) {
+        // 不在此处通知其他流 (调用者仍在自身回调中)，交给下一轮派发
+        c->failed = TRUE;
+        Reactor_Rearm(c->h);
+        return -1;
+    }
+    h2conn_update_interest(c);
+    return 0;
+}
+
+void H2Pool_Consume(ProxySession* s, int n) {
+    if (!s || !s->h2_stream || n <= 0) return;
+    H2Stream* st = s->h2_stream;
+    if (st->conn->dead) return;
+    if (n > st->unconsumed) n = st->unconsumed;
+    if (n <= 0) return;
+    st->unconsumed -= n;
+    // 流已关闭时只更新连接级窗口
+    nghttp2_session_consume(st->conn->sess, s->h2_stream_id, (size_t)n);
+    h2conn_update_interest(st->conn); // 可能产生 WINDOW_UPDATE
+}
+
+void H2Pool_Detach(ProxySession* s) {
+    if (!s || !s->h2_stream) return;
+    H2Stream* st = s->h2_stream;
+    H2Conn* c = st->conn;
+
+    if (!c->dead) {
+        if (!st->closed && s->h2_stream_id > 0) {
+            nghttp2_session_set_stream_user_data(c->sess, s->h2_stream_id, NULL);
+            nghttp2_submit_rst_stream(c->sess, NGHTTP2_FLAG_NONE, s->h2_stream_id, NGHTTP2_CANCEL);
+        }
+        if (st->unconsumed > 0) nghttp2_session_consume_connection(c->sess, (size_t)st->unconsumed);
+    }
+
+    if (st->prev) st->prev->next = st->next;
+    else c->streams = st->next;
+    if (st->next) st->next->prev = st->prev;
+    c->stream_count--;
+    free(st);
+
+    s->h2_stream = NULL;
+    s->h2_sess = NULL;
+    s->h2_stream_id = 0;
+
+    if (c->dead) {
+        h2conn_maybe_free(c);
+        return;
+    }
+    h2conn_update_interest(c); // RST_STREAM / WINDOW_UPDATE 在下一轮可写时发出
+    // 派发期间由 h2conn_on_event 在通知结束后处理
+    if (c->stream_count == 0 && c->busy == 0) h2conn_on_idle(c);
+}
@@ -1,4 +1,21 @@
 /* src/proxy_loop.c */
+// [New] 2026-10-16: 新增 RELAY_MODE_MUX：多路复用隧道上的流 (proxy_mux.c)，只注册浏览器句柄，上行受流控窗口约束
+// [New] 2026-10-16: H2 转发支持共享连接上的流 (proxy_h2_pool.c)：只注册浏览器句柄，下行数据写出后才归还流控窗口
+// [New] 2026-10-16: 心跳 / 空闲超时改由 Reactor 时间轮驱动，回调内统一使用缓存时钟 Reactor_Now；心跳间隔自适应 (空闲时逐步放宽，双向数据都计入活动)
+// [New] 2026-10-16: 全双工半关闭：一侧 FIN 转为另一侧 shutdown(SD_SEND) / close_notify / WS Close，反方向继续转发
+// [Fix] 2026-10-16: WS 传输不再因浏览器 FIN 发送 Close 帧 (会同时结束下行、截断下载)，只停止上行并继续转发下行至远端关闭
+// [Fix] 2026-10-17: H2 转发同样支持半关闭 (浏览器 FIN 转为 END_STREAM)；半关闭后由客户端句柄上的专用定时器限时，
+// 只有下行数据帧计入活动 (Pong 不计)，且不再发送心跳
+// [New] 2026-10-16: 上行 TLS 写入改为非阻塞 + 有界待发送队列，队列非空时暂停读取浏览器，不再阻塞循环线程
+// [New] 2026-10-16: 上行写合并，浏览器的连续小写入合并为满尺寸 WS 帧 / TLS 记录
+// [Refactor] 2026-10-16: 下行 WS 帧改为流式转发，载荷随到随转，不再为大帧扩容缓冲
+// [Refactor] 2026-10-16: 下行 ws_read_buf 改为环形缓冲 + 游标解析，逐帧转发不再 memmove
+// [Mod] 2026-10-16: 上行 WS 封帧改为帧头预留 + 原地掩码，热路径不再使用第二块缓冲
+// [Mod] 2026-10-16: UDP 目标域名解析改用共享解析器 (utils_dns.c)，缓存按记录 TTL 过期
+// [Mod] 2026-10-16: UDP 目标域名解析改为提交到共享线程池
+// [Mod] 2026-10-16: TCP 直连回退路径改为原地收发，去掉中转块与剩余数据拷贝
+// [New] 2026-10-16: TCP 直连优先使用 Registered I/O 数据面 (proxy_rio.c)
+// [Refactor] 2026-10-16: 传输循环改为共享 Reactor 事件驱动，移除每会话 select 轮询与 send_robust 阻塞发送
 // [Refactor] 2026-01-28: 修复 UDP 转发中的 DNS 阻塞问题，改为异步线程解析 + 丢包重试机制
 // [Refactor] 2026-01-28: 修复 send_robust 的软超时问题，改为绝对时间截止 (Hard Timeout)
 // [Fix] 2026-01-28: 修复 HTTP/1.1 循环中错误向纯 TCP 连接发送 WebSocket Ping 的问题
@@ -20,756 +37,1097 @@
 #include <ws2tcpip.h> // for getaddrinfo
 #include <process.h>  // for _beginthreadex
 
-#define WS_FRAME_OVERHEAD 16 
 #define MAX_BURST_LOOPS 32
-#define PAGE_ALIGN_SIZE 4096
 
 // [New] 定义直连模式的空闲超时时间 (300秒)
 #define TCP_DIRECT_IDLE_TIMEOUT 300000 
 
-// --- DNS Cache (Async Implementation) ---
-// 用于减少 UDP 转发循环中 getaddrinfo 的调用频率，并避免阻塞
-typedef struct {
-    char domain[256];
-    struct in_addr ip;
-    ULONGLONG expire_tick;
-    // [Fix] 状态机：0=Empty/Expired, 1=Ready, 2=Resolving
-    volatile int state; 
-} DNSCacheEntry;
-
-#define DNS_CACHE_SIZE 64
-static DNSCacheEntry s_dnsCache[DNS_CACHE_SIZE];
-static CRITICAL_SECTION s_dnsLock;
-static volatile long s_dnsInitState = 0;
-
-static void EnsureDnsCacheInited() {
-    if (InterlockedCompareExchange(&s_dnsInitState, 1, 0) == 0) {
-        InitializeCriticalSection(&s_dnsLock);
-        memset(s_dnsCache, 0, sizeof(s_dnsCache));
-        s_dnsInitState = 2; // Done
-    }
-    while (s_dnsInitState != 2) Sleep(1); 
-}
-
-// [New] 异步 DNS 解析线程
-static unsigned __stdcall Thread_ResolveDNS(void* arg) {
-    char* host_ptr = (char*)arg;
-    char host[256];
-    strncpy(host, host_ptr, 255); host[255] = 0;
-    free(host_ptr); // 释放参数副本
-
-    struct addrinfo hints = {0}, *res = NULL;
-    hints.ai_family = AF_INET; 
-    hints.ai_socktype = SOCK_DGRAM;
-
-    struct in_addr resolved_addr;
-    int success = 0;
-
-    // 此处阻塞，但在独立线程中，不影响主循环
-    if (getaddrinfo(host, NULL, &hints, &res) == 0) {
-        resolved_addr = ((struct sockaddr_in*)res->ai_addr)->sin_addr;
-        freeaddrinfo(res);
-        success = 1;
-    }
-
-    EnsureDnsCacheInited();
-    EnterCriticalSection(&s_dnsLock);
-    
-    // 更新缓存
-    // 找到对应的 Resolving 条目 (通过域名匹配)
-    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
-        if (s_dnsCache[i].state == 2 && _stricmp(s_dnsCache[i].domain, host) == 0) {
-            if (success) {
-                s_dnsCache[i].ip = resolved_addr;
-                s_dnsCache[i].expire_tick = GetTickCount64() + 60000; // 60s TTL
-                s_dnsCache[i].state = 1; // Ready
-            } else {
-                // 解析失败，重置为空，允许重试
-                s_dnsCache[i].state = 0; 
-                s_dnsCache[i].expire_tick = 0;
-            }
+// [New] 自适应心跳间隔上限 (低于常见 CDN / NAT 约 100 秒的空闲断开)
+#define KEEPALIVE_MAX_INTERVAL 90000
+
+// [New] TLS / H2 隧道半关闭后 (浏览器已 FIN)，等待远端继续下发数据的最长空闲时间 (客户端句柄定时器)
+#define RELAY_HALF_CLOSE_TIMEOUT 60000
+
+// --- DNS (UDP 转发) ---
+// [Mod] 2026-10-16: 改用共享解析器 (utils_dns.c) 的非阻塞查询，替代本文件的 64 项线性缓存
+
+// 只查缓存、不阻塞：未命中时在后台解析，返回 -1 (UDP 允许丢包，客户端重试时缓存已就绪)
+// 转发 Socket 为 IPv4，只取 IPv4 地址
+static int resolve_hostname_cached(const char* host, struct in_addr* out_addr) {
+    struct addrinfo* res = NULL;
+    if (Dns_Resolve(host, 0, 0, &res) != 0) return -1;
+
+    int ret = -1;
+    for (struct addrinfo* ai = res; ai; ai = ai->ai_next) {
+        if (ai->ai_family == AF_INET) {
+            *out_addr = ((struct sockaddr_in*)ai->ai_addr)->sin_addr;
+            ret = 0;
             break;
         }
     }
-    LeaveCriticalSection(&s_dnsLock);
-    return 0;
+    Dns_FreeAddrs(res);
+    return ret;
 }
 
-// 带缓存的 DNS 解析 (IPv4) - [Fix] 非阻塞模式
-// 返回值: 0=Success, -1=Pending/Fail (Should retry later)
-static int resolve_hostname_cached(const char* host, struct in_addr* out_addr) {
-    EnsureDnsCacheInited();
-    ULONGLONG now = GetTickCount64();
-    
-    EnterCriticalSection(&s_dnsLock);
-    
-    int idx = -1;
-    int empty_idx = -1;
-
-    // 1. 查找现有条目
-    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
-        if (_stricmp(s_dnsCache[i].domain, host) == 0) {
-            // 检查是否过期
-            if (s_dnsCache[i].state == 1 && s_dnsCache[i].expire_tick < now) {
-                s_dnsCache[i].state = 0; // 标记过期
-            }
-            idx = i;
-            break;
+// --- 内部辅助函数 ---
+
+// --- [New] Keep-Alive 辅助函数 ---
+
+static int get_next_keepalive_interval() {
+    return 15000 + (rand() % 35001);
+}
+
+static int build_ws_ping_frame(char* buf) {
+    buf[0] = (char)0x89; // Fin=1, Opcode=9 (PING)
+    buf[1] = (char)0x80; // Mask=1, Len=0
+    *(int*)(buf + 2) = rand(); 
+    return 6; // 2 header + 4 mask
+}
+
+// [New] 非阻塞发送：尽力写入，返回已发送字节数 (可能为 0)，-1 表示连接错误
+static int send_nb(SOCKET s, const char* data, int len) {
+    int total = 0;
+    while (total < len) {
+        int n = send(s, data + total, len - total, 0);
+        if (n > 0) {
+            total += n;
+            continue;
         }
-        if (s_dnsCache[i].state == 0 && empty_idx == -1) {
-            empty_idx = i;
+        int err = WSAGetLastError();
+        if (err == WSAEWOULDBLOCK) break;
+        if (err == WSAEINTR) continue;
+        return -1;
+    }
+    return total;
+}
+
+// =========================================================================================
+// [Refactor] 2026-10-16: 传输循环迁移至共享 Reactor
+// 每个会话不再独占一个 select 循环线程，而是注册两个句柄 (客户端/远端) 到事件循环中，
+// 由回调驱动数据转发。同一会话的所有回调都在同一个循环线程上执行，因此 RelayCtx 无需加锁。
+// =========================================================================================
+
+// 待发送数据 (send / tls_write_nb 只写出一部分时暂存剩余部分)
+// 存在待发送数据时暂停读取对端，形成背压，避免无限缓冲
+typedef struct {
+    char* data;
+    int off;
+    int len;
+    int cap;
+} RelayPending;
+
+struct RelayCtx {
+    ProxySession* s;
+    RelayMode mode;
+    int loop;
+    ReactorHandle* hc;          // 客户端 Socket (UDP 模式下为 TCP 控制连接)
+    ReactorHandle* hr;          // 远端 Socket (UDP 模式下为 UDP Socket)
+    BOOL is_vless;
+    BOOL finished;
+    ULONGLONG last_activity;    // 最近一次收到数据 (隧道模式只计下行数据帧)
+    int rx_head;                // ws_read_buf 环形缓冲的读游标 (有效数据长度为 s->ws_buf_len)
+    long long rx_frame_left;    // 当前 WS 帧尚未转发的载荷字节 (0 = 等待下一个帧头)
+    long long rx_frame_pos;     // 当前帧已处理的载荷字节 (解掩码相位)
+    BOOL rx_frame_data;         // 当前帧为数据帧 (否则丢弃载荷)
+    BOOL rx_frame_masked;
+    unsigned char rx_frame_mask[4];
+    int vless_skip;             // VLESS 响应头剩余待跳过字节
+    BOOL client_eof;            // [New] 浏览器已 FIN (上行结束)
+    BOOL remote_eof;            // [New] 远端已结束 (下行结束)
+    BOOL up_shut;               // 已向远端转发上行结束
+    BOOL down_shut;             // 已向浏览器转发 FIN
+    int idle_pings;             // [New] 连续空闲 (两次心跳之间无数据) 的心跳次数
+    ULONGLONG last_ping_tick;   // 上一次发送心跳的时间
+    RelayPending to_client;
+    RelayPending to_remote;     // TCP 直连为原始数据；TLS 模式为已封帧的明文 (等待 tls_write_nb)
+    RelayDoneCallback on_done;
+    void* done_arg;
+};
+
+static volatile LONG s_activeRelays = 0;
+
+static int pending_append(RelayPending* p, const char* data, int len) {
+    if (len <= 0) return 0;
+    if (p->off > 0 && p->off == p->len) { p->off = 0; p->len = 0; }
+
+    if (p->len + len > p->cap) {
+        if (p->len + len > MAX_WS_FRAME_SIZE) return -1;
+        int new_cap = p->cap ? p->cap : IO_BUFFER_SIZE;
+        while (new_cap < p->len + len) new_cap *= 2;
+        char* nb = (char*)realloc(p->data, new_cap);
+        if (!nb) return -1;
+        p->data = nb;
+        p->cap = new_cap;
+    }
+    memcpy(p->data + p->len, data, len);
+    p->len += len;
+    return 0;
+}
+
+static void pending_free(RelayPending* p) {
+    if (p->data) free(p->data);
+    memset(p, 0, sizeof(RelayPending));
+}
+
+static BOOL pending_empty(const RelayPending* p) {
+    return p->off >= p->len;
+}
+
+static int pending_size(const RelayPending* p) {
+    return pending_empty(p) ? 0 : p->len - p->off;
+}
+
+// 标记已写出 n 字节
+static void pending_consume(RelayPending* p, int n) {
+    p->off += n;
+    if (pending_empty(p)) {
+        p->off = p->len = 0;
+        // 大块突发后收缩回默认容量，避免长连接长期占用内存
+        if (p->cap > IO_BUFFER_SIZE) {
+            free(p->data);
+            p->data = NULL;
+            p->cap = 0;
         }
     }
+}
+
+// 刷新待发送数据。返回 0=继续, -1=连接错误
+static int pending_flush(SOCKET sock, RelayPending* p) {
+    if (pending_empty(p)) return 0;
+    int n = send_nb(sock, p->data + p->off, p->len - p->off);
+    if (n < 0) return -1;
+    pending_consume(p, n);
+    return 0;
+}
+
+// 发送到客户端：先尝试直接写出，剩余部分进入待发送队列
+static int relay_send_client(RelayCtx* r, const char* data, int len) {
+    if (!pending_empty(&r->to_client)) return pending_append(&r->to_client, data, len);
+    int n = send_nb(r->s->clientSock, data, len);
+    if (n < 0) return -1;
+    return pending_append(&r->to_client, data + n, len - n);
+}
+
+// [New] 发送到远端 (TLS)：与 relay_send_client 对称，TLS 层暂不接受的部分进入 to_remote 队列
+// 队列中只存放完整的 WS 帧 / 明文块，心跳帧追加在其后，不会插入到帧中间
+static int relay_send_remote(RelayCtx* r, const char* data, int len) {
+    if (!pending_empty(&r->to_remote)) return pending_append(&r->to_remote, data, len);
+    int n = tls_write_nb(&r->s->tls, data, len);
+    if (n < 0) return -1;
+    return pending_append(&r->to_remote, data + n, len - n);
+}
 
-    // 2. 状态处理
-    if (idx != -1) {
-        if (s_dnsCache[idx].state == 1) { // Hit & Ready
-            *out_addr = s_dnsCache[idx].ip;
-            LeaveCriticalSection(&s_dnsLock);
-            return 0;
-        } else if (s_dnsCache[idx].state == 2) { // Resolving
-            LeaveCriticalSection(&s_dnsLock);
-            return -1; // 正在解析中，通知调用者丢包/等待
+// 远端可写：先排空引擎中的密文，再继续写入队列。返回 0=继续, -1=连接错误
+static int relay_flush_remote(RelayCtx* r) {
+    if (tls_flush_nb(&r->s->tls) < 0) return -1;
+    RelayPending* p = &r->to_remote;
+    if (pending_empty(p)) return 0;
+    int n = tls_write_nb(&r->s->tls, p->data + p->off, p->len - p->off);
+    if (n < 0) return -1;
+    pending_consume(p, n);
+    return 0;
+}
+
+// [New] 半关闭传递：某方向读到 FIN 且该方向的待发送数据已写完后，向目标端转发结束，反方向继续转发
+// 返回 1=会话已结束 (直连为两个方向都已结束；隧道为下行已结束), 0=继续, -1=连接错误
+static int relay_propagate_fin(RelayCtx* r) {
+    ProxySession* s = r->s;
+
+    if (r->client_eof && !r->up_shut && pending_empty(&r->to_remote)) {
+        r->up_shut = TRUE;
+        if (r->mode == RELAY_MODE_TCP_DIRECT) {
+            shutdown(s->remoteSock, SD_SEND);
+        } else if (r->mode == RELAY_MODE_MUX) {
+            MuxPool_CloseWrite(s); // 流级 FIN，隧道上的其他流不受影响
+        } else if (r->mode == RELAY_MODE_H2) {
+            // 流级 END_STREAM 由 data provider 在暂存数据发完后发出 (h2_browser_eof)，连接上的其他流不受影响
+        } else if (s->is_ws_transport) {
+            // WS 没有单向结束：Close 帧会让服务端关闭整个连接。上行到此为止，下行照常转发直到远端结束
+        } else if (tls_shutdown_write(&s->tls) < 0) {
+            return -1;
         }
     }
+    if (r->remote_eof && !r->down_shut && pending_empty(&r->to_client)) {
+        r->down_shut = TRUE;
+        shutdown(s->clientSock, SD_SEND);
+    }
 
-    // 3. Cache Miss or Expired -> 发起异步解析
-    // 寻找可用槽位
-    if (idx == -1) {
-        if (empty_idx != -1) idx = empty_idx;
-        else idx = rand() % DNS_CACHE_SIZE; // 随机驱逐
-    }
-
-    // 初始化槽位为 Resolving
-    strncpy(s_dnsCache[idx].domain, host, 255);
-    s_dnsCache[idx].domain[255] = 0;
-    s_dnsCache[idx].state = 2; // Mark as Resolving
-    s_dnsCache[idx].expire_tick = now + 10000; // 临时超时，防止线程挂死导致槽位永久占用
-    
-    // 复制域名传递给线程
-    char* host_copy = _strdup(host);
-    if (host_copy) {
-        unsigned threadID;
-        uintptr_t hThread = _beginthreadex(NULL, 0, Thread_ResolveDNS, host_copy, 0, &threadID);
-        if (hThread) CloseHandle((HANDLE)hThread);
-        else free(host_copy);
-    } else {
-        s_dnsCache[idx].state = 0; // OOM Revert
+    if (r->mode == RELAY_MODE_TCP_DIRECT) return (r->up_shut && r->down_shut) ? 1 : 0;
+    return r->down_shut ? 1 : 0;
+}
+
+// 读缓冲按需借用：空闲时归还内存池，降低大量空闲长连接的内存占用
+static int relay_acquire_read_buf(ProxySession* s) {
+    if (s->ws_read_buf) return 0;
+    s->ws_read_buf = (char*)Pool_Alloc_16K();
+    if (!s->ws_read_buf) return -1;
+    s->ws_read_buf_is_pooled = 1;
+    s->ws_read_buf_cap = IO_BUFFER_SIZE;
+    s->ws_buf_len = 0;
+    return 0;
+}
+
+static void relay_release_read_buf(ProxySession* s) {
+    if (s->ws_read_buf && s->ws_read_buf_is_pooled && s->ws_buf_len == 0) {
+        Pool_Free_16K(s->ws_read_buf);
+        s->ws_read_buf = NULL;
     }
+}
 
-    LeaveCriticalSection(&s_dnsLock);
-    return -1; // Pending
+static void relay_release_session_buf(char** buf, int* is_pooled) {
+    if (!*buf) return;
+    if (*is_pooled) Pool_Free_16K(*buf);
+    else free(*buf);
+    *buf = NULL;
 }
 
-// --- 内部辅助函数 ---
+static void relay_finish(RelayCtx* r, const char* reason) {
+    if (r->finished) return;
+    r->finished = TRUE;
+
+    if (reason) log_msg("[Conn-%d] Relay closed: %s", r->s->clientSock, reason);
+
+    Reactor_Remove(r->hc);
+    Reactor_Remove(r->hr);
+    pending_free(&r->to_client);
+    pending_free(&r->to_remote);
+
+    r->s->relay = NULL;
+    InterlockedDecrement(&s_activeRelays);
+
+    RelayDoneCallback cb = r->on_done;
+    ProxySession* s = r->s;
+    void* arg = r->done_arg;
+    free(r);
 
-// [Safe] 安全的缓冲区扩容逻辑
-static int buffer_ensure_capacity(char** buf, int* cap, int* is_pooled, int current_len, int min_required) {
-    if (!buf || !cap || !is_pooled) return -1;
-    
-    if (*cap >= min_required) return 0;
-
-    size_t current_cap_sz = (size_t)*cap;
-    size_t min_req_sz = (size_t)min_required;
-    
-    // 1. 协议硬限制 (防止恶意大包导致 OOM)
-    if (min_req_sz > MAX_WS_FRAME_SIZE) {
-        log_msg("[Buffer] Request exceeds protocol limit: %zu", min_req_sz);
+    if (cb) cb(s, arg);
+}
+
+// 根据待发送队列与协议状态重新计算两端的关注事件
+static void relay_update_interest(RelayCtx* r) {
+    int ce = 0, re = 0;
+
+    switch (r->mode) {
+        case RELAY_MODE_TCP_DIRECT:
+            if (pending_empty(&r->to_remote) && !r->client_eof) ce |= REACTOR_EV_READ;
+            if (!pending_empty(&r->to_client)) ce |= REACTOR_EV_WRITE;
+            if (pending_empty(&r->to_client) && !r->remote_eof) re |= REACTOR_EV_READ;
+            if (!pending_empty(&r->to_remote)) re |= REACTOR_EV_WRITE;
+            break;
+        case RELAY_MODE_TLS:
+            if (pending_empty(&r->to_remote) && !r->client_eof) ce |= REACTOR_EV_READ;
+            if (!pending_empty(&r->to_client)) ce |= REACTOR_EV_WRITE;
+            else if (!r->remote_eof) re |= REACTOR_EV_READ;
+            if (!pending_empty(&r->to_remote) || TlsEngine_CipherOutPending(&r->s->tls) > 0) re |= REACTOR_EV_WRITE;
+            break;
+        case RELAY_MODE_H2:
+            if (r->s->h2_browser_len <= IO_BUFFER_SIZE - 1024 && r->s->h2_handshake_done == 1 && !r->client_eof) ce |= REACTOR_EV_READ;
+            if (!pending_empty(&r->to_client)) ce |= REACTOR_EV_WRITE;
+            if (r->s->h2_stream) break; // 共享连接的读写由连接池负责，背压依靠流控窗口
+            if (pending_empty(&r->to_client)) re |= REACTOR_EV_READ;
+            if (nghttp2_session_want_write(r->s->h2_sess) || TlsEngine_CipherOutPending(&r->s->tls) > 0) re |= REACTOR_EV_WRITE;
+            break;
+        case RELAY_MODE_UDP:
+            ce = REACTOR_EV_READ;
+            re = REACTOR_EV_READ;
+            break;
+        case RELAY_MODE_MUX:
+            // 对端窗口耗尽或隧道写满时暂停读取浏览器，窗口更新 / 隧道排空后由通知恢复
+            if (!r->client_eof && MuxPool_Writable(r->s) > 0) ce |= REACTOR_EV_READ;
+            if (!pending_empty(&r->to_client)) ce |= REACTOR_EV_WRITE;
+            break;
+    }
+
+    Reactor_SetEvents(r->hc, ce);
+    Reactor_SetEvents(r->hr, re);
+}
+
+// [New] 自适应心跳间隔：基础间隔保持随机 (15~50 秒)，连接持续空闲时每次放宽 1.5 倍直到上限，
+// 有数据往来后回到基础间隔。数据本身即可维持 NAT / CDN 连接状态，繁忙连接不会收到心跳
+static int relay_keepalive_interval(RelayCtx* r) {
+    int ms = get_next_keepalive_interval();
+    for (int i = 0; i < r->idle_pings && ms < KEEPALIVE_MAX_INTERVAL; i++) ms += ms / 2;
+    return (ms > KEEPALIVE_MAX_INTERVAL) ? KEEPALIVE_MAX_INTERVAL : ms;
+}
+
+// 定时器只在到期时按最新活动时间重新计算，数据收发路径不触碰定时器
+static void relay_schedule_keepalive(RelayCtx* r) {
+    ULONGLONG elapsed = Reactor_Now() - r->s->last_keepalive_tick;
+    int delay = (elapsed >= (ULONGLONG)r->s->next_keepalive_interval) ? 1 : (int)(r->s->next_keepalive_interval - elapsed);
+    Reactor_SetTimer(r->hr, delay);
+}
+
+// [New] 浏览器半关闭：上行结束，隧道模式在客户端句柄上启动半关闭计时 (该句柄的定时器在这些模式下未被占用)
+static void relay_mark_client_eof(RelayCtx* r) {
+    r->client_eof = TRUE;
+    r->last_activity = Reactor_Now();
+    if (r->mode == RELAY_MODE_TLS || r->mode == RELAY_MODE_H2) Reactor_SetTimer(r->hc, RELAY_HALF_CLOSE_TIMEOUT);
+}
+
+// [New] 半关闭计时到期：远端在 RELAY_HALF_CLOSE_TIMEOUT 内没有下发任何数据时视为不会再主动结束。返回 -1 表示连接应关闭
+static int relay_on_half_close_timer(RelayCtx* r) {
+    ULONGLONG idle = Reactor_Now() - r->last_activity;
+    if (idle >= RELAY_HALF_CLOSE_TIMEOUT) {
+        log_msg("[Conn-%d] No downstream data for %ds after browser half-close.", r->s->clientSock, RELAY_HALF_CLOSE_TIMEOUT / 1000);
         return -1;
     }
+    Reactor_SetTimer(r->hc, (int)(RELAY_HALF_CLOSE_TIMEOUT - idle));
+    return 0;
+}
+
+// 心跳到期处理。返回 -1 表示连接应关闭
+static int relay_on_keepalive(RelayCtx* r) {
+    ProxySession* s = r->s;
+    ULONGLONG now = Reactor_Now();
+
+    // [Fix] 浏览器已半关闭：不再发送心跳 (否则远端的 Pong 会一直维持隧道)，由半关闭计时决定何时结束
+    if (r->client_eof) return 0;
 
-    // 2. 扩容策略: 倍增 + 线性 + 4KB对齐
-    size_t new_cap_sz = (current_cap_sz == 0) ? 4096 : current_cap_sz;
-    
-    while (new_cap_sz < min_req_sz) {
-        if (new_cap_sz < 1048576) {
-            new_cap_sz *= 2; // < 1MB: 倍增
-        } else {
-            new_cap_sz += 1048576; // > 1MB: 线性增加 1MB
+    if (now - s->last_keepalive_tick >= (ULONGLONG)s->next_keepalive_interval) {
+        // 上次心跳之后没有任何数据：连接处于空闲，放宽下一次间隔
+        if (s->last_keepalive_tick == r->last_ping_tick) r->idle_pings++;
+        else r->idle_pings = 0;
+
+        if (r->mode == RELAY_MODE_H2) {
+            if (nghttp2_submit_ping(s->h2_sess, NGHTTP2_FLAG_NONE, NULL) == 0) {
+                if (nghttp2_session_send(s->h2_sess) != 0) return -1;
+            }
+        } else if (s->is_ws_transport) {
+            // [Fix] 仅当传输层为 WebSocket 时才发送 Ping 帧
+            char ping[8];
+            int ping_len = build_ws_ping_frame(ping);
+            if (relay_send_remote(r, ping, ping_len) < 0) return -1;
         }
+        s->last_keepalive_tick = now;
+        r->last_ping_tick = now;
+        s->next_keepalive_interval = relay_keepalive_interval(r);
+    }
+    relay_schedule_keepalive(r);
+    return 0;
+}
+
+// --- TCP 直连 ---
+
+// [Mod] 2026-10-16: 每个方向的待发送队列兼作"管道"：直接 recv 到队列缓冲后原地发送，
+// 未发完的部分留在原处等待可写，不再经过临时块中转与二次拷贝
+// [Mod] 2026-10-16: 读到 FIN 只标记该方向结束 (*eof)，由 relay_propagate_fin 在数据写完后转发
+static int direct_pump(RelayCtx* r, SOCKET from, SOCKET to, RelayPending* pend, BOOL* eof) {
+    if (!pending_empty(pend)) return 0; // 背压：对端尚未写完
+
+    if (pend->cap < IO_BUFFER_SIZE) {
+        char* nb = (char*)realloc(pend->data, IO_BUFFER_SIZE);
+        if (!nb) return -1;
+        pend->data = nb;
+        pend->cap = IO_BUFFER_SIZE;
+    }
+    pend->off = pend->len = 0;
+
+    int len = recv(from, pend->data, pend->cap, 0);
+    if (len == 0) { *eof = TRUE; return 0; }
+    if (len < 0) return (WSAGetLastError() == WSAEWOULDBLOCK) ? 0 : -1;
+
+    r->last_activity = Reactor_Now();
+    int n = send_nb(to, pend->data, len);
+    if (n < 0) return -1;
+    if (n < len) {
+        pend->off = n;
+        pend->len = len;
     }
-    
-    // 对齐到 4KB 边界
-    if (new_cap_sz % PAGE_ALIGN_SIZE != 0) {
-        new_cap_sz = ((new_cap_sz / PAGE_ALIGN_SIZE) + 1) * PAGE_ALIGN_SIZE;
-    }
-
-    // 最终兜底
-    if (new_cap_sz > MAX_WS_FRAME_SIZE) new_cap_sz = MAX_WS_FRAME_SIZE;
-    if (new_cap_sz < min_req_sz) return -1; // 无法满足
-
-    // 3. 执行分配
-    char* new_buf = NULL;
-    if (*is_pooled) {
-        // 从内存池迁移到堆
-        new_buf = (char*)malloc(new_cap_sz);
-        if (!new_buf) return -1;
-        
-        if (*buf && current_len > 0) {
-            memcpy(new_buf, *buf, current_len);
+    return 0;
+}
+
+static void on_direct_event(ReactorHandle* h, int ev, void* arg) {
+    RelayCtx* r = (RelayCtx*)arg;
+    if (ev & REACTOR_EV_ERROR) { relay_finish(r, NULL); return; }
+    ProxySession* s = r->s;
+    BOOL is_client = (h == r->hc);
+
+    if (ev & REACTOR_EV_TIMER) {
+        ULONGLONG idle = Reactor_Now() - r->last_activity;
+        if (idle >= TCP_DIRECT_IDLE_TIMEOUT) {
+            log_msg("[Conn-%d] Direct connection timed out (Idle > %ds).", s->clientSock, TCP_DIRECT_IDLE_TIMEOUT / 1000);
+            relay_finish(r, NULL);
+            return;
         }
-        
-        Pool_Free_16K(*buf); // 归还旧块
-        *is_pooled = 0;
-    } else {
-        // 堆上扩容
-        new_buf = (char*)realloc(*buf, new_cap_sz);
-        if (!new_buf) return -1; 
+        Reactor_SetTimer(h, (int)(TCP_DIRECT_IDLE_TIMEOUT - idle));
+    }
+
+    if (ev & REACTOR_EV_WRITE) {
+        RelayPending* out = is_client ? &r->to_client : &r->to_remote;
+        if (pending_flush(is_client ? s->clientSock : s->remoteSock, out) < 0) { relay_finish(r, NULL); return; }
+    }
+
+    if (ev & REACTOR_EV_READ) {
+        int rc = is_client ? direct_pump(r, s->clientSock, s->remoteSock, &r->to_remote, &r->client_eof)
+                           : direct_pump(r, s->remoteSock, s->clientSock, &r->to_client, &r->remote_eof);
+        if (rc < 0) { relay_finish(r, NULL); return; }
     }
 
-    *buf = new_buf;
-    *cap = (int)new_cap_sz;
+    if (relay_propagate_fin(r) != 0) { relay_finish(r, NULL); return; }
+    relay_update_interest(r);
+}
+
+// --- TLS / WebSocket 隧道 ---
+
+// --- [New] 2026-10-16: ws_read_buf 环形缓冲 ---
+// 读游标 rx_head + 有效长度 ws_buf_len 描述 [head, head+len) (模 cap)，逐帧前移游标而不搬移数据；
+// 帧头跨越回绕点时由 ws_parse_header_split 拼接解析，载荷按两段直接转发
+
+static int ring_tail(RelayCtx* r) {
+    ProxySession* s = r->s;
+    int t = r->rx_head + s->ws_buf_len;
+    return (t >= s->ws_read_buf_cap) ? t - s->ws_read_buf_cap : t;
+}
+
+// 返回尾部可连续写入的空间
+static int ring_write_space(RelayCtx* r, char** ptr) {
+    ProxySession* s = r->s;
+    if (s->ws_buf_len == 0) r->rx_head = 0; // 空时复位，获得最大连续空间
+    if (s->ws_buf_len >= s->ws_read_buf_cap) return 0;
+
+    int tail = ring_tail(r);
+    *ptr = s->ws_read_buf + tail;
+    return (tail >= r->rx_head) ? s->ws_read_buf_cap - tail : r->rx_head - tail;
+}
+
+// 取 [off, off+len) 对应的两段内存 (第二段在未回绕时为空)
+static void ring_segments(RelayCtx* r, int off, int len, char** p1, int* l1, char** p2, int* l2) {
+    ProxySession* s = r->s;
+    int start = r->rx_head + off;
+    if (start >= s->ws_read_buf_cap) start -= s->ws_read_buf_cap;
+
+    int first = s->ws_read_buf_cap - start;
+    if (first > len) first = len;
+    *p1 = s->ws_read_buf + start; *l1 = first;
+    *p2 = s->ws_read_buf;         *l2 = len - first;
+}
+
+static void ring_consume(RelayCtx* r, int n) {
+    ProxySession* s = r->s;
+    s->ws_buf_len -= n;
+    r->rx_head += n;
+    if (r->rx_head >= s->ws_read_buf_cap) r->rx_head -= s->ws_read_buf_cap;
+    if (s->ws_buf_len == 0) r->rx_head = 0;
+}
+
+static int ring_send_client(RelayCtx* r, int off, int len) {
+    char *p1, *p2; int l1, l2;
+    ring_segments(r, off, len, &p1, &l1, &p2, &l2);
+    if (l1 > 0 && relay_send_client(r, p1, l1) < 0) return -1;
+    if (l2 > 0 && relay_send_client(r, p2, l2) < 0) return -1;
     return 0;
 }
 
-// [Robust] 健壮的发送函数
-// [Fix] 修复超时逻辑：使用绝对截止时间 (Total Transmission Timeout) 防止低速攻击
-static int send_robust(SOCKET s, const char* data, int len) {
-    int total_sent = 0;
-    const ULONGLONG SEND_TIMEOUT_MS = 5000;
-    
-    // 设定绝对截止时间
-    ULONGLONG deadline_tick = GetTickCount64() + SEND_TIMEOUT_MS;
+// 解析并转发 ws_read_buf 中已完整的数据。返回 -1 表示连接应关闭
+static int tls_deliver_buffered(RelayCtx* r) {
+    ProxySession* s = r->s;
 
-    while (total_sent < len) {
-        // 检查总超时
-        if (GetTickCount64() > deadline_tick) {
-            return -1; // 强制超时
+    if (!s->is_ws_transport) {
+        // Raw TLS Mode: 直接透传收到的数据
+        if (s->ws_buf_len > 0) {
+            s->last_keepalive_tick = r->last_activity = Reactor_Now(); // 下行数据同样计入心跳活动
+            if (ring_send_client(r, 0, s->ws_buf_len) < 0) return -1;
+            ring_consume(r, s->ws_buf_len);
         }
+        return 0;
+    }
 
-        int n = send(s, data + total_sent, len - total_sent, 0);
-        
-        if (n > 0) {
-            total_sent += n;
-            // 注意：不再重置超时时间，要求必须在 SEND_TIMEOUT_MS 内发完所有数据
-        } else {
-            int err = WSAGetLastError();
-            if (err == WSAEWOULDBLOCK) {
-                // Socket 缓冲区满，使用 select 等待可写
-                fd_set wfd;
-                FD_ZERO(&wfd);
-                FD_SET(s, &wfd);
-                
-                // 计算剩余时间
-                ULONGLONG now = GetTickCount64();
-                if (now >= deadline_tick) return -1;
-                
-                long wait_ms = (long)(deadline_tick - now);
-                struct timeval tv;
-                tv.tv_sec = wait_ms / 1000;
-                tv.tv_usec = (wait_ms % 1000) * 1000;
-                
-                int sel_res = select(0, NULL, &wfd, NULL, &tv);
-                
-                if (sel_res > 0) {
-                    continue; // 可写，重试
-                } else if (sel_res == 0) {
-                    return -1; // select 超时
-                } else {
-                    return -1; // select 错误
+    // [New] 2026-10-16: 流式转发。帧头解析后载荷随到随转，只记录当前帧剩余字节数，
+    // 大帧不再整帧缓存，缓冲始终保持为 16K 内存池块
+    while (s->ws_buf_len > 0) {
+        char *p1, *p2; int l1, l2;
+
+        if (r->rx_frame_left == 0) {
+            // 等待帧头
+            WsFrameHeader fh;
+            ring_segments(r, 0, s->ws_buf_len, &p1, &l1, &p2, &l2);
+            int hl = ws_parse_header_split((unsigned char*)p1, l1, (unsigned char*)p2, l2, &fh);
+            if (hl < 0) return -1;
+            if (hl == 0) break; // 帧头未收全
+
+            // 处理控制帧 (Close)：下行结束，已转发的数据仍会写完
+            if (fh.opcode == 0x8) { r->remote_eof = TRUE; break; }
+
+            ring_consume(r, hl);
+            r->rx_frame_left = fh.payload_len;
+            r->rx_frame_pos = 0;
+            r->rx_frame_data = (fh.opcode <= 0x2); // Ping/Pong 载荷直接丢弃
+            r->rx_frame_masked = fh.masked;
+            memcpy(r->rx_frame_mask, fh.mask, 4);
+            continue;
+        }
+
+        int n = (r->rx_frame_left < s->ws_buf_len) ? (int)r->rx_frame_left : s->ws_buf_len;
+
+        if (r->rx_frame_data) {
+            if (r->is_vless && !s->vless_response_header_stripped && r->vless_skip == 0) {
+                // VLESS 响应头: [版本][附加长度 N][N 字节附加信息]，需先拿到前 2 字节
+                if (r->rx_frame_left < 2) {
+                    n = (int)r->rx_frame_left; // 与原逻辑一致：过短的载荷整体丢弃
+                    goto skip;
                 }
-            } else if (err == WSAEINTR) {
-                continue;
-            } else {
-                return -1; // 真正的网络错误
+                if (n < 2) break;
+                if (r->rx_frame_masked) {
+                    ring_segments(r, 0, 2, &p1, &l1, &p2, &l2);
+                    ws_mask_inplace((unsigned char*)p1, l1, r->rx_frame_mask, (size_t)r->rx_frame_pos);
+                    if (l2 > 0) ws_mask_inplace((unsigned char*)p2, l2, r->rx_frame_mask, (size_t)r->rx_frame_pos + l1);
+                    // 已解掩码的 2 字节随后一并跳过，不会被重复处理
+                }
+                ring_segments(r, 1, 1, &p1, &l1, &p2, &l2);
+                r->vless_skip = 2 + (unsigned char)(l1 ? p1[0] : p2[0]);
+                s->vless_response_header_stripped = 1;
             }
+            if (r->vless_skip > 0) {
+                if (n > r->vless_skip) n = r->vless_skip;
+                r->vless_skip -= n;
+                goto skip;
+            }
+
+            ring_segments(r, 0, n, &p1, &l1, &p2, &l2);
+            if (r->rx_frame_masked) {
+                ws_mask_inplace((unsigned char*)p1, l1, r->rx_frame_mask, (size_t)r->rx_frame_pos);
+                if (l2 > 0) ws_mask_inplace((unsigned char*)p2, l2, r->rx_frame_mask, (size_t)r->rx_frame_pos + l1);
+            }
+            if (l1 > 0 && relay_send_client(r, p1, l1) < 0) return -1;
+            if (l2 > 0 && relay_send_client(r, p2, l2) < 0) return -1;
+            s->last_keepalive_tick = r->last_activity = Reactor_Now(); // 只有数据帧计入活动 (Pong 不计)
         }
+
+    skip:
+        ring_consume(r, n);
+        r->rx_frame_left -= n;
+        r->rx_frame_pos += n;
     }
-    return total_sent;
+    return 0;
 }
 
-// --- [New] Keep-Alive 辅助函数 ---
+static int tls_pump_remote(RelayCtx* r) {
+    ProxySession* s = r->s;
 
-static int get_next_keepalive_interval() {
-    return 15000 + (rand() % 35001);
+    for (int i = 0; i < MAX_BURST_LOOPS; i++) {
+        if (relay_acquire_read_buf(s) != 0) return -1;
+
+        char* wp = NULL;
+        int space_left = ring_write_space(r, &wp);
+        if (space_left <= 0) return -1;
+
+        int len = tls_read(&s->tls, wp, space_left);
+        if (len < 0) { r->remote_eof = TRUE; break; } // close_notify / EOF
+        if (len == 0) break;
+
+        s->ws_buf_len += len;
+        if (tls_deliver_buffered(r) < 0) return -1;
+        if (r->remote_eof) break;
+        if (!pending_empty(&r->to_client)) break; // 客户端写满，等待可写后再继续
+        if (tls_pending(&s->tls) <= 0) break;
+    }
+
+    // SSL / 引擎缓冲中仍有可解密数据，Socket 不会再触发可读，需主动重新派发
+    if (!r->remote_eof && pending_empty(&r->to_client) && tls_pending(&s->tls) > 0) Reactor_Rearm(r->hr);
+    relay_release_read_buf(s);
+    return 0;
 }
 
-static int build_ws_ping_frame(char* buf) {
-    buf[0] = (char)0x89; // Fin=1, Opcode=9 (PING)
-    buf[1] = (char)0x80; // Mask=1, Len=0
-    *(int*)(buf + 2) = rand(); 
-    return 6; // 2 header + 4 mask
+// 把已暂存的浏览器数据作为一个 WS 帧 / 一条 TLS 记录发出
+static int tls_flush_upstream(RelayCtx* r, char* payload, int len) {
+    // [Fix] 根据传输层类型决定是否封装 WS 帧
+    if (r->s->is_ws_transport) {
+        int flen = 0;
+        char* frame = build_ws_frame_inplace(payload, len, &flen);
+        return relay_send_remote(r, frame, flen);
+    }
+    return relay_send_remote(r, payload, len);
 }
 
-// =========================================================================================
-// [Logic Branch New] UDP 直连转发循环
-// =========================================================================================
-void step_transfer_loop_udp_direct(ProxySession* s) {
-    if (s->udpSock == INVALID_SOCKET) return;
+// [Mod] 2026-10-16: 单块缓冲 + 帧头预留空间：浏览器数据收在 WS_FRAME_HEADROOM 之后，
+// 帧头直接写在载荷前方并原地掩码，不再经第二块缓冲整块拷贝
+// [New] 2026-10-16: 写合并。一次可读事件内连续 recv，把浏览器已到达的多次小写入攒成一批，
+// 攒满 (帧头 + 载荷 = 16K，恰好一条满尺寸 TLS 记录) 即发；浏览器暂无更多数据 (WSAEWOULDBLOCK) 时立即发出，不引入额外等待
+static int tls_pump_client(RelayCtx* r) {
+    ProxySession* s = r->s;
+    if (!pending_empty(&r->to_remote)) return 0; // 背压：上行尚未写完
 
-    log_msg("[Conn-%d] Entering UDP Direct Loop", s->clientSock);
-    
-    SOCKET tcp = s->clientSock;
-    SOCKET udp = s->udpSock;
-    
-    // 设置非阻塞
-    u_long mode = 1;
-    ioctlsocket(tcp, FIONBIO, &mode);
-    ioctlsocket(udp, FIONBIO, &mode);
-    
-    fd_set rfds;
-    struct timeval tv;
-    
-    // 复用 TCP 流程中的缓冲区
-    if (!s->c_buf || !s->ws_send_buf) return;
-    char* recv_buf = s->c_buf;
-    char* send_buf_wrapper = s->ws_send_buf;
-    int send_buf_cap = IO_BUFFER_SIZE; 
-    
-    while (g_proxyRunning) {
-        FD_ZERO(&rfds);
-        FD_SET(tcp, &rfds);
-        FD_SET(udp, &rfds);
-        
-        tv.tv_sec = 1; tv.tv_usec = 0; 
-        
-        int n = select(0, &rfds, NULL, NULL, &tv);
-        if (n < 0) break;
-        if (n == 0 && !g_proxyRunning) break;
-        
-        // 1. 监控 TCP 连接 (用于感知客户端断开)
-        if (FD_ISSET(tcp, &rfds)) {
-            char probe[16];
-            int rn = recv(tcp, probe, sizeof(probe), 0);
-            if (rn <= 0) { // FIN or Error
-                int err = WSAGetLastError();
-                if (rn == 0 || err != WSAEWOULDBLOCK) {
-                    break;
-                }
+    char* buf = (char*)Pool_Alloc_16K();
+    if (!buf) return -1;
+
+    int rc = 0;
+    char* payload = buf + WS_FRAME_HEADROOM;
+    int cap = IO_BUFFER_SIZE - WS_FRAME_HEADROOM;
+    int staged = 0;
+
+    for (int i = 0; i < MAX_BURST_LOOPS; i++) {
+        int len = recv(s->clientSock, payload + staged, cap - staged, 0);
+        if (len > 0) {
+            s->last_keepalive_tick = Reactor_Now();
+            staged += len;
+            if (staged == cap) {
+                if (tls_flush_upstream(r, payload, staged) < 0) { rc = -1; break; }
+                staged = 0;
+                if (!pending_empty(&r->to_remote)) break; // 远端写满，余下数据留在浏览器 Socket 中
             }
+            continue;
         }
-        
-        // 2. 处理 UDP 数据
-        if (FD_ISSET(udp, &rfds)) {
-            struct sockaddr_in src_addr;
-            int src_len = sizeof(src_addr);
-            int len = recvfrom(udp, recv_buf, IO_BUFFER_SIZE, 0, (struct sockaddr*)&src_addr, &src_len);
-            
-            if (len > 0) {
-                // A. 客户端 -> 目标
-                if (!s->has_client_udp_addr || 
-                    (memcmp(&src_addr.sin_addr, &s->client_udp_addr.sin_addr, 4) == 0 && 
-                     src_addr.sin_port == s->client_udp_addr.sin_port)) {
-                    
-                    if (!s->has_client_udp_addr) {
-                        memcpy(&s->client_udp_addr, &src_addr, sizeof(src_addr));
-                        s->has_client_udp_addr = 1;
-                    }
-                    
-                    if (len < 10) continue; 
-                    if (recv_buf[0] != 0x00 || recv_buf[1] != 0x00) continue; 
-                    if (recv_buf[2] != 0x00) continue; 
-                    
-                    int header_len = 0;
-                    struct sockaddr_in target;
-                    memset(&target, 0, sizeof(target));
-                    target.sin_family = AF_INET;
-                    
-                    if (recv_buf[3] == 0x01) { // IPv4
-                        memcpy(&target.sin_addr, &recv_buf[4], 4);
-                        target.sin_port = *(unsigned short*)&recv_buf[8]; 
-                        header_len = 10;
-                    } else if (recv_buf[3] == 0x03) { // Domain
-                        int dlen = (unsigned char)recv_buf[4];
-                        if (len < 5 + dlen + 2) continue;
-                        
-                        char domain[256];
-                        memcpy(domain, &recv_buf[5], dlen); domain[dlen] = 0;
-                        
-                        // [Fix] 使用异步缓存解析，避免阻塞循环
-                        struct in_addr resolved_ip;
-                        int res_ret = resolve_hostname_cached(domain, &resolved_ip);
-                        
-                        if (res_ret == 0) {
-                            target.sin_addr = resolved_ip;
-                        } else {
-                            // -1 表示正在解析或解析失败。
-                            // 由于 UDP 是无连接且允许丢包的，我们在此处丢弃该包。
-                            // 客户端超时后会重试，届时缓存可能已就绪 (DNS Thread done).
-                            continue; 
-                        }
-                        
-                        target.sin_port = *(unsigned short*)&recv_buf[5 + dlen];
-                        header_len = 5 + dlen + 2;
-                    } else {
-                        continue; 
-                    }
-                    
-                    if (len > header_len) {
-                        sendto(udp, recv_buf + header_len, len - header_len, 0, (struct sockaddr*)&target, sizeof(target));
-                    }
-                } 
-                // B. 目标 -> 客户端
-                else {
-                    if (!s->has_client_udp_addr) continue; 
-                    
-                    int payload_len = len;
-                    int hlen = 0;
-                    send_buf_wrapper[hlen++] = 0x00; send_buf_wrapper[hlen++] = 0x00; 
-                    send_buf_wrapper[hlen++] = 0x00; 
-                    send_buf_wrapper[hlen++] = 0x01; // IPv4
-                    memcpy(&send_buf_wrapper[hlen], &src_addr.sin_addr, 4); hlen += 4;
-                    memcpy(&send_buf_wrapper[hlen], &src_addr.sin_port, 2); hlen += 2;
-                    
-                    if (hlen + payload_len <= send_buf_cap) {
-                        memcpy(send_buf_wrapper + hlen, recv_buf, payload_len);
-                        sendto(udp, send_buf_wrapper, hlen + payload_len, 0, (struct sockaddr*)&s->client_udp_addr, sizeof(s->client_udp_addr));
-                    }
-                }
-            }
+        if (len == 0) {
+            // [New] 浏览器半关闭：上行结束，下行继续
+            relay_mark_client_eof(r);
+        } else if (WSAGetLastError() != WSAEWOULDBLOCK) {
+            rc = -1;
         }
+        break; // 浏览器空闲
     }
+
+    // FIN / 连接关闭前同样先把已收到的数据发出
+    if (staged > 0 && tls_flush_upstream(r, payload, staged) < 0) rc = -1;
+
+    Pool_Free_16K(buf);
+    return rc;
 }
 
-// =========================================================================================
-// [Logic Branch Direct] TCP 直连透传循环 (No TLS, No WS)
-// [Fix] 增加 Idle Timeout 逻辑，防止僵尸连接
-// =========================================================================================
-static void step_transfer_loop_tcp_direct(ProxySession* s) {
-    u_long mode = 1; 
-    ioctlsocket(s->clientSock, FIONBIO, &mode); 
-    ioctlsocket(s->remoteSock, FIONBIO, &mode);
-
-    // [New] 开启 TCP Keep-Alive 以增强底层保活
-    BOOL opt = TRUE;
-    setsockopt(s->clientSock, SOL_SOCKET, SO_KEEPALIVE, (const char*)&opt, sizeof(BOOL));
-    setsockopt(s->remoteSock, SOL_SOCKET, SO_KEEPALIVE, (const char*)&opt, sizeof(BOOL));
-
-    log_msg("[Conn-%d] Entering TCP Direct Loop (Raw Forwarding)", s->clientSock);
-
-    fd_set fds; 
-    struct timeval tv; 
-    
-    // 使用 session 的 buffer
-    char* buf = s->c_buf; 
-    int buf_cap = IO_BUFFER_SIZE;
-    
-    // [New] 活跃时间追踪
-    ULONGLONG last_activity_tick = GetTickCount64();
-
-    while(g_proxyRunning) {
-        FD_ZERO(&fds); 
-        FD_SET(s->clientSock, &fds); 
-        FD_SET(s->remoteSock, &fds);
-        
-        tv.tv_sec = 0; tv.tv_usec = 50000; // 50ms
-        
-        int n = select(0, &fds, NULL, NULL, &tv);
-        if (n < 0) break; 
-        
-        // 检查空闲超时
-        if (n == 0) {
-            if (!g_proxyRunning) break;
-            
-            // 如果超时未活动，断开连接
-            if (GetTickCount64() - last_activity_tick > TCP_DIRECT_IDLE_TIMEOUT) {
-                log_msg("[Conn-%d] Direct connection timed out (Idle > %ds).", s->clientSock, TCP_DIRECT_IDLE_TIMEOUT / 1000);
-                break;
-            }
-            continue; 
-        }
-        
-        // 1. Client -> Remote (Direct)
-        if (FD_ISSET(s->clientSock, &fds)) {
-            int len = recv(s->clientSock, buf, buf_cap, 0);
-            if (len > 0) {
-                if (send_robust(s->remoteSock, buf, len) < 0) break;
-                last_activity_tick = GetTickCount64(); // 更新活跃时间
-            } else if (len == 0) {
-                break; // Client closed
-            } else {
-                if (WSAGetLastError() != WSAEWOULDBLOCK) break;
+static void on_tls_event(ReactorHandle* h, int ev, void* arg) {
+    RelayCtx* r = (RelayCtx*)arg;
+    if (ev & REACTOR_EV_ERROR) { relay_finish(r, NULL); return; }
+    BOOL is_client = (h == r->hc);
+
+    // 远端句柄的定时器为心跳，客户端句柄的定时器为半关闭计时
+    if ((ev & REACTOR_EV_TIMER) && (is_client ? relay_on_half_close_timer(r) : relay_on_keepalive(r)) < 0) { relay_finish(r, NULL); return; }
+
+    if (is_client) {
+        if (ev & REACTOR_EV_WRITE) {
+            if (pending_flush(r->s->clientSock, &r->to_client) < 0) { relay_finish(r, NULL); return; }
+            // 客户端排空后继续处理已缓冲的帧
+            if (pending_empty(&r->to_client) && r->s->ws_buf_len > 0) {
+                if (tls_deliver_buffered(r) < 0) { relay_finish(r, NULL); return; }
             }
+            if (!r->remote_eof && pending_empty(&r->to_client) && r->s->tls.ssl && tls_pending(&r->s->tls) > 0) Reactor_Rearm(r->hr);
         }
-        
-        // 2. Remote -> Client (Direct)
-        if (FD_ISSET(s->remoteSock, &fds)) {
-            int len = recv(s->remoteSock, buf, buf_cap, 0);
-            if (len > 0) {
-                if (send_robust(s->clientSock, buf, len) < 0) break;
-                last_activity_tick = GetTickCount64(); // 更新活跃时间
-            } else if (len == 0) {
-                break; // Remote closed
-            } else {
-                if (WSAGetLastError() != WSAEWOULDBLOCK) break;
-            }
+        if ((ev & REACTOR_EV_READ) && !r->client_eof && tls_pump_client(r) < 0) { relay_finish(r, NULL); return; }
+    } else {
+        if ((ev & REACTOR_EV_WRITE) && relay_flush_remote(r) < 0) { relay_finish(r, NULL); return; }
+        if ((ev & REACTOR_EV_READ) && !r->remote_eof && pending_empty(&r->to_client) && tls_pump_remote(r) < 0) { relay_finish(r, NULL); return; }
+    }
+
+    if (relay_propagate_fin(r) != 0) { relay_finish(r, NULL); return; }
+    relay_update_interest(r);
+}
+
+// --- HTTP/2 隧道 ---
+
+static int h2_pump_remote(RelayCtx* r) {
+    ProxySession* s = r->s;
+
+    for (int i = 0; i < MAX_BURST_LOOPS; i++) {
+        if (relay_acquire_read_buf(s) != 0) return -1;
+
+        int len = tls_read(&s->tls, s->ws_read_buf, s->ws_read_buf_cap);
+        if (len < 0) return -1;
+        if (len == 0) break;
+
+        int rv = nghttp2_session_mem_recv(s->h2_sess, (uint8_t*)s->ws_read_buf, len);
+        if (rv < 0) {
+            log_msg("[H2] mem_recv error: %s", nghttp2_strerror(rv));
+            return -1;
         }
+        if (!pending_empty(&r->to_client)) break;
+        if (tls_pending(&s->tls) <= 0) break;
     }
+
+    if (pending_empty(&r->to_client) && tls_pending(&s->tls) > 0) Reactor_Rearm(r->hr);
+    relay_release_read_buf(s);
+    return 0;
 }
 
-// =========================================================================================
-// [Logic Branch 1] HTTP/1.1 传输循环 (含 Direct 分流)
-// =========================================================================================
-void step_transfer_loop_h1(ProxySession* s) {
-    // [Fix] 检查是否为直连模式，如果是，则跳转到纯 TCP 循环
-    if (_stricmp(s->config.type, "direct") == 0) {
-        step_transfer_loop_tcp_direct(s);
+static int h2_pump_client(RelayCtx* r) {
+    ProxySession* s = r->s;
+    int max_read = IO_BUFFER_SIZE - s->h2_browser_len;
+    if (max_read > IO_BUFFER_SIZE / 2) max_read = IO_BUFFER_SIZE / 2;
+    if (max_read <= 0) return 0;
+
+    int len = recv(s->clientSock, s->h2_browser_buf + s->h2_browser_len, max_read, 0);
+    if (len > 0) {
+        s->h2_browser_len += len;
+        s->last_keepalive_tick = Reactor_Now();
+        nghttp2_session_resume_data(s->h2_sess, s->h2_stream_id);
+        return 0;
+    }
+    if (len == 0) {
+        // [New] 浏览器半关闭：暂存数据发完后结束流的上行 (END_STREAM)，下行继续直到服务端结束流
+        s->h2_browser_eof = 1;
+        relay_mark_client_eof(r);
+        nghttp2_session_resume_data(s->h2_sess, s->h2_stream_id);
+        return 0;
+    }
+    if (WSAGetLastError() != WSAEWOULDBLOCK) return -1;
+    return 0;
+}
+
+static void on_h2_event(ReactorHandle* h, int ev, void* arg) {
+    RelayCtx* r = (RelayCtx*)arg;
+    if (ev & REACTOR_EV_ERROR) { relay_finish(r, NULL); return; }
+    ProxySession* s = r->s;
+    BOOL is_client = (h == r->hc);
+
+    if ((ev & REACTOR_EV_TIMER) && (is_client ? relay_on_half_close_timer(r) : relay_on_keepalive(r)) < 0) { relay_finish(r, NULL); return; }
+
+    if (is_client) {
+        if (ev & REACTOR_EV_WRITE) {
+            int queued = pending_size(&r->to_client);
+            if (pending_flush(s->clientSock, &r->to_client) < 0) { relay_finish(r, NULL); return; }
+            if (s->h2_stream) H2Pool_Consume(s, queued - pending_size(&r->to_client));
+            else if (pending_empty(&r->to_client) && tls_pending(&s->tls) > 0) Reactor_Rearm(r->hr);
+        }
+        if ((ev & REACTOR_EV_READ) && !r->client_eof && h2_pump_client(r) < 0) { relay_finish(r, NULL); return; }
+    } else {
+        if ((ev & REACTOR_EV_WRITE) && tls_flush_nb(&s->tls) < 0) { relay_finish(r, NULL); return; }
+        if ((ev & REACTOR_EV_READ) && pending_empty(&r->to_client) && h2_pump_remote(r) < 0) { relay_finish(r, NULL); return; }
+    }
+
+    if (s->h2_stream) {
+        // 共享连接：帧由连接池冲刷；流结束后先把已收到的下行数据写完再关闭
+        if (H2Pool_Flush(s) < 0) { relay_finish(r, NULL); return; }
+        if (s->h2_handshake_done != 1 && pending_empty(&r->to_client)) { relay_finish(r, NULL); return; }
+        relay_update_interest(r);
+        return;
+    }
+
+    // 统一在事件末尾冲刷 nghttp2 输出 (DATA/WINDOW_UPDATE/PING ACK 等)
+    if (nghttp2_session_want_write(s->h2_sess)) {
+        int rv = nghttp2_session_send(s->h2_sess);
+        if (rv != 0 && rv != NGHTTP2_ERR_WOULDBLOCK) { relay_finish(r, NULL); return; }
+    }
+
+    // 流结束 (服务端 END_STREAM / RST) 后与共享连接一致：先把已收到的下行数据写完再关闭
+    if ((s->h2_handshake_done != 1 ||
+         (!nghttp2_session_want_read(s->h2_sess) && !nghttp2_session_want_write(s->h2_sess))) &&
+        pending_empty(&r->to_client)) {
+        relay_finish(r, NULL);
         return;
     }
 
-    // 确保 Socket 为非阻塞
-    u_long mode = 1; 
-    ioctlsocket(s->clientSock, FIONBIO, &mode); 
-    ioctlsocket(s->remoteSock, FIONBIO, &mode);
-    
-    // [New] 初始化 Keep-Alive
-    s->last_keepalive_tick = GetTickCount64();
-    s->next_keepalive_interval = get_next_keepalive_interval();
-
-    fd_set fds; 
-    struct timeval tv; 
-    BOOL is_vless = (_stricmp(s->config.type, "vless") == 0);
-    int burst_limit = 0;
-
-    // [Fix] 自动检测 WS 模式（如果未在握手时显式设置）
-    // 为了兼容性，如果 ws_send_buf 存在且配置暗示 WS，则认为是 WS。
-    // 但更安全的是依赖 s->is_ws_transport (由调用者/握手设置)。
-    // 这里做兜底：如果 is_ws_transport 为 0，但 ws_send_buf 已分配，我们假定调用者可能忘了设 flag，
-    // 除非 config 明确是 "tcp" 或 "grpc" 等非 WS 传输。
-    // 鉴于此函数主要用于 VMess-WS / HTTPS-Proxy，我们严格遵守 is_ws_transport。
-    // 如果 is_ws_transport 未初始化（旧代码路径），则保持原行为（视为 WS）可能会出错，
-    // 但根据指令我们只修复 Keep-Alive 逻辑。
-
-    while(g_proxyRunning) {
-        FD_ZERO(&fds); 
-        FD_SET(s->clientSock, &fds); 
-        FD_SET(s->remoteSock, &fds);
-        
-        // 必须判空保护，防止 SSL 尚未建立时访问 (虽然非直连模式下应已建立)
-        int pending = (s->tls.ssl) ? SSL_pending(s->tls.ssl) : 0;
-        
-        if (pending > 0 || burst_limit > 0) { 
-            tv.tv_sec = 0; tv.tv_usec = 0; 
-            if (burst_limit > 0) burst_limit--;
-        } else {
-            tv.tv_sec = 0; tv.tv_usec = 50000;
+    relay_update_interest(r);
+}
+
+// [New] 共享连接上的流状态变化 (下行数据入队、流关闭、连接失败)，由连接池在循环线程上回调
+static void relay_on_h2_stream(ProxySession* s) {
+    RelayCtx* r = s->relay;
+    if (!r || r->finished) return;
+    if (s->h2_handshake_done != 1 && pending_empty(&r->to_client)) { relay_finish(r, NULL); return; }
+    relay_update_interest(r);
+}
+
+// --- [New] 多路复用隧道上的流 ---
+
+// 流状态检查：重置 / 隧道断开立即结束；对端 FIN 在下行数据写完后转发给浏览器
+static void relay_mux_check(RelayCtx* r) {
+    int st = MuxPool_Status(r->s);
+    if (st < 0) { relay_finish(r, NULL); return; }
+    if (st > 0) r->remote_eof = TRUE;
+    if (relay_propagate_fin(r) != 0) { relay_finish(r, NULL); return; }
+    relay_update_interest(r);
+}
+
+// 浏览器数据按流控窗口读取，每次读取作为一个 DATA 帧写入隧道
+static int mux_pump_client(RelayCtx* r) {
+    ProxySession* s = r->s;
+    char* buf = (char*)Pool_Alloc_16K();
+    if (!buf) return -1;
+
+    int rc = 0;
+    for (int i = 0; i < MAX_BURST_LOOPS; i++) {
+        int room = MuxPool_Writable(s);
+        if (room <= 0) break; // 背压：等待窗口更新或隧道排空
+        if (room > IO_BUFFER_SIZE) room = IO_BUFFER_SIZE;
+
+        int len = recv(s->clientSock, buf, room, 0);
+        if (len > 0) {
+            s->last_keepalive_tick = Reactor_Now();
+            if (MuxPool_Write(s, buf, len) < 0) { rc = -1; break; }
+            continue;
         }
-        
-        int n = select(0, &fds, NULL, NULL, &tv);
-        if (n < 0) break; 
-        if (n == 0 && !g_proxyRunning) break; 
-        
-        // --- Keep-Alive 逻辑 ---
-        ULONGLONG now = GetTickCount64();
-        if (now - s->last_keepalive_tick >= (ULONGLONG)s->next_keepalive_interval) {
-            // [Fix] 仅当传输层为 WebSocket 时才发送 Ping 帧
-            // 对于纯 TCP/TLS 连接，发送 WS Ping 是非法数据
-            if (s->is_ws_transport) {
-                if (s->ws_send_buf && s->ws_send_buf_is_pooled || s->ws_send_buf) {
-                     int ping_len = build_ws_ping_frame(s->ws_send_buf);
-                     if (tls_write(&s->tls, s->ws_send_buf, ping_len) < 0) break;
-                }
-            }
-            s->last_keepalive_tick = now;
-            s->next_keepalive_interval = get_next_keepalive_interval();
+        if (len == 0) {
+            relay_mark_client_eof(r);
+        } else if (WSAGetLastError() != WSAEWOULDBLOCK) {
+            rc = -1;
         }
+        break;
+    }
+    Pool_Free_16K(buf);
+    return rc;
+}
 
-        int did_work = 0;
-
-        // 1. Browser -> Proxy (recv)
-        if (FD_ISSET(s->clientSock, &fds)) {
-            int max_recv = IO_BUFFER_SIZE - WS_FRAME_OVERHEAD;
-            if (max_recv < 1024) max_recv = 1024; 
-
-            int len = recv(s->clientSock, s->c_buf, max_recv, 0);
-            if (len > 0) {
-                did_work = 1;
-                s->last_keepalive_tick = GetTickCount64();
-
-                // [Fix] 根据传输层类型决定是否封装 WS 帧
-                if (s->is_ws_transport) {
-                    int flen = build_ws_frame(s->c_buf, len, s->ws_send_buf);
-                    if (tls_write(&s->tls, s->ws_send_buf, flen) < 0) break;
-                } else {
-                    // 纯 TLS 模式，直接发送原始数据
-                    if (tls_write(&s->tls, s->c_buf, len) < 0) break;
-                }
-            } else if (len == 0) {
-                break; 
+static void on_mux_event(ReactorHandle* h, int ev, void* arg) {
+    RelayCtx* r = (RelayCtx*)arg;
+    if (ev & REACTOR_EV_ERROR) { relay_finish(r, NULL); return; }
+    ProxySession* s = r->s;
+
+    if (ev & REACTOR_EV_WRITE) {
+        int queued = pending_size(&r->to_client);
+        if (pending_flush(s->clientSock, &r->to_client) < 0) { relay_finish(r, NULL); return; }
+        MuxPool_Consume(s, queued - pending_size(&r->to_client));
+    }
+    if ((ev & REACTOR_EV_READ) && !r->client_eof && mux_pump_client(r) < 0) { relay_finish(r, NULL); return; }
+    relay_mux_check(r);
+}
+
+// 隧道上的流状态变化 (下行数据入队、窗口更新、对端结束、隧道失败)，由隧道在循环线程上回调
+static void relay_on_mux_stream(ProxySession* s) {
+    RelayCtx* r = s->relay;
+    if (!r || r->finished) return;
+    relay_mux_check(r);
+}
+
+// --- UDP 直连 ---
+
+static int udp_pump(RelayCtx* r) {
+    ProxySession* s = r->s;
+    SOCKET udp = s->udpSock;
+    char* recv_buf = (char*)Pool_Alloc_16K();
+    char* send_buf_wrapper = (char*)Pool_Alloc_16K();
+    int send_buf_cap = IO_BUFFER_SIZE;
+
+    if (!recv_buf || !send_buf_wrapper) {
+        if (recv_buf) Pool_Free_16K(recv_buf);
+        if (send_buf_wrapper) Pool_Free_16K(send_buf_wrapper);
+        return -1;
+    }
+
+    for (int i = 0; i < MAX_BURST_LOOPS; i++) {
+        struct sockaddr_in src_addr;
+        int src_len = sizeof(src_addr);
+        int len = recvfrom(udp, recv_buf, IO_BUFFER_SIZE, 0, (struct sockaddr*)&src_addr, &src_len);
+        if (len <= 0) break; // WOULDBLOCK 或 ICMP 错误 (WSAECONNRESET)，均不终止会话
+
+        // A. 客户端 -> 目标
+        if (!s->has_client_udp_addr ||
+            (memcmp(&src_addr.sin_addr, &s->client_udp_addr.sin_addr, 4) == 0 &&
+             src_addr.sin_port == s->client_udp_addr.sin_port)) {
+
+            if (!s->has_client_udp_addr) {
+                memcpy(&s->client_udp_addr, &src_addr, sizeof(src_addr));
+                s->has_client_udp_addr = 1;
+            }
+
+            if (len < 10) continue;
+            if (recv_buf[0] != 0x00 || recv_buf[1] != 0x00) continue;
+            if (recv_buf[2] != 0x00) continue;
+
+            int header_len = 0;
+            struct sockaddr_in target;
+            memset(&target, 0, sizeof(target));
+            target.sin_family = AF_INET;
+
+            if (recv_buf[3] == 0x01) { // IPv4
+                memcpy(&target.sin_addr, &recv_buf[4], 4);
+                target.sin_port = *(unsigned short*)&recv_buf[8];
+                header_len = 10;
+            } else if (recv_buf[3] == 0x03) { // Domain
+                int dlen = (unsigned char)recv_buf[4];
+                if (len < 5 + dlen + 2) continue;
+
+                char domain[256];
+                memcpy(domain, &recv_buf[5], dlen); domain[dlen] = 0;
+
+                // [Fix] 使用异步缓存解析，避免阻塞事件循环
+                // -1 表示正在解析或解析失败，UDP 允许丢包，客户端重试时缓存可能已就绪
+                struct in_addr resolved_ip;
+                if (resolve_hostname_cached(domain, &resolved_ip) != 0) continue;
+                target.sin_addr = resolved_ip;
+
+                target.sin_port = *(unsigned short*)&recv_buf[5 + dlen];
+                header_len = 5 + dlen + 2;
             } else {
-                if (WSAGetLastError() != WSAEWOULDBLOCK) break;
+                continue;
             }
-        }
-        
-        // 2. Proxy -> Browser (tls_read)
-        if (FD_ISSET(s->remoteSock, &fds) || pending > 0) {
-            int space_left = s->ws_read_buf_cap - s->ws_buf_len;
-            
-            if (space_left > 0) {
-                int len = tls_read(&s->tls, s->ws_read_buf + s->ws_buf_len, space_left);
-                if (len < 0) break; 
-                if (len > 0) {
-                    s->ws_buf_len += len;
-                    did_work = 1;
-                }
+
+            if (len > header_len) {
+                sendto(udp, recv_buf + header_len, len - header_len, 0, (struct sockaddr*)&target, sizeof(target));
             }
-            
-            // [Fix] 分离 WS 解析逻辑与 Raw 数据逻辑
-            if (s->is_ws_transport) {
-                // 解析 WebSocket 帧
-                while (s->ws_buf_len > 0) {
-                    int hl, pl;
-                    long long frame_total = check_ws_frame((unsigned char*)s->ws_read_buf, s->ws_buf_len, &hl, &pl);
-                    
-                    int required_cap = 0;
-                    if (frame_total > 0) {
-                        if (frame_total > MAX_WS_FRAME_SIZE) goto loop_end; 
-                        if (frame_total > s->ws_read_buf_cap) required_cap = (int)frame_total;
-                    } else {
-                        if (s->ws_buf_len >= s->ws_read_buf_cap) {
-                             required_cap = (s->ws_read_buf_cap < INT_MAX / 2) ? s->ws_read_buf_cap * 2 : INT_MAX;
-                        }
-                    }
-
-                    if (required_cap > 0) {
-                        if (buffer_ensure_capacity(&s->ws_read_buf, &s->ws_read_buf_cap, &s->ws_read_buf_is_pooled, s->ws_buf_len, required_cap) != 0) {
-                            goto loop_end; // OOM
-                        }
-                        if (frame_total <= 0) break; 
-                    }
-
-                    if (frame_total <= 0 || frame_total > s->ws_buf_len) break; 
-                    
-                    // 处理控制帧
-                    if ((s->ws_read_buf[0] & 0x0F) == 0x8) goto loop_end; 
-                    
-                    // 处理数据帧
-                    if (((s->ws_read_buf[0] & 0x0F) <= 0x2) && pl > 0) {
-                        char* payload = s->ws_read_buf + hl; 
-                        int psize = pl;
-                        
-                        if (is_vless && !s->vless_response_header_stripped) {
-                             if (psize >= 2) {
-                                 int h = 2 + (unsigned char)payload[1];
-                                 if (psize >= h) { 
-                                     payload += h; psize -= h; 
-                                     s->vless_response_header_stripped = 1; 
-                                 } else psize = 0; 
-                             } else psize = 0;
-                        }
-                        
-                        if (psize > 0) {
-                            if (send_robust(s->clientSock, payload, psize) < 0) goto loop_end;
-                        }
-                    }
-                    
-                    int remaining = s->ws_buf_len - (int)frame_total;
-                    if (remaining > 0) memmove(s->ws_read_buf, s->ws_read_buf + frame_total, remaining);
-                    s->ws_buf_len = remaining;
-                    
-                    burst_limit = MAX_BURST_LOOPS;
-                }
-            } else {
-                // Raw TLS Mode: 直接透传收到的数据
-                if (s->ws_buf_len > 0) {
-                    if (send_robust(s->clientSock, s->ws_read_buf, s->ws_buf_len) < 0) goto loop_end;
-                    s->ws_buf_len = 0; // 全部发送完毕
-                    burst_limit = MAX_BURST_LOOPS;
-                }
+        }
+        // B. 目标 -> 客户端
+        else {
+            if (!s->has_client_udp_addr) continue;
+
+            int hlen = 0;
+            send_buf_wrapper[hlen++] = 0x00; send_buf_wrapper[hlen++] = 0x00;
+            send_buf_wrapper[hlen++] = 0x00;
+            send_buf_wrapper[hlen++] = 0x01; // IPv4
+            memcpy(&send_buf_wrapper[hlen], &src_addr.sin_addr, 4); hlen += 4;
+            memcpy(&send_buf_wrapper[hlen], &src_addr.sin_port, 2); hlen += 2;
+
+            if (hlen + len <= send_buf_cap) {
+                memcpy(send_buf_wrapper + hlen, recv_buf, len);
+                sendto(udp, send_buf_wrapper, hlen + len, 0, (struct sockaddr*)&s->client_udp_addr, sizeof(s->client_udp_addr));
             }
         }
     }
-loop_end:
-    return;
+
+    Pool_Free_16K(recv_buf);
+    Pool_Free_16K(send_buf_wrapper);
+    return 0;
 }
 
-// =========================================================================================
-// [Logic Branch 2] HTTP/2 传输循环
-// =========================================================================================
-void step_transfer_loop_h2(ProxySession* s) {
-    u_long mode = 1; 
-    ioctlsocket(s->clientSock, FIONBIO, &mode); 
-    ioctlsocket(s->remoteSock, FIONBIO, &mode);
-    
-    s->last_keepalive_tick = GetTickCount64();
-    s->next_keepalive_interval = get_next_keepalive_interval();
-    
-    fd_set read_fds, write_fds; 
-    struct timeval tv;
-    int burst_limit = 0;
-    
-    while(g_proxyRunning && s->h2_handshake_done == 1) {
-        FD_ZERO(&read_fds); FD_ZERO(&write_fds);
-        
-        int buffer_avail = IO_BUFFER_SIZE - s->h2_browser_len;
-        if (buffer_avail < 0) buffer_avail = 0;
-
-        if (buffer_avail >= 1024) { 
-            FD_SET(s->clientSock, &read_fds); 
-        }
+static void on_udp_event(ReactorHandle* h, int ev, void* arg) {
+    RelayCtx* r = (RelayCtx*)arg;
 
-        FD_SET(s->remoteSock, &read_fds);
-        
-        int pending = SSL_pending(s->tls.ssl);
-        
-        int want_write = nghttp2_session_want_write(s->h2_sess);
-        if (want_write) FD_SET(s->remoteSock, &write_fds);
-
-        if (pending > 0 || burst_limit > 0) { 
-            tv.tv_sec = 0; tv.tv_usec = 0; 
-            if (burst_limit > 0) burst_limit--;
-        } else {
-            tv.tv_sec = 0; tv.tv_usec = 50000;
-        }
+    if (ev & REACTOR_EV_ERROR) { relay_finish(r, NULL); return; }
 
-        int n = select(0, &read_fds, &write_fds, NULL, &tv);
-        if (n < 0) break;
-        if (n == 0 && !g_proxyRunning) break;
-        
-        // Keep-Alive
-        ULONGLONG now = GetTickCount64();
-        if (now - s->last_keepalive_tick >= (ULONGLONG)s->next_keepalive_interval) {
-            int rv = nghttp2_submit_ping(s->h2_sess, NGHTTP2_FLAG_NONE, NULL);
-            if (rv == 0) nghttp2_session_send(s->h2_sess); 
-            s->last_keepalive_tick = now;
-            s->next_keepalive_interval = get_next_keepalive_interval();
+    if (h == r->hc) {
+        // 监控 TCP 控制连接 (用于感知客户端断开)
+        if (ev & REACTOR_EV_READ) {
+            char probe[16];
+            int rn = recv(r->s->clientSock, probe, sizeof(probe), 0);
+            if (rn == 0 || (rn < 0 && WSAGetLastError() != WSAEWOULDBLOCK)) { relay_finish(r, NULL); return; }
         }
+    } else if (ev & REACTOR_EV_READ) {
+        if (udp_pump(r) < 0) { relay_finish(r, NULL); return; }
+    }
+}
 
-        int did_work = 0;
-
-        // 1. Browser -> H2 Buffer
-        if (FD_ISSET(s->clientSock, &read_fds)) {
-            int max_read = buffer_avail;
-            if (max_read > IO_BUFFER_SIZE / 2) max_read = IO_BUFFER_SIZE / 2;
-            
-            if (max_read > 0) {
-                int len = recv(s->clientSock, s->h2_browser_buf + s->h2_browser_len, max_read, 0);
-                if (len > 0) {
-                    did_work = 1;
-                    s->h2_browser_len += len;
-                    s->last_keepalive_tick = GetTickCount64();
-                    nghttp2_session_resume_data(s->h2_sess, s->h2_stream_id);
-                } else if (len == 0) {
-                    break; 
-                } else {
-                    if (WSAGetLastError() != WSAEWOULDBLOCK) break;
-                }
-            }
-        }
+// --- 注册与生命周期 ---
 
-        // 2. H2 Send -> TLS
-        if (want_write) {
-            if (FD_ISSET(s->remoteSock, &write_fds)) {
-                 int rv = nghttp2_session_send(s->h2_sess);
-                 if (rv != 0 && rv != NGHTTP2_ERR_WOULDBLOCK) break;
-                 if (rv == 0) did_work = 1;
-            }
-        }
+static void relay_register(void* arg) {
+    RelayCtx* r = (RelayCtx*)arg;
+    ProxySession* s = r->s;
+    ReactorCallback cb = NULL;
+    SOCKET remote = s->remoteSock;
 
-        // 3. TLS Read -> H2 Recv
-        if (FD_ISSET(s->remoteSock, &read_fds) || pending > 0) {
-            int len = tls_read(&s->tls, s->ws_read_buf, s->ws_read_buf_cap);
-            if (len < 0) break; 
-            if (len > 0) {
-                did_work = 1;
-                int rv = nghttp2_session_mem_recv(s->h2_sess, (uint8_t*)s->ws_read_buf, len);
-                if (rv < 0) {
-                    log_msg("[H2] mem_recv error: %s", nghttp2_strerror(rv));
-                    break;
-                }
-            }
+    switch (r->mode) {
+        case RELAY_MODE_TCP_DIRECT: cb = on_direct_event; break;
+        case RELAY_MODE_TLS:        cb = on_tls_event; break;
+        case RELAY_MODE_H2:         cb = on_h2_event; break;
+        case RELAY_MODE_UDP:        cb = on_udp_event; remote = s->udpSock; break;
+        case RELAY_MODE_MUX:        cb = on_mux_event; break;
+    }
+
+    r->hc = Reactor_Add(r->loop, s->clientSock, REACTOR_EV_READ, cb, r);
+    if (r->hc && s->h2_stream) {
+        // [New] 共享 H2 连接：远端句柄与连接级保活归连接池，这里只关注浏览器一侧
+        H2Pool_SetNotify(s, relay_on_h2_stream);
+        relay_update_interest(r);
+        relay_on_h2_stream(s); // 注册前流可能已结束
+        return;
+    }
+    if (r->hc && r->mode == RELAY_MODE_MUX) {
+        // [New] 多路复用：隧道句柄与保活归隧道池
+        MuxPool_SetNotify(s, relay_on_mux_stream);
+        relay_on_mux_stream(s);
+        return;
+    }
+    r->hr = r->hc ? Reactor_Add(r->loop, remote, REACTOR_EV_READ, cb, r) : NULL;
+    if (!r->hc || !r->hr) {
+        relay_finish(r, "reactor registration failed");
+        return;
+    }
+
+    if (r->mode == RELAY_MODE_TCP_DIRECT) {
+        log_msg("[Conn-%d] Entering TCP Direct Relay (Raw Forwarding)", s->clientSock);
+        Reactor_SetTimer(r->hc, TCP_DIRECT_IDLE_TIMEOUT);
+    } else if (r->mode == RELAY_MODE_TLS || r->mode == RELAY_MODE_H2) {
+        // [New] 逐连接报告 kTLS 卸载是否生效 (仅在开启时输出)
+        if (s->tls.ktls & TLS_KTLS_REQUESTED) {
+            log_msg("[Conn-%d] kTLS offload: %s", s->clientSock, tls_ktls_status(&s->tls));
         }
+        relay_schedule_keepalive(r);
+        relay_update_interest(r);
+        // 握手阶段可能已有数据留在 SSL 缓冲或 ws_read_buf 中
+        if (s->ws_buf_len > 0 || tls_pending(&s->tls) > 0) Reactor_Rearm(r->hr);
+    }
+}
+
+static void relay_rio_done(ProxySession* s, void* arg) {
+    relay_finish((RelayCtx*)arg, NULL);
+}
+
+int Relay_Start(ProxySession* s, RelayMode mode, RelayDoneCallback on_done, void* arg) {
+    if (!s || s->clientSock == INVALID_SOCKET) return -1;
+    // 共享 H2 连接上的流没有独占的远端 Socket / TLS
+    BOOL shared_h2 = (mode == RELAY_MODE_H2 && s->h2_stream);
+    if (mode == RELAY_MODE_MUX) {
+        if (!s->mux_stream) return -1;
+    } else {
+        if (mode == RELAY_MODE_UDP ? (s->udpSock == INVALID_SOCKET) : (!shared_h2 && s->remoteSock == INVALID_SOCKET)) return -1;
+        if ((mode == RELAY_MODE_TLS || mode == RELAY_MODE_H2) && !shared_h2 && !s->tls.ssl) return -1;
+        if (mode == RELAY_MODE_H2 && !s->h2_sess) return -1;
+    }
+
+    if (!Reactor_IsRunning() && Reactor_Init(0) != 0) return -1;
 
-        if (did_work) burst_limit = MAX_BURST_LOOPS;
+    // [New] 连接上限不再受 FD_SETSIZE 约束，由活跃中继计数单独限制
+    if (InterlockedIncrement(&s_activeRelays) > MAX_CONNECTIONS) {
+        InterlockedDecrement(&s_activeRelays);
+        log_msg("[Conn-%d] Relay rejected: too many active connections (%d)", s->clientSock, MAX_CONNECTIONS);
+        return -1;
     }
+
+    RelayCtx* r = (RelayCtx*)calloc(1, sizeof(RelayCtx));
+    if (!r) { InterlockedDecrement(&s_activeRelays); return -1; }
+
+    r->s = s;
+    r->mode = mode;
+    // 流必须与所属连接 / 隧道在同一循环
+    if (shared_h2) r->loop = H2Pool_GetLoop(s);
+    else if (mode == RELAY_MODE_MUX) r->loop = MuxPool_GetLoop(s);
+    else r->loop = Reactor_PickLoop();
+    r->is_vless = (_stricmp(s->config.type, "vless") == 0);
+    r->last_activity = GetTickCount64();
+    r->on_done = on_done;
+    r->done_arg = arg;
+
+    u_long nb = 1;
+    ioctlsocket(s->clientSock, FIONBIO, &nb);
+    if (mode == RELAY_MODE_UDP) {
+        ioctlsocket(s->udpSock, FIONBIO, &nb);
+    } else if (!shared_h2 && mode != RELAY_MODE_MUX) {
+        ioctlsocket(s->remoteSock, FIONBIO, &nb);
+    }
+
+    if (mode == RELAY_MODE_TCP_DIRECT) {
+        // [New] 开启 TCP Keep-Alive 以增强底层保活
+        BOOL opt = TRUE;
+        setsockopt(s->clientSock, SOL_SOCKET, SO_KEEPALIVE, (const char*)&opt, sizeof(BOOL));
+        setsockopt(s->remoteSock, SOL_SOCKET, SO_KEEPALIVE, (const char*)&opt, sizeof(BOOL));
+    }
+    if (mode == RELAY_MODE_TLS || mode == RELAY_MODE_H2) {
+        s->last_keepalive_tick = GetTickCount64();
+        s->next_keepalive_interval = get_next_keepalive_interval();
+    }
+
+    // 握手阶段使用的收发缓冲在转发阶段改为按事件临时借用，提前归还内存池
+    relay_release_session_buf(&s->c_buf, &s->c_buf_is_pooled);
+    relay_release_session_buf(&s->ws_send_buf, &s->ws_send_buf_is_pooled);
+    if (mode == RELAY_MODE_TCP_DIRECT || mode == RELAY_MODE_UDP || mode == RELAY_MODE_MUX || shared_h2) {
+        relay_release_session_buf(&s->ws_read_buf, &s->ws_read_buf_is_pooled);
+        s->ws_buf_len = 0;
+    }
+
+    s->relay = r;
+
+    // [New] 直连模式优先走 Registered I/O 批量数据面，不可用时回退到 Reactor
+    if (mode == RELAY_MODE_TCP_DIRECT && Rio_StartDirect(s, relay_rio_done, r) == 0) {
+        return 0;
+    }
+
+    if (Reactor_Post(r->loop, relay_register, r) != 0) {
+        s->relay = NULL;
+        InterlockedDecrement(&s_activeRelays);
+        free(r);
+        return -1;
+    }
+    return 0;
+}
+
+// [New] H2 数据回调使用：在事件循环中以非阻塞方式写往客户端
+int Relay_SendToClient(ProxySession* s, const char* data, int len) {
+    if (!s || !s->relay) return -1;
+    s->last_keepalive_tick = s->relay->last_activity = Reactor_Now(); // 下行数据同样计入心跳与半关闭计时
+    RelayPending* p = &s->relay->to_client;
+    int queued = pending_size(p);
+    if (relay_send_client(s->relay, data, len) < 0) return -1;
+    // [New] 共享连接：已直接写给浏览器的部分立即归还窗口，其余在写出后归还
+    if (s->h2_stream) H2Pool_Consume(s, len - (pending_size(p) - queued));
+    else if (s->mux_stream) MuxPool_Consume(s, len - (pending_size(p) - queued));
+    return 0;
+}
+
+LONG Relay_GetActiveCount(void) {
+    return s_activeRelays;
 }
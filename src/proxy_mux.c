@@ -0,0 +1,849 @@
+/* src/proxy_mux.c */
+// [New] 2026-10-16: 隧道多路复用 (sing-box mux 协议，yamux 帧)，替代"每个浏览器连接一条 TCP + TLS + WS 升级"
+// 设计要点:
+// 1. 隧道的建立与普通连接相同 (TLS + 可选 WS 升级 + 代理协议头)，只是协议头的目标为 sp.mux.sing-box.arpa:444；
+//    随后发送会话请求 [版本 0][协议 2 = yamux]，此后隧道内的字节流均为 yamux 帧
+// 2. 每个浏览器连接对应一个 yamux 流：SYN 开流，首个 DATA 为流请求 [flags u16][SOCKS 地址]；
+//    服务端在该流的首个下行数据前回复状态字节 (0 = 成功, 1 = 失败 + 原因)，由本模块剥离
+// 3. 与 H2 连接池 (proxy_h2_pool.c) 相同：每个事件循环各自维护隧道链表，隧道及其上的流只在该循环线程上访问，无需加锁；
+//    同一节点最多 g_muxMaxConnections 条隧道，每条最多 g_muxMaxStreams 个流，服务端确认 (ACK) 过流之后才允许复用
+// 4. 逐流流控 (yamux 窗口)：上行受对端窗口约束，下行数据写给浏览器后才累计归还窗口，一个慢速浏览器只会阻塞自己的流
+// 5. 隧道在任何流被确认前断开时视为节点不支持多路复用，该节点在 MUX_BAN_MS 内改回逐连接隧道
+// 6. 下行的 WS 帧与 yamux 帧均为流式解析，不缓存整帧；隧道级 yamux Ping 保活，空闲超时 / GoAway 后不再开流
+// [Fix] 2026-10-17: 会话请求的协议字节改为 2 (sing-mux 编号: h2mux=0, smux=1, yamux=2)，原先的 1 会让服务端按 smux 解析；
+// 隧道头的构造拆分为 MuxPool_BuildPreamble 以便单元测试 (tests/test_mux_preamble.c)
+
+#include "proxy_internal.h"
+#include "utils.h"
+#include "common.h"
+#include <stdio.h>
+
+#define MUX_MAX_LOOPS         16        // 不小于 proxy_reactor.c 的 REACTOR_MAX_LOOPS
+#define MUX_KEY_LEN           1024
+#define MUX_STREAM_WINDOW     (256 * 1024) // yamux 初始流窗口 (协议约定，双方相同)
+#define MUX_OUT_HIGH          (128 * 1024) // 隧道待发送数据超过该值时暂停读取各流的浏览器数据
+#define MUX_TICK_MS           15000     // 保活 / 空闲检查周期
+#define MUX_PING_INTERVAL     30000     // 隧道无下行数据超过该时间时发送 Ping
+#define MUX_DEAD_TIMEOUT      90000     // 连续无下行数据 (Ping 无响应) 视为隧道已断开
+#define MUX_IDLE_TIMEOUT      60000     // 无流的隧道保留时间
+#define MUX_BAN_MS            300000    // 节点不支持多路复用时回退到逐连接隧道的时长
+#define MUX_MAX_BANS          8
+#define MUX_MAX_BURST         32
+
+#define MUX_DEST_HOST         "sp.mux.sing-box.arpa"
+#define MUX_DEST_PORT         444
+#define MUX_PROTOCOL_YAMUX    2         // sing-mux 协议编号: h2mux=0, smux=1, yamux=2
+
+// yamux 帧头: [版本 0][类型][flags u16][流 ID u32][长度 u32]，均为大端
+#define YAMUX_HDR_LEN         12
+#define YAMUX_TYPE_DATA       0
+#define YAMUX_TYPE_WINDOW     1
+#define YAMUX_TYPE_PING       2
+#define YAMUX_TYPE_GOAWAY     3
+#define YAMUX_FLAG_SYN        0x1
+#define YAMUX_FLAG_ACK        0x2
+#define YAMUX_FLAG_FIN        0x4
+#define YAMUX_FLAG_RST        0x8
+
+// 单个 DATA 帧的载荷上限：WS 帧头 + yamux 帧头 + 载荷恰好占一条满尺寸 TLS 记录
+#define MUX_FRAME_PAYLOAD     (IO_BUFFER_SIZE - WS_FRAME_HEADROOM - YAMUX_HDR_LEN)
+
+typedef struct MuxConn {
+    struct MuxConn* next;       // 所属循环的隧道链表
+    int loop;
+    char key[MUX_KEY_LEN];
+    char label[300];            // 日志用 host:port
+
+    SOCKET sock;
+    TLSContext tls;
+    ReactorHandle* h;
+    BOOL is_ws;                 // 隧道为 WebSocket (否则为裸 TLS)
+
+    // 下行解析状态 (流式，不缓存整帧)
+    int vless_skip;             // VLESS 响应头: -1=等待前 2 字节, >0=剩余附加信息字节, 0=已剥离 (或非 VLESS)
+    int vless_hdr_len;
+    unsigned char ws_hdr[WS_FRAME_HEADROOM]; // 跨读取边界的 WS 帧头残留
+    int ws_hdr_len;
+    long long ws_left;          // 当前 WS 帧剩余载荷
+    long long ws_pos;           // 当前 WS 帧已处理载荷 (解掩码相位)
+    BOOL ws_data;
+    BOOL ws_masked;
+    unsigned char ws_mask[4];
+    unsigned char fr_hdr[YAMUX_HDR_LEN]; // 跨边界的 yamux 帧头残留
+    int fr_hdr_len;
+    uint32_t fr_left;           // 当前 DATA 帧剩余载荷
+    uint32_t fr_id;
+    int fr_flags;
+
+    // 上行：已封装好的帧 (WS 模式下每个 yamux 帧单独封装为一个 WS 帧)
+    char* out;
+    int out_off;
+    int out_len;
+    int out_cap;
+    BOOL out_blocked;           // 曾因写满拒绝过流的写入，排空后通知各流恢复读取
+
+    MuxStream* streams;         // 活动流 (双向链表)
+    int stream_count;
+    uint32_t next_id;           // 客户端流 ID 为奇数
+    uint32_t ping_id;
+    int busy;                   // 正在派发事件 / 通知流，期间推迟释放与冲刷
+
+    BOOL listed;                // 在隧道链表中，可被复用 (超出每节点上限的隧道为独占隧道)
+    BOOL verified;              // 服务端已确认过流，可复用
+    BOOL draining;              // GoAway / 流 ID 用尽 / 空闲超时：不再开流
+    BOOL failed;                // 隧道错误，等待下一轮派发时通知所有流
+    BOOL dead;                  // 已关闭，等待流全部解除关联后释放
+
+    ULONGLONG last_rx;
+    ULONGLONG idle_since;       // 最后一个流结束的时间
+} MuxConn;
+
+struct MuxStream {
+    MuxConn* conn;
+    ProxySession* s;
+    MuxStreamNotify notify;
+    MuxStream* prev;
+    MuxStream* next;
+    uint32_t id;
+    uint32_t send_window;       // 对端允许继续发送的字节数
+    int unconsumed;             // 已收到但浏览器尚未接收的字节
+    int credit;                 // 浏览器已接收、尚未通告给对端的窗口
+    int resp_state;             // 0=等待状态字节, 1=成功, 2=服务端拒绝 (后续数据丢弃)
+    BOOL local_fin;
+    BOOL remote_fin;
+    BOOL reset;
+    BOOL dirty;                 // 有状态变化，待通知持有者
+};
+
+typedef struct {
+    uint64_t key_hash;
+    ULONGLONG until;
+} MuxBan;
+
+static MuxConn* s_pool[MUX_MAX_LOOPS];
+static MuxBan s_bans[MUX_MAX_LOOPS][MUX_MAX_BANS];
+
+static void muxconn_on_event(ReactorHandle* h, int events, void* arg);
+
+// --- 辅助函数 ---
+
+static void mux_make_key(const ProxySession* s, char* out, int cap) {
+    snprintf(out, cap, "%s|%s|%d|%s|%s|%s|%s|%s|%d", s->config.type, s->config.host, s->config.port,
+             s->config.sni, s->config.path, s->config.mode, s->config.user, s->config.pass, s->config.allowInsecure ? 1 : 0);
+}
+
+static uint64_t mux_hash_key(const char* key) {
+    uint64_t h = 1469598103934665603ULL; // FNV-1a
+    for (const unsigned char* p = (const unsigned char*)key; *p; p++) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void put_be32(unsigned char* p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24); p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);  p[3] = (unsigned char)v;
+}
+
+static uint32_t get_be32(const unsigned char* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static BOOL mux_is_banned(int loop, uint64_t hash) {
+    ULONGLONG now = Reactor_Now();
+    for (int i = 0; i < MUX_MAX_BANS; i++) {
+        if (s_bans[loop][i].key_hash == hash && s_bans[loop][i].until > now) return TRUE;
+    }
+    return FALSE;
+}
+
+static void mux_ban(MuxConn* c) {
+    uint64_t hash = mux_hash_key(c->key);
+    MuxBan* slot = &s_bans[c->loop][0];
+    for (int i = 0; i < MUX_MAX_BANS; i++) {
+        MuxBan* b = &s_bans[c->loop][i];
+        if (b->key_hash == hash) { slot = b; break; }
+        if (b->until < slot->until) slot = b; // 覆盖最早到期的条目
+    }
+    slot->key_hash = hash;
+    slot->until = Reactor_Now() + MUX_BAN_MS;
+    log_msg("[Mux] Tunnel to %s closed before any stream was accepted; using per-connection tunnels for %d s",
+            c->label, MUX_BAN_MS / 1000);
+}
+
+static int muxconn_out_size(MuxConn* c) {
+    return c->out_len - c->out_off;
+}
+
+// 在发送队列末尾预留 n 字节，返回写入位置
+static char* muxconn_out_reserve(MuxConn* c, int n) {
+    if (c->out_off > 0 && c->out_off == c->out_len) c->out_off = c->out_len = 0;
+    if (c->out_len + n > c->out_cap) {
+        if (c->out_off > 0) {
+            memmove(c->out, c->out + c->out_off, c->out_len - c->out_off);
+            c->out_len -= c->out_off;
+            c->out_off = 0;
+        }
+        if (c->out_len + n > c->out_cap) {
+            if (c->out_len + n > MAX_WS_FRAME_SIZE) return NULL;
+            int new_cap = c->out_cap ? c->out_cap : IO_BUFFER_SIZE;
+            while (new_cap < c->out_len + n) new_cap *= 2;
+            char* nb = (char*)realloc(c->out, new_cap);
+            if (!nb) return NULL;
+            c->out = nb;
+            c->out_cap = new_cap;
+        }
+    }
+    return c->out + c->out_len;
+}
+
+// 把一段隧道明文追加到发送队列 (WS 模式下封装为一个 WS 帧)
+static int muxconn_queue_raw(MuxConn* c, const char* data, int len) {
+    int hl = c->is_ws ? ws_frame_header_len(len) : 0;
+    char* p = muxconn_out_reserve(c, hl + len);
+    if (!p) return -1;
+    memcpy(p + hl, data, len);
+    if (c->is_ws) {
+        int flen = 0;
+        build_ws_frame_inplace(p + hl, len, &flen);
+    }
+    c->out_len += hl + len;
+    return 0;
+}
+
+static int muxconn_queue_frame(MuxConn* c, int type, int flags, uint32_t id, uint32_t length, const char* payload, int plen) {
+    int body = YAMUX_HDR_LEN + plen;
+    int hl = c->is_ws ? ws_frame_header_len(body) : 0;
+    char* p = muxconn_out_reserve(c, hl + body);
+    if (!p) return -1;
+
+    unsigned char* f = (unsigned char*)p + hl;
+    f[0] = 0;
+    f[1] = (unsigned char)type;
+    f[2] = (unsigned char)(flags >> 8);
+    f[3] = (unsigned char)flags;
+    put_be32(f + 4, id);
+    put_be32(f + 8, length);
+    if (plen > 0) memcpy(f + YAMUX_HDR_LEN, payload, plen);
+
+    if (c->is_ws) {
+        int flen = 0;
+        build_ws_frame_inplace((char*)f, body, &flen);
+    }
+    c->out_len += hl + body;
+    return 0;
+}
+
+static void muxconn_update_interest(MuxConn* c) {
+    if (c->dead || !c->h) return;
+    int ev = REACTOR_EV_READ;
+    if (muxconn_out_size(c) > 0 || TlsEngine_CipherOutPending(&c->tls) > 0) ev |= REACTOR_EV_WRITE;
+    Reactor_SetEvents(c->h, ev);
+}
+
+// 写出发送队列。返回 -1 表示隧道已断开
+static int muxconn_flush(MuxConn* c) {
+    if (tls_flush_nb(&c->tls) < 0) return -1;
+    if (muxconn_out_size(c) > 0) {
+        int n = tls_write_nb(&c->tls, c->out + c->out_off, muxconn_out_size(c));
+        if (n < 0) return -1;
+        c->out_off += n;
+        if (c->out_off == c->out_len) {
+            c->out_off = c->out_len = 0;
+            // 大块突发后收缩回默认容量
+            if (c->out_cap > IO_BUFFER_SIZE) {
+                free(c->out);
+                c->out = NULL;
+                c->out_cap = 0;
+            }
+        }
+    }
+    if (c->out_blocked && muxconn_out_size(c) < MUX_OUT_HIGH / 2) {
+        // 队列已降下来：通知各流恢复读取浏览器
+        c->out_blocked = FALSE;
+        for (MuxStream* st = c->streams; st; st = st->next) st->dirty = TRUE;
+        Reactor_Rearm(c->h);
+    }
+    return 0;
+}
+
+// 流的持有者在自身回调中写入帧后调用：派发期间由 muxconn_on_event 统一冲刷
+static void muxconn_kick(MuxConn* c) {
+    if (c->dead || c->busy > 0) return;
+    if (muxconn_flush(c) < 0) {
+        // 不在此处通知其他流 (调用者仍在自身回调中)，交给下一轮派发
+        c->failed = TRUE;
+        Reactor_Rearm(c->h);
+        return;
+    }
+    muxconn_update_interest(c);
+}
+
+static void muxconn_unlist(MuxConn* c) {
+    if (!c->listed) return;
+    MuxConn** pp = &s_pool[c->loop];
+    while (*pp && *pp != c) pp = &(*pp)->next;
+    if (*pp) *pp = c->next;
+    c->next = NULL;
+    c->listed = FALSE;
+}
+
+static void muxconn_close(MuxConn* c) {
+    if (c->dead) return;
+    c->dead = TRUE;
+    muxconn_unlist(c);
+    if (c->h) { Reactor_Remove(c->h); c->h = NULL; }
+    tls_close(&c->tls);
+    if (c->sock != INVALID_SOCKET) { closesocket(c->sock); c->sock = INVALID_SOCKET; }
+}
+
+static void muxconn_maybe_free(MuxConn* c) {
+    if (c->busy > 0 || c->stream_count > 0 || !c->dead) return;
+    if (c->out) free(c->out);
+    free(c);
+}
+
+// 无流时：不可复用的隧道立即关闭，其余保留到空闲超时
+static void muxconn_on_idle(MuxConn* c) {
+    if (c->dead || c->stream_count > 0) return;
+    if (!c->listed || c->draining || !c->verified) {
+        if (muxconn_queue_frame(c, YAMUX_TYPE_GOAWAY, 0, 0, 0, NULL, 0) == 0) muxconn_flush(c); // 尽力发出 GoAway
+        log_msg("[Mux] Tunnel to %s released", c->label);
+        muxconn_close(c);
+        muxconn_maybe_free(c);
+        return;
+    }
+    c->idle_since = Reactor_Now();
+}
+
+// 通知有状态变化的流 (all = TRUE 时通知全部)。持有者可能在回调中解除关联
+static void muxconn_notify_streams(MuxConn* c, BOOL all) {
+    MuxStream* st = c->streams;
+    while (st) {
+        MuxStream* next = st->next;
+        if (all || st->dirty) {
+            st->dirty = FALSE;
+            if (st->notify) st->notify(st->s);
+        }
+        st = next;
+    }
+}
+
+static void muxconn_fail(MuxConn* c, const char* reason) {
+    if (!c->dead) {
+        log_msg("[Mux] Tunnel to %s closed: %s (%d stream(s))", c->label, reason, c->stream_count);
+        if (!c->verified) mux_ban(c);
+    }
+    muxconn_close(c);
+    for (MuxStream* st = c->streams; st; st = st->next) st->reset = TRUE;
+    c->busy++;
+    muxconn_notify_streams(c, TRUE);
+    c->busy--;
+    muxconn_maybe_free(c);
+}
+
+static MuxStream* muxconn_find(MuxConn* c, uint32_t id) {
+    for (MuxStream* st = c->streams; st; st = st->next) {
+        if (st->id == id) return st;
+    }
+    return NULL;
+}
+
+// --- 流控与流状态 ---
+
+static void muxstream_consume(MuxStream* st, int n) {
+    if (n > st->unconsumed) n = st->unconsumed;
+    if (n <= 0) return;
+    st->unconsumed -= n;
+    st->credit += n;
+    // 与 yamux 实现一致：累计到半个窗口再通告，避免逐段发送窗口更新
+    if (st->credit >= MUX_STREAM_WINDOW / 2 && !st->remote_fin && !st->reset && !st->conn->dead) {
+        if (muxconn_queue_frame(st->conn, YAMUX_TYPE_WINDOW, 0, st->id, (uint32_t)st->credit, NULL, 0) == 0) st->credit = 0;
+    }
+}
+
+static void muxstream_reset(MuxStream* st) {
+    if (st->reset) return;
+    st->reset = TRUE;
+    st->dirty = TRUE;
+    if (!st->conn->dead) muxconn_queue_frame(st->conn, YAMUX_TYPE_WINDOW, YAMUX_FLAG_RST, st->id, 0, NULL, 0);
+}
+
+static void muxstream_on_data(MuxStream* st, const char* p, int n) {
+    ProxySession* s = st->s;
+    st->unconsumed += n;
+    st->dirty = TRUE;
+
+    if (st->reset || st->resp_state == 2) {
+        muxstream_consume(st, n); // 流已放弃，直接归还窗口
+        return;
+    }
+    if (st->resp_state == 0) {
+        // 服务端对流请求的回复
+        unsigned char status = (unsigned char)p[0];
+        muxstream_consume(st, 1);
+        p++; n--;
+        if (status != 0) {
+            log_msg("[Conn-%d] [Mux] Stream %u to %s:%d rejected by server", s->clientSock, st->id, s->target_host, s->target_port);
+            st->resp_state = 2;
+            muxstream_consume(st, n);
+            muxstream_reset(st);
+            return;
+        }
+        st->resp_state = 1;
+        if (n == 0) return;
+    }
+
+    if (!s->relay || Relay_SendToClient(s, p, n) < 0) {
+        muxstream_consume(st, n);
+        muxstream_reset(st);
+    }
+}
+
+static void muxconn_on_stream_flags(MuxConn* c, uint32_t id, int flags) {
+    if (flags & YAMUX_FLAG_ACK) c->verified = TRUE; // 服务端接受了流：确认支持多路复用
+    MuxStream* st = muxconn_find(c, id);
+    if (!st) return;
+    if (flags & YAMUX_FLAG_FIN) { st->remote_fin = TRUE; st->dirty = TRUE; }
+    if (flags & YAMUX_FLAG_RST) { st->reset = TRUE; st->dirty = TRUE; }
+}
+
+// --- 下行解析 ---
+
+// 处理一个完整的 yamux 帧头。返回 -1 表示协议错误
+static int yamux_on_header(MuxConn* c) {
+    const unsigned char* h = c->fr_hdr;
+    if (h[0] != 0) return -1;
+    int type = h[1];
+    int flags = (h[2] << 8) | h[3];
+    uint32_t id = get_be32(h + 4);
+    uint32_t length = get_be32(h + 8);
+
+    switch (type) {
+        case YAMUX_TYPE_DATA:
+        case YAMUX_TYPE_WINDOW:
+            if (flags & YAMUX_FLAG_SYN) {
+                // 不接受服务端发起的流
+                muxconn_queue_frame(c, YAMUX_TYPE_WINDOW, YAMUX_FLAG_RST, id, 0, NULL, 0);
+                if (type == YAMUX_TYPE_DATA) { c->fr_id = 0; c->fr_flags = 0; c->fr_left = length; }
+                return 0;
+            }
+            if (type == YAMUX_TYPE_DATA) {
+                if (length > MUX_STREAM_WINDOW) return -1; // 超出接收窗口
+                c->fr_id = id;
+                c->fr_flags = flags;
+                c->fr_left = length;
+                if (length == 0) muxconn_on_stream_flags(c, id, flags);
+            } else {
+                MuxStream* st = muxconn_find(c, id);
+                if (st && length > 0) {
+                    st->send_window += length;
+                    st->dirty = TRUE;
+                }
+                muxconn_on_stream_flags(c, id, flags);
+            }
+            return 0;
+        case YAMUX_TYPE_PING:
+            if (flags & YAMUX_FLAG_SYN) muxconn_queue_frame(c, YAMUX_TYPE_PING, YAMUX_FLAG_ACK, 0, length, NULL, 0);
+            return 0;
+        case YAMUX_TYPE_GOAWAY:
+            if (!c->draining) log_msg("[Mux] GoAway from %s (code %u), no new streams", c->label, length);
+            c->draining = TRUE;
+            muxconn_unlist(c);
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+// 隧道明文 (WS 载荷或裸 TLS 数据) 进入 yamux 解析
+static int muxconn_feed(MuxConn* c, const unsigned char* p, int len) {
+    // VLESS 响应头 [版本][附加长度 N][N 字节] 只在隧道开头出现一次
+    while (len > 0 && c->vless_skip != 0) {
+        if (c->vless_skip < 0) {
+            if (++c->vless_hdr_len == 2) c->vless_skip = p[0];
+            p++; len--;
+        } else {
+            int n = (c->vless_skip < len) ? c->vless_skip : len;
+            c->vless_skip -= n;
+            p += n; len -= n;
+        }
+    }
+
+    while (len > 0) {
+        if (c->fr_left > 0) {
+            int n = (c->fr_left < (uint32_t)len) ? (int)c->fr_left : len;
+            MuxStream* st = c->fr_id ? muxconn_find(c, c->fr_id) : NULL;
+            if (st) muxstream_on_data(st, (const char*)p, n); // 已解除关联的流：直接丢弃
+            p += n; len -= n;
+            c->fr_left -= n;
+            if (c->fr_left == 0 && c->fr_id) muxconn_on_stream_flags(c, c->fr_id, c->fr_flags);
+            continue;
+        }
+
+        int n = YAMUX_HDR_LEN - c->fr_hdr_len;
+        if (n > len) n = len;
+        memcpy(c->fr_hdr + c->fr_hdr_len, p, n);
+        c->fr_hdr_len += n;
+        p += n; len -= n;
+        if (c->fr_hdr_len < YAMUX_HDR_LEN) break;
+        c->fr_hdr_len = 0;
+        if (yamux_on_header(c) < 0) return -1;
+    }
+    return 0;
+}
+
+// 流式解析 WS 帧，数据帧载荷交给 muxconn_feed (p 可被原地解掩码)
+static int muxconn_feed_ws(MuxConn* c, unsigned char* p, int len) {
+    while (len > 0) {
+        if (c->ws_left == 0) {
+            WsFrameHeader fh;
+            int hl = ws_parse_header_split(c->ws_hdr, c->ws_hdr_len, p, len, &fh);
+            if (hl < 0) return -1;
+            if (hl == 0) {
+                // 帧头不完整：保存残留，下次拼接
+                if (c->ws_hdr_len + len > (int)sizeof(c->ws_hdr)) return -1;
+                memcpy(c->ws_hdr + c->ws_hdr_len, p, len);
+                c->ws_hdr_len += len;
+                return 0;
+            }
+            int used = hl - c->ws_hdr_len;
+            c->ws_hdr_len = 0;
+            p += used; len -= used;
+            if (fh.opcode == 0x8) return -1; // Close
+            c->ws_left = fh.payload_len;
+            c->ws_pos = 0;
+            c->ws_data = (fh.opcode <= 0x2); // Ping/Pong 载荷直接丢弃
+            c->ws_masked = fh.masked;
+            memcpy(c->ws_mask, fh.mask, 4);
+            continue;
+        }
+
+        int n = (c->ws_left < len) ? (int)c->ws_left : len;
+        if (c->ws_data) {
+            if (c->ws_masked) ws_mask_inplace(p, (size_t)n, c->ws_mask, (size_t)c->ws_pos);
+            if (muxconn_feed(c, p, n) < 0) return -1;
+        }
+        p += n; len -= n;
+        c->ws_left -= n;
+        c->ws_pos += n;
+    }
+    return 0;
+}
+
+// 读取所有可用的数据并解析。返回 -1 表示隧道已断开
+static int muxconn_pump(MuxConn* c) {
+    char* buf = (char*)Pool_Alloc_16K();
+    if (!buf) return -1;
+
+    int ret = 0;
+    for (int i = 0; i < MUX_MAX_BURST; i++) {
+        int n = tls_read(&c->tls, buf, IO_BUFFER_SIZE);
+        if (n < 0) { ret = -1; break; }
+        if (n == 0) break;
+        c->last_rx = Reactor_Now();
+
+        int rv = c->is_ws ? muxconn_feed_ws(c, (unsigned char*)buf, n) : muxconn_feed(c, (const unsigned char*)buf, n);
+        if (rv < 0) {
+            log_msg("[Mux] Protocol error on tunnel to %s", c->label);
+            ret = -1;
+            break;
+        }
+        if (tls_pending(&c->tls) <= 0) break;
+    }
+    Pool_Free_16K(buf);
+
+    if (ret == 0 && tls_pending(&c->tls) > 0) Reactor_Rearm(c->h);
+    return ret;
+}
+
+static void muxconn_on_timer(MuxConn* c) {
+    ULONGLONG now = Reactor_Now();
+    if (c->stream_count == 0 && now - c->idle_since >= MUX_IDLE_TIMEOUT) {
+        c->draining = TRUE;
+        muxconn_on_idle(c);
+        return;
+    }
+    if (now - c->last_rx >= MUX_DEAD_TIMEOUT) {
+        log_msg("[Mux] Tunnel to %s: no data for %d s, keepalive lost", c->label, MUX_DEAD_TIMEOUT / 1000);
+        c->failed = TRUE;
+        return;
+    }
+    if (now - c->last_rx >= MUX_PING_INTERVAL) muxconn_queue_frame(c, YAMUX_TYPE_PING, YAMUX_FLAG_SYN, 0, ++c->ping_id, NULL, 0);
+    Reactor_SetTimer(c->h, MUX_TICK_MS);
+}
+
+static void muxconn_on_event(ReactorHandle* h, int events, void* arg) {
+    MuxConn* c = (MuxConn*)arg;
+    if (c->dead) return;
+    if (c->failed || (events & REACTOR_EV_ERROR)) { muxconn_fail(c, "socket error"); return; }
+
+    c->busy++;
+    if (events & REACTOR_EV_TIMER) muxconn_on_timer(c);
+    if (!c->dead && !c->failed && (events & REACTOR_EV_READ) && muxconn_pump(c) < 0) c->failed = TRUE;
+    c->busy--;
+
+    if (c->dead) { muxconn_maybe_free(c); return; }
+    if (c->failed) { muxconn_fail(c, "tunnel closed"); return; }
+
+    c->busy++;
+    muxconn_notify_streams(c, FALSE);
+    c->busy--;
+
+    if (c->dead) { muxconn_maybe_free(c); return; }
+    if (c->stream_count == 0) {
+        muxconn_on_idle(c); // 通知期间最后一个流已解除关联
+        if (c->dead) return;
+    }
+
+    // 解析与通知期间产生的帧 (窗口更新、Ping 应答、流数据) 统一在这里写出
+    if (muxconn_flush(c) < 0) { muxconn_fail(c, "tunnel closed"); return; }
+    muxconn_update_interest(c);
+}
+
+// --- 流管理 ---
+
+static int muxconn_open_stream(MuxConn* c, ProxySession* s) {
+    if (c->next_id > 0x7FFFFFF0) {
+        // 流 ID 用尽：该隧道不再开流
+        c->draining = TRUE;
+        muxconn_unlist(c);
+        return -1;
+    }
+
+    // 流请求: [flags u16 = 0 (TCP)][SOCKS 地址]
+    unsigned char req[2 + 262];
+    req[0] = 0; req[1] = 0;
+    int alen = tunnel_build_socks_addr(s->target_host, s->target_port, req + 2);
+    if (alen < 0) return -1;
+
+    MuxStream* st = (MuxStream*)calloc(1, sizeof(MuxStream));
+    if (!st) return -1;
+    st->id = c->next_id;
+    st->send_window = MUX_STREAM_WINDOW - (uint32_t)(2 + alen);
+
+    // SYN 与流请求同批发出，服务端收到后即开始连接目标
+    if (muxconn_queue_frame(c, YAMUX_TYPE_WINDOW, YAMUX_FLAG_SYN, st->id, 0, NULL, 0) != 0 ||
+        muxconn_queue_frame(c, YAMUX_TYPE_DATA, 0, st->id, (uint32_t)(2 + alen), (const char*)req, 2 + alen) != 0) {
+        free(st);
+        return -1;
+    }
+    c->next_id += 2;
+
+    st->conn = c;
+    st->s = s;
+    st->next = c->streams;
+    if (c->streams) c->streams->prev = st;
+    c->streams = st;
+    c->stream_count++;
+    s->mux_stream = st;
+    s->alpn_is_h2 = 0;
+
+    muxconn_kick(c);
+    return 0;
+}
+
+// --- 对外接口 ---
+
+BOOL MuxPool_IsEligible(ProxySession* s, int loop) {
+    if (!g_enableMux || !s || loop < 0 || loop >= MUX_MAX_LOOPS) return FALSE;
+    // 只有协议头由本程序生成且服务端按 sing-box 规则处理多路复用目标的协议
+    if (_stricmp(s->config.type, "vless") != 0 && _stricmp(s->config.type, "trojan") != 0) return FALSE;
+
+    char key[MUX_KEY_LEN];
+    mux_make_key(s, key, sizeof(key));
+    return !mux_is_banned(loop, mux_hash_key(key));
+}
+
+int MuxPool_Attach(ProxySession* s, int loop) {
+    if (!s || loop < 0 || loop >= MUX_MAX_LOOPS) return -1;
+
+    char key[MUX_KEY_LEN];
+    mux_make_key(s, key, sizeof(key));
+
+    // 选择流最少的可用隧道
+    MuxConn* best = NULL;
+    for (MuxConn* c = s_pool[loop]; c; c = c->next) {
+        if (c->dead || c->failed || c->draining || !c->verified) continue;
+        if (strcmp(c->key, key) != 0) continue;
+        if (c->stream_count >= g_muxMaxStreams) continue;
+        if (!best || c->stream_count < best->stream_count) best = c;
+    }
+    if (!best) return -1;
+
+    if (muxconn_open_stream(best, s) != 0) return -1;
+    log_msg("[Conn-%d] [Mux] Reusing tunnel to %s for %s:%d (stream %u, %d active)",
+            s->clientSock, best->label, s->target_host, s->target_port, s->mux_stream->id, best->stream_count);
+    return 0;
+}
+
+// 隧道头: 目标为多路复用保留地址的代理协议头 + 会话请求 [版本 0][协议]
+int MuxPool_BuildPreamble(ProxySession* s, unsigned char* out) {
+    char saved_host[sizeof(s->target_host)];
+    int saved_port = s->target_port;
+    memcpy(saved_host, s->target_host, sizeof(saved_host));
+    strcpy(s->target_host, MUX_DEST_HOST);
+    s->target_port = MUX_DEST_PORT;
+    int len = tunnel_build_proxy_header(s, out);
+    memcpy(s->target_host, saved_host, sizeof(saved_host));
+    s->target_port = saved_port;
+
+    if (len <= 0) return -1; // SOCKS5 出站不支持多路复用
+    out[len++] = 0x00;
+    out[len++] = MUX_PROTOCOL_YAMUX;
+    return len;
+}
+
+int MuxPool_Adopt(ProxySession* s, int loop) {
+    if (!s || !s->tls.ssl || s->remoteSock == INVALID_SOCKET || loop < 0 || loop >= MUX_MAX_LOOPS) return -1;
+
+    MuxConn* c = (MuxConn*)calloc(1, sizeof(MuxConn));
+    if (!c) return -1;
+
+    // 传输层所有权转移到隧道
+    c->loop = loop;
+    c->sock = s->remoteSock;
+    c->tls = s->tls;
+    s->remoteSock = INVALID_SOCKET;
+    memset(&s->tls, 0, sizeof(TLSContext));
+    c->tls.sock = c->sock;
+    c->is_ws = s->is_ws_transport;
+    s->is_ws_transport = 0;
+    c->vless_skip = (_stricmp(s->config.type, "vless") == 0) ? -1 : 0;
+    c->next_id = 1;
+
+    mux_make_key(s, c->key, sizeof(c->key));
+    snprintf(c->label, sizeof(c->label), "%s:%d", s->config.host, s->config.port);
+    c->last_rx = c->idle_since = Reactor_Now();
+
+    unsigned char head[MUX_PREAMBLE_MAX];
+    int head_len = MuxPool_BuildPreamble(s, head);
+
+    u_long nb = 1;
+    ioctlsocket(c->sock, FIONBIO, &nb);
+
+    c->h = (head_len > 0 && muxconn_queue_raw(c, (const char*)head, head_len) == 0)
+         ? Reactor_Add(loop, c->sock, REACTOR_EV_READ, muxconn_on_event, c) : NULL;
+    if (!c->h) {
+        muxconn_close(c);
+        muxconn_maybe_free(c);
+        return -1;
+    }
+    Reactor_SetTimer(c->h, MUX_TICK_MS);
+
+    // 超出每节点上限时作为独占隧道使用，流结束后关闭
+    int same = 0;
+    for (MuxConn* o = s_pool[loop]; o; o = o->next) {
+        if (!o->dead && !o->draining && strcmp(o->key, c->key) == 0) same++;
+    }
+    if (same < g_muxMaxConnections) {
+        c->next = s_pool[loop];
+        s_pool[loop] = c;
+        c->listed = TRUE;
+    }
+
+    if (muxconn_open_stream(c, s) != 0) {
+        muxconn_close(c);
+        muxconn_maybe_free(c);
+        return -1;
+    }
+    // 握手阶段可能已读入数据 (101 响应之后的帧) 或仍留在 SSL 缓冲中
+    if (s->ws_buf_len > 0) {
+        int rv = c->is_ws ? muxconn_feed_ws(c, (unsigned char*)s->ws_read_buf, s->ws_buf_len)
+                          : muxconn_feed(c, (const unsigned char*)s->ws_read_buf, s->ws_buf_len);
+        s->ws_buf_len = 0;
+        if (rv < 0) c->failed = TRUE;
+    }
+    Reactor_Rearm(c->h);
+    log_msg("[Conn-%d] [Mux] New %s tunnel to %s (loop %d), stream %u for %s:%d", s->clientSock,
+            c->listed ? "shared" : "dedicated", c->label, loop, s->mux_stream->id, s->target_host, s->target_port);
+    return 0;
+}
+
+void MuxPool_SetNotify(ProxySession* s, MuxStreamNotify notify) {
+    if (s && s->mux_stream) s->mux_stream->notify = notify;
+}
+
+int MuxPool_GetLoop(ProxySession* s) {
+    return (s && s->mux_stream) ? s->mux_stream->conn->loop : -1;
+}
+
+int MuxPool_Writable(ProxySession* s) {
+    if (!s || !s->mux_stream) return 0;
+    MuxStream* st = s->mux_stream;
+    MuxConn* c = st->conn;
+    if (c->dead || c->failed || st->reset || st->local_fin) return 0;
+    if (muxconn_out_size(c) >= MUX_OUT_HIGH) {
+        c->out_blocked = TRUE;
+        return 0;
+    }
+    return (st->send_window < MUX_FRAME_PAYLOAD) ? (int)st->send_window : MUX_FRAME_PAYLOAD;
+}
+
+int MuxPool_Write(ProxySession* s, const char* data, int len) {
+    if (!s || !s->mux_stream) return -1;
+    MuxStream* st = s->mux_stream;
+    MuxConn* c = st->conn;
+    if (c->dead || c->failed || st->reset || st->local_fin) return -1;
+    if ((uint32_t)len > st->send_window) return -1;
+
+    while (len > 0) {
+        int n = (len < MUX_FRAME_PAYLOAD) ? len : MUX_FRAME_PAYLOAD;
+        if (muxconn_queue_frame(c, YAMUX_TYPE_DATA, 0, st->id, (uint32_t)n, data, n) != 0) return -1;
+        st->send_window -= (uint32_t)n;
+        data += n; len -= n;
+    }
+    muxconn_kick(c);
+    return 0;
+}
+
+void MuxPool_CloseWrite(ProxySession* s) {
+    if (!s || !s->mux_stream) return;
+    MuxStream* st = s->mux_stream;
+    if (st->local_fin || st->reset || st->conn->dead) return;
+    st->local_fin = TRUE;
+    muxconn_queue_frame(st->conn, YAMUX_TYPE_WINDOW, YAMUX_FLAG_FIN, st->id, 0, NULL, 0);
+    muxconn_kick(st->conn);
+}
+
+void MuxPool_Consume(ProxySession* s, int n) {
+    if (!s || !s->mux_stream || n <= 0) return;
+    MuxStream* st = s->mux_stream;
+    if (st->conn->dead) return;
+    muxstream_consume(st, n);
+    muxconn_kick(st->conn); // 可能产生窗口更新
+}
+
+int MuxPool_Status(ProxySession* s) {
+    if (!s || !s->mux_stream) return -1;
+    MuxStream* st = s->mux_stream;
+    if (st->reset || st->conn->dead || st->conn->failed) return -1;
+    return st->remote_fin ? 1 : 0;
+}
+
+void MuxPool_Detach(ProxySession* s) {
+    if (!s || !s->mux_stream) return;
+    MuxStream* st = s->mux_stream;
+    MuxConn* c = st->conn;
+
+    // 双向均未正常结束的流需要重置，服务端才会释放对应的目标连接
+    if (!c->dead && !st->reset && !(st->local_fin && st->remote_fin)) {
+        muxconn_queue_frame(c, YAMUX_TYPE_WINDOW, YAMUX_FLAG_RST, st->id, 0, NULL, 0);
+    }
+
+    if (st->prev) st->prev->next = st->next;
+    else c->streams = st->next;
+    if (st->next) st->next->prev = st->prev;
+    c->stream_count--;
+    free(st);
+    s->mux_stream = NULL;
+
+    if (c->dead) {
+        muxconn_maybe_free(c);
+        return;
+    }
+    muxconn_kick(c);
+    // 派发期间由 muxconn_on_event 在通知结束后处理
+    if (c->stream_count == 0 && c->busy == 0) muxconn_on_idle(c);
+}
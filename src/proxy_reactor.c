@@ -0,0 +1,667 @@
+/* src/proxy_reactor.c */
+// [New] 2026-10-16: 共享事件循环 (Reactor)，替代每会话独立线程 + select() 轮询
+// 设计要点:
+// 1. 固定数量的事件循环线程 (默认 = CPU 核心数，上限 REACTOR_MAX_LOOPS)，所有会话复用
+// 2. 后端使用 WSAPoll (Windows)，不受 FD_SETSIZE 限制；语义为电平触发，与原 select 行为一致
+// 3. 跨线程操作 (添加/修改/删除/投递任务) 通过命令队列 + 自连接 UDP 唤醒套接字完成
+// 4. 句柄只在其所属循环线程上回调，同一会话的多个句柄应注册到同一循环，避免加锁
+// [New] 2026-10-16: 定时器改为每循环一个分层时间轮 (4 层 x 64 槽，精度 16ms)，插入 / 取消 O(1)，
+// 到期只处理当前槽，不再每轮遍历全部句柄比较 timer_at；每轮只读取一次系统时钟 (Reactor_Now)
+// [Fix] 2026-10-16: 无关注事件的句柄不参与 WSAPoll (半关闭后 POLLHUP 会持续返回，导致循环空转)；定时器不受影响
+// [Fix] 2026-10-16: Reactor_Shutdown 等待超时 (循环线程未退出) 时不再释放循环状态
+// [New] 2026-10-16: Reactor_IsLoopThread 供同步路径与事件循环共用的代码判断是否允许阻塞
+// [Fix] 2026-10-17: 循环状态改为堆分配；Shutdown 超时时整体放弃 (泄漏) 旧的循环数组及仍在使用它的线程，
+// 状态复位为 0，之后的 Reactor_Init 分配新数组重新启动，不再永久停在 3
+
+#include "proxy_internal.h"
+#include "utils.h"
+#include "common.h"
+#include <process.h>
+#include <stddef.h>
+
+#define REACTOR_MAX_LOOPS   4
+#define REACTOR_MAX_WAIT_MS 1000 // 无定时器时的最长等待，用于感知 running 变化
+#define REACTOR_INIT_CAP    64
+
+// 分层时间轮：第 L 层每槽跨度 16ms * 64^L，4 层覆盖约 74 小时 (更远的到期时间按上限放入最高层)
+#define WHEEL_TICK_MS  16  // 与 Windows 系统时钟粒度 (~15.6ms) 相当
+#define WHEEL_BITS     6
+#define WHEEL_SLOTS    (1 << WHEEL_BITS)
+#define WHEEL_MASK     (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS   4
+#define WHEEL_MAX_SPAN ((ULONGLONG)1 << (WHEEL_BITS * WHEEL_LEVELS))
+
+// 侵入式双向链表节点 (槽位与到期链表均带哨兵，摘除无需知道所在槽)
+typedef struct TimerLink {
+    struct TimerLink* next;
+    struct TimerLink* prev;
+} TimerLink;
+
+typedef enum {
+    REACTOR_CMD_ADD = 0,
+    REACTOR_CMD_MOD,
+    REACTOR_CMD_TIMER,
+    REACTOR_CMD_DEL,
+    REACTOR_CMD_POST
+} ReactorCmdType;
+
+typedef struct ReactorCmd {
+    ReactorCmdType type;
+    ReactorHandle* h;
+    int value;
+    void (*fn)(void*);
+    void* arg;
+    struct ReactorCmd* next;
+} ReactorCmd;
+
+typedef struct ReactorLoop {
+    int index;
+    HANDLE thread;
+    volatile DWORD thread_id;
+    volatile BOOL running;
+
+    // 唤醒机制: 自连接的 UDP 套接字 (WSAPoll 无法等待内核事件对象)
+    SOCKET wake_sock;
+    volatile LONG wake_pending;
+
+    // 跨线程命令队列
+    CRITICAL_SECTION cmd_lock;
+    ReactorCmd* cmd_head;
+    ReactorCmd* cmd_tail;
+
+    // 轮询集合 (slot 0 固定为唤醒套接字)
+    WSAPOLLFD* fds;
+    ReactorHandle** handles;
+    int count;
+    int cap;
+    int has_dead;     // 本轮有句柄被删除，需要压缩
+    int rearm_count;  // 请求立即重新派发的句柄数量
+
+    // 定时器 (仅循环线程访问)
+    TimerLink wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+    TimerLink expired;     // 已到期、待派发
+    ULONGLONG wheel_tick;  // 时间轮已推进到的 tick
+    int timer_count;
+    ULONGLONG now;         // 粗粒度时钟：本轮缓存的 GetTickCount64()
+} ReactorLoop;
+
+struct ReactorHandle {
+    SOCKET sock;
+    int events;
+    ReactorCallback cb;
+    void* arg;
+    ReactorLoop* loop;
+    int slot;              // 在 fds/handles 中的位置 (-1 = 尚未加入)
+    int dead;
+    int rearm;             // 下一轮立即以 READ 事件派发 (用于 SSL_pending 等用户态缓冲)
+    TimerLink tlink;       // 时间轮节点 (next == NULL 表示无定时器)
+    ULONGLONG timer_expire; // 到期 tick
+};
+
+#define TIMER_OWNER(l) ((ReactorHandle*)((char*)(l) - offsetof(ReactorHandle, tlink)))
+
+static ReactorLoop* s_loops = NULL;  // REACTOR_MAX_LOOPS 个，正常停止后复用
+static BOOL s_loopsAbandoned = FALSE; // 上次停止超时，旧数组仍被卡住的线程使用，下次初始化需重新分配
+static int s_loopCount = 0;
+static volatile LONG s_rrCursor = 0;
+
+#if defined(_MSC_VER)
+    static __declspec(thread) ReactorLoop* t_loop = NULL;
+#else
+    static __thread ReactorLoop* t_loop = NULL;
+#endif
+
+// 0=Uninit, 1=Initializing, 2=Running, 3=Stopping
+static volatile LONG s_reactorState = 0;
+
+// --- 内部辅助函数 ---
+
+static BOOL is_loop_thread(ReactorLoop* loop) {
+    return loop->thread_id == GetCurrentThreadId();
+}
+
+// --- 分层时间轮 (仅循环线程) ---
+
+static void tlist_init(TimerLink* head) {
+    head->next = head->prev = head;
+}
+
+static void tlist_push(TimerLink* head, TimerLink* n) {
+    n->prev = head->prev;
+    n->next = head;
+    head->prev->next = n;
+    head->prev = n;
+}
+
+static void tlist_unlink(TimerLink* n) {
+    n->prev->next = n->next;
+    n->next->prev = n->prev;
+    n->next = n->prev = NULL;
+}
+
+// 把整个槽位链表移到 dst 尾部
+static void tlist_splice(TimerLink* dst, TimerLink* src) {
+    if (src->next == src) return;
+    src->next->prev = dst->prev;
+    dst->prev->next = src->next;
+    src->prev->next = dst;
+    dst->prev = src->prev;
+    tlist_init(src);
+}
+
+static void wheel_init(ReactorLoop* loop) {
+    for (int l = 0; l < WHEEL_LEVELS; l++) {
+        for (int i = 0; i < WHEEL_SLOTS; i++) tlist_init(&loop->wheel[l][i]);
+    }
+    tlist_init(&loop->expired);
+    loop->now = GetTickCount64();
+    loop->wheel_tick = loop->now / WHEEL_TICK_MS;
+    loop->timer_count = 0;
+}
+
+// 按到期 tick 放入对应层级的槽位；已到期的直接进入到期链表
+static void wheel_place(ReactorLoop* loop, ReactorHandle* h, ULONGLONG expire) {
+    ULONGLONG delta = (expire > loop->wheel_tick) ? expire - loop->wheel_tick : 0;
+    if (delta == 0) { tlist_push(&loop->expired, &h->tlink); return; }
+    if (delta >= WHEEL_MAX_SPAN) { expire = loop->wheel_tick + WHEEL_MAX_SPAN - 1; delta = WHEEL_MAX_SPAN - 1; }
+
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= ((ULONGLONG)1 << (WHEEL_BITS * (level + 1)))) level++;
+    int slot = (int)((expire >> (WHEEL_BITS * level)) & WHEEL_MASK);
+    h->timer_expire = expire;
+    tlist_push(&loop->wheel[level][slot], &h->tlink);
+}
+
+static void wheel_cancel(ReactorLoop* loop, ReactorHandle* h) {
+    if (!h->tlink.next) return;
+    tlist_unlink(&h->tlink);
+    loop->timer_count--;
+}
+
+// 高层槽位到期时把其中的定时器重新分配到低层
+static void wheel_cascade(ReactorLoop* loop, int level) {
+    int slot = (int)((loop->wheel_tick >> (WHEEL_BITS * level)) & WHEEL_MASK);
+    TimerLink pending;
+    tlist_init(&pending);
+    tlist_splice(&pending, &loop->wheel[level][slot]);
+    while (pending.next != &pending) {
+        TimerLink* n = pending.next;
+        tlist_unlink(n);
+        ReactorHandle* h = TIMER_OWNER(n);
+        wheel_place(loop, h, h->timer_expire);
+    }
+}
+
+// 推进到当前时间，到期的定时器移入 expired
+static void wheel_advance(ReactorLoop* loop) {
+    ULONGLONG target = loop->now / WHEEL_TICK_MS;
+    if (loop->timer_count == 0) { loop->wheel_tick = target; return; }
+
+    while (loop->wheel_tick < target) {
+        loop->wheel_tick++;
+        int idx = (int)(loop->wheel_tick & WHEEL_MASK);
+        if (idx == 0) {
+            for (int l = 1; l < WHEEL_LEVELS; l++) {
+                wheel_cascade(loop, l);
+                if (((loop->wheel_tick >> (WHEEL_BITS * l)) & WHEEL_MASK) != 0) break;
+            }
+        }
+        tlist_splice(&loop->expired, &loop->wheel[0][idx]);
+    }
+}
+
+// 距最近一个可能到期的槽位的毫秒数：只扫描第 0 层，第 0 层为空时最多等到下一次进位
+static int wheel_next_timeout(ReactorLoop* loop) {
+    if (loop->expired.next != &loop->expired) return 0;
+    if (loop->timer_count == 0) return REACTOR_MAX_WAIT_MS;
+
+    ULONGLONG tick = loop->wheel_tick + 1;
+    for (int i = 0; i < WHEEL_SLOTS; i++, tick++) {
+        TimerLink* head = &loop->wheel[0][tick & WHEEL_MASK];
+        if (head->next != head || (tick & WHEEL_MASK) == 0) break;
+    }
+    ULONGLONG at = tick * WHEEL_TICK_MS;
+    if (at <= loop->now) return 0;
+    ULONGLONG wait = at - loop->now;
+    return (wait > REACTOR_MAX_WAIT_MS) ? REACTOR_MAX_WAIT_MS : (int)wait;
+}
+
+static SOCKET create_wake_socket() {
+    SOCKET s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s == INVALID_SOCKET) return INVALID_SOCKET;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+
+    int addr_len = sizeof(addr);
+    if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        getsockname(s, (struct sockaddr*)&addr, &addr_len) != 0 ||
+        connect(s, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+
+    u_long mode = 1;
+    ioctlsocket(s, FIONBIO, &mode);
+    return s;
+}
+
+static void loop_wake(ReactorLoop* loop) {
+    if (InterlockedExchange(&loop->wake_pending, 1) == 0) {
+        char b = 0;
+        send(loop->wake_sock, &b, 1, 0);
+    }
+}
+
+static void loop_drain_wake(ReactorLoop* loop) {
+    char junk[64];
+    while (recv(loop->wake_sock, junk, sizeof(junk), 0) > 0) { }
+    InterlockedExchange(&loop->wake_pending, 0);
+}
+
+static short to_poll_events(int events) {
+    short pe = 0;
+    if (events & REACTOR_EV_READ) pe |= POLLRDNORM;
+    if (events & REACTOR_EV_WRITE) pe |= POLLWRNORM;
+    return pe;
+}
+
+// 关注事件为空时以负值句柄占位，WSAPoll 将其忽略
+static SOCKET to_poll_fd(const ReactorHandle* h) {
+    return h->events ? h->sock : INVALID_SOCKET;
+}
+
+static int loop_grow(ReactorLoop* loop) {
+    if (loop->count < loop->cap) return 0;
+    int new_cap = loop->cap ? loop->cap * 2 : REACTOR_INIT_CAP;
+
+    WSAPOLLFD* nf = (WSAPOLLFD*)realloc(loop->fds, sizeof(WSAPOLLFD) * new_cap);
+    if (!nf) return -1;
+    loop->fds = nf;
+
+    ReactorHandle** nh = (ReactorHandle**)realloc(loop->handles, sizeof(ReactorHandle*) * new_cap);
+    if (!nh) return -1;
+    loop->handles = nh;
+
+    loop->cap = new_cap;
+    return 0;
+}
+
+// 以下 apply_* 仅在循环线程内调用
+static void apply_add(ReactorLoop* loop, ReactorHandle* h) {
+    if (h->dead) { free(h); return; }
+    if (loop_grow(loop) != 0) {
+        // OOM: 以错误事件通知持有者，由其自行清理
+        log_msg("[Reactor] Loop %d: failed to grow poll set", loop->index);
+        h->dead = 1;
+        h->cb(h, REACTOR_EV_ERROR, h->arg);
+        free(h);
+        return;
+    }
+    h->slot = loop->count;
+    loop->fds[h->slot].fd = to_poll_fd(h);
+    loop->fds[h->slot].events = to_poll_events(h->events);
+    loop->fds[h->slot].revents = 0;
+    loop->handles[h->slot] = h;
+    loop->count++;
+}
+
+static void apply_mod(ReactorHandle* h, int events) {
+    h->events = events;
+    if (h->slot > 0 && !h->dead) {
+        h->loop->fds[h->slot].fd = to_poll_fd(h);
+        h->loop->fds[h->slot].events = to_poll_events(events);
+    }
+}
+
+static void apply_timer(ReactorHandle* h, int delay_ms) {
+    ReactorLoop* loop = h->loop;
+    if (h->dead) return;
+    wheel_cancel(loop, h);
+    if (delay_ms <= 0) return;
+    // 向上取整到 tick 边界，保证不会提前触发
+    wheel_place(loop, h, (loop->now + (ULONGLONG)delay_ms + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS);
+    loop->timer_count++;
+}
+
+static void apply_del(ReactorLoop* loop, ReactorHandle* h) {
+    if (h->dead) return;
+    h->dead = 1;
+    if (h->rearm) { h->rearm = 0; loop->rearm_count--; }
+    wheel_cancel(loop, h);
+    if (h->slot > 0) {
+        loop->fds[h->slot].fd = INVALID_SOCKET; // WSAPoll 忽略负值句柄
+        loop->fds[h->slot].events = 0;
+        loop->has_dead = 1;
+    }
+    // slot == -1: ADD 命令尚在队列中，apply_add 检测到 dead 后负责释放
+}
+
+static void loop_compact(ReactorLoop* loop) {
+    if (!loop->has_dead) return;
+    int w = 1;
+    for (int r = 1; r < loop->count; r++) {
+        ReactorHandle* h = loop->handles[r];
+        if (h->dead) { free(h); continue; }
+        if (w != r) {
+            loop->fds[w] = loop->fds[r];
+            loop->handles[w] = h;
+            h->slot = w;
+        }
+        w++;
+    }
+    loop->count = w;
+    loop->has_dead = 0;
+}
+
+static void loop_run_commands(ReactorLoop* loop) {
+    EnterCriticalSection(&loop->cmd_lock);
+    ReactorCmd* cmd = loop->cmd_head;
+    loop->cmd_head = loop->cmd_tail = NULL;
+    LeaveCriticalSection(&loop->cmd_lock);
+
+    while (cmd) {
+        ReactorCmd* next = cmd->next;
+        switch (cmd->type) {
+            case REACTOR_CMD_ADD:   apply_add(loop, cmd->h); break;
+            case REACTOR_CMD_MOD:   apply_mod(cmd->h, cmd->value); break;
+            case REACTOR_CMD_TIMER: apply_timer(cmd->h, cmd->value); break;
+            case REACTOR_CMD_DEL:   apply_del(loop, cmd->h); break;
+            case REACTOR_CMD_POST:  cmd->fn(cmd->arg); break;
+        }
+        free(cmd);
+        cmd = next;
+    }
+}
+
+static int loop_enqueue(ReactorLoop* loop, ReactorCmdType type, ReactorHandle* h, int value, void (*fn)(void*), void* arg) {
+    ReactorCmd* cmd = (ReactorCmd*)malloc(sizeof(ReactorCmd));
+    if (!cmd) return -1;
+    cmd->type = type; cmd->h = h; cmd->value = value;
+    cmd->fn = fn; cmd->arg = arg; cmd->next = NULL;
+
+    EnterCriticalSection(&loop->cmd_lock);
+    if (loop->cmd_tail) loop->cmd_tail->next = cmd;
+    else loop->cmd_head = cmd;
+    loop->cmd_tail = cmd;
+    LeaveCriticalSection(&loop->cmd_lock);
+
+    loop_wake(loop);
+    return 0;
+}
+
+static int loop_next_timeout(ReactorLoop* loop) {
+    if (loop->rearm_count > 0) return 0;
+    return wheel_next_timeout(loop);
+}
+
+// 逐个派发到期定时器 (回调中可安全地取消 / 重设任意定时器)
+static void loop_fire_timers(ReactorLoop* loop) {
+    while (loop->expired.next != &loop->expired) {
+        ReactorHandle* h = TIMER_OWNER(loop->expired.next);
+        wheel_cancel(loop, h);
+        if (!h->dead) h->cb(h, REACTOR_EV_TIMER, h->arg);
+    }
+}
+
+// --- 事件循环线程 ---
+static unsigned __stdcall ReactorLoopThread(void* arg) {
+    ReactorLoop* loop = (ReactorLoop*)arg;
+    loop->thread_id = GetCurrentThreadId();
+    t_loop = loop;
+
+    while (loop->running) {
+        loop->now = GetTickCount64();
+        loop_run_commands(loop);
+        loop_compact(loop);
+
+        int timeout = loop_next_timeout(loop);
+
+        int n = WSAPoll(loop->fds, (ULONG)loop->count, timeout);
+        if (n < 0) {
+            log_msg("[Reactor] Loop %d: WSAPoll error %d", loop->index, WSAGetLastError());
+            Sleep(1);
+            continue;
+        }
+
+        if (loop->fds[0].revents) loop_drain_wake(loop);
+
+        loop->now = GetTickCount64();
+        wheel_advance(loop);
+
+        int snapshot = loop->count; // 回调中新增的句柄下一轮再处理
+        for (int i = 1; i < snapshot; i++) {
+            ReactorHandle* h = loop->handles[i];
+            if (h->dead) continue;
+
+            int ev = 0;
+            short re = loop->fds[i].revents;
+            loop->fds[i].revents = 0;
+
+            if (re & (POLLRDNORM | POLLHUP)) ev |= REACTOR_EV_READ;
+            if (re & POLLWRNORM) ev |= REACTOR_EV_WRITE;
+            if (re & (POLLERR | POLLNVAL)) ev |= REACTOR_EV_ERROR | REACTOR_EV_READ;
+
+            if (h->rearm) {
+                h->rearm = 0;
+                loop->rearm_count--;
+                ev |= REACTOR_EV_READ;
+            }
+
+            // 只派发持有者关心的事件 (错误始终派发)
+            ev &= (h->events | REACTOR_EV_ERROR);
+            if (ev) h->cb(h, ev, h->arg);
+        }
+
+        loop_fire_timers(loop);
+    }
+    t_loop = NULL;
+
+    // 退出时通知所有存活句柄，由持有者释放会话资源
+    loop_run_commands(loop);
+    for (int i = 1; i < loop->count; i++) {
+        ReactorHandle* h = loop->handles[i];
+        if (!h->dead) h->cb(h, REACTOR_EV_ERROR, h->arg);
+    }
+    loop_run_commands(loop);
+    loop->has_dead = 1;
+    for (int i = 1; i < loop->count; i++) loop->handles[i]->dead = 1;
+    loop_compact(loop);
+    return 0;
+}
+
+// --- 对外接口 ---
+
+int Reactor_Init(int loop_count) {
+    if (InterlockedCompareExchange(&s_reactorState, 1, 0) != 0) {
+        while (s_reactorState == 1) Sleep(1);
+        return (s_reactorState == 2) ? 0 : -1;
+    }
+
+    if (loop_count <= 0) {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        loop_count = (int)si.dwNumberOfProcessors;
+    }
+    if (loop_count < 1) loop_count = 1;
+    if (loop_count > REACTOR_MAX_LOOPS) loop_count = REACTOR_MAX_LOOPS;
+
+    if (!s_loops || s_loopsAbandoned) {
+        ReactorLoop* loops = (ReactorLoop*)calloc(REACTOR_MAX_LOOPS, sizeof(ReactorLoop));
+        if (!loops) {
+            InterlockedExchange(&s_reactorState, 0);
+            log_msg("[Reactor] Failed to start event loops (OOM).");
+            return -1;
+        }
+        s_loops = loops; // 被放弃的旧数组不释放
+        s_loopsAbandoned = FALSE;
+    }
+
+    int started = 0;
+    for (int i = 0; i < loop_count; i++) {
+        ReactorLoop* loop = &s_loops[i];
+        memset(loop, 0, sizeof(ReactorLoop));
+        loop->index = i;
+        wheel_init(loop);
+        loop->wake_sock = create_wake_socket();
+        if (loop->wake_sock == INVALID_SOCKET) {
+            log_msg("[Reactor] Failed to create wake socket: %d", WSAGetLastError());
+            break;
+        }
+        InitializeCriticalSection(&loop->cmd_lock);
+
+        if (loop_grow(loop) != 0) {
+            closesocket(loop->wake_sock);
+            DeleteCriticalSection(&loop->cmd_lock);
+            break;
+        }
+        loop->fds[0].fd = loop->wake_sock;
+        loop->fds[0].events = POLLRDNORM;
+        loop->fds[0].revents = 0;
+        loop->handles[0] = NULL;
+        loop->count = 1;
+        loop->running = TRUE;
+
+        loop->thread = (HANDLE)_beginthreadex(NULL, 0, ReactorLoopThread, loop, 0, NULL);
+        if (!loop->thread) {
+            closesocket(loop->wake_sock);
+            DeleteCriticalSection(&loop->cmd_lock);
+            free(loop->fds); free(loop->handles);
+            break;
+        }
+        started++;
+    }
+
+    s_loopCount = started;
+    if (started == 0) {
+        InterlockedExchange(&s_reactorState, 0);
+        log_msg("[Reactor] Failed to start event loops.");
+        return -1;
+    }
+
+    InterlockedExchange(&s_reactorState, 2);
+    log_msg("[Reactor] Started %d event loop(s).", started);
+    return 0;
+}
+
+void Reactor_Shutdown(void) {
+    if (InterlockedCompareExchange(&s_reactorState, 3, 2) != 2) return;
+
+    for (int i = 0; i < s_loopCount; i++) {
+        s_loops[i].running = FALSE;
+        loop_wake(&s_loops[i]);
+    }
+    BOOL bSafe = TRUE;
+    for (int i = 0; i < s_loopCount; i++) {
+        ReactorLoop* loop = &s_loops[i];
+        if (loop->thread) {
+            if (WaitForSingleObject(loop->thread, 5000) != WAIT_OBJECT_0) bSafe = FALSE;
+            CloseHandle(loop->thread);
+            loop->thread = NULL;
+        }
+    }
+    if (!bSafe) {
+        // [Fix] 仍有循环线程卡在回调中：旧数组连同 fds / handles / 锁一起放弃 (卡住的线程恢复后自行退出)，
+        // 避免释放后访问；状态复位，下次初始化使用新数组
+        LOG_WARN("[Reactor] Event loop did not exit in time, skipping cleanup");
+        s_loopCount = 0;
+        s_loopsAbandoned = TRUE;
+        InterlockedExchange(&s_reactorState, 0);
+        return;
+    }
+    for (int i = 0; i < s_loopCount; i++) {
+        ReactorLoop* loop = &s_loops[i];
+        closesocket(loop->wake_sock);
+        loop->wake_sock = INVALID_SOCKET;
+        DeleteCriticalSection(&loop->cmd_lock);
+        free(loop->fds); loop->fds = NULL;
+        free(loop->handles); loop->handles = NULL;
+        loop->count = loop->cap = 0;
+    }
+    s_loopCount = 0;
+    InterlockedExchange(&s_reactorState, 0);
+    log_msg("[Reactor] Event loops stopped.");
+}
+
+BOOL Reactor_IsRunning(void) {
+    return s_reactorState == 2;
+}
+
+int Reactor_PickLoop(void) {
+    if (s_loopCount <= 0) return -1;
+    LONG n = InterlockedIncrement(&s_rrCursor);
+    return (int)((unsigned long)n % (unsigned long)s_loopCount);
+}
+
+int Reactor_Post(int loop_idx, void (*fn)(void*), void* arg) {
+    if (!fn || s_reactorState != 2 || loop_idx < 0 || loop_idx >= s_loopCount) return -1;
+    return loop_enqueue(&s_loops[loop_idx], REACTOR_CMD_POST, NULL, 0, fn, arg);
+}
+
+// [New] 粗粒度时钟：循环线程内返回本轮缓存的时间 (每轮只读一次系统时钟)，其他线程直接读取
+ULONGLONG Reactor_Now(void) {
+    ReactorLoop* loop = t_loop;
+    return loop ? loop->now : GetTickCount64();
+}
+
+// [New] 当前线程是否为事件循环线程 (共用的发送回调据此决定能否等待可写)
+BOOL Reactor_IsLoopThread(void) {
+    return t_loop != NULL;
+}
+
+ReactorHandle* Reactor_Add(int loop_idx, SOCKET s, int events, ReactorCallback cb, void* arg) {
+    if (!cb || s == INVALID_SOCKET || s_reactorState != 2) return NULL;
+    if (loop_idx < 0 || loop_idx >= s_loopCount) loop_idx = Reactor_PickLoop();
+    if (loop_idx < 0) return NULL;
+
+    ReactorHandle* h = (ReactorHandle*)calloc(1, sizeof(ReactorHandle));
+    if (!h) return NULL;
+    h->sock = s;
+    h->events = events;
+    h->cb = cb;
+    h->arg = arg;
+    h->loop = &s_loops[loop_idx];
+    h->slot = -1;
+
+    if (is_loop_thread(h->loop)) {
+        apply_add(h->loop, h);
+        return h;
+    }
+    if (loop_enqueue(h->loop, REACTOR_CMD_ADD, h, 0, NULL, NULL) != 0) {
+        free(h);
+        return NULL;
+    }
+    return h;
+}
+
+void Reactor_SetEvents(ReactorHandle* h, int events) {
+    if (!h || h->dead) return;
+    if (is_loop_thread(h->loop)) apply_mod(h, events);
+    else loop_enqueue(h->loop, REACTOR_CMD_MOD, h, events, NULL, NULL);
+}
+
+void Reactor_SetTimer(ReactorHandle* h, int delay_ms) {
+    if (!h || h->dead) return;
+    if (is_loop_thread(h->loop)) apply_timer(h, delay_ms);
+    else loop_enqueue(h->loop, REACTOR_CMD_TIMER, h, delay_ms, NULL, NULL);
+}
+
+void Reactor_Rearm(ReactorHandle* h) {
+    // 仅限循环线程内调用 (典型场景: 回调中 SSL_pending > 0 但本轮配额已用完)
+    if (!h || h->dead || h->rearm || !is_loop_thread(h->loop)) return;
+    h->rearm = 1;
+    h->loop->rearm_count++;
+}
+
+void Reactor_Remove(ReactorHandle* h) {
+    if (!h) return;
+    if (is_loop_thread(h->loop)) apply_del(h->loop, h);
+    else loop_enqueue(h->loop, REACTOR_CMD_DEL, h, 0, NULL, NULL);
+}
+
+int Reactor_GetLoop(ReactorHandle* h) {
+    return h ? h->loop->index : -1;
+}
@@ -0,0 +1,636 @@
+/* src/proxy_rio.c */
+// [New] 2026-10-16: Registered I/O (RIO) 数据面后端，用于 TCP 直连透传
+// 设计要点:
+// 1. 收发缓冲来自预先注册 (RIORegisterBuffer) 的 16K 块 slab，内核无需逐次锁定/映射用户内存
+// 2. 每个方向保持若干个块轮转 (RIO_UP_DEPTH / RIO_DOWN_DEPTH) (收 -> 发 -> 收)，收发可重叠进行
+// 3. 一批完成事件内产生的所有 RIOSend/RIOReceive 均以 RIO_MSG_DEFER 提交，
+//    批次结束后每个请求队列只做一次 RIO_MSG_COMMIT_ONLY，显著减少系统调用次数
+// 4. 系统不支持 RIO 或远端 Socket 未以 WSA_FLAG_REGISTERED_IO 创建时，返回失败由调用者回退到 Reactor 路径
+// [New] 2026-10-16: 零拷贝透传 (对应 Linux splice 的 Windows 实现)
+// 5. 收到的块原样作为发送缓冲，用户态不做任何 memcpy；客户端为本机回环时将其 SO_SNDBUF 置 0，
+//    内核直接从注册块发送而不再复制到 AFD 发送缓冲。零缓冲发送依赖足够的在途请求，
+//    因此下行 (远端 -> 客户端，大文件下载方向) 的在途块数高于上行；上行面向广域网，保留内核缓冲
+// [New] 2026-10-16: 半关闭传递。某方向收到 FIN 后不再投递该方向的接收，待其块全部发完后
+// 对另一端 shutdown(SD_SEND)，反方向继续转发；两个方向都结束时才关闭会话
+// [Fix] 2026-10-16: 仅远端 Socket 使用 RIO。客户端 Socket 由外部接入 (未以 WSA_FLAG_REGISTERED_IO 创建)，
+// 为其创建请求队列必然失败，此前所有会话都回退到 Reactor。客户端侧改为重叠 WSARecv/WSASend，
+// 与 RIO 完成队列共用一个 IOCP (RIO_IOCP_COMPLETION 通知)，循环线程统一由 GetQueuedCompletionStatusEx 驱动
+// [Fix] 2026-10-16: 零拷贝随之落在客户端侧的重叠 WSASend 上：SO_SNDBUF 为 0 时 AFD 锁定块内存直接发送，
+// 下行 RIO_DOWN_DEPTH 个块即在途的重叠发送数；仅在会话确定交给 RIO 循环后才设置，回退路径不受影响
+// [Fix] 2026-10-16: Rio_Shutdown 等待超时 (循环线程未退出) 时不再释放循环状态
+
+#include "proxy_internal.h"
+#include "utils.h"
+#include "common.h"
+#include <mswsock.h>
+#include <process.h>
+
+#define RIO_MAX_LOOPS          2
+#define RIO_UP_DEPTH           2      // 上行 (客户端 -> 远端) 在途的块数量
+#define RIO_DOWN_DEPTH         4      // 下行 (远端 -> 客户端) 在途的块数量
+#define RIO_OPS_PER_RELAY      (RIO_UP_DEPTH + RIO_DOWN_DEPTH)
+#define RIO_MAX_RELAYS_PER_LOOP 1024
+#define RIO_CQ_SIZE            (RIO_MAX_RELAYS_PER_LOOP * RIO_OPS_PER_RELAY)
+#define RIO_DEQUEUE_BATCH      128
+#define RIO_BLOCK_SIZE         IO_BUFFER_SIZE
+#define RIO_SLAB_BLOCKS        128    // 每个 slab 2MB，按需追加注册
+#define RIO_MAX_SLABS          48     // 满载 (1024 会话 x 6 块) 所需的 slab 数
+#define RIO_IDLE_TIMEOUT       300000 // 与 Reactor 直连路径一致
+#define RIO_WAIT_MS            1000
+
+typedef enum { RIO_OP_IDLE = 0, RIO_OP_RECV, RIO_OP_SEND } RioOpState;
+
+struct RioRelay;
+
+typedef struct {
+    WSAOVERLAPPED ov;     // 客户端侧重叠请求 (须为首成员，完成时由 lpOverlapped 还原 RioOp)
+    struct RioRelay* relay;
+    int dir;              // 0 = Client -> Remote, 1 = Remote -> Client
+    RioOpState state;
+    int block;            // slab 块编号 (-1 = 未分配)
+    ULONG len;
+} RioOp;
+
+typedef struct RioSide {
+    SOCKET sock;
+    RIO_RQ rq;            // 仅远端侧有效；客户端侧走重叠 I/O
+    int dirty;            // 本批次有延迟提交的请求
+    struct RioRelay* owner;
+    struct RioSide* dirty_next;
+} RioSide;
+
+typedef struct RioRelay {
+    ProxySession* s;
+    RioSide side[2];      // 0 = Client, 1 = Remote
+    RioOp ops[RIO_OPS_PER_RELAY];
+    int outstanding;
+    int closing;
+    int eof[2];           // 该方向已收到 FIN (下标同 RioOp.dir)
+    int fin_sent[2];      // 已向该方向的目标端转发 FIN
+    ULONGLONG last_activity;
+    RelayDoneCallback on_done;
+    void* done_arg;
+    struct RioRelay* next;
+    struct RioRelay* prev;
+    struct RioRelay* cmd_next;
+    struct RioRelay* dead_next;
+} RioRelay;
+
+typedef struct {
+    char* base;
+    RIO_BUFFERID id;
+} RioSlab;
+
+typedef struct {
+    int index;
+    HANDLE thread;
+    volatile BOOL running;
+    RIO_CQ cq;
+    HANDLE iocp;          // RIONotify 通知、客户端重叠请求完成、新会话投递通知共用
+    OVERLAPPED notify_ov; // RIO 完成队列的 IOCP 通知
+    int notify_armed;     // 已调用 RIONotify 且通知尚未取出
+
+    CRITICAL_SECTION cmd_lock;
+    RioRelay* cmd_head;
+    volatile LONG relay_count; // 含尚未接入的会话，用于容量控制
+
+    RioRelay* relays;     // 活跃会话链表 (仅循环线程访问)
+    RioSide* dirty_head;  // 本批次待提交的请求队列
+    RioRelay* dead_head;  // 已结束、待批次提交后释放的会话
+
+    RioSlab slabs[RIO_MAX_SLABS];
+    int slab_count;
+    int* free_blocks;     // 空闲块栈 (仅循环线程访问)
+    int free_count;
+} RioLoop;
+
+static RIO_EXTENSION_FUNCTION_TABLE s_rio;
+static RioLoop s_rioLoops[RIO_MAX_LOOPS];
+static int s_rioLoopCount = 0;
+static volatile LONG s_rioCursor = 0;
+
+// 0=Uninit, 1=Initializing, 2=Running, 3=Unavailable/Stopped
+static volatile LONG s_rioState = 0;
+
+// IOCP 完成键
+#define RIO_KEY_NOTIFY  1     // RIO 完成队列有新结果
+#define RIO_KEY_CMD     2     // 新会话投递 / 停止
+#define RIO_KEY_CLIENT  3     // 客户端 Socket 的重叠请求完成
+
+// --- 注册缓冲 slab ---
+
+static int slab_grow(RioLoop* loop) {
+    if (loop->slab_count >= RIO_MAX_SLABS) return -1;
+
+    DWORD size = RIO_SLAB_BLOCKS * RIO_BLOCK_SIZE;
+    char* base = (char*)VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!base) return -1;
+
+    RIO_BUFFERID id = s_rio.RIORegisterBuffer(base, size);
+    if (id == RIO_INVALID_BUFFERID) {
+        VirtualFree(base, 0, MEM_RELEASE);
+        return -1;
+    }
+
+    int* nf = (int*)realloc(loop->free_blocks, sizeof(int) * (loop->slab_count + 1) * RIO_SLAB_BLOCKS);
+    if (!nf) {
+        s_rio.RIODeregisterBuffer(id);
+        VirtualFree(base, 0, MEM_RELEASE);
+        return -1;
+    }
+    loop->free_blocks = nf;
+
+    int slab = loop->slab_count++;
+    loop->slabs[slab].base = base;
+    loop->slabs[slab].id = id;
+    for (int i = RIO_SLAB_BLOCKS - 1; i >= 0; i--) {
+        loop->free_blocks[loop->free_count++] = slab * RIO_SLAB_BLOCKS + i;
+    }
+    return 0;
+}
+
+static int block_alloc(RioLoop* loop) {
+    if (loop->free_count == 0 && slab_grow(loop) != 0) return -1;
+    return loop->free_blocks[--loop->free_count];
+}
+
+static void block_free(RioLoop* loop, int block) {
+    if (block >= 0) loop->free_blocks[loop->free_count++] = block;
+}
+
+static char* block_ptr(RioLoop* loop, int block) {
+    return loop->slabs[block / RIO_SLAB_BLOCKS].base + (size_t)(block % RIO_SLAB_BLOCKS) * RIO_BLOCK_SIZE;
+}
+
+static void block_to_buf(RioLoop* loop, int block, ULONG len, RIO_BUF* out) {
+    out->BufferId = loop->slabs[block / RIO_SLAB_BLOCKS].id;
+    out->Offset = (ULONG)(block % RIO_SLAB_BLOCKS) * RIO_BLOCK_SIZE;
+    out->Length = len;
+}
+
+// --- 会话处理 (仅循环线程) ---
+
+static void relay_begin_close(RioLoop* loop, RioRelay* r);
+
+static int op_post(RioLoop* loop, RioOp* op, RioOpState state) {
+    RioRelay* r = op->relay;
+    // dir 0: 从客户端收，向远端发；dir 1 相反
+    RioSide* side = (state == RIO_OP_RECV) ? &r->side[op->dir] : &r->side[1 - op->dir];
+    if (side == &r->side[0]) {
+        // 客户端侧：同一块作为普通重叠缓冲投递，完成事件经 IOCP 返回
+        WSABUF wb;
+        DWORD flags = 0;
+        wb.buf = block_ptr(loop, op->block);
+        wb.len = (state == RIO_OP_RECV) ? RIO_BLOCK_SIZE : op->len;
+        memset(&op->ov, 0, sizeof(op->ov));
+        op->state = state;
+        int rc = (state == RIO_OP_RECV)
+            ? WSARecv(side->sock, &wb, 1, NULL, &flags, &op->ov, NULL)
+            : WSASend(side->sock, &wb, 1, NULL, 0, &op->ov, NULL);
+        if (rc != 0 && WSAGetLastError() != WSA_IO_PENDING) {
+            op->state = RIO_OP_IDLE;
+            return -1;
+        }
+        // 立即完成时同样会投递完成包 (未启用 FILE_SKIP_COMPLETION_PORT_ON_SUCCESS)
+        r->outstanding++;
+        return 0;
+    }
+
+    RIO_BUF buf;
+    block_to_buf(loop, op->block, (state == RIO_OP_RECV) ? RIO_BLOCK_SIZE : op->len, &buf);
+
+    op->state = state;
+    BOOL ok = (state == RIO_OP_RECV)
+        ? s_rio.RIOReceive(side->rq, &buf, 1, RIO_MSG_DEFER, op)
+        : s_rio.RIOSend(side->rq, &buf, 1, RIO_MSG_DEFER, op);
+    if (!ok) {
+        op->state = RIO_OP_IDLE;
+        return -1;
+    }
+    if (!side->dirty) {
+        side->dirty = 1;
+        side->dirty_next = loop->dirty_head;
+        loop->dirty_head = side;
+    }
+    r->outstanding++;
+    return 0;
+}
+
+static void relay_unlink(RioLoop* loop, RioRelay* r) {
+    if (r->prev) r->prev->next = r->next;
+    else loop->relays = r->next;
+    if (r->next) r->next->prev = r->prev;
+}
+
+static void relay_finalize(RioLoop* loop, RioRelay* r) {
+    for (int i = 0; i < RIO_OPS_PER_RELAY; i++) {
+        block_free(loop, r->ops[i].block);
+        r->ops[i].block = -1;
+    }
+    relay_unlink(loop, r);
+    InterlockedDecrement(&loop->relay_count);
+
+    // 延迟释放：待提交链表中可能仍引用该会话的请求队列
+    r->dead_next = loop->dead_head;
+    loop->dead_head = r;
+
+    if (r->on_done) r->on_done(r->s, r->done_arg);
+}
+
+// 关闭 Socket 以取消所有在途请求，待全部完成事件返回后再释放缓冲
+static void relay_begin_close(RioLoop* loop, RioRelay* r) {
+    if (r->closing) return;
+    r->closing = 1;
+
+    ProxySession* s = r->s;
+    if (s->clientSock != INVALID_SOCKET) { closesocket(s->clientSock); s->clientSock = INVALID_SOCKET; }
+    if (s->remoteSock != INVALID_SOCKET) { closesocket(s->remoteSock); s->remoteSock = INVALID_SOCKET; }
+
+    if (r->outstanding == 0) relay_finalize(loop, r);
+}
+
+// 方向 dir 已收到 FIN 且该方向没有在途块时，向目标端转发 FIN；两个方向都结束后关闭会话
+static void relay_try_fin(RioLoop* loop, RioRelay* r, int dir) {
+    if (!r->eof[dir] || r->fin_sent[dir]) return;
+    for (int i = 0; i < RIO_OPS_PER_RELAY; i++) {
+        if (r->ops[i].dir == dir && r->ops[i].state != RIO_OP_IDLE) return;
+    }
+    r->fin_sent[dir] = 1;
+    shutdown(r->side[1 - dir].sock, SD_SEND);
+    if (r->fin_sent[1 - dir]) relay_begin_close(loop, r);
+}
+
+static void relay_on_complete(RioLoop* loop, RioOp* op, LONG status, ULONG bytes) {
+    RioRelay* r = op->relay;
+    r->outstanding--;
+
+    if (r->closing) {
+        op->state = RIO_OP_IDLE;
+        if (r->outstanding == 0) relay_finalize(loop, r);
+        return;
+    }
+
+    if (status != 0) {
+        relay_begin_close(loop, r);
+        return;
+    }
+
+    if (op->state == RIO_OP_RECV) {
+        if (bytes == 0) { // FIN：该方向的块停止轮转
+            op->state = RIO_OP_IDLE;
+            r->eof[op->dir] = 1;
+            relay_try_fin(loop, r, op->dir);
+            return;
+        }
+        r->last_activity = GetTickCount64();
+        op->len = bytes;
+        if (op_post(loop, op, RIO_OP_SEND) != 0) relay_begin_close(loop, r);
+    } else if (r->eof[op->dir]) {
+        op->state = RIO_OP_IDLE;
+        relay_try_fin(loop, r, op->dir);
+    } else {
+        if (op_post(loop, op, RIO_OP_RECV) != 0) relay_begin_close(loop, r);
+    }
+}
+
+static void relay_attach(RioLoop* loop, RioRelay* r) {
+    r->next = loop->relays;
+    r->prev = NULL;
+    if (loop->relays) loop->relays->prev = r;
+    loop->relays = r;
+
+    for (int i = 0; i < RIO_OPS_PER_RELAY; i++) {
+        RioOp* op = &r->ops[i];
+        op->block = block_alloc(loop);
+        if (op->block < 0 || op_post(loop, op, RIO_OP_RECV) != 0) {
+            log_msg("[Conn-%d] [RIO] Failed to post initial receive", r->s->clientSock);
+            relay_begin_close(loop, r);
+            return;
+        }
+    }
+}
+
+static void loop_commit(RioLoop* loop) {
+    RioSide* side = loop->dirty_head;
+    loop->dirty_head = NULL;
+    while (side) {
+        RioSide* next = side->dirty_next;
+        side->dirty = 0;
+        // 同一请求队列的收发共用一次提交；已关闭的 Socket 其请求已被取消，无需提交
+        if (!side->owner->closing) s_rio.RIOSend(side->rq, NULL, 0, RIO_MSG_COMMIT_ONLY, NULL);
+        side = next;
+    }
+
+    RioRelay* r = loop->dead_head;
+    loop->dead_head = NULL;
+    while (r) {
+        RioRelay* next = r->dead_next;
+        free(r);
+        r = next;
+    }
+}
+
+static void loop_take_commands(RioLoop* loop) {
+    EnterCriticalSection(&loop->cmd_lock);
+    RioRelay* r = loop->cmd_head;
+    loop->cmd_head = NULL;
+    LeaveCriticalSection(&loop->cmd_lock);
+
+    while (r) {
+        RioRelay* next = r->cmd_next;
+        relay_attach(loop, r);
+        r = next;
+    }
+}
+
+static void loop_check_idle(RioLoop* loop) {
+    ULONGLONG now = GetTickCount64();
+    RioRelay* r = loop->relays;
+    while (r) {
+        RioRelay* next = r->next; // relay_begin_close 可能释放 r
+        if (!r->closing && now - r->last_activity > RIO_IDLE_TIMEOUT) {
+            log_msg("[Conn-%d] [RIO] Direct connection timed out (Idle > %ds).", r->s->clientSock, RIO_IDLE_TIMEOUT / 1000);
+            relay_begin_close(loop, r);
+        }
+        r = next;
+    }
+}
+
+static void loop_drain(RioLoop* loop, RIORESULT* results) {
+    ULONG n;
+    while ((n = s_rio.RIODequeueCompletion(loop->cq, results, RIO_DEQUEUE_BATCH)) > 0) {
+        if (n == RIO_CORRUPT_CQ) {
+            log_msg("[RIO] Loop %d: completion queue corrupted", loop->index);
+            loop->running = FALSE;
+            return;
+        }
+        for (ULONG i = 0; i < n; i++) {
+            relay_on_complete(loop, (RioOp*)(ULONG_PTR)results[i].RequestContext, results[i].Status, results[i].BytesTransferred);
+        }
+        loop_commit(loop);
+        if (n < RIO_DEQUEUE_BATCH) break;
+    }
+}
+
+// 等待一批 IOCP 完成包：客户端请求直接处理，RIO 通知转为出队完成队列
+static void loop_wait(RioLoop* loop, OVERLAPPED_ENTRY* entries, RIORESULT* results, DWORD timeout) {
+    if (!loop->notify_armed && s_rio.RIONotify(loop->cq) == 0) loop->notify_armed = 1;
+
+    ULONG n = 0;
+    if (GetQueuedCompletionStatusEx(loop->iocp, entries, RIO_DEQUEUE_BATCH, &n, timeout, FALSE)) {
+        for (ULONG i = 0; i < n; i++) {
+            if (entries[i].lpCompletionKey == RIO_KEY_CLIENT && entries[i].lpOverlapped) {
+                RioOp* op = (RioOp*)entries[i].lpOverlapped;
+                relay_on_complete(loop, op, (LONG)op->ov.Internal, entries[i].dwNumberOfBytesTransferred);
+            } else if (entries[i].lpCompletionKey == RIO_KEY_NOTIFY) {
+                loop->notify_armed = 0;
+            }
+        }
+    }
+    // 出队本身不进入内核，每轮都检查一次，不依赖通知是否已到达
+    loop_drain(loop, results);
+    loop_commit(loop);
+}
+
+static unsigned __stdcall RioLoopThread(void* arg) {
+    RioLoop* loop = (RioLoop*)arg;
+    RIORESULT* results = (RIORESULT*)malloc(sizeof(RIORESULT) * RIO_DEQUEUE_BATCH);
+    OVERLAPPED_ENTRY* entries = (OVERLAPPED_ENTRY*)malloc(sizeof(OVERLAPPED_ENTRY) * RIO_DEQUEUE_BATCH);
+    if (!results || !entries) { free(results); free(entries); return 1; }
+
+    ULONGLONG last_idle_check = GetTickCount64();
+
+    while (loop->running) {
+        loop_take_commands(loop);
+        loop_commit(loop);
+
+        loop_wait(loop, entries, results, RIO_WAIT_MS);
+
+        ULONGLONG now = GetTickCount64();
+        if (now - last_idle_check >= RIO_WAIT_MS) {
+            loop_check_idle(loop);
+            loop_commit(loop);
+            last_idle_check = now;
+        }
+    }
+
+    // 退出：关闭所有会话，等待取消完成后释放 (最多 2 秒)
+    loop_take_commands(loop);
+    RioRelay* r = loop->relays;
+    while (r) {
+        RioRelay* next = r->next;
+        relay_begin_close(loop, r);
+        r = next;
+    }
+    ULONGLONG deadline = GetTickCount64() + 2000;
+    while (loop->relays && GetTickCount64() < deadline) {
+        loop_wait(loop, entries, results, 50);
+    }
+    loop_commit(loop);
+
+    free(entries);
+    free(results);
+    return 0;
+}
+
+static BOOL rio_peer_is_loopback(SOCKET sock) {
+    struct sockaddr_storage ss;
+    int len = sizeof(ss);
+    if (getpeername(sock, (struct sockaddr*)&ss, &len) != 0) return FALSE;
+
+    if (ss.ss_family == AF_INET) {
+        const unsigned char* b = (const unsigned char*)&((struct sockaddr_in*)&ss)->sin_addr;
+        return b[0] == 127;
+    }
+    if (ss.ss_family == AF_INET6) {
+        const unsigned char* b = (const unsigned char*)&((struct sockaddr_in6*)&ss)->sin6_addr;
+        static const unsigned char v6_loop[16] = { 0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,1 };
+        static const unsigned char v4_mapped[12] = { 0,0,0,0, 0,0,0,0, 0,0,0xff,0xff };
+        if (memcmp(b, v6_loop, 16) == 0) return TRUE;
+        return memcmp(b, v4_mapped, 12) == 0 && b[12] == 127;
+    }
+    return FALSE;
+}
+
+// --- 对外接口 ---
+
+static void rio_init_once(void) {
+    if (InterlockedCompareExchange(&s_rioState, 1, 0) != 0) {
+        while (s_rioState == 1) Sleep(1);
+        return;
+    }
+
+    SOCKET probe = WSASocketW(AF_INET, SOCK_STREAM, IPPROTO_TCP, NULL, 0, WSA_FLAG_REGISTERED_IO);
+    GUID guid = WSAID_MULTIPLE_RIO;
+    DWORD bytes = 0;
+    memset(&s_rio, 0, sizeof(s_rio));
+    s_rio.cbSize = sizeof(s_rio);
+
+    if (probe == INVALID_SOCKET ||
+        WSAIoctl(probe, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER, &guid, sizeof(guid),
+                 &s_rio, sizeof(s_rio), &bytes, NULL, NULL) != 0) {
+        if (probe != INVALID_SOCKET) closesocket(probe);
+        log_msg("[RIO] Registered I/O unavailable, using readiness-based relay.");
+        InterlockedExchange(&s_rioState, 3);
+        return;
+    }
+    closesocket(probe);
+
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    int count = (si.dwNumberOfProcessors > 1) ? RIO_MAX_LOOPS : 1;
+
+    int started = 0;
+    for (int i = 0; i < count; i++) {
+        RioLoop* loop = &s_rioLoops[i];
+        memset(loop, 0, sizeof(RioLoop));
+        loop->index = i;
+        loop->iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+        if (!loop->iocp) break;
+
+        RIO_NOTIFICATION_COMPLETION nc;
+        memset(&nc, 0, sizeof(nc));
+        nc.Type = RIO_IOCP_COMPLETION;
+        nc.Iocp.IocpHandle = loop->iocp;
+        nc.Iocp.CompletionKey = (void*)(ULONG_PTR)RIO_KEY_NOTIFY;
+        nc.Iocp.Overlapped = &loop->notify_ov;
+
+        loop->cq = s_rio.RIOCreateCompletionQueue(RIO_CQ_SIZE, &nc);
+        if (loop->cq == RIO_INVALID_CQ) { CloseHandle(loop->iocp); break; }
+
+        InitializeCriticalSection(&loop->cmd_lock);
+        loop->running = TRUE;
+        loop->thread = (HANDLE)_beginthreadex(NULL, 0, RioLoopThread, loop, 0, NULL);
+        if (!loop->thread) {
+            s_rio.RIOCloseCompletionQueue(loop->cq);
+            CloseHandle(loop->iocp);
+            DeleteCriticalSection(&loop->cmd_lock);
+            break;
+        }
+        started++;
+    }
+
+    s_rioLoopCount = started;
+    if (started == 0) {
+        log_msg("[RIO] Failed to start completion loops, using readiness-based relay.");
+        InterlockedExchange(&s_rioState, 3);
+        return;
+    }
+    log_msg("[RIO] Started %d completion loop(s).", started);
+    InterlockedExchange(&s_rioState, 2);
+}
+
+BOOL Rio_IsAvailable(void) {
+    if (s_rioState == 0 || s_rioState == 1) rio_init_once();
+    return s_rioState == 2;
+}
+
+SOCKET Rio_CreateSocket(int af, int type, int protocol) {
+    if (Rio_IsAvailable()) {
+        SOCKET s = WSASocketW(af, type, protocol, NULL, 0, WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO);
+        if (s != INVALID_SOCKET) return s;
+    }
+    return socket(af, type, protocol);
+}
+
+int Rio_StartDirect(ProxySession* s, RelayDoneCallback on_done, void* arg) {
+    if (!s || !Rio_IsAvailable()) return -1;
+
+    int idx = (int)((unsigned long)InterlockedIncrement(&s_rioCursor) % (unsigned long)s_rioLoopCount);
+    RioLoop* loop = &s_rioLoops[idx];
+
+    if (InterlockedIncrement(&loop->relay_count) > RIO_MAX_RELAYS_PER_LOOP) {
+        InterlockedDecrement(&loop->relay_count);
+        return -1; // 完成队列容量已满
+    }
+
+    RioRelay* r = (RioRelay*)calloc(1, sizeof(RioRelay));
+    if (!r) { InterlockedDecrement(&loop->relay_count); return -1; }
+
+    r->s = s;
+    r->on_done = on_done;
+    r->done_arg = arg;
+    r->last_activity = GetTickCount64();
+    r->side[0].sock = s->clientSock;
+    r->side[1].sock = s->remoteSock;
+    r->side[0].owner = r->side[1].owner = r;
+    for (int i = 0; i < RIO_OPS_PER_RELAY; i++) {
+        r->ops[i].relay = r;
+        r->ops[i].dir = (i < RIO_UP_DEPTH) ? 0 : 1;
+        r->ops[i].block = -1;
+    }
+
+    // 客户端侧关联到循环的 IOCP，重叠收发的完成包与 RIO 通知由同一线程取出
+    // (关联不影响回退后 Reactor 路径的非阻塞 recv/send)
+    if (!CreateIoCompletionPort((HANDLE)s->clientSock, loop->iocp, RIO_KEY_CLIENT, 0)) {
+        free(r);
+        InterlockedDecrement(&loop->relay_count);
+        return -1;
+    }
+
+    // 远端请求队列在调用线程创建：未以 WSA_FLAG_REGISTERED_IO 创建的 Socket 会在此失败，调用者回退
+    // 远端侧收下行、发上行
+    r->side[0].rq = RIO_INVALID_RQ;
+    r->side[1].rq = s_rio.RIOCreateRequestQueue(r->side[1].sock,
+                                                RIO_DOWN_DEPTH, 1, RIO_UP_DEPTH, 1,
+                                                loop->cq, loop->cq, r);
+    if (r->side[1].rq == RIO_INVALID_RQ) {
+        free(r);
+        InterlockedDecrement(&loop->relay_count);
+        return -1;
+    }
+
+    // 回环客户端：关闭发送缓冲，重叠 WSASend 在完成前由内核直接引用块内存 (零拷贝)
+    // 须在最后一个失败点之后设置：回退到 Reactor 的非阻塞 send 不能使用零发送缓冲
+    BOOL zero_copy = FALSE;
+    if (rio_peer_is_loopback(s->clientSock)) {
+        int zero = 0;
+        zero_copy = (setsockopt(s->clientSock, SOL_SOCKET, SO_SNDBUF, (const char*)&zero, sizeof(zero)) == 0);
+    }
+
+    // 投递后会话归循环线程所有，可能随时结束，日志须在投递前输出
+    log_msg("[Conn-%d] Entering TCP Direct Relay (Registered I/O%s)", s->clientSock, zero_copy ? ", zero-copy" : "");
+
+    EnterCriticalSection(&loop->cmd_lock);
+    r->cmd_next = loop->cmd_head;
+    loop->cmd_head = r;
+    LeaveCriticalSection(&loop->cmd_lock);
+    PostQueuedCompletionStatus(loop->iocp, 0, RIO_KEY_CMD, NULL);
+    return 0;
+}
+
+void Rio_Shutdown(void) {
+    if (InterlockedCompareExchange(&s_rioState, 3, 2) != 2) return;
+
+    for (int i = 0; i < s_rioLoopCount; i++) {
+        s_rioLoops[i].running = FALSE;
+        PostQueuedCompletionStatus(s_rioLoops[i].iocp, 0, RIO_KEY_CMD, NULL);
+    }
+
+    // 任一循环线程未在时限内退出时不释放任何状态 (线程仍可能访问完成队列与注册块)，保持 Stopped
+    BOOL bSafe = TRUE;
+    for (int i = 0; i < s_rioLoopCount; i++) {
+        if (s_rioLoops[i].thread && WaitForSingleObject(s_rioLoops[i].thread, 5000) != WAIT_OBJECT_0) bSafe = FALSE;
+    }
+    if (!bSafe) {
+        LOG_WARN("[RIO] Completion loop did not exit in time, skipping cleanup");
+        return;
+    }
+
+    for (int i = 0; i < s_rioLoopCount; i++) {
+        RioLoop* loop = &s_rioLoops[i];
+        if (loop->thread) CloseHandle(loop->thread);
+        s_rio.RIOCloseCompletionQueue(loop->cq);
+        for (int k = 0; k < loop->slab_count; k++) {
+            s_rio.RIODeregisterBuffer(loop->slabs[k].id);
+            VirtualFree(loop->slabs[k].base, 0, MEM_RELEASE);
+        }
+        free(loop->free_blocks);
+        CloseHandle(loop->iocp);
+        DeleteCriticalSection(&loop->cmd_lock);
+        memset(loop, 0, sizeof(RioLoop));
+    }
+    s_rioLoopCount = 0;
+    // 允许下次启动时重新探测
+    InterlockedExchange(&s_rioState, 0);
+}
@@ -0,0 +1,195 @@
+/* src/proxy_route_cache.c */
+// [New] 2026-10-16: 路由决策缓存，位于 CheckRoutingAndApply 与路由匹配器之间
+// 设计要点:
+// 1. 流量集中在少数域名上：按小写 host 缓存 Router_Match 的结果 (包括"未命中任何规则")，命中时不再执行规则匹配
+// 2. 按 host 哈希分为 ROUTE_CACHE_SHARDS 个分片，每个分片一把锁、固定容量的哈希表 + LRU 链表，满时淘汰最久未用的条目
+// 3. 每个分片记录其条目所属的规则代数 (Router_GetGeneration)；ReloadRoutingRules / GUI 修改路由 / 规则集更新
+//    都会发布新快照并递增代数，分片在下一次访问时整体清空，无需遍历或通知
+// 4. 写入时使用查询前读取的代数：查询期间规则恰好被替换时结果直接丢弃，不会把旧规则的结论记在新代数下
+// 5. 命中 / 未命中计数可通过 RouteCache_GetStats 读取，规则代数变化时记录一次累计命中率
+
+#include "proxy_internal.h"
+#include "utils.h"
+#include "config.h"
+#include "common.h"
+#include <stdio.h>
+#include <ctype.h>
+
+#define ROUTE_CACHE_SHARDS      8
+#define ROUTE_CACHE_SHARD_SIZE  64   // 每个分片的条目数 (总容量 512)
+#define ROUTE_CACHE_BUCKETS     128  // 每个分片的哈希桶数 (2 的幂)
+#define ROUTE_CACHE_HOST_LEN    256
+
+typedef struct {
+    char host[ROUTE_CACHE_HOST_LEN];
+    int rule;                           // -1 = 未命中任何规则
+    char tag[32];
+    char entry[MAX_RULE_CONTENT_LEN];
+    int chain;                          // 同桶下一个条目 (-1 结束)
+    int prev, next;                     // LRU 链表 (头部为最近使用)
+} RouteCacheEntry;
+
+typedef struct {
+    CRITICAL_SECTION lock;
+    LONG generation;
+    int buckets[ROUTE_CACHE_BUCKETS];
+    RouteCacheEntry entries[ROUTE_CACHE_SHARD_SIZE];
+    int head, tail;
+    int count;
+} RouteCacheShard;
+
+static RouteCacheShard s_shards[ROUTE_CACHE_SHARDS];
+static volatile LONG s_cacheHits = 0, s_cacheMisses = 0;
+static volatile LONG s_loggedGeneration = 0;
+
+// 0=Uninit, 1=Initializing, 2=Ready
+static volatile LONG s_cacheState = 0;
+
+static void shard_reset(RouteCacheShard* sh, LONG generation) {
+    for (int i = 0; i < ROUTE_CACHE_BUCKETS; i++) sh->buckets[i] = -1;
+    sh->head = sh->tail = -1;
+    sh->count = 0;
+    sh->generation = generation;
+}
+
+static void route_cache_init_once() {
+    if (InterlockedCompareExchange(&s_cacheState, 1, 0) != 0) {
+        while (s_cacheState == 1) Sleep(1);
+        return;
+    }
+    LONG gen = Router_GetGeneration();
+    for (int i = 0; i < ROUTE_CACHE_SHARDS; i++) {
+        InitializeCriticalSection(&s_shards[i].lock);
+        shard_reset(&s_shards[i], gen);
+    }
+    s_loggedGeneration = gen;
+    InterlockedExchange(&s_cacheState, 2);
+}
+
+static unsigned int route_cache_hash(const char* s) {
+    unsigned int h = 2166136261u;
+    for (; *s; s++) h = (h ^ (unsigned char)*s) * 16777619u;
+    return h;
+}
+
+static void lru_unlink(RouteCacheShard* sh, int i) {
+    RouteCacheEntry* e = &sh->entries[i];
+    if (e->prev >= 0) sh->entries[e->prev].next = e->next; else sh->head = e->next;
+    if (e->next >= 0) sh->entries[e->next].prev = e->prev; else sh->tail = e->prev;
+}
+
+static void lru_push_front(RouteCacheShard* sh, int i) {
+    RouteCacheEntry* e = &sh->entries[i];
+    e->prev = -1;
+    e->next = sh->head;
+    if (sh->head >= 0) sh->entries[sh->head].prev = i;
+    sh->head = i;
+    if (sh->tail < 0) sh->tail = i;
+}
+
+static int shard_find(RouteCacheShard* sh, unsigned int bucket, const char* host) {
+    for (int i = sh->buckets[bucket]; i >= 0; i = sh->entries[i].chain) {
+        if (strcmp(sh->entries[i].host, host) == 0) return i;
+    }
+    return -1;
+}
+
+// 取一个空闲槽位，满时淘汰 LRU 尾部
+static int shard_alloc(RouteCacheShard* sh) {
+    if (sh->count < ROUTE_CACHE_SHARD_SIZE) return sh->count++;
+
+    int victim = sh->tail;
+    unsigned int b = (route_cache_hash(sh->entries[victim].host) >> 8) & (ROUTE_CACHE_BUCKETS - 1);
+    int* link = &sh->buckets[b];
+    while (*link >= 0 && *link != victim) link = &sh->entries[*link].chain;
+    if (*link == victim) *link = sh->entries[victim].chain;
+    lru_unlink(sh, victim);
+    return victim;
+}
+
+// 规则代数变化后记录一次累计命中率
+static void route_cache_log_generation(LONG gen) {
+    LONG prev = s_loggedGeneration;
+    if (prev == gen || InterlockedCompareExchange(&s_loggedGeneration, gen, prev) != prev) return;
+    LONG hits = s_cacheHits, misses = s_cacheMisses;
+    LONG total = hits + misses;
+    if (total > 0) {
+        log_msg("[Routing] Rules changed, decision cache cleared (hits %ld, misses %ld, hit rate %ld%%)",
+            hits, misses, (LONG)((LONGLONG)hits * 100 / total));
+    }
+}
+
+int RouteCache_Match(const char* host, char* out_tag, int tag_len, char* out_entry, int entry_len) {
+    if (!host || !host[0]) return -1;
+    if (s_cacheState != 2) route_cache_init_once();
+
+    char key[ROUTE_CACHE_HOST_LEN];
+    int n = 0;
+    for (; host[n] && n < ROUTE_CACHE_HOST_LEN - 1; n++) key[n] = (char)tolower((unsigned char)host[n]);
+    key[n] = 0;
+    if (host[n]) return Router_Match(host, out_tag, tag_len, out_entry, entry_len); // 超长域名不缓存
+
+    unsigned int h = route_cache_hash(key);
+    RouteCacheShard* sh = &s_shards[h & (ROUTE_CACHE_SHARDS - 1)];
+    unsigned int bucket = (h >> 8) & (ROUTE_CACHE_BUCKETS - 1);
+    LONG gen = Router_GetGeneration();
+    if (gen != s_loggedGeneration) route_cache_log_generation(gen);
+
+    EnterCriticalSection(&sh->lock);
+    if (sh->generation != gen) shard_reset(sh, gen);
+    int i = shard_find(sh, bucket, key);
+    if (i >= 0) {
+        RouteCacheEntry* e = &sh->entries[i];
+        int rule = e->rule;
+        if (out_tag) ConfigSafeStrCpy(out_tag, tag_len, e->tag);
+        if (out_entry) ConfigSafeStrCpy(out_entry, entry_len, e->entry);
+        if (sh->head != i) { lru_unlink(sh, i); lru_push_front(sh, i); }
+        LeaveCriticalSection(&sh->lock);
+        InterlockedIncrement(&s_cacheHits);
+        return rule;
+    }
+    LeaveCriticalSection(&sh->lock);
+    InterlockedIncrement(&s_cacheMisses);
+
+    char tag[32] = "", entry[MAX_RULE_CONTENT_LEN] = "";
+    int rule = Router_Match(host, tag, sizeof(tag), entry, sizeof(entry));
+
+    EnterCriticalSection(&sh->lock);
+    // 查询期间规则已被替换时不写入 (结果可能来自任一代)
+    if (Router_GetGeneration() == gen) {
+        if (sh->generation != gen) shard_reset(sh, gen);
+        if (shard_find(sh, bucket, key) < 0) {
+            int slot = shard_alloc(sh);
+            RouteCacheEntry* e = &sh->entries[slot];
+            memcpy(e->host, key, n + 1);
+            e->rule = rule;
+            ConfigSafeStrCpy(e->tag, sizeof(e->tag), tag);
+            ConfigSafeStrCpy(e->entry, sizeof(e->entry), entry);
+            e->chain = sh->buckets[bucket];
+            sh->buckets[bucket] = slot;
+            lru_push_front(sh, slot);
+        }
+    }
+    LeaveCriticalSection(&sh->lock);
+
+    if (out_tag) ConfigSafeStrCpy(out_tag, tag_len, tag);
+    if (out_entry) ConfigSafeStrCpy(out_entry, entry_len, entry);
+    return rule;
+}
+
+void RouteCache_GetStats(LONG* hits, LONG* misses, int* entries) {
+    if (hits) *hits = s_cacheHits;
+    if (misses) *misses = s_cacheMisses;
+    if (entries) {
+        int total = 0;
+        if (s_cacheState == 2) {
+            LONG gen = Router_GetGeneration();
+            for (int i = 0; i < ROUTE_CACHE_SHARDS; i++) {
+                EnterCriticalSection(&s_shards[i].lock);
+                if (s_shards[i].generation == gen) total += s_shards[i].count;
+                LeaveCriticalSection(&s_shards[i].lock);
+            }
+        }
+        *entries = total;
+    }
+}
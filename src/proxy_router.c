@@ -0,0 +1,429 @@
+/* src/proxy_router.c */
+// [New] 2026-10-16: 编译后的路由匹配器，替代 CheckRoutingAndApply 中逐条规则 / 逐个条目的线性扫描
+// 设计要点:
+// 1. g_routingRules 在加载或重载时编译为只读快照：域名后缀进入按标签倒序的前缀树 (com -> google -> www)，
+//    IPv4 / IPv6 CIDR 进入按位的二叉基数树，regexp: 规则只在编译时 regcomp 一次
+// 2. 语义与原实现一致：条目按 (规则, 规则内顺序) 全局编号，同一目标命中多个条目时取编号最小者；
+//    树上每个节点记录以其结尾的最小条目编号，查找沿路径取最小值，耗时只与域名标签数 / 地址位数有关
+// 3. 正则无法合并为单一自动机 (POSIX regex 不支持多模式集合)，按规则顺序逐个执行已编译的正则，
+//    编号不小于已命中条目的正则直接跳过
+// 4. [New] 外部规则集 (proxy_rule_provider.c) 的映射文件随快照一起打开 / 释放，内联规则未命中时按配置顺序查询
+// 5. 快照通过指针原子替换发布，查找不加锁；旧快照按两代读者计数回收：
+//    读者登记当前代后读取指针，替换者翻转代数并等待旧代读者离开后再释放 (只有重载路径等待)
+
+#include "proxy_internal.h"
+#include "utils.h"
+#include "config.h"
+#include "common.h"
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <limits.h>
+#include <regex.h>
+
+typedef struct RouteTrieNode {
+    char* label;                    // 父节点到本节点的标签 (小写)
+    int entry;                      // 以本节点结尾的最小条目编号，-1 = 无
+    struct RouteTrieNode** kids;    // 按 label 排序，查找时二分
+    int kid_count;
+    int kid_cap;
+} RouteTrieNode;
+
+typedef struct {
+    int child[2];                   // 0 = 无子节点 (0 号为根，不会成为子节点)
+    int entry;
+} RouteBitNode;
+
+typedef struct {
+    RouteBitNode* nodes;
+    int count;
+    int cap;
+} RouteBitTree;
+
+typedef struct {
+    regex_t re;
+    int entry;
+} RouteRegex;
+
+typedef struct {
+    RuleSet* set;
+    char tag[32];
+    char outboundTag[32];
+} RouteProvider;
+
+typedef struct {
+    RouteTrieNode* domains;
+    RouteBitTree v4;
+    RouteBitTree v6;
+    RouteRegex* regexes;
+    int regex_count;
+    char (*tags)[32];               // 每条规则的 outboundTag
+    int rule_count;
+    char** entries;                 // 条目原文 (日志用)
+    int* entry_rules;               // 条目所属规则
+    int entry_count;
+    RouteProvider providers[MAX_RULE_PROVIDERS];
+    int provider_count;
+} RouterSnapshot;
+
+static RouterSnapshot* volatile s_snapshot = NULL;
+static volatile LONG s_epoch = 0;
+static volatile LONG s_readers[2] = { 0, 0 };
+static CRITICAL_SECTION s_routerLock; // 只串行化重建 / 发布
+static volatile LONG s_generation = 0; // [New] 每次发布新快照后递增 (决策缓存据此整体失效)
+
+// 0=Uninit, 1=Initializing, 2=Ready
+static volatile LONG s_routerState = 0;
+
+static void router_init_once() {
+    if (InterlockedCompareExchange(&s_routerState, 1, 0) != 0) {
+        while (s_routerState == 1) Sleep(1);
+        return;
+    }
+    InitializeCriticalSection(&s_routerLock);
+    InterlockedExchange(&s_routerState, 2);
+}
+
+// --- 域名前缀树 ---
+
+static RouteTrieNode* trie_new(const char* label, int len) {
+    RouteTrieNode* n = (RouteTrieNode*)calloc(1, sizeof(RouteTrieNode));
+    if (!n) return NULL;
+    n->entry = -1;
+    if (label) {
+        n->label = (char*)malloc(len + 1);
+        if (!n->label) { free(n); return NULL; }
+        for (int i = 0; i < len; i++) n->label[i] = (char)tolower((unsigned char)label[i]);
+        n->label[len] = 0;
+    }
+    return n;
+}
+
+static void trie_free(RouteTrieNode* n) {
+    if (!n) return;
+    for (int i = 0; i < n->kid_count; i++) trie_free(n->kids[i]);
+    free(n->kids);
+    free(n->label);
+    free(n);
+}
+
+// 比较 label 与长度为 len 的 s (s 已为小写)
+static int trie_cmp(const char* label, const char* s, int len) {
+    int c = strncmp(label, s, len);
+    if (c != 0) return c;
+    return label[len] ? 1 : 0;
+}
+
+// 二分查找子节点；未找到时 *pos 为插入位置
+static RouteTrieNode* trie_find(const RouteTrieNode* n, const char* s, int len, int* pos) {
+    int lo = 0, hi = n->kid_count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int c = trie_cmp(n->kids[mid]->label, s, len);
+        if (c == 0) { if (pos) *pos = mid; return n->kids[mid]; }
+        if (c < 0) lo = mid + 1; else hi = mid - 1;
+    }
+    if (pos) *pos = lo;
+    return NULL;
+}
+
+static int trie_insert(RouteTrieNode* root, const char* domain, int entry) {
+    char buf[MAX_RULE_CONTENT_LEN];
+    int len = 0;
+    for (; domain[len] && len < (int)sizeof(buf) - 1; len++) buf[len] = (char)tolower((unsigned char)domain[len]);
+    buf[len] = 0;
+    if (len == 0) return -1;
+
+    RouteTrieNode* n = root;
+    int end = len;
+    while (end >= 0) {
+        // 从右往左取一个标签 [start, end)
+        int start = end - 1;
+        while (start >= 0 && buf[start] != '.') start--;
+        start++;
+        int pos = 0;
+        RouteTrieNode* kid = trie_find(n, buf + start, end - start, &pos);
+        if (!kid) {
+            kid = trie_new(buf + start, end - start);
+            if (!kid) return -1;
+            if (n->kid_count == n->kid_cap) {
+                int cap = n->kid_cap ? n->kid_cap * 2 : 4;
+                RouteTrieNode** kids = (RouteTrieNode**)realloc(n->kids, cap * sizeof(RouteTrieNode*));
+                if (!kids) { trie_free(kid); return -1; }
+                n->kids = kids;
+                n->kid_cap = cap;
+            }
+            memmove(n->kids + pos + 1, n->kids + pos, (n->kid_count - pos) * sizeof(RouteTrieNode*));
+            n->kids[pos] = kid;
+            n->kid_count++;
+        }
+        n = kid;
+        end = start - 1; // 跳过 '.'
+    }
+    if (n->entry < 0 || entry < n->entry) n->entry = entry;
+    return 0;
+}
+
+// host 已为小写；沿标签路径取最小条目编号
+static void trie_match(const RouteTrieNode* root, const char* host, int* best) {
+    const RouteTrieNode* n = root;
+    int end = (int)strlen(host);
+    while (end >= 0 && n) {
+        int start = end - 1;
+        while (start >= 0 && host[start] != '.') start--;
+        start++;
+        n = trie_find(n, host + start, end - start, NULL);
+        if (n && n->entry >= 0 && n->entry < *best) *best = n->entry;
+        end = start - 1;
+    }
+}
+
+// --- CIDR 基数树 ---
+
+static int bits_new_node(RouteBitTree* t) {
+    if (t->count == t->cap) {
+        int cap = t->cap ? t->cap * 2 : 64;
+        RouteBitNode* nodes = (RouteBitNode*)realloc(t->nodes, cap * sizeof(RouteBitNode));
+        if (!nodes) return -1;
+        t->nodes = nodes;
+        t->cap = cap;
+    }
+    RouteBitNode* n = &t->nodes[t->count];
+    n->child[0] = n->child[1] = 0;
+    n->entry = -1;
+    return t->count++;
+}
+
+static int bits_insert(RouteBitTree* t, const unsigned char* addr, int prefix, int entry) {
+    if (t->count == 0 && bits_new_node(t) < 0) return -1;
+    int cur = 0;
+    for (int i = 0; i < prefix; i++) {
+        int bit = (addr[i / 8] >> (7 - (i % 8))) & 1;
+        int next = t->nodes[cur].child[bit];
+        if (next == 0) {
+            next = bits_new_node(t);
+            if (next < 0) return -1;
+            t->nodes[cur].child[bit] = next;
+        }
+        cur = next;
+    }
+    RouteBitNode* n = &t->nodes[cur];
+    if (n->entry < 0 || entry < n->entry) n->entry = entry;
+    return 0;
+}
+
+static void bits_match(const RouteBitTree* t, const unsigned char* addr, int bits, int* best) {
+    if (t->count == 0) return;
+    int cur = 0;
+    for (int i = 0; ; i++) {
+        const RouteBitNode* n = &t->nodes[cur];
+        if (n->entry >= 0 && n->entry < *best) *best = n->entry;
+        if (i >= bits) break;
+        int bit = (addr[i / 8] >> (7 - (i % 8))) & 1;
+        cur = n->child[bit];
+        if (cur == 0) break;
+    }
+}
+
+// 与 CidrMatch 相同的写法: "ip"、"ip/prefix"，前缀缺省为整段地址
+static int bits_add_cidr(RouterSnapshot* r, const char* text, int entry) {
+    char ip[128];
+    int prefix = -1;
+    const char* slash = strchr(text, '/');
+    size_t len = slash ? (size_t)(slash - text) : strlen(text);
+    if (len >= sizeof(ip)) return -1;
+    memcpy(ip, text, len);
+    ip[len] = 0;
+    if (slash) prefix = atoi(slash + 1);
+
+    unsigned char addr[16];
+    if (inet_pton(AF_INET, ip, addr) == 1) {
+        if (prefix < 0 || prefix > 32) prefix = 32;
+        return bits_insert(&r->v4, addr, prefix, entry);
+    }
+    if (inet_pton(AF_INET6, ip, addr) == 1) {
+        if (prefix < 0 || prefix > 128) prefix = 128;
+        return bits_insert(&r->v6, addr, prefix, entry);
+    }
+    return -1;
+}
+
+// --- 快照 ---
+
+static void snapshot_free(RouterSnapshot* r) {
+    if (!r) return;
+    trie_free(r->domains);
+    free(r->v4.nodes);
+    free(r->v6.nodes);
+    for (int i = 0; i < r->regex_count; i++) regfree(&r->regexes[i].re);
+    free(r->regexes);
+    free(r->tags);
+    for (int i = 0; i < r->entry_count; i++) free(r->entries[i]);
+    free(r->entries);
+    free(r->entry_rules);
+    for (int i = 0; i < r->provider_count; i++) RuleSet_Close(r->providers[i].set);
+    free(r);
+}
+
+// 调用者持有 g_configLock
+static RouterSnapshot* snapshot_build(const RoutingRule* rules, int count, const RuleProvider* providers, int provider_count) {
+    RouterSnapshot* r = (RouterSnapshot*)calloc(1, sizeof(RouterSnapshot));
+    if (!r) return NULL;
+
+    int total = 0;
+    for (int i = 0; i < count; i++) total += rules[i].contentCount;
+    r->domains = trie_new(NULL, 0);
+    r->tags = calloc(count > 0 ? count : 1, sizeof(*r->tags));
+    r->entries = (char**)calloc(total > 0 ? total : 1, sizeof(char*));
+    r->entry_rules = (int*)calloc(total > 0 ? total : 1, sizeof(int));
+    r->regexes = (RouteRegex*)calloc(total > 0 ? total : 1, sizeof(RouteRegex));
+    if (!r->domains || !r->tags || !r->entries || !r->entry_rules || !r->regexes) { snapshot_free(r); return NULL; }
+    r->rule_count = count;
+
+    for (int i = 0; i < count; i++) {
+        const RoutingRule* rule = &rules[i];
+        ConfigSafeStrCpy(r->tags[i], sizeof(r->tags[i]), rule->outboundTag);
+
+        for (int j = 0; j < rule->contentCount; j++) {
+            const char* text = rule->contents[j];
+            int entry = r->entry_count;
+            r->entries[entry] = _strdup(text);
+            if (!r->entries[entry]) continue;
+            r->entry_rules[entry] = i;
+            r->entry_count++;
+
+            int rc = 0;
+            if (strncmp(text, "regexp:", 7) == 0) {
+                RouteRegex* x = &r->regexes[r->regex_count];
+                if (regcomp(&x->re, text + 7, REG_EXTENDED | REG_ICASE | REG_NOSUB) == 0) {
+                    x->entry = entry;
+                    r->regex_count++;
+                } else {
+                    rc = -1;
+                }
+            } else if (strncmp(text, "ip:", 3) == 0 || strncmp(text, "cidr:", 5) == 0 ||
+                       strchr(text, '/') != NULL || IsIpStr(text)) {
+                const char* val = text;
+                if (strncmp(text, "ip:", 3) == 0) val += 3;
+                else if (strncmp(text, "cidr:", 5) == 0) val += 5;
+                rc = bits_add_cidr(r, val, entry);
+            } else {
+                const char* domain = text;
+                if (strncmp(domain, "domain:", 7) == 0) domain += 7;
+                rc = trie_insert(r->domains, domain, entry);
+            }
+            if (rc != 0) log_msg("[Routing] Ignored invalid rule entry: %s", text);
+        }
+    }
+
+    for (int i = 0; i < provider_count; i++) {
+        RuleSet* set = RuleSet_Open(&providers[i]);
+        if (!set) continue; // 尚未编译 (后台更新完成后会再次重建)
+        RouteProvider* p = &r->providers[r->provider_count++];
+        p->set = set;
+        ConfigSafeStrCpy(p->tag, sizeof(p->tag), providers[i].tag);
+        ConfigSafeStrCpy(p->outboundTag, sizeof(p->outboundTag), providers[i].outboundTag);
+    }
+    return r;
+}
+
+// 读者登记 / 离开 (不加锁)
+static RouterSnapshot* router_acquire(int* slot) {
+    while (TRUE) {
+        LONG e = s_epoch;
+        InterlockedIncrement(&s_readers[e & 1]);
+        if (s_epoch == e) {
+            *slot = (int)(e & 1);
+            return s_snapshot;
+        }
+        InterlockedDecrement(&s_readers[e & 1]); // 替换者刚翻转代数，重新登记
+    }
+}
+
+static void router_release(int slot) {
+    InterlockedDecrement(&s_readers[slot]);
+}
+
+// 替换快照并回收旧快照 (调用者持有 s_routerLock)
+static void router_publish(RouterSnapshot* next) {
+    RouterSnapshot* old = (RouterSnapshot*)InterlockedExchangePointer((PVOID volatile*)&s_snapshot, next);
+    InterlockedIncrement(&s_generation); // 必须在替换指针之后：读到新代数的缓存一定查到新快照
+    LONG e = InterlockedIncrement(&s_epoch) - 1;
+    while (s_readers[e & 1] != 0) Sleep(0);
+    snapshot_free(old);
+}
+
+void Router_Rebuild(void) {
+    if (s_routerState != 2) router_init_once();
+
+    EnterCriticalSection(&s_routerLock);
+    EnterCriticalSection(&g_configLock);
+    int count = g_routingRuleCount + g_ruleProviderCount;
+    RouterSnapshot* next = (count > 0) ? snapshot_build(g_routingRules, g_routingRuleCount, g_ruleProviders, g_ruleProviderCount) : NULL;
+    LeaveCriticalSection(&g_configLock);
+
+    if (count > 0 && !next) {
+        log_msg("[Routing] Failed to compile routing rules, keeping previous rule set");
+    } else {
+        router_publish(next);
+        if (next) {
+            log_msg("[Routing] Compiled %d rule(s) / %d entries (CIDR nodes v4=%d v6=%d, regex=%d), %d rule provider(s)",
+                next->rule_count, next->entry_count, next->v4.count, next->v6.count, next->regex_count, next->provider_count);
+        }
+    }
+    LeaveCriticalSection(&s_routerLock);
+}
+
+LONG Router_GetGeneration(void) {
+    return s_generation;
+}
+
+int Router_Match(const char* host, char* out_tag, int tag_len, char* out_entry, int entry_len) {
+    if (!host || !host[0] || !s_snapshot) return -1;
+
+    int slot = 0;
+    RouterSnapshot* r = router_acquire(&slot);
+    if (!r) { router_release(slot); return -1; }
+
+    int best = INT_MAX; // 最小条目编号
+    int family = 0;
+    unsigned char addr[16];
+    char lower[256];
+    if (inet_pton(AF_INET, host, addr) == 1) {
+        family = AF_INET;
+        bits_match(&r->v4, addr, 32, &best);
+    } else if (inet_pton(AF_INET6, host, addr) == 1) {
+        family = AF_INET6;
+        bits_match(&r->v6, addr, 128, &best);
+    } else {
+        int n = 0;
+        for (; host[n] && n < (int)sizeof(lower) - 1; n++) lower[n] = (char)tolower((unsigned char)host[n]);
+        lower[n] = 0;
+        trie_match(r->domains, lower, &best);
+
+        for (int i = 0; i < r->regex_count && r->regexes[i].entry < best; i++) {
+            if (regexec(&r->regexes[i].re, host, 0, NULL, 0) == 0) { best = r->regexes[i].entry; break; }
+        }
+    }
+
+    int ret = -1;
+    if (best != INT_MAX) {
+        ret = r->entry_rules[best];
+        if (out_tag) ConfigSafeStrCpy(out_tag, tag_len, r->tags[ret]);
+        if (out_entry) ConfigSafeStrCpy(out_entry, entry_len, r->entries[best]);
+    } else {
+        // 外部规则集：规则序号接在内联规则之后
+        for (int i = 0; i < r->provider_count; i++) {
+            const RouteProvider* p = &r->providers[i];
+            BOOL hit = family ? RuleSet_MatchIp(p->set, addr, family) : RuleSet_MatchDomain(p->set, lower);
+            if (!hit) continue;
+            ret = r->rule_count + i;
+            if (out_tag) ConfigSafeStrCpy(out_tag, tag_len, p->outboundTag);
+            if (out_entry) snprintf(out_entry, entry_len, "provider:%s", p->tag);
+            break;
+        }
+    }
+    router_release(slot);
+    return ret;
+}
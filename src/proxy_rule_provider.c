@@ -0,0 +1,677 @@
+/* src/proxy_rule_provider.c */
+// [New] 2026-10-16: 外部规则集 (routing.providers)，把数十万条的域名 / CIDR 列表编译为紧凑的二进制文件并内存映射
+// 设计要点:
+// 1. 源文件每行一条，兼容常见写法 (hosts 文件、domain:/full:/+./*./|| 前缀、Clash 的 DOMAIN-SUFFIX,/IP-CIDR,)；
+//    本地路径在文件修改后重新编译，http(s) 地址按 interval 定期下载，失败时保留旧文件并在 RULESET_RETRY_SEC 后重试
+// 2. 域名按字符倒序后排序去重 (www.google.com -> moc.elgoog.www)，已被更短后缀覆盖的条目直接丢弃；
+//    每 RULESET_BLOCK 条为一块做前缀压缩 (与前一条的公共前缀长度 + 剩余部分)，块首完整保存并建立偏移索引
+// 3. 查询时对域名的每个标签后缀 (com / google.com / www.google.com) 在块首上二分、块内顺序解码，
+//    耗时只与标签数和 log(条目数) 有关
+// 4. CIDR 转为排序合并后的地址区间 (IPv4 / IPv6 分开)，查询为一次二分
+// 5. 编译文件内只有偏移没有指针，直接 MapViewOfFile 只读映射；页面由系统按需调入，常驻内存不随条目数增长
+// 6. 映射中的文件不能被覆盖：更新时先写临时文件，替换失败则先把旧文件改名让路 (映射时带 FILE_SHARE_DELETE)
+
+#include "proxy_internal.h"
+#include "proxy.h"
+#include "utils.h"
+#include "config.h"
+#include "common.h"
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <time.h>
+
+#define RULESET_MAGIC            "MRS1"
+#define RULESET_VERSION          1
+#define RULESET_BLOCK            16                  // 每个前缀压缩块的条目数
+#define RULESET_MAX_DOMAIN       253
+#define RULESET_MAX_SOURCE       (64 * 1024 * 1024)  // 源文件 / 下载大小上限
+#define RULESET_FETCH_TIMEOUT_MS 60000
+#define RULESET_RETRY_SEC        300                 // 更新失败后的重试间隔
+#define RULESET_DIR              L"rules"
+
+#pragma pack(push, 1)
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t kind;           // RULE_PROVIDER_*
+    uint32_t count;          // 有效条目数
+    uint64_t built;          // 编译时间 (Unix 秒)
+    uint32_t source_hash;    // 类型 + 来源的 FNV-1a，配置改动后旧文件自动失效
+    uint32_t block_count;    // 域名: 块数
+    uint32_t index_off;      //       块偏移索引 uint32[block_count] (相对 data_off)
+    uint32_t data_off;
+    uint32_t data_len;
+    uint32_t v4_count;       // CIDR: IPv4 区间 {起, 止} (主机字节序)
+    uint32_t v4_off;
+    uint32_t v6_count;       //       IPv6 区间 {起[16], 止[16]} (网络字节序)
+    uint32_t v6_off;
+    uint32_t reserved;
+} RuleSetHeader;
+#pragma pack(pop)
+
+struct RuleSet {
+    const unsigned char* base;
+    size_t size;
+    const RuleSetHeader* hdr;
+};
+
+typedef struct {
+    uint32_t start, end;
+} RangeV4;
+
+typedef struct {
+    unsigned char start[16], end[16];
+} RangeV6;
+
+typedef struct {
+    char tag[32];
+    time_t last_try;
+} ProviderTry;
+
+static volatile LONG s_refreshing = 0;
+static ProviderTry s_tries[MAX_RULE_PROVIDERS]; // 只在持有 s_refreshing 时访问
+
+// --- 文件与来源 ---
+
+static uint32_t ruleset_source_hash(const RuleProvider* p) {
+    uint32_t h = 2166136261u;
+    h = (h ^ (uint32_t)p->type) * 16777619u;
+    for (const char* c = p->source; *c; c++) h = (h ^ (unsigned char)*c) * 16777619u;
+    return h;
+}
+
+// rules\<tag><suffix>，tag 中的非常规字符替换为 '_'
+static void ruleset_path(const char* tag, const wchar_t* suffix, wchar_t* out, int len) {
+    char safe[32];
+    int n = 0;
+    for (; tag[n] && n < (int)sizeof(safe) - 1; n++) {
+        char c = tag[n];
+        safe[n] = (isalnum((unsigned char)c) || c == '-' || c == '_') ? c : '_';
+    }
+    safe[n] = 0;
+    swprintf(out, len, L"%ls\\%hs%ls", RULESET_DIR, safe, suffix);
+}
+
+static time_t filetime_to_unix(const FILETIME* ft) {
+    ULONGLONG t = ((ULONGLONG)ft->dwHighDateTime << 32) | ft->dwLowDateTime;
+    return (time_t)(t / 10000000ULL - 11644473600ULL);
+}
+
+// 本地源文件可能超过 ReadFileToBuffer 的上限，这里单独读取
+static char* ruleset_read_local(const char* path, size_t* out_len) {
+    wchar_t wpath[MAX_PATH];
+    if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, MAX_PATH) == 0) return NULL;
+
+    FILE* f = _wfopen(wpath, L"rb");
+    if (!f) return NULL;
+    char* buf = NULL;
+    if (fseek(f, 0, SEEK_END) == 0) {
+        long size = ftell(f);
+        if (size >= 0 && size <= RULESET_MAX_SOURCE && fseek(f, 0, SEEK_SET) == 0) {
+            buf = (char*)malloc((size_t)size + 1);
+            if (buf) {
+                size_t n = fread(buf, 1, (size_t)size, f);
+                buf[n] = 0;
+                *out_len = n;
+            }
+        }
+    }
+    fclose(f);
+    return buf;
+}
+
+static BOOL ruleset_header_valid(const RuleSetHeader* h, size_t size, const RuleProvider* p) {
+    if (memcmp(h->magic, RULESET_MAGIC, 4) != 0 || h->version != RULESET_VERSION) return FALSE;
+    if (h->kind != (uint32_t)p->type || h->source_hash != ruleset_source_hash(p)) return FALSE;
+    if (h->kind == RULE_PROVIDER_DOMAIN) {
+        if ((uint64_t)h->index_off + (uint64_t)h->block_count * 4 > size) return FALSE;
+        if ((uint64_t)h->data_off + h->data_len > size) return FALSE;
+    } else {
+        if ((uint64_t)h->v4_off + (uint64_t)h->v4_count * sizeof(RangeV4) > size) return FALSE;
+        if ((uint64_t)h->v6_off + (uint64_t)h->v6_count * sizeof(RangeV6) > size) return FALSE;
+    }
+    return TRUE;
+}
+
+// 是否需要重新编译 (文件缺失或无效、本地源已修改、订阅已到期)
+static BOOL ruleset_is_stale(const RuleProvider* p, time_t now) {
+    wchar_t path[MAX_PATH];
+    ruleset_path(p->tag, L".mrs", path, MAX_PATH);
+
+    RuleSetHeader h;
+    DWORD rd = 0;
+    HANDLE f = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+    if (f == INVALID_HANDLE_VALUE) return TRUE;
+    LARGE_INTEGER size;
+    BOOL ok = GetFileSizeEx(f, &size) && ReadFile(f, &h, sizeof(h), &rd, NULL) && rd == sizeof(h);
+    CloseHandle(f);
+    if (!ok || !ruleset_header_valid(&h, (size_t)size.QuadPart, p)) return TRUE;
+
+    if (p->isUrl) return (now - (time_t)h.built) >= p->interval;
+
+    wchar_t wsrc[MAX_PATH];
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    if (MultiByteToWideChar(CP_UTF8, 0, p->source, -1, wsrc, MAX_PATH) == 0) return FALSE;
+    if (!GetFileAttributesExW(wsrc, GetFileExInfoStandard, &fad)) return FALSE; // 源文件暂时不在时沿用旧文件
+    return filetime_to_unix(&fad.ftLastWriteTime) > (time_t)h.built;
+}
+
+// --- 源文件解析 ---
+
+static char* next_line(char** cur) {
+    char* s = *cur;
+    if (!s || !*s) return NULL;
+    char* nl = strchr(s, '\n');
+    if (nl) { *nl = 0; *cur = nl + 1; }
+    else *cur = s + strlen(s);
+    return s;
+}
+
+static char* trim_token(char* s) {
+    while (*s == ' ' || *s == '\t') s++;
+    char* e = s + strlen(s);
+    while (e > s && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r')) *--e = 0;
+    return s;
+}
+
+static BOOL strip_prefix(char** s, const char* prefix) {
+    size_t n = strlen(prefix);
+    if (strnicmp(*s, prefix, n) != 0) return FALSE;
+    *s += n;
+    return TRUE;
+}
+
+// 把一行规范化为倒序小写域名 (原地修改)，返回长度，0 = 跳过
+static int parse_domain_line(char* line, char** out) {
+    char* s = trim_token(line);
+    if (!*s || *s == '#' || *s == '!' || *s == ';') return 0;
+
+    // hosts 文件: "0.0.0.0 ads.example.com"
+    char* sp = strpbrk(s, " \t");
+    BOOL hosts = FALSE;
+    if (sp) {
+        s = sp + 1;
+        while (*s == ' ' || *s == '\t') s++;
+        sp = strpbrk(s, " \t#");
+        if (sp) *sp = 0;
+        hosts = TRUE;
+    }
+    if (!strip_prefix(&s, "DOMAIN-SUFFIX,") && !strip_prefix(&s, "DOMAIN,") &&
+        !strip_prefix(&s, "domain:") && !strip_prefix(&s, "full:")) {
+        strip_prefix(&s, "||");
+    }
+    char* cut = strpbrk(s, ",^$");
+    if (cut) *cut = 0;
+    if (!strip_prefix(&s, "+.") && !strip_prefix(&s, "*.")) strip_prefix(&s, ".");
+
+    int len = (int)strlen(s);
+    while (len > 0 && s[len - 1] == '.') s[--len] = 0;
+    if (len == 0 || len > RULESET_MAX_DOMAIN) return 0;
+    if (hosts && !strchr(s, '.')) return 0; // hosts 文件中的 localhost / broadcasthost 等
+
+    for (int i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (!isalnum(c) && c != '-' && c != '.' && c != '_') return 0;
+        s[i] = (char)tolower(c);
+    }
+    for (int i = 0, j = len - 1; i < j; i++, j--) { char t = s[i]; s[i] = s[j]; s[j] = t; }
+    *out = s;
+    return len;
+}
+
+// 解析一行 CIDR，返回 4 / 6，0 = 跳过
+static int parse_cidr_line(char* line, RangeV4* v4, RangeV6* v6) {
+    char* s = trim_token(line);
+    if (!*s || *s == '#' || *s == '!' || *s == ';') return 0;
+    if (!strip_prefix(&s, "IP-CIDR,") && !strip_prefix(&s, "IP-CIDR6,") && !strip_prefix(&s, "ip:")) strip_prefix(&s, "cidr:");
+    char* cut = strpbrk(s, ", \t#");
+    if (cut) *cut = 0;
+
+    int prefix = -1;
+    char* slash = strchr(s, '/');
+    if (slash) { *slash = 0; prefix = atoi(slash + 1); }
+
+    unsigned char addr[16];
+    if (inet_pton(AF_INET, s, addr) == 1) {
+        if (prefix < 0 || prefix > 32) prefix = 32;
+        uint32_t a = ((uint32_t)addr[0] << 24) | ((uint32_t)addr[1] << 16) | ((uint32_t)addr[2] << 8) | addr[3];
+        uint32_t mask = prefix ? (0xFFFFFFFFu << (32 - prefix)) : 0;
+        v4->start = a & mask;
+        v4->end = v4->start | ~mask;
+        return 4;
+    }
+    if (inet_pton(AF_INET6, s, addr) == 1) {
+        if (prefix < 0 || prefix > 128) prefix = 128;
+        for (int i = 0; i < 16; i++) {
+            int bits = prefix - i * 8;
+            unsigned char mask = bits >= 8 ? 0xFF : (bits <= 0 ? 0 : (unsigned char)(0xFF << (8 - bits)));
+            v6->start[i] = addr[i] & mask;
+            v6->end[i] = addr[i] | (unsigned char)~mask;
+        }
+        return 6;
+    }
+    return 0;
+}
+
+// --- 编译 ---
+
+typedef struct {
+    unsigned char* data;
+    size_t len, cap;
+} OutBuf;
+
+static int out_put(OutBuf* b, const void* p, size_t n) {
+    if (b->len + n > b->cap) {
+        size_t cap = b->cap ? b->cap : 65536;
+        while (cap < b->len + n) cap *= 2;
+        unsigned char* d = (unsigned char*)realloc(b->data, cap);
+        if (!d) return -1;
+        b->data = d;
+        b->cap = cap;
+    }
+    if (p) memcpy(b->data + b->len, p, n);
+    else memset(b->data + b->len, 0, n);
+    b->len += n;
+    return 0;
+}
+
+static void out_align(OutBuf* b) {
+    while (b->len % 4) out_put(b, NULL, 1);
+}
+
+static int cmp_str(const void* a, const void* b) {
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+static int build_domain(char* text, RuleSetHeader* h, OutBuf* out) {
+    size_t cap = 4096, n = 0;
+    char** list = (char**)malloc(cap * sizeof(char*));
+    if (!list) return -1;
+
+    char* cur = text;
+    char* line;
+    while ((line = next_line(&cur)) != NULL) {
+        char* d = NULL;
+        if (parse_domain_line(line, &d) == 0) continue;
+        if (n == cap) {
+            char** grown = (char**)realloc(list, cap * 2 * sizeof(char*));
+            if (!grown) { free(list); return -1; }
+            list = grown;
+            cap *= 2;
+        }
+        list[n++] = d;
+    }
+    qsort(list, n, sizeof(char*), cmp_str);
+
+    // 去重，并丢弃已被更短后缀覆盖的条目 (moc.elgoog 覆盖 moc.elgoog.www)
+    size_t kept = 0;
+    const char* cover = NULL;
+    size_t cover_len = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (cover && strncmp(list[i], cover, cover_len) == 0 && (list[i][cover_len] == 0 || list[i][cover_len] == '.')) continue;
+        list[kept++] = list[i];
+        cover = list[i];
+        cover_len = strlen(cover);
+    }
+
+    uint32_t blocks = (uint32_t)((kept + RULESET_BLOCK - 1) / RULESET_BLOCK);
+    if (out_put(out, NULL, sizeof(RuleSetHeader)) != 0) { free(list); return -1; }
+    h->index_off = (uint32_t)out->len;
+    h->block_count = blocks;
+    if (out_put(out, NULL, (size_t)blocks * 4) != 0) { free(list); return -1; }
+    out_align(out);
+    h->data_off = (uint32_t)out->len;
+
+    for (size_t i = 0; i < kept; i++) {
+        unsigned char len = (unsigned char)strlen(list[i]);
+        int rc;
+        if (i % RULESET_BLOCK == 0) {
+            uint32_t off = (uint32_t)(out->len - h->data_off);
+            memcpy(out->data + h->index_off + (i / RULESET_BLOCK) * 4, &off, 4);
+            rc = out_put(out, &len, 1);
+            if (rc == 0) rc = out_put(out, list[i], len);
+        } else {
+            const char* prev = list[i - 1];
+            unsigned char shared = 0;
+            while (shared < len && prev[shared] == list[i][shared]) shared++;
+            unsigned char rest = (unsigned char)(len - shared);
+            rc = out_put(out, &shared, 1);
+            if (rc == 0) rc = out_put(out, &rest, 1);
+            if (rc == 0) rc = out_put(out, list[i] + shared, rest);
+        }
+        if (rc != 0) { free(list); return -1; }
+    }
+    h->data_len = (uint32_t)(out->len - h->data_off);
+    h->count = (uint32_t)kept;
+    free(list);
+    return 0;
+}
+
+static int cmp_v4(const void* a, const void* b) {
+    uint32_t x = ((const RangeV4*)a)->start, y = ((const RangeV4*)b)->start;
+    return (x > y) - (x < y);
+}
+
+static int cmp_v6(const void* a, const void* b) {
+    return memcmp(((const RangeV6*)a)->start, ((const RangeV6*)b)->start, 16);
+}
+
+static int build_cidr(char* text, RuleSetHeader* h, OutBuf* out) {
+    size_t cap4 = 1024, cap6 = 256, n4 = 0, n6 = 0;
+    RangeV4* v4 = (RangeV4*)malloc(cap4 * sizeof(RangeV4));
+    RangeV6* v6 = (RangeV6*)malloc(cap6 * sizeof(RangeV6));
+    int rc = -1;
+    if (!v4 || !v6) goto done;
+
+    char* cur = text;
+    char* line;
+    while ((line = next_line(&cur)) != NULL) {
+        RangeV4 r4;
+        RangeV6 r6;
+        int kind = parse_cidr_line(line, &r4, &r6);
+        if (kind == 4) {
+            if (n4 == cap4) {
+                RangeV4* g = (RangeV4*)realloc(v4, cap4 * 2 * sizeof(RangeV4));
+                if (!g) goto done;
+                v4 = g; cap4 *= 2;
+            }
+            v4[n4++] = r4;
+        } else if (kind == 6) {
+            if (n6 == cap6) {
+                RangeV6* g = (RangeV6*)realloc(v6, cap6 * 2 * sizeof(RangeV6));
+                if (!g) goto done;
+                v6 = g; cap6 *= 2;
+            }
+            v6[n6++] = r6;
+        }
+    }
+    h->count = (uint32_t)(n4 + n6);
+
+    // 排序后合并重叠 (IPv4 也合并相邻) 区间，保证二分结果唯一
+    qsort(v4, n4, sizeof(RangeV4), cmp_v4);
+    size_t m4 = 0;
+    for (size_t i = 0; i < n4; i++) {
+        if (m4 > 0 && (v4[m4 - 1].end == 0xFFFFFFFFu || v4[i].start <= v4[m4 - 1].end + 1)) {
+            if (v4[i].end > v4[m4 - 1].end) v4[m4 - 1].end = v4[i].end;
+        } else {
+            v4[m4++] = v4[i];
+        }
+    }
+    qsort(v6, n6, sizeof(RangeV6), cmp_v6);
+    size_t m6 = 0;
+    for (size_t i = 0; i < n6; i++) {
+        if (m6 > 0 && memcmp(v6[i].start, v6[m6 - 1].end, 16) <= 0) {
+            if (memcmp(v6[i].end, v6[m6 - 1].end, 16) > 0) memcpy(v6[m6 - 1].end, v6[i].end, 16);
+        } else {
+            v6[m6++] = v6[i];
+        }
+    }
+
+    if (out_put(out, NULL, sizeof(RuleSetHeader)) != 0) goto done;
+    h->v4_off = (uint32_t)out->len;
+    h->v4_count = (uint32_t)m4;
+    if (out_put(out, v4, m4 * sizeof(RangeV4)) != 0) goto done;
+    h->v6_off = (uint32_t)out->len;
+    h->v6_count = (uint32_t)m6;
+    if (out_put(out, v6, m6 * sizeof(RangeV6)) != 0) goto done;
+    rc = 0;
+
+done:
+    free(v4);
+    free(v6);
+    return rc;
+}
+
+// 写入临时文件后替换正式文件
+static int ruleset_write(const char* tag, const unsigned char* data, size_t len) {
+    wchar_t path[MAX_PATH], tmp[MAX_PATH], old[MAX_PATH];
+    ruleset_path(tag, L".mrs", path, MAX_PATH);
+    ruleset_path(tag, L".mrs.tmp", tmp, MAX_PATH);
+    ruleset_path(tag, L".mrs.old", old, MAX_PATH);
+
+    HANDLE f = CreateFileW(tmp, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (f == INVALID_HANDLE_VALUE) return -1;
+    DWORD written = 0;
+    BOOL ok = WriteFile(f, data, (DWORD)len, &written, NULL) && written == (DWORD)len;
+    CloseHandle(f);
+    if (!ok) { DeleteFileW(tmp); return -1; }
+
+    if (MoveFileExW(tmp, path, MOVEFILE_REPLACE_EXISTING)) return 0;
+    // 旧文件仍被当前快照映射：改名让路，映射随旧快照释放
+    if (MoveFileExW(path, old, MOVEFILE_REPLACE_EXISTING) && MoveFileExW(tmp, path, 0)) return 0;
+    DeleteFileW(tmp);
+    return -1;
+}
+
+static int ruleset_update(const RuleProvider* p) {
+    size_t len = 0;
+    char* text = p->isUrl ? Utils_HttpGetEx(p->source, RULESET_FETCH_TIMEOUT_MS, RULESET_MAX_SOURCE, &len)
+                          : ruleset_read_local(p->source, &len);
+    if (!text) {
+        log_msg("[Rules] Provider %s: failed to load %s", p->tag, p->source);
+        return -1;
+    }
+
+    RuleSetHeader h;
+    memset(&h, 0, sizeof(h));
+    OutBuf out = { NULL, 0, 0 };
+    int rc = (p->type == RULE_PROVIDER_DOMAIN) ? build_domain(text, &h, &out) : build_cidr(text, &h, &out);
+    free(text);
+
+    // 没有任何有效条目 (多半是错误页面) 时保留旧文件
+    if (rc != 0 || h.count == 0) {
+        log_msg("[Rules] Provider %s: no valid entries in %s", p->tag, p->source);
+        free(out.data);
+        return -1;
+    }
+
+    memcpy(h.magic, RULESET_MAGIC, 4);
+    h.version = RULESET_VERSION;
+    h.kind = (uint32_t)p->type;
+    h.built = (uint64_t)time(NULL);
+    h.source_hash = ruleset_source_hash(p);
+    memcpy(out.data, &h, sizeof(h));
+
+    rc = ruleset_write(p->tag, out.data, out.len);
+    if (rc == 0) log_msg("[Rules] Provider %s: compiled %u entries (%u KB)", p->tag, h.count, (unsigned)(out.len / 1024));
+    else log_msg("[Rules] Provider %s: failed to write compiled rule set", p->tag);
+    free(out.data);
+    return rc;
+}
+
+// --- 更新调度 ---
+
+static ProviderTry* ruleset_try_slot(const char* tag) {
+    int oldest = 0;
+    for (int i = 0; i < MAX_RULE_PROVIDERS; i++) {
+        if (strcmp(s_tries[i].tag, tag) == 0) return &s_tries[i];
+        if (s_tries[i].last_try < s_tries[oldest].last_try) oldest = i;
+    }
+    ConfigSafeStrCpy(s_tries[oldest].tag, sizeof(s_tries[oldest].tag), tag);
+    s_tries[oldest].last_try = 0;
+    return &s_tries[oldest];
+}
+
+int RuleProvider_Refresh(BOOL force) {
+    if (InterlockedCompareExchange(&s_refreshing, 1, 0) != 0) return 0;
+
+    RuleProvider list[MAX_RULE_PROVIDERS];
+    EnterCriticalSection(&g_configLock);
+    int count = g_ruleProviderCount;
+    memcpy(list, g_ruleProviders, count * sizeof(RuleProvider));
+    LeaveCriticalSection(&g_configLock);
+
+    int updated = 0;
+    if (count > 0) CreateDirectoryW(RULESET_DIR, NULL);
+    time_t now = time(NULL);
+    for (int i = 0; i < count; i++) {
+        const RuleProvider* p = &list[i];
+        if (!force && !ruleset_is_stale(p, now)) continue;
+        ProviderTry* t = ruleset_try_slot(p->tag);
+        if (!force && now - t->last_try < RULESET_RETRY_SEC) continue;
+        t->last_try = now;
+        if (ruleset_update(p) == 0) updated++;
+    }
+    InterlockedExchange(&s_refreshing, 0);
+
+    if (updated > 0) Router_Rebuild();
+    return updated;
+}
+
+static void Task_RuleProviderRefresh(void* arg) {
+    (void)arg;
+    RuleProvider_Refresh(FALSE);
+}
+
+void RuleProvider_RefreshAsync(void) {
+    if (g_ruleProviderCount == 0 || s_refreshing) return;
+    ThreadPool_SubmitBackground(Task_RuleProviderRefresh, NULL, NULL, NULL);
+}
+
+// --- 映射与查询 ---
+
+RuleSet* RuleSet_Open(const RuleProvider* p) {
+    wchar_t path[MAX_PATH];
+    ruleset_path(p->tag, L".mrs", path, MAX_PATH);
+
+    HANDLE f = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (f == INVALID_HANDLE_VALUE) return NULL;
+
+    LARGE_INTEGER size;
+    HANDLE map = NULL;
+    const unsigned char* base = NULL;
+    if (GetFileSizeEx(f, &size) && size.QuadPart >= (LONGLONG)sizeof(RuleSetHeader)) {
+        map = CreateFileMappingW(f, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (map) base = (const unsigned char*)MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+    }
+    // 视图独立持有映射，句柄可立即关闭
+    if (map) CloseHandle(map);
+    CloseHandle(f);
+    if (!base) return NULL;
+
+    if (!ruleset_header_valid((const RuleSetHeader*)base, (size_t)size.QuadPart, p)) {
+        log_msg("[Rules] Provider %s: compiled rule set is outdated or invalid", p->tag);
+        UnmapViewOfFile(base);
+        return NULL;
+    }
+    RuleSet* rs = (RuleSet*)calloc(1, sizeof(RuleSet));
+    if (!rs) { UnmapViewOfFile(base); return NULL; }
+    rs->base = base;
+    rs->size = (size_t)size.QuadPart;
+    rs->hdr = (const RuleSetHeader*)base;
+    return rs;
+}
+
+void RuleSet_Close(RuleSet* rs) {
+    if (!rs) return;
+    UnmapViewOfFile(rs->base);
+    free(rs);
+}
+
+int RuleSet_Count(const RuleSet* rs) {
+    return rs ? (int)rs->hdr->count : 0;
+}
+
+// 比较长度为 alen 的 a 与长度为 blen 的 b
+static int cmp_bytes(const unsigned char* a, int alen, const char* b, int blen) {
+    int n = alen < blen ? alen : blen;
+    int c = memcmp(a, b, n);
+    if (c != 0) return c;
+    return (alen > blen) - (alen < blen);
+}
+
+// [Fix] 2026-10-16: 解码前校验块偏移与拼接长度，损坏或被篡改的 .mrs 文件不再越界读写
+static BOOL ruleset_domain_exact(const RuleSet* rs, const char* key, int klen) {
+    const RuleSetHeader* h = rs->hdr;
+    const unsigned char* data = rs->base + h->data_off;
+    const unsigned char* end = data + h->data_len;
+    const unsigned char* index = rs->base + h->index_off;
+
+    // 找最后一个块首 <= key 的块
+    int lo = 0, hi = (int)h->block_count - 1, blk = -1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        uint32_t off;
+        memcpy(&off, index + (size_t)mid * 4, 4);
+        if (off >= h->data_len) return FALSE; // 偏移先于指针运算校验，避免越界指针
+        const unsigned char* p = data + off;
+        if (p + 1 + p[0] > end) return FALSE;
+        int c = cmp_bytes(p + 1, p[0], key, klen);
+        if (c == 0) return TRUE;
+        if (c < 0) { blk = mid; lo = mid + 1; } else hi = mid - 1;
+    }
+    if (blk < 0) return FALSE;
+
+    uint32_t off;
+    memcpy(&off, index + (size_t)blk * 4, 4);
+    if (off >= h->data_len) return FALSE;
+    const unsigned char* p = data + off;
+    unsigned char cur[256];
+    int len = p[0];
+    if (p + 1 + len > end) return FALSE;
+    memcpy(cur, p + 1, len);
+    p += 1 + len;
+
+    uint32_t remain = h->count - (uint32_t)blk * RULESET_BLOCK;
+    for (uint32_t i = 1; i < RULESET_BLOCK && i < remain; i++) {
+        if (p + 2 > end) return FALSE;
+        int shared = p[0], rest = p[1];
+        if (shared > len || p + 2 + rest > end) return FALSE;
+        if (shared + rest > 255) return FALSE; // 损坏的文件：拼接结果会超出 cur
+        memcpy(cur + shared, p + 2, rest);
+        len = shared + rest;
+        p += 2 + rest;
+        int c = cmp_bytes(cur, len, key, klen);
+        if (c == 0) return TRUE;
+        if (c > 0) return FALSE;
+    }
+    return FALSE;
+}
+
+BOOL RuleSet_MatchDomain(const RuleSet* rs, const char* lower_host) {
+    if (!rs || rs->hdr->kind != RULE_PROVIDER_DOMAIN || rs->hdr->block_count == 0) return FALSE;
+    int len = (int)strlen(lower_host);
+    while (len > 0 && lower_host[len - 1] == '.') len--;
+    if (len == 0 || len > RULESET_MAX_DOMAIN) return FALSE;
+
+    char rev[RULESET_MAX_DOMAIN + 1];
+    for (int i = 0; i < len; i++) rev[i] = lower_host[len - 1 - i];
+    rev[len] = 0;
+
+    // 倒序串中每个 '.' 之前的部分都对应一个标签边界后缀
+    for (int i = 1; i <= len; i++) {
+        if (i == len || rev[i] == '.') {
+            if (ruleset_domain_exact(rs, rev, i)) return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+BOOL RuleSet_MatchIp(const RuleSet* rs, const unsigned char* addr, int family) {
+    if (!rs || rs->hdr->kind != RULE_PROVIDER_IPCIDR) return FALSE;
+    const RuleSetHeader* h = rs->hdr;
+
+    if (family == AF_INET) {
+        const RangeV4* r = (const RangeV4*)(rs->base + h->v4_off);
+        uint32_t a = ((uint32_t)addr[0] << 24) | ((uint32_t)addr[1] << 16) | ((uint32_t)addr[2] << 8) | addr[3];
+        int lo = 0, hi = (int)h->v4_count - 1, found = -1;
+        while (lo <= hi) {
+            int mid = (lo + hi) / 2;
+            if (r[mid].start <= a) { found = mid; lo = mid + 1; } else hi = mid - 1;
+        }
+        return found >= 0 && a <= r[found].end;
+    }
+    if (family == AF_INET6) {
+        const RangeV6* r = (const RangeV6*)(rs->base + h->v6_off);
+        int lo = 0, hi = (int)h->v6_count - 1, found = -1;
+        while (lo <= hi) {
+            int mid = (lo + hi) / 2;
+            if (memcmp(r[mid].start, addr, 16) <= 0) { found = mid; lo = mid + 1; } else hi = mid - 1;
+        }
+        return found >= 0 && memcmp(addr, r[found].end, 16) <= 0;
+    }
+    return FALSE;
+}
@@ -52,7 +52,10 @@ int session_init(ProxySession* s, ClientContext* ctx) {
 void session_free(ProxySession* s) {
     if (!s) return;
 
-    if (s->h2_sess) { nghttp2_session_del(s->h2_sess); s->h2_sess = NULL; }
+    // [Mod] 2026-10-16: 共享连接上的流只解除关联，nghttp2 会话归连接池所有
+    if (s->h2_stream) H2Pool_Detach(s);
+    else if (s->h2_sess) { nghttp2_session_del(s->h2_sess); s->h2_sess = NULL; }
+    if (s->mux_stream) MuxPool_Detach(s); // [New] 多路复用隧道上的流
     
     if (s->c_buf) {
         if (s->c_buf_is_pooled) Pool_Free_16K(s->c_buf);
@@ -10,28 +10,6 @@
 #define NGHTTP2_SETTINGS_ENABLE_CONNECT_PROTOCOL 0x08
 #endif
 
-// 辅助：带超时的 TLS 读取
-static int tls_read_with_timeout(TLSContext* tls, char* buf, int max_len, int timeout_ms) {
-    if (!tls || !tls->ssl) return -1;
-    ULONGLONG start = GetTickCount64();
-    int sock = SSL_get_fd(tls->ssl);
-
-    while (g_proxyRunning) {
-        int n = tls_read(tls, buf, max_len);
-        if (n > 0) return n; 
-        if (n < 0) return -1; 
-        
-        if (GetTickCount64() - start > (ULONGLONG)timeout_ms) return 0;
-
-        fd_set rfds;
-        FD_ZERO(&rfds); FD_SET(sock, &rfds);
-        struct timeval tv = {0, 50000}; 
-        int r = select(0, &rfds, NULL, NULL, &tv);
-        if (r < 0) return -1; 
-    }
-    return -1; 
-}
-
 // 辅助：标准地址序列化
 static int append_addr_standard(unsigned char* buf, int offset, const char* host, int port) {
     struct in_addr ip4;
@@ -55,13 +33,34 @@ static int append_addr_standard(unsigned char* buf, int offset, const char* host
     return len;
 }
 
-// Step 3 (H1): 普通 HTTP/1.1 WS 握手
-static int step_handshake_ws_h1(ProxySession* s) {
-    if (!g_proxyRunning) return -1;
-    if (_stricmp(s->config.type, "direct") == 0) return 0;
+// [New] 2026-10-16: SOCKS 地址格式 (多路复用流请求复用)
+int tunnel_build_socks_addr(const char* host, int port, unsigned char* out) {
+    return append_addr_standard(out, 0, host, port);
+}
+
+// [Refactor] 2026-10-16: 报文构造/解析拆分为独立函数，由事件驱动状态机 (proxy_fsm.c) 调用
+// [Fix] 2026-10-17: 移除阻塞的 step_handshake_ws / step_send_proxy_request 及其轮询辅助函数
 
-    log_msg("[Conn-%d] Starting HTTP/1.1 WebSocket Handshake...", s->clientSock);
-    
+// 发送一段上行负载：H2 写入 data provider 暂存区，多路复用写入隧道流
+// [Fix] 2026-10-16: 返回写入结果 (0=已写入或排队, -1=错误)，暂存区放不下时报错而不是静默丢弃。
+// WS 隧道由状态机封帧并排队发送 (fsm_send_tunnel)，此处不处理
+int tunnel_send_payload(ProxySession* s, const char* data, int len) {
+    if (len <= 0) return 0;
+    if (s->mux_stream) return MuxPool_Write(s, data, len); // [New] 多路复用：作为流数据写入隧道
+
+    if (s->alpn_is_h2) {
+        if (s->h2_browser_len + len >= IO_BUFFER_SIZE) return -1;
+        memcpy(s->h2_browser_buf + s->h2_browser_len, data, len);
+        s->h2_browser_len += len;
+        nghttp2_session_resume_data(s->h2_sess, s->h2_stream_id);
+        if (s->h2_stream) return H2Pool_Flush(s); // 共享连接：由连接池冲刷并关注可写
+        return (nghttp2_session_send(s->h2_sess) == 0) ? 0 : -1;
+    }
+    return -1;
+}
+
+// 构造 HTTP/1.1 WebSocket 升级请求 (写入 ws_send_buf)，返回长度
+int tunnel_build_ws_upgrade(ProxySession* s) {
     unsigned char rnd_key[16]; char ws_key_str[32];
     if (RAND_bytes(rnd_key, 16) != 1) return -1;
     base64_encode_key(rnd_key, ws_key_str);
@@ -73,7 +72,7 @@ static int step_handshake_ws_h1(ProxySession* s) {
         else { snprintf(fixed_path, sizeof(fixed_path), "/%s", s->config.path); req_path = fixed_path; }
     }
 
-    int offset = snprintf(s->ws_send_buf, IO_BUFFER_SIZE, 
+    return snprintf(s->ws_send_buf, IO_BUFFER_SIZE, 
         "GET %s HTTP/1.1\r\n"
         "Host: %s\r\n"
         "User-Agent: %s\r\n"
@@ -85,12 +84,10 @@ static int step_handshake_ws_h1(ProxySession* s) {
         "Cache-Control: no-cache\r\n"
         "\r\n", 
         req_path, host_val, s->userAgent, ws_key_str);
+}
 
-    if (tls_write(&s->tls, s->ws_send_buf, offset) <= 0) return -1;
-    int hlen = tls_read_with_timeout(&s->tls, s->ws_read_buf, s->ws_read_buf_cap - 1, 10000); 
-    if (hlen <= 0) return -1;
-    s->ws_read_buf[hlen] = 0;
-    
+// 校验升级响应 (ws_read_buf 前 hlen 字节，须以 0 结尾)，响应头之后的帧数据移到缓冲区头部
+int tunnel_check_ws_upgrade(ProxySession* s, int hlen) {
     if (!strstr(s->ws_read_buf, "101")) return -1; 
     
     log_msg("[Conn-%d] WS Handshake Success (101).", s->clientSock);
@@ -109,32 +106,8 @@ static int step_handshake_ws_h1(ProxySession* s) {
     return 0;
 }
 
-static int h2_poll_and_process(ProxySession* s, int wait_ms) {
-    if (!s || !s->h2_sess) return -1;
-    int sock = SSL_get_fd(s->tls.ssl);
-    fd_set rfds; FD_ZERO(&rfds); FD_SET(sock, &rfds);
-    struct timeval tv = {0, wait_ms * 1000}; 
-    
-    if (select(0, &rfds, NULL, NULL, &tv) > 0) {
-        int n = tls_read(&s->tls, s->ws_read_buf, s->ws_read_buf_cap);
-        if (n > 0) {
-            if (nghttp2_session_mem_recv(s->h2_sess, (uint8_t*)s->ws_read_buf, n) < 0) return -1;
-        } else if (n < 0) return -1;
-    }
-    if (nghttp2_session_send(s->h2_sess) != 0) return -1;
-    return 0;
-}
-
-// Step 3 (H2): HTTP/2 握手
-static int step_handshake_ws_h2(ProxySession* s) {
-    if (!g_proxyRunning) return -1;
-    if (_stricmp(s->config.type, "direct") == 0) return 0;
-
-    BOOL is_rfc8441_ws = FALSE;
-    if (s->config.path && (strchr(s->config.path, '?') || strstr(s->config.path, "sw"))) is_rfc8441_ws = TRUE;
-    
-    log_msg("[Conn-%d] Starting HTTP/2 Stream. Mode: %s...", s->clientSock, is_rfc8441_ws ? "WebSocket" : "Standard");
-    
+// 创建 nghttp2 会话并提交隧道请求 (SETTINGS + HEADERS 已写出)
+int tunnel_h2_open_stream(ProxySession* s) {
     nghttp2_session_callbacks *callbacks;
     nghttp2_session_callbacks_new(&callbacks);
     nghttp2_session_callbacks_set_send_callback(callbacks, h2_send_callback);
@@ -150,6 +123,19 @@ static int step_handshake_ws_h2(ProxySession* s) {
     nghttp2_submit_settings(s->h2_sess, NGHTTP2_FLAG_NONE, iv, 2);
     if (nghttp2_session_send(s->h2_sess) != 0) return -1;
 
+    if (tunnel_h2_submit_request(s) != 0) return -1;
+    if (nghttp2_session_send(s->h2_sess) != 0) return -1;
+    return 0;
+}
+
+// [New] 在 s->h2_sess 上提交隧道请求 (POST 或 RFC 8441 扩展 CONNECT)，独占连接与共享连接 (proxy_h2_pool.c) 共用
+// 流用户数据为 s，各 nghttp2 回调据此找到所属会话
+int tunnel_h2_submit_request(ProxySession* s) {
+    BOOL is_rfc8441_ws = FALSE;
+    if (s->config.path && (strchr(s->config.path, '?') || strstr(s->config.path, "sw"))) is_rfc8441_ws = TRUE;
+
+    log_msg("[Conn-%d] Starting HTTP/2 Stream. Mode: %s...", s->clientSock, is_rfc8441_ws ? "WebSocket" : "Standard");
+
     char norm_path[256];
     const char* raw_path = (strlen(s->config.path) > 0) ? s->config.path : "/";
     if (raw_path[0] != '/') snprintf(norm_path, sizeof(norm_path), "/%s", raw_path);
@@ -176,69 +162,20 @@ static int step_handshake_ws_h2(ProxySession* s) {
          nva[nvlen++] = (nghttp2_nv){ (uint8_t*)"mode", (uint8_t*)s->config.mode, 4, strlen(s->config.mode), NGHTTP2_NV_FLAG_NONE };
     }
 
-    nghttp2_data_provider rv; rv.read_callback = h2_data_provider_read;
+    nghttp2_data_provider rv; rv.source.ptr = s; rv.read_callback = h2_data_provider_read;
     s->h2_stream_id = nghttp2_submit_request(s->h2_sess, NULL, nva, nvlen, &rv, s);
     if (s->h2_stream_id < 0) return -1;
-    
-    if (nghttp2_session_send(s->h2_sess) != 0) return -1;
-    
+
     s->h2_status_code = 0; 
-    ULONGLONG start_wait = GetTickCount64();
-    while (GetTickCount64() - start_wait < 500 && g_proxyRunning) {
-        if (h2_poll_and_process(s, 5) != 0) return -1; 
-        if (s->h2_status_code > 0) {
-            if (s->h2_status_code >= 400) return -1; 
-            s->h2_handshake_done = 1;
-            return 0;
-        }
-    }
-    s->h2_handshake_done = 1;
     return 0;
 }
 
-// 智能握手分发
-int step_handshake_ws(ProxySession* s) {
-    if (!g_proxyRunning) return -1;
-    if (_stricmp(s->config.type, "direct") == 0) return 0;
-
-    const char* alpn = tls_get_alpn_selected(&s->tls);
-    
-    if (alpn && strcmp(alpn, "h2") == 0) {
-        s->alpn_is_h2 = 1;
-        int ret = step_handshake_ws_h2(s);
-        
-        // Auto-Fallback Logic
-        if (ret != 0 && s->fallback_state == 0) {
-            log_msg("[Conn-%d] [Fallback] H2 failed. Downgrading to HTTP/1.1...", s->clientSock);
-            
-            if (s->h2_sess) { nghttp2_session_del(s->h2_sess); s->h2_sess = NULL; }
-            tls_close(&s->tls);
-            if (s->remoteSock != INVALID_SOCKET) { closesocket(s->remoteSock); s->remoteSock = INVALID_SOCKET; }
-            
-            s->fallback_state = 1; 
-            s->alpn_is_h2 = 0;     
-            
-            // Re-connect and recurse
-            if (step_connect_upstream(s) == 0) return step_handshake_ws(s);
-            else return -1;
-        }
-        return ret;
-    }
-    
-    s->alpn_is_h2 = 0;
-    return step_handshake_ws_h1(s);
-}
-
-// Step 4: 发送代理请求
-int step_send_proxy_request(ProxySession* s) {
-    if (!g_proxyRunning) return -1;
-    if (_stricmp(s->config.type, "direct") == 0) return 0;
-
-    log_msg("[Conn-%d] Sending proxy protocol header (%s)...", s->clientSock, s->config.type);
-    
-    unsigned char proto_buf[2048]; memset(proto_buf, 0, sizeof(proto_buf));
-    int proto_len = 0, flen = 0;
+// 构造代理协议头 (out 至少 2048 字节)
+// 返回: >0 头部长度, 0=SOCKS5 出站 (需逐步交互，见 tunnel_socks5_build_*), -1=错误
+int tunnel_build_proxy_header(ProxySession* s, unsigned char* proto_buf) {
+    int proto_len = 0;
     struct in_addr ip4; struct in6_addr ip6;
+    memset(proto_buf, 0, 2048);
     
     BOOL is_vless = (_stricmp(s->config.type, "vless") == 0);
     BOOL is_trojan = (_stricmp(s->config.type, "trojan") == 0);
@@ -290,54 +227,32 @@ int step_send_proxy_request(ProxySession* s) {
         int added = append_addr_standard(proto_buf, proto_len, s->target_host, s->target_port);
         if (added < 0) return -1; proto_len += added;
     } else {
-        // SOCKS5 Outbound
-        char auth[] = {0x05, 0x01, 0x00}; 
-        if (strlen(s->config.user) > 0) auth[2] = 0x02; 
-        if (s->alpn_is_h2) return -1;
-        
-        flen = build_ws_frame(auth, 3, s->ws_send_buf);
-        tls_write(&s->tls, s->ws_send_buf, flen);
-        
-        char resp_buf[512]; 
-        int rn = ws_read_frame(&s->tls, resp_buf, sizeof(resp_buf));
-        if (rn < 2) return -1;
-        
-        if (resp_buf[1] == 0x02) { 
-            int ulen = strlen(s->config.user); int plen = strlen(s->config.pass);
-            unsigned char auth_pkg[512]; int ap_len = 0;
-            auth_pkg[ap_len++] = 0x01; 
-            auth_pkg[ap_len++] = ulen; memcpy(auth_pkg+ap_len, s->config.user, ulen); ap_len += ulen;
-            auth_pkg[ap_len++] = plen; memcpy(auth_pkg+ap_len, s->config.pass, plen); ap_len += plen;
-            flen = build_ws_frame((char*)auth_pkg, ap_len, s->ws_send_buf);
-            tls_write(&s->tls, s->ws_send_buf, flen);
-            
-            rn = ws_read_frame(&s->tls, resp_buf, sizeof(resp_buf));
-            if (rn < 2 || resp_buf[1] != 0x00) return -1;
-        } 
-
-        int slen = 0; unsigned char socks_req[512];
-        socks_req[slen++] = 0x05; socks_req[slen++] = 0x01; socks_req[slen++] = 0x00; 
-        int added = append_addr_standard(socks_req, slen, s->target_host, s->target_port);
-        if (added < 0) return -1; slen += added;
+        // SOCKS5 Outbound: 需要多轮交互，H2 模式下不支持
+        return s->alpn_is_h2 ? -1 : 0;
+    }
+    return proto_len;
+}
 
-        flen = build_ws_frame((char*)socks_req, slen, s->ws_send_buf);
-        tls_write(&s->tls, s->ws_send_buf, flen);
+// SOCKS5 出站子握手报文 (out 至少 512 字节)
+int tunnel_socks5_build_greeting(ProxySession* s, unsigned char* out) {
+    out[0] = 0x05; out[1] = 0x01; out[2] = 0x00;
+    if (strlen(s->config.user) > 0) out[2] = 0x02; 
+    return 3;
+}
 
-        rn = ws_read_frame(&s->tls, resp_buf, sizeof(resp_buf));
-        if (rn < 4 || resp_buf[1] != 0x00) return -1; 
-        return 0;
-    }
+int tunnel_socks5_build_auth(ProxySession* s, unsigned char* auth_pkg) {
+    int ulen = strlen(s->config.user); int plen = strlen(s->config.pass);
+    int ap_len = 0;
+    auth_pkg[ap_len++] = 0x01; 
+    auth_pkg[ap_len++] = ulen; memcpy(auth_pkg+ap_len, s->config.user, ulen); ap_len += ulen;
+    auth_pkg[ap_len++] = plen; memcpy(auth_pkg+ap_len, s->config.pass, plen); ap_len += plen;
+    return ap_len;
+}
 
-    if (s->alpn_is_h2) {
-        if (s->h2_browser_len + proto_len < IO_BUFFER_SIZE) {
-            memcpy(s->h2_browser_buf + s->h2_browser_len, proto_buf, proto_len);
-            s->h2_browser_len += proto_len;
-            nghttp2_session_resume_data(s->h2_sess, s->h2_stream_id);
-            nghttp2_session_send(s->h2_sess);
-        }
-    } else {
-        flen = build_ws_frame((char*)proto_buf, proto_len, s->ws_send_buf);
-        tls_write(&s->tls, s->ws_send_buf, flen);
-    }
-    return 0;
+int tunnel_socks5_build_connect(ProxySession* s, unsigned char* socks_req) {
+    int slen = 0;
+    socks_req[slen++] = 0x05; socks_req[slen++] = 0x01; socks_req[slen++] = 0x00; 
+    int added = append_addr_standard(socks_req, slen, s->target_host, s->target_port);
+    if (added < 0) return -1;
+    return slen + added;
 }
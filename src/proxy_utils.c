@@ -2,6 +2,7 @@
 // [Refactor] 2026-01-29: 优化 IO 模型，消除退出时的界面卡顿
 // [Security] 2026-01-29: 修复 read_header_robust 潜在的 Slowloris DoS 风险
 // [Fix] 2026-01-29: 统一使用微秒级轮询检查 g_proxyRunning
+// [Refactor] 2026-10-16: 等待改用 Cancel_Wait (停止通知套接字)，按真实超时休眠，不再 1ms 轮询
 
 #include "proxy_internal.h"
 #include "utils.h" 
@@ -12,9 +13,6 @@
 extern volatile BOOL g_proxyRunning;
 extern volatile LONG64 g_total_allocated_mem; 
 
-// [Config] 轮询间隔 1ms
-#define IO_POLL_INTERVAL_US 1000 
-
 // 1. 动态内存分配与监控包装器
 void* proxy_malloc(size_t size) {
     if (size > MAX_TOTAL_MEMORY_USAGE) {
@@ -68,33 +66,13 @@ void trojan_password_hash(const char* password, char* out_hex) {
 // 4. 接收超时辅助函数 (带全局状态检查)
 // 返回: >0 字节数, 0 对方关闭, -1 错误, -2 超时
 int recv_timeout(SOCKET s, char *buf, int len, int timeout_sec) {
-    ULONGLONG start = GetTickCount64();
-    ULONGLONG timeout_ms = (ULONGLONG)timeout_sec * 1000;
-
-    while (g_proxyRunning) {
-        if (GetTickCount64() - start > timeout_ms) return -2; // Timeout
-
-        fd_set fds; 
-        FD_ZERO(&fds); 
-        FD_SET(s, &fds);
-        
-        // 使用短超时轮询，以便及时响应 g_proxyRunning 变化
-        struct timeval tv;
-        tv.tv_sec = 0;
-        tv.tv_usec = IO_POLL_INTERVAL_US; // 1ms
+    if (!g_proxyRunning) return -1; // App exit
 
-        int n = select(0, &fds, NULL, NULL, &tv);
-        
-        if (n > 0) {
-            // Data ready
-            return recv(s, buf, len, 0);
-        }
-        else if (n < 0) {
-            return -1; // Socket Error
-        }
-        // n == 0: continue loop
-    }
-    return -1; // App exit
+    // 停止代理时 Cancel_Wait 立即返回，无需短超时轮询
+    int ready = Cancel_Wait(s, CANCEL_WAIT_READ, timeout_sec * 1000);
+    if (ready < 0) return -1;  // App exit / Socket Error
+    if (ready == 0) return -2; // Timeout
+    return recv(s, buf, len, 0);
 }
 
 // 5. 健壮的头部读取 (防止 Slowloris 攻击)
@@ -146,19 +124,12 @@ int send_all(SOCKET s, const char *buf, int len) {
         if (n == -1) {
             int err = WSAGetLastError();
             if (err == WSAEWOULDBLOCK) { 
-                if (start_wait == 0) start_wait = GetTickCount64();
-                if (GetTickCount64() - start_wait > MAX_WAIT_MS) return -1;
+                ULONGLONG now = GetTickCount64();
+                if (start_wait == 0) start_wait = now;
+                if (now - start_wait > MAX_WAIT_MS) return -1;
 
-                fd_set wfd; 
-                FD_ZERO(&wfd); 
-                FD_SET(s, &wfd);
-                
-                // [Fix] 1ms 轮询，消除停止代理时的卡顿
-                struct timeval tv;
-                tv.tv_sec = 0;
-                tv.tv_usec = IO_POLL_INTERVAL_US; 
-                
-                select(0, NULL, &wfd, NULL, &tv);
+                // 等待可写或停止信号 (停止代理时立即返回)
+                if (Cancel_Wait(s, CANCEL_WAIT_WRITE, (int)(MAX_WAIT_MS - (now - start_wait))) < 0) return -1;
                 continue; 
             }
             return -1; // Real error
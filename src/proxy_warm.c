@@ -0,0 +1,443 @@
+/* src/proxy_warm.c */
+// [New] 2026-10-16: 预建上游连接池，新浏览器连接的首个请求省去 DNS 解析 / TCP 连接 / TLS 握手 (约 2-3 个 RTT)
+// 设计要点:
+// 1. 按节点 (地址 + SNI + TLS 设置) 保持 g_warmPoolSize 条已完成 TCP + TLS 握手的空闲连接；
+//    只预建到 TLS 为止：多数服务端在 WS 升级 / 首个请求之后只等待数秒，而 TLS 之后的空闲连接通常可保持数十秒
+// 2. 与 H2 连接池 (proxy_h2_pool.c) 相同：每个事件循环各自维护节点链表，只在该循环线程上访问，无需加锁；
+//    解析提交到共享线程池，connect / TLS 握手在循环上非阻塞推进
+// 3. 按需预建：节点第一次被使用时登记，此后每次取用都补足到目标数量；节点超过 WARM_NODE_TTL 未被使用后不再补充
+// 4. 存活检查：空闲连接保持监听可读，收到 EOF / 错误 / 意外的应用数据即丢弃 (TLS 1.3 会话票据等握手后消息照常消化)；
+//    超过最长空闲时间主动关闭；连接在到期前被对端关闭时，按实际存活时间缩短该节点的空闲上限
+// 5. 取出的连接交还给握手状态机 (proxy_fsm.c) 从 ALPN 分支继续 (WS 升级或交给 H2 连接池)，
+//    若此时发现连接已失效，状态机改为新建连接，不计入重试与降级
+
+#include "proxy_internal.h"
+#include "utils.h"
+#include "common.h"
+#include <ws2tcpip.h>
+#include <stdio.h>
+
+#define WARM_MAX_LOOPS        16        // 不小于 proxy_reactor.c 的 REACTOR_MAX_LOOPS
+#define WARM_RESOLVE_TIMEOUT_MS 10000
+#define WARM_MAX_NODES        8         // 每个循环登记的节点数上限
+#define WARM_KEY_LEN          1024
+#define WARM_CONNECT_TIMEOUT  5000
+#define WARM_TLS_TIMEOUT      10000
+#define WARM_NODE_TTL         300000    // 节点最后一次使用后继续补充的时长
+#define WARM_MIN_IDLE         3000      // 自适应缩短后的最短空闲上限
+#define WARM_RETRY_BASE       2000      // 预建失败后的退避 (指数增长)
+#define WARM_RETRY_MAX        60000
+#define WARM_RESOLVE_LOST     120000    // 解析结果超过该时间未投递回来 (事件循环曾重启)，不再计入节点
+
+typedef enum {
+    WARM_RESOLVE = 0,   // 后台线程解析
+    WARM_CONNECT,       // 非阻塞 connect 进行中
+    WARM_TLS,           // TLS 握手
+    WARM_IDLE           // 已就绪，等待取用
+} WarmState;
+
+typedef struct WarmNode WarmNode;
+
+typedef struct WarmConn {
+    WarmNode* node;
+    struct WarmConn* next;
+    WarmState state;
+    SOCKET sock;
+    TLSContext tls;
+    ReactorHandle* h;
+    struct addrinfo* addrs;
+    struct addrinfo* cur;
+    ULONGLONG since;        // 提交解析 / 进入 WARM_IDLE 的时间
+    BOOL lost;              // 已从节点移除，等待解析结果回来后释放
+} WarmConn;
+
+struct WarmNode {
+    WarmNode* next;
+    int loop;
+    char key[WARM_KEY_LEN];
+    char label[300];
+    ProxyConfig config;
+    CryptoSettings crypto;
+    WarmConn* conns;        // 全部连接 (含握手中)
+    int count;
+    ULONGLONG last_used;
+    ULONGLONG retry_at;     // 退避期间不补充
+    int fails;
+    int max_idle_ms;        // 初始为 g_warmPoolMaxIdle，按观测到的服务端空闲超时缩短
+    int hits;
+    int misses;
+};
+
+typedef struct {
+    WarmConn* c;
+    int loop;
+    char host[256];
+    int port;
+    char ech_domain[256];
+    struct addrinfo* res;
+    int rc;
+    BOOL ran;
+} WarmResolveJob;
+
+static WarmNode* s_nodes[WARM_MAX_LOOPS];
+
+static void warmconn_on_event(ReactorHandle* h, int events, void* arg);
+static void warm_try_connect(WarmConn* c);
+static void warm_refill(WarmNode* n);
+
+// --- 辅助函数 ---
+
+// 只包含影响 TCP / TLS 阶段的字段：协议类型与路径不同的节点可以共用同一条预建连接
+static void warm_make_key(const ProxySession* s, char* out, int cap) {
+    snprintf(out, cap, "%s|%d|%s|%d|%d", s->config.host, s->config.port, s->config.sni,
+             s->config.allowInsecure ? 1 : 0, s->cryptoSettings.alpnOverride);
+}
+
+static void warmconn_close(WarmConn* c) {
+    if (c->h) { Reactor_Remove(c->h); c->h = NULL; }
+    tls_close(&c->tls);
+    if (c->sock != INVALID_SOCKET) { closesocket(c->sock); c->sock = INVALID_SOCKET; }
+    if (c->addrs) { Dns_FreeAddrs(c->addrs); c->addrs = NULL; }
+    c->cur = NULL;
+}
+
+static void warmnode_unlink(WarmNode* n, WarmConn* c) {
+    WarmConn** pp = &n->conns;
+    while (*pp && *pp != c) pp = &(*pp)->next;
+    if (*pp) { *pp = c->next; n->count--; }
+    c->next = NULL;
+}
+
+// 节点已过期且没有连接时释放
+static void warmnode_maybe_free(WarmNode* n) {
+    if (n->count > 0 || Reactor_Now() - n->last_used < WARM_NODE_TTL) return;
+    WarmNode** pp = &s_nodes[n->loop];
+    while (*pp && *pp != n) pp = &(*pp)->next;
+    if (*pp) *pp = n->next;
+    log_msg("[Warm] %s released (%d hit, %d miss)", n->label, n->hits, n->misses);
+    free(n);
+}
+
+// 移除并释放连接。refill = TRUE 时按节点状态补充
+static void warmconn_drop(WarmConn* c, BOOL refill) {
+    WarmNode* n = c->node;
+    warmconn_close(c);
+    warmnode_unlink(n, c);
+    free(c);
+    if (refill) warm_refill(n);
+    warmnode_maybe_free(n);
+}
+
+// 预建失败：退避后由下一次取用重新补充
+static void warmconn_fail(WarmConn* c) {
+    WarmNode* n = c->node;
+    if (n->fails < 5) n->fails++;
+    ULONGLONG delay = (ULONGLONG)WARM_RETRY_BASE << (n->fails - 1);
+    if (delay > WARM_RETRY_MAX) delay = WARM_RETRY_MAX;
+    n->retry_at = Reactor_Now() + delay;
+    warmconn_drop(c, FALSE);
+}
+
+// --- 建立连接 ---
+
+static void warm_on_ready(WarmConn* c) {
+    WarmNode* n = c->node;
+    c->state = WARM_IDLE;
+    c->since = Reactor_Now();
+    n->fails = 0;
+    if (c->addrs) { Dns_FreeAddrs(c->addrs); c->addrs = NULL; c->cur = NULL; }
+    // 空闲期间只关心对端关闭 / 握手后消息
+    Reactor_SetEvents(c->h, REACTOR_EV_READ);
+    Reactor_SetTimer(c->h, n->max_idle_ms);
+    if (tls_pending(&c->tls) > 0) Reactor_Rearm(c->h);
+}
+
+static void warm_next_address(WarmConn* c) {
+    if (c->h) { Reactor_Remove(c->h); c->h = NULL; }
+    tls_close(&c->tls);
+    if (c->sock != INVALID_SOCKET) { closesocket(c->sock); c->sock = INVALID_SOCKET; }
+    if (c->cur) c->cur = c->cur->ai_next;
+    warm_try_connect(c);
+}
+
+static void warm_tls_step(WarmConn* c) {
+    int r = tls_connect_step(&c->tls);
+    if (r == TLS_STEP_DONE) { warm_on_ready(c); return; }
+    if (r < 0) { warm_next_address(c); return; }
+    Reactor_SetEvents(c->h, (r == TLS_STEP_WANT_WRITE) ? REACTOR_EV_WRITE : REACTOR_EV_READ);
+}
+
+static void warm_on_connected(WarmConn* c) {
+    WarmNode* n = c->node;
+    // ALPN 选择与 outbound_tls_begin 一致 (预建只用于未降级的连接)
+    c->tls.sock = c->sock;
+    if (tls_connect_begin(&c->tls, n->config.sni, n->config.host, &n->crypto, n->config.allowInsecure) != 0) {
+        warm_next_address(c);
+        return;
+    }
+    c->state = WARM_TLS;
+    Reactor_SetTimer(c->h, WARM_TLS_TIMEOUT);
+    warm_tls_step(c);
+}
+
+static void warm_try_connect(WarmConn* c) {
+    while (c->cur) {
+        struct addrinfo* ai = c->cur;
+        c->sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (c->sock == INVALID_SOCKET) { c->cur = ai->ai_next; continue; }
+
+        int flag = 1;
+        u_long nb = 1;
+        setsockopt(c->sock, IPPROTO_TCP, TCP_NODELAY, (char *)&flag, sizeof(int));
+        ioctlsocket(c->sock, FIONBIO, &nb);
+
+        int res = connect(c->sock, ai->ai_addr, (int)ai->ai_addrlen);
+        if (res == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK) {
+            closesocket(c->sock); c->sock = INVALID_SOCKET;
+            c->cur = ai->ai_next;
+            continue;
+        }
+
+        c->h = Reactor_Add(c->node->loop, c->sock, REACTOR_EV_WRITE, warmconn_on_event, c);
+        if (!c->h) break;
+        c->state = WARM_CONNECT;
+        Reactor_SetTimer(c->h, WARM_CONNECT_TIMEOUT);
+        return;
+    }
+    // 不做多轮重试：失败由节点退避处理，真实请求仍走正常握手路径
+    warmconn_fail(c);
+}
+
+static void warm_on_resolved(void* arg) {
+    WarmResolveJob* job = (WarmResolveJob*)arg;
+    WarmConn* c = job->c;
+
+    if (c->lost) {
+        if (job->res) Dns_FreeAddrs(job->res);
+        free(c);
+    } else if (job->rc != 0 || !job->res || !g_proxyRunning) {
+        if (job->res) Dns_FreeAddrs(job->res);
+        warmconn_fail(c);
+    } else {
+        c->addrs = job->res;
+        c->cur = c->addrs;
+        warm_try_connect(c);
+    }
+    free(job);
+}
+
+static void Task_WarmResolve(void* arg) {
+    WarmResolveJob* job = (WarmResolveJob*)arg;
+
+    // [Mod] 2026-10-16: 经共享解析器 (utils_dns.c)，与会话解析合并并共用缓存
+    job->rc = Dns_Resolve(job->host, job->port, WARM_RESOLVE_TIMEOUT_MS, &job->res);
+    job->ran = TRUE;
+
+    // 与 proxy_fsm.c 相同：预取 ECH 配置，握手时不在事件循环中发起 DoH 请求
+    if (job->rc == 0 && job->ech_domain[0] && !ThreadPool_IsCancelled()) {
+        size_t ech_len = 0;
+        unsigned char* ech = FetchECHConfig(job->ech_domain, g_echConfigServer, &ech_len);
+        if (ech) free(ech);
+    }
+}
+
+static void Task_WarmResolveDone(void* arg) {
+    WarmResolveJob* job = (WarmResolveJob*)arg;
+    if (!job->ran) job->rc = EAI_AGAIN;
+
+    if (Reactor_Post(job->loop, warm_on_resolved, job) != 0) {
+        // [Fix] 2026-10-16: 事件循环已停止，不会再有线程访问节点链表：在此摘除并释放连接，
+        // 否则它一直挂在节点上 (计入 count 且永不释放)
+        WarmConn* c = job->c;
+        if (!c->lost) warmnode_unlink(c->node, c);
+        warmconn_close(c);
+        free(c);
+        if (job->res) Dns_FreeAddrs(job->res);
+        free(job);
+    }
+}
+
+static void warmconn_start(WarmNode* n) {
+    WarmConn* c = (WarmConn*)calloc(1, sizeof(WarmConn));
+    WarmResolveJob* job = (WarmResolveJob*)calloc(1, sizeof(WarmResolveJob));
+    if (!c || !job) { free(c); free(job); return; }
+
+    c->node = n;
+    c->sock = INVALID_SOCKET;
+    c->state = WARM_RESOLVE;
+    c->since = Reactor_Now();
+    c->next = n->conns;
+    n->conns = c;
+    n->count++;
+
+    job->c = c;
+    job->loop = n->loop;
+    strncpy(job->host, n->config.host, sizeof(job->host) - 1);
+    job->port = n->config.port;
+    if (g_enableECH) {
+        const char* sni = (strlen(n->config.sni) > 0) ? n->config.sni : n->config.host;
+        if (!IsIpStr(sni)) {
+            const char* query = (strlen(g_echPublicName) > 0) ? g_echPublicName : sni;
+            strncpy(job->ech_domain, query, sizeof(job->ech_domain) - 1);
+        }
+    }
+    // 被线程池拒绝时同样经由 Task_WarmResolveDone 以失败结束
+    ThreadPool_Submit(Task_WarmResolve, job, Task_WarmResolveDone);
+}
+
+static void warm_refill(WarmNode* n) {
+    if (!g_proxyRunning || g_warmPoolSize <= 0) return;
+    ULONGLONG now = Reactor_Now();
+    if (now - n->last_used >= WARM_NODE_TTL || now < n->retry_at) return;
+    while (n->count < g_warmPoolSize) {
+        int before = n->count;
+        warmconn_start(n);
+        if (n->count == before) break; // OOM
+    }
+}
+
+// --- 事件处理 ---
+
+// 空闲连接可读：消化握手后消息，EOF / 错误 / 应用数据都说明连接已不可用
+static void warm_on_idle_read(WarmConn* c) {
+    char junk[256];
+    int r;
+    while ((r = tls_read(&c->tls, junk, sizeof(junk))) == 0) {
+        if (tls_pending(&c->tls) <= 0) return;
+    }
+
+    WarmNode* n = c->node;
+    int age = (int)(Reactor_Now() - c->since);
+    if (r < 0 && age < n->max_idle_ms) {
+        // 服务端的空闲超时短于当前上限：留出余量后缩短，避免取到即将被关闭的连接
+        int shorter = age - age / 4;
+        if (shorter < WARM_MIN_IDLE) shorter = WARM_MIN_IDLE;
+        if (shorter < n->max_idle_ms) {
+            n->max_idle_ms = shorter;
+            log_msg("[Warm] %s closed by peer after %d ms idle, max idle now %d ms", n->label, age, shorter);
+        }
+    }
+    warmconn_drop(c, TRUE);
+}
+
+static void warmconn_on_event(ReactorHandle* h, int events, void* arg) {
+    WarmConn* c = (WarmConn*)arg;
+
+    switch (c->state) {
+        case WARM_CONNECT: {
+            if (events & REACTOR_EV_TIMER) { warm_next_address(c); return; }
+            int err = 0, len = sizeof(err);
+            if ((events & REACTOR_EV_ERROR) ||
+                getsockopt(c->sock, SOL_SOCKET, SO_ERROR, (char*)&err, &len) < 0 || err != 0) {
+                warm_next_address(c);
+                return;
+            }
+            warm_on_connected(c);
+            return;
+        }
+        case WARM_TLS:
+            if (events & (REACTOR_EV_TIMER | REACTOR_EV_ERROR)) { warm_next_address(c); return; }
+            warm_tls_step(c);
+            return;
+        case WARM_IDLE:
+            if (!g_proxyRunning) { warmconn_drop(c, FALSE); return; }
+            if (events & REACTOR_EV_TIMER) { warmconn_drop(c, TRUE); return; } // 到期轮换
+            if (events & REACTOR_EV_ERROR) { warmconn_drop(c, TRUE); return; }
+            if (events & REACTOR_EV_READ) warm_on_idle_read(c);
+            return;
+        default:
+            return;
+    }
+}
+
+// 清理过期节点与丢失的解析任务 (事件循环停止时未能投递回来的任务)
+static void warm_sweep(int loop) {
+    ULONGLONG now = Reactor_Now();
+    WarmNode** pp = &s_nodes[loop];
+    while (*pp) {
+        WarmNode* n = *pp;
+        WarmConn* c = n->conns;
+        while (c) {
+            WarmConn* next = c->next;
+            if (c->state == WARM_RESOLVE && now - c->since >= WARM_RESOLVE_LOST) {
+                warmnode_unlink(n, c);
+                c->lost = TRUE; // 结果若仍投递回来，由 warm_on_resolved 释放
+            }
+            c = next;
+        }
+        if (n->count == 0 && now - n->last_used >= WARM_NODE_TTL) {
+            *pp = n->next;
+            log_msg("[Warm] %s released (%d hit, %d miss)", n->label, n->hits, n->misses);
+            free(n);
+            continue;
+        }
+        pp = &n->next;
+    }
+}
+
+// --- 对外接口 ---
+
+int WarmPool_Take(ProxySession* s, int loop) {
+    if (g_warmPoolSize <= 0 || !s || loop < 0 || loop >= WARM_MAX_LOOPS) return -1;
+    if (_stricmp(s->config.type, "direct") == 0 || s->fallback_state != 0) return -1;
+
+    char key[WARM_KEY_LEN];
+    warm_make_key(s, key, sizeof(key));
+    ULONGLONG now = Reactor_Now();
+    warm_sweep(loop);
+
+    WarmNode* n = s_nodes[loop];
+    int nodes = 0;
+    for (; n; n = n->next, nodes++) {
+        if (strcmp(n->key, key) == 0 && memcmp(&n->crypto, &s->cryptoSettings, sizeof(CryptoSettings)) == 0) break;
+    }
+
+    if (!n) {
+        // 首次使用：登记节点并开始预建，本次请求照常新建连接
+        if (nodes >= WARM_MAX_NODES) return -1;
+        n = (WarmNode*)calloc(1, sizeof(WarmNode));
+        if (!n) return -1;
+        n->loop = loop;
+        strncpy(n->key, key, sizeof(n->key) - 1);
+        snprintf(n->label, sizeof(n->label), "%s:%d", s->config.host, s->config.port);
+        n->config = s->config;
+        n->crypto = s->cryptoSettings;
+        n->max_idle_ms = g_warmPoolMaxIdle * 1000;
+        n->last_used = now;
+        n->misses = 1;
+        n->next = s_nodes[loop];
+        s_nodes[loop] = n;
+        warm_refill(n);
+        return -1;
+    }
+    n->last_used = now;
+
+    // 取最近就绪的连接 (最不可能已被对端关闭)
+    WarmConn* best = NULL;
+    for (WarmConn* c = n->conns; c; c = c->next) {
+        if (c->state != WARM_IDLE) continue;
+        if (!best || c->since > best->since) best = c;
+    }
+    if (!best) {
+        n->misses++;
+        warm_refill(n);
+        return -1;
+    }
+
+    // 传输层所有权转移到会话
+    int idle_ms = (int)(now - best->since);
+    Reactor_Remove(best->h); best->h = NULL;
+    s->remoteSock = best->sock;
+    s->tls = best->tls;
+    s->tls.sock = s->remoteSock;
+    best->sock = INVALID_SOCKET;
+    memset(&best->tls, 0, sizeof(TLSContext));
+    warmnode_unlink(n, best);
+    free(best);
+    n->hits++;
+
+    log_msg("[Conn-%d] [Warm] Using pre-connected upstream %s (idle %d ms, %d/%d hit)",
+            s->clientSock, n->label, idle_ms, n->hits, n->hits + n->misses);
+    warm_refill(n);
+    return 0;
+}
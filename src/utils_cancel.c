@@ -0,0 +1,163 @@
+/* src/utils_cancel.c */
+// [New] 2026-10-16: 停止通知 (取消原语)，替代各阻塞等待中 1ms select 轮询 g_proxyRunning 的做法
+// 设计要点:
+// 1. 一个自连接的 UDP 套接字充当 self-pipe：Cancel_Signal 向其写入一个字节且不读出，之后它始终可读
+// 2. 所有阻塞等待都通过 Cancel_Wait 把该套接字加入 select 读集合，按真实超时休眠；
+//    空闲会话不再产生唤醒，停止代理时所有等待立即返回
+// 3. Cancel_Reset 读空套接字，供下一次启动复用
+// 4. 套接字创建失败时退化为 100ms 分片等待，仍能感知停止信号
+// [New] 2026-10-16: Cancel_Select 供同时等待多个 Socket 的调用者 (utils_dial.c 连接竞速) 使用
+
+#include "utils.h"
+#include "common.h"
+#include <winsock2.h>
+
+#define CANCEL_FALLBACK_SLICE_MS 100
+
+static SOCKET s_cancelSock = INVALID_SOCKET;
+static volatile LONG s_cancelSignaled = 0;
+
+// 0=Uninit, 1=Initializing, 2=Ready, 3=Unavailable
+static volatile LONG s_cancelState = 0;
+
+static SOCKET create_cancel_socket() {
+    SOCKET s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s == INVALID_SOCKET) return INVALID_SOCKET;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+
+    int addr_len = sizeof(addr);
+    if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        getsockname(s, (struct sockaddr*)&addr, &addr_len) != 0 ||
+        connect(s, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+
+    u_long mode = 1;
+    ioctlsocket(s, FIONBIO, &mode);
+    return s;
+}
+
+static void cancel_init_once() {
+    if (InterlockedCompareExchange(&s_cancelState, 1, 0) != 0) {
+        while (s_cancelState == 1) Sleep(1);
+        return;
+    }
+
+    s_cancelSock = create_cancel_socket();
+    if (s_cancelSock == INVALID_SOCKET) {
+        LOG_WARN("[Cancel] Failed to create notify socket (%d), falling back to sliced waits", WSAGetLastError());
+        InterlockedExchange(&s_cancelState, 3);
+        return;
+    }
+    // 初始化前已经发出的停止信号
+    if (s_cancelSignaled) {
+        char b = 0;
+        send(s_cancelSock, &b, 1, 0);
+    }
+    InterlockedExchange(&s_cancelState, 2);
+}
+
+void Cancel_Signal(void) {
+    if (InterlockedExchange(&s_cancelSignaled, 1) != 0) return;
+    if (s_cancelState == 0 || s_cancelState == 1) cancel_init_once();
+    if (s_cancelSock != INVALID_SOCKET) {
+        char b = 0;
+        send(s_cancelSock, &b, 1, 0);
+    }
+}
+
+void Cancel_Reset(void) {
+    if (s_cancelState == 0 || s_cancelState == 1) cancel_init_once();
+    if (s_cancelSock != INVALID_SOCKET) {
+        char junk[16];
+        while (recv(s_cancelSock, junk, sizeof(junk), 0) > 0) { }
+    }
+    InterlockedExchange(&s_cancelSignaled, 0);
+}
+
+BOOL Cancel_IsSignaled(void) {
+    return s_cancelSignaled != 0;
+}
+
+int Cancel_Wait(SOCKET sock, int events, int timeout_ms) {
+    if (s_cancelState == 0 || s_cancelState == 1) cancel_init_once();
+    ULONGLONG deadline = (timeout_ms >= 0) ? GetTickCount64() + (ULONGLONG)timeout_ms : 0;
+    BOOL has_notify = (s_cancelSock != INVALID_SOCKET);
+
+    while (TRUE) {
+        if (s_cancelSignaled) return -1;
+
+        int slice = -1;
+        if (timeout_ms >= 0) {
+            ULONGLONG now = GetTickCount64();
+            slice = (now >= deadline) ? 0 : (int)(deadline - now);
+        }
+        if (!has_notify && (slice < 0 || slice > CANCEL_FALLBACK_SLICE_MS)) slice = CANCEL_FALLBACK_SLICE_MS;
+
+        fd_set rfds, wfds, efds;
+        FD_ZERO(&rfds); FD_ZERO(&wfds); FD_ZERO(&efds);
+        if (events & CANCEL_WAIT_READ) FD_SET(sock, &rfds);
+        if (events & CANCEL_WAIT_WRITE) FD_SET(sock, &wfds);
+        FD_SET(sock, &efds); // 非阻塞 connect 失败在异常集合中报告
+        if (has_notify) FD_SET(s_cancelSock, &rfds);
+
+        struct timeval tv;
+        struct timeval* ptv = NULL;
+        if (slice >= 0) {
+            tv.tv_sec = slice / 1000;
+            tv.tv_usec = (slice % 1000) * 1000;
+            ptv = &tv;
+        }
+
+        int n = select(0, &rfds, &wfds, &efds, ptv);
+        if (n < 0) return -1;
+        if (s_cancelSignaled || (has_notify && FD_ISSET(s_cancelSock, &rfds))) return -1;
+
+        if (n > 0) {
+            int ready = 0;
+            if (FD_ISSET(sock, &rfds)) ready |= CANCEL_WAIT_READ;
+            if (FD_ISSET(sock, &wfds)) ready |= CANCEL_WAIT_WRITE;
+            if (FD_ISSET(sock, &efds)) ready |= CANCEL_WAIT_ERROR;
+            if (ready) return ready;
+        }
+        if (timeout_ms >= 0 && GetTickCount64() >= deadline) return 0;
+    }
+}
+
+int Cancel_Select(fd_set* rfds, fd_set* wfds, fd_set* efds, int timeout_ms) {
+    if (s_cancelState == 0 || s_cancelState == 1) cancel_init_once();
+    if (s_cancelSignaled) return -1;
+
+    BOOL has_notify = (s_cancelSock != INVALID_SOCKET);
+    if (!has_notify && (timeout_ms < 0 || timeout_ms > CANCEL_FALLBACK_SLICE_MS)) timeout_ms = CANCEL_FALLBACK_SLICE_MS;
+
+    fd_set local;
+    if (!rfds) { FD_ZERO(&local); rfds = &local; }
+    if (has_notify) FD_SET(s_cancelSock, rfds);
+
+    struct timeval tv;
+    struct timeval* ptv = NULL;
+    if (timeout_ms >= 0) {
+        tv.tv_sec = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
+        ptv = &tv;
+    }
+
+    int n = select(0, rfds, wfds, efds, ptv);
+    if (n < 0) return -1;
+    if (s_cancelSignaled || (has_notify && FD_ISSET(s_cancelSock, rfds))) return -1;
+    return n;
+}
+
+void Cancel_Cleanup(void) {
+    if (InterlockedCompareExchange(&s_cancelState, 0, 2) == 2) {
+        closesocket(s_cancelSock);
+        s_cancelSock = INVALID_SOCKET;
+    }
+}
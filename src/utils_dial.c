@@ -0,0 +1,218 @@
+/* src/utils_dial.c */
+// [New] 2026-10-16: Happy Eyeballs (RFC 8305) 拨号器，替代各处逐个地址串行 connect 的循环
+// 设计要点:
+// 1. 候选地址按地址族交替排列，首个地址族取该目标上次胜出的地址族 (无记录时 IPv6 优先)
+// 2. 每隔 DIAL_ATTEMPT_DELAY_MS 发起下一个连接尝试，前一个尝试失败时立即发起；所有尝试在同一个 select 中等待
+// 3. 第一个连通的 Socket 胜出，其余尝试立即关闭；胜出的地址族按目标记录，供下次排序
+// 4. 黑洞地址 (如不可达的 IPv6) 不再独占整个超时，总耗时由 timeout_ms 统一约束
+// 5. 同步调用者 (TcpPing / InternalHttpsGet) 用 Dial_Race；
+//    事件驱动的状态机只用 Dial_SortAddrs / Dial_RecordWinner，按同样的节奏在 Reactor 上竞速
+
+#include "utils.h"
+#include "common.h"
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <stdio.h>
+
+#define DIAL_FAMILY_SLOTS   64
+#define DIAL_FAMILY_TTL_MS  (10 * 60 * 1000) // 记录过期后回到 IPv6 优先，让修复后的 IPv6 重新有机会胜出
+
+typedef struct {
+    char key[272];
+    int family;
+    ULONGLONG tick;
+} DialFamilyEntry;
+
+typedef struct {
+    SOCKET sock;
+    int family;
+    ULONGLONG start;
+} DialAttempt;
+
+static DialFamilyEntry s_families[DIAL_FAMILY_SLOTS];
+static CRITICAL_SECTION s_dialLock;
+
+// 0=Uninit, 1=Initializing, 2=Ready
+static volatile LONG s_dialState = 0;
+
+static void dial_init_once() {
+    if (InterlockedCompareExchange(&s_dialState, 1, 0) != 0) {
+        while (s_dialState == 1) Sleep(1);
+        return;
+    }
+    InitializeCriticalSection(&s_dialLock);
+    memset(s_families, 0, sizeof(s_families));
+    InterlockedExchange(&s_dialState, 2);
+}
+
+static int dial_preferred_family(const char* key) {
+    int family = AF_INET6;
+    if (!key || !key[0]) return family;
+    if (s_dialState != 2) dial_init_once();
+
+    ULONGLONG now = GetTickCount64();
+    EnterCriticalSection(&s_dialLock);
+    for (int i = 0; i < DIAL_FAMILY_SLOTS; i++) {
+        if (s_families[i].key[0] && strcmp(s_families[i].key, key) == 0) {
+            if (now - s_families[i].tick < DIAL_FAMILY_TTL_MS) family = s_families[i].family;
+            break;
+        }
+    }
+    LeaveCriticalSection(&s_dialLock);
+    return family;
+}
+
+void Dial_RecordWinner(const char* key, int family) {
+    if (!key || !key[0] || (family != AF_INET && family != AF_INET6)) return;
+    if (s_dialState != 2) dial_init_once();
+
+    ULONGLONG now = GetTickCount64();
+    EnterCriticalSection(&s_dialLock);
+    int slot = -1, oldest = 0;
+    for (int i = 0; i < DIAL_FAMILY_SLOTS; i++) {
+        if (s_families[i].key[0] && strcmp(s_families[i].key, key) == 0) { slot = i; break; }
+        if (s_families[i].tick < s_families[oldest].tick) oldest = i;
+    }
+    if (slot < 0) {
+        slot = oldest;
+        strncpy(s_families[slot].key, key, sizeof(s_families[slot].key) - 1);
+        s_families[slot].key[sizeof(s_families[slot].key) - 1] = 0;
+    }
+    s_families[slot].family = family;
+    s_families[slot].tick = now;
+    LeaveCriticalSection(&s_dialLock);
+}
+
+int Dial_SortAddrs(const struct addrinfo* res, const char* key, const struct addrinfo** out, int max) {
+    const struct addrinfo* first[DIAL_MAX_CANDIDATES];
+    const struct addrinfo* second[DIAL_MAX_CANDIDATES];
+    int n1 = 0, n2 = 0, count = 0;
+    if (max > DIAL_MAX_CANDIDATES) max = DIAL_MAX_CANDIDATES;
+
+    int preferred = dial_preferred_family(key);
+    for (const struct addrinfo* ai = res; ai; ai = ai->ai_next) {
+        if (ai->ai_family == preferred) { if (n1 < DIAL_MAX_CANDIDATES) first[n1++] = ai; }
+        else if (n2 < DIAL_MAX_CANDIDATES) second[n2++] = ai;
+    }
+    // 系统解析器已按 RFC 6724 排好族内顺序，这里只做两族交替
+    for (int i = 0, j = 0; count < max && (i < n1 || j < n2); ) {
+        if (i < n1) out[count++] = first[i++];
+        if (count < max && j < n2) out[count++] = second[j++];
+    }
+    return count;
+}
+
+static void dial_close_all(DialAttempt* att, int count, int keep) {
+    for (int i = 0; i < count; i++) {
+        if (i != keep && att[i].sock != INVALID_SOCKET) { closesocket(att[i].sock); att[i].sock = INVALID_SOCKET; }
+    }
+}
+
+SOCKET Dial_Race(const struct addrinfo* res, const char* key, int timeout_ms, int flags,
+                 DialOpenFn open_fn, void* open_arg, int* connect_ms) {
+    const struct addrinfo* cands[DIAL_MAX_CANDIDATES];
+    DialAttempt att[DIAL_MAX_CANDIDATES];
+    int n = Dial_SortAddrs(res, key, cands, DIAL_MAX_CANDIDATES);
+    int started = 0, active = 0, winner = -1;
+    BOOL cancellable = (flags & DIAL_CANCELLABLE) != 0;
+
+    ULONGLONG now = GetTickCount64();
+    ULONGLONG deadline = now + (ULONGLONG)(timeout_ms > 0 ? timeout_ms : 0);
+    ULONGLONG next_at = now;
+
+    while (winner < 0) {
+        if (cancellable && Cancel_IsSignaled()) break;
+        now = GetTickCount64();
+
+        // 到点 (或没有在途尝试) 时发起下一个候选
+        while (started < n && (now >= next_at || active == 0) && now < deadline) {
+            const struct addrinfo* ai = cands[started];
+            DialAttempt* a = &att[started++];
+            a->family = ai->ai_family;
+            a->start = now;
+            a->sock = open_fn ? open_fn(ai->ai_family, ai->ai_socktype, ai->ai_protocol, open_arg)
+                              : socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (a->sock == INVALID_SOCKET) continue;
+
+            u_long nb = 1;
+            ioctlsocket(a->sock, FIONBIO, &nb);
+            if (connect(a->sock, ai->ai_addr, (int)ai->ai_addrlen) == 0) { winner = started - 1; break; }
+            if (WSAGetLastError() != WSAEWOULDBLOCK) {
+                closesocket(a->sock); a->sock = INVALID_SOCKET;
+                continue; // 立即失败：不等待间隔，直接尝试下一个
+            }
+            active++;
+            next_at = now + DIAL_ATTEMPT_DELAY_MS;
+            break;
+        }
+        if (winner >= 0) break;
+        if (active == 0 && started >= n) break;
+        if (now >= deadline) break;
+
+        ULONGLONG wake = deadline;
+        if (started < n && next_at < wake) wake = next_at;
+        int wait_ms = (int)(wake > now ? wake - now : 0);
+
+        fd_set rfds, wfds, efds;
+        FD_ZERO(&rfds); FD_ZERO(&wfds); FD_ZERO(&efds);
+        for (int i = 0; i < started; i++) {
+            if (att[i].sock == INVALID_SOCKET) continue;
+            FD_SET(att[i].sock, &wfds);
+            FD_SET(att[i].sock, &efds); // 非阻塞 connect 失败在异常集合中报告
+        }
+
+        int sel;
+        if (cancellable) {
+            sel = Cancel_Select(&rfds, &wfds, &efds, wait_ms);
+        } else {
+            struct timeval tv;
+            tv.tv_sec = wait_ms / 1000;
+            tv.tv_usec = (wait_ms % 1000) * 1000;
+            sel = select(0, NULL, &wfds, &efds, &tv);
+        }
+        if (sel < 0) break;
+        if (sel == 0) continue;
+
+        now = GetTickCount64();
+        for (int i = 0; i < started && winner < 0; i++) {
+            SOCKET sk = att[i].sock;
+            if (sk == INVALID_SOCKET) continue;
+            BOOL failed = FD_ISSET(sk, &efds);
+            if (!failed && !FD_ISSET(sk, &wfds)) continue;
+
+            int err = 0, len = sizeof(err);
+            if (!failed && getsockopt(sk, SOL_SOCKET, SO_ERROR, (char*)&err, &len) == 0 && err == 0) {
+                winner = i;
+                break;
+            }
+            closesocket(sk);
+            att[i].sock = INVALID_SOCKET;
+            active--;
+            next_at = now; // RFC 8305: 尝试失败时立即发起下一个
+        }
+    }
+
+    dial_close_all(att, started, winner);
+    if (winner < 0) return INVALID_SOCKET;
+
+    Dial_RecordWinner(key, att[winner].family);
+    if (connect_ms) {
+        int ms = (int)(GetTickCount64() - att[winner].start);
+        *connect_ms = (ms > 0) ? ms : 1;
+    }
+    return att[winner].sock;
+}
+
+SOCKET Dial_Connect(const char* host, int port, int timeout_ms, int flags, int* connect_ms) {
+    struct addrinfo* res = NULL;
+    char key[272];
+    snprintf(key, sizeof(key), "%s:%d", host, port);
+
+    // [Warn] 缓存未命中时会等待解析，请勿在 UI 线程直接调用
+    ULONGLONG start = GetTickCount64();
+    if (Dns_Resolve(host, port, timeout_ms, &res) != 0) return INVALID_SOCKET;
+    int remain = timeout_ms - (int)(GetTickCount64() - start);
+    SOCKET s = (remain > 0) ? Dial_Race(res, key, remain, flags, NULL, NULL, connect_ms) : INVALID_SOCKET;
+    Dns_FreeAddrs(res);
+    return s;
+}
@@ -0,0 +1,914 @@
+/* src/utils_dns.c */
+// [New] 2026-10-16: 共享异步 DNS 解析器，替代 proxy_loop.c 的 64 项线性缓存与各处直接调用的阻塞 getaddrinfo
+// 设计要点:
+// 1. 缓存为按域名 (小写) 散列的哈希表，有效期取应答记录的 TTL；NXDOMAIN / 无记录按否定缓存保存
+// 2. 同名的并发查询合并为一次：首个未命中者发起解析，其余调用者在条件变量上等待同一结果
+// 3. 过期不久 (DNS_STALE_WINDOW_MS 内) 的记录直接返回并在后台刷新 (stale-while-revalidate)，
+//    刷新失败时继续提供旧记录 (RFC 8767)；节点地址解析过一次后，连接不再等待 DNS
+// 4. 后端按 DnsMode 选择: 0=系统解析器 (专用线程 getaddrinfo，固定 TTL)；
+//    1=UDP：一个套接字上并发 A / AAAA 查询，由单个收包线程按事务 ID 分发并负责重传；
+//    2=DoH (RFC 8484)：专用线程经 utils_net.c 的 HTTPS 客户端查询。UDP / DoH 失败时回退到系统解析器
+// 5. timeout_ms = 0 的查询只看缓存、从不阻塞 (事件循环与 UDP 转发使用)，未命中时在后台发起解析
+// [Fix] 2026-10-16: 系统解析与 DoH 查询改由各自的专用线程 (DnsLane) 执行，不再提交到共享线程池。
+// 线程池任务 (握手解析、连接预建) 会阻塞在 Dns_Resolve 上等待结果，若结果也由线程池产生，
+// 工作线程全部在等待时解析任务无人执行，直到超时。等待关系现为单向: 线程池 -> DoH 线程 -> 系统解析线程
+// [New] 2026-10-17: Dns_IsDohUrl 供加载设置时校验 DoH 地址 (不合格时解析回退到系统解析器，需提示用户)
+
+#include "utils.h"
+#include "common.h"
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <iphlpapi.h>
+#include <process.h>
+#include <stdio.h>
+#include <openssl/rand.h>
+
+#pragma comment(lib, "iphlpapi.lib")
+
+#define DNS_BUCKETS          256
+#define DNS_MAX_ENTRIES      1024
+#define DNS_MAX_ADDRS        8
+#define DNS_MIN_TTL_MS       5000
+#define DNS_MAX_TTL_MS       (3600 * 1000)
+#define DNS_SYSTEM_TTL_MS    60000           // 系统解析器不提供 TTL，沿用原缓存的 60 秒
+#define DNS_NEG_DEFAULT_MS   30000           // 无 SOA 时的否定缓存时长
+#define DNS_NEG_MAX_MS       300000
+#define DNS_FAIL_TTL_MS      5000            // 解析失败 (超时 / SERVFAIL) 且无旧记录时的短暂否定缓存
+#define DNS_STALE_WINDOW_MS  (3600 * 1000)   // 记录过期后仍可先用后刷的时长
+#define DNS_STALE_SERVE_MS   30000           // 刷新失败时旧记录再提供的时长 (RFC 8767 建议 30 秒)
+
+#define DNS_MAX_PENDING      128
+#define DNS_MAX_SERVERS      4
+#define DNS_UDP_RETRY_MS     1000
+#define DNS_UDP_TRIES        3
+#define DNS_SERVER_REFRESH_MS 60000
+
+#define DNS_SYSTEM_THREADS   4               // getaddrinfo 专用线程
+#define DNS_DOH_THREADS      2               // DoH 查询专用线程 (可能等待 DoH 服务器自身的系统解析)
+#define DNS_LANE_MAX_THREADS 4
+#define DNS_LANE_MAX_QUEUED  256
+
+typedef struct {
+    int family;
+    unsigned char addr[16];
+} DnsAddr;
+
+typedef struct DnsEntry {
+    struct DnsEntry* next;
+    char host[256];          // 小写
+    unsigned int hash;
+    DnsAddr addrs[DNS_MAX_ADDRS];
+    int count;
+    BOOL negative;
+    ULONGLONG expires;       // 0 = 尚无结果
+    ULONGLONG stale_until;
+    ULONGLONG last_used;
+    BOOL resolving;          // 已有解析在途 (并发查询合并)
+    int waiters;             // 正在等待的调用者 (不可淘汰)
+} DnsEntry;
+
+// UDP 后端的一次在途查询 (A 与 AAAA 各一个事务 ID)
+typedef struct {
+    BOOL used;
+    char host[256];
+    unsigned short id[2];
+    BOOL done[2];
+    DnsAddr addrs[DNS_MAX_ADDRS];
+    int count;
+    DWORD ttl_ms;            // 正向记录的最小 TTL
+    DWORD neg_ms;            // 否定应答的 TTL
+    BOOL servfail;           // 任一查询失败或被截断：回退到系统解析器
+    ULONGLONG sent_at;
+    int tries;
+    int server;
+} DnsPending;
+
+typedef struct DnsJob {
+    struct DnsJob* next;
+    char host[256];
+} DnsJob;
+
+// 一组专用解析线程及其 FIFO 队列
+typedef struct {
+    const char* name;
+    void (*run)(DnsJob* job);
+    int thread_want;
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE cond;
+    DnsJob* head;
+    DnsJob* tail;
+    int queued;
+    HANDLE threads[DNS_LANE_MAX_THREADS];
+    int thread_count;
+    volatile LONG state;     // 0=未启动, 1=启动中, 2=运行, 3=不可用 / 已停止
+    volatile LONG stopping;
+} DnsLane;
+
+static DnsEntry* s_buckets[DNS_BUCKETS];
+static int s_entryCount = 0;
+static CRITICAL_SECTION s_dnsLock;
+static CONDITION_VARIABLE s_dnsCond;
+
+// 0=Uninit, 1=Initializing, 2=Ready
+static volatile LONG s_dnsState = 0;
+
+// 统计 (用于日志)
+static volatile LONG s_statHits = 0, s_statStale = 0, s_statMisses = 0, s_statCoalesced = 0;
+
+// UDP 后端
+static SOCKET s_udpSock = INVALID_SOCKET;
+static HANDLE s_udpThread = NULL;
+static volatile LONG s_udpState = 0; // 0=未启动, 1=启动中, 2=运行, 3=不可用
+static volatile LONG s_udpStopping = 0;
+static DnsPending s_pending[DNS_MAX_PENDING];
+static struct sockaddr_in s_servers[DNS_MAX_SERVERS];
+static int s_serverCount = 0;
+static ULONGLONG s_serversLoaded = 0;
+
+static void dns_start_system(const char* host);
+static void dns_run_system(DnsJob* job);
+static void dns_run_doh(DnsJob* job);
+
+static DnsLane s_systemLane = { "System", dns_run_system, DNS_SYSTEM_THREADS };
+static DnsLane s_dohLane = { "DoH", dns_run_doh, DNS_DOH_THREADS };
+
+static void dns_init_once() {
+    if (InterlockedCompareExchange(&s_dnsState, 1, 0) != 0) {
+        while (s_dnsState == 1) Sleep(1);
+        return;
+    }
+    InitializeCriticalSection(&s_dnsLock);
+    InitializeConditionVariable(&s_dnsCond);
+    memset(s_buckets, 0, sizeof(s_buckets));
+    memset(s_pending, 0, sizeof(s_pending));
+    InterlockedExchange(&s_dnsState, 2);
+}
+
+static unsigned int dns_hash(const char* s) {
+    unsigned int h = 2166136261u; // FNV-1a
+    while (*s) { h ^= (unsigned char)*s++; h *= 16777619u; }
+    return h;
+}
+
+static void dns_lower(char* dst, const char* src, int cap) {
+    int i = 0;
+    for (; src[i] && i < cap - 1; i++) dst[i] = (char)tolower((unsigned char)src[i]);
+    // 忽略末尾的根标签点
+    if (i > 0 && dst[i - 1] == '.') i--;
+    dst[i] = 0;
+}
+
+// --- 结果链表 (与 getaddrinfo 结构兼容，统一用 Dns_FreeAddrs 释放) ---
+
+typedef struct {
+    struct addrinfo ai;
+    struct sockaddr_in6 sa; // 足以容纳 sockaddr_in
+} DnsAiNode;
+
+static struct addrinfo* dns_build_list(const DnsAddr* addrs, int count, int port) {
+    struct addrinfo* head = NULL;
+    struct addrinfo** tail = &head;
+    for (int i = 0; i < count; i++) {
+        DnsAiNode* n = (DnsAiNode*)calloc(1, sizeof(DnsAiNode));
+        if (!n) break;
+        n->ai.ai_family = addrs[i].family;
+        n->ai.ai_socktype = SOCK_STREAM;
+        n->ai.ai_protocol = IPPROTO_TCP;
+        n->ai.ai_addr = (struct sockaddr*)&n->sa;
+        if (addrs[i].family == AF_INET6) {
+            n->sa.sin6_family = AF_INET6;
+            n->sa.sin6_port = htons((unsigned short)port);
+            memcpy(&n->sa.sin6_addr, addrs[i].addr, 16);
+            n->ai.ai_addrlen = sizeof(struct sockaddr_in6);
+        } else {
+            struct sockaddr_in* sin = (struct sockaddr_in*)&n->sa;
+            sin->sin_family = AF_INET;
+            sin->sin_port = htons((unsigned short)port);
+            memcpy(&sin->sin_addr, addrs[i].addr, 4);
+            n->ai.ai_addrlen = sizeof(struct sockaddr_in);
+        }
+        *tail = &n->ai;
+        tail = &n->ai.ai_next;
+    }
+    return head;
+}
+
+void Dns_FreeAddrs(struct addrinfo* res) {
+    while (res) {
+        struct addrinfo* next = res->ai_next;
+        free(res); // ai 为 DnsAiNode 首成员
+        res = next;
+    }
+}
+
+// 从 getaddrinfo 结果中提取地址 (去重)
+static int dns_collect_addrinfo(const struct addrinfo* res, DnsAddr* out, int max) {
+    int count = 0;
+    for (const struct addrinfo* ai = res; ai && count < max; ai = ai->ai_next) {
+        DnsAddr a;
+        memset(&a, 0, sizeof(a));
+        if (ai->ai_family == AF_INET) {
+            a.family = AF_INET;
+            memcpy(a.addr, &((struct sockaddr_in*)ai->ai_addr)->sin_addr, 4);
+        } else if (ai->ai_family == AF_INET6) {
+            a.family = AF_INET6;
+            memcpy(a.addr, &((struct sockaddr_in6*)ai->ai_addr)->sin6_addr, 16);
+        } else {
+            continue;
+        }
+        BOOL dup = FALSE;
+        for (int i = 0; i < count && !dup; i++) dup = (memcmp(&out[i], &a, sizeof(a)) == 0);
+        if (!dup) out[count++] = a;
+    }
+    return count;
+}
+
+// IP 字面量不经过缓存
+static BOOL dns_numeric(const char* host, int port, struct addrinfo** out) {
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_flags = AI_NUMERICHOST;
+    if (getaddrinfo(host, NULL, &hints, &res) != 0) return FALSE;
+
+    DnsAddr addrs[DNS_MAX_ADDRS];
+    int count = dns_collect_addrinfo(res, addrs, DNS_MAX_ADDRS);
+    freeaddrinfo(res);
+    *out = dns_build_list(addrs, count, port);
+    return TRUE;
+}
+
+// --- 缓存 (调用者持有 s_dnsLock) ---
+
+static DnsEntry* dns_find_locked(const char* key, unsigned int hash) {
+    for (DnsEntry* e = s_buckets[hash % DNS_BUCKETS]; e; e = e->next) {
+        if (e->hash == hash && strcmp(e->host, key) == 0) return e;
+    }
+    return NULL;
+}
+
+// 淘汰最久未使用且没有在途解析 / 等待者的条目
+static void dns_evict_locked() {
+    DnsEntry** victim = NULL;
+    for (int b = 0; b < DNS_BUCKETS; b++) {
+        for (DnsEntry** pp = &s_buckets[b]; *pp; pp = &(*pp)->next) {
+            DnsEntry* e = *pp;
+            if (e->resolving || e->waiters > 0) continue;
+            if (!victim || e->last_used < (*victim)->last_used) victim = pp;
+        }
+    }
+    if (!victim) return;
+    DnsEntry* e = *victim;
+    *victim = e->next;
+    free(e);
+    s_entryCount--;
+}
+
+static DnsEntry* dns_get_locked(const char* key, unsigned int hash) {
+    DnsEntry* e = dns_find_locked(key, hash);
+    if (e) return e;
+    if (s_entryCount >= DNS_MAX_ENTRIES) dns_evict_locked();
+
+    e = (DnsEntry*)calloc(1, sizeof(DnsEntry));
+    if (!e) return NULL;
+    strncpy(e->host, key, sizeof(e->host) - 1);
+    e->hash = hash;
+    e->next = s_buckets[hash % DNS_BUCKETS];
+    s_buckets[hash % DNS_BUCKETS] = e;
+    s_entryCount++;
+    return e;
+}
+
+// 写入解析结果并唤醒等待者
+// ok=FALSE 表示解析失败 (超时 / 服务器错误)；ok=TRUE 且 count=0 表示域名不存在或没有地址记录
+static void dns_complete(const char* key, BOOL ok, const DnsAddr* addrs, int count, DWORD ttl_ms) {
+    if (s_dnsState != 2) dns_init_once();
+    ULONGLONG now = GetTickCount64();
+    unsigned int hash = dns_hash(key);
+
+    EnterCriticalSection(&s_dnsLock);
+    DnsEntry* e = dns_get_locked(key, hash);
+    if (e) {
+        e->resolving = FALSE;
+        if (ok && count > 0) {
+            if (ttl_ms < DNS_MIN_TTL_MS) ttl_ms = DNS_MIN_TTL_MS;
+            if (ttl_ms > DNS_MAX_TTL_MS) ttl_ms = DNS_MAX_TTL_MS;
+            memcpy(e->addrs, addrs, sizeof(DnsAddr) * count);
+            e->count = count;
+            e->negative = FALSE;
+            e->expires = now + ttl_ms;
+            e->stale_until = e->expires + DNS_STALE_WINDOW_MS;
+        } else if (ok) {
+            if (ttl_ms < DNS_MIN_TTL_MS) ttl_ms = DNS_MIN_TTL_MS;
+            if (ttl_ms > DNS_NEG_MAX_MS) ttl_ms = DNS_NEG_MAX_MS;
+            e->count = 0;
+            e->negative = TRUE;
+            e->expires = now + ttl_ms;
+            e->stale_until = e->expires;
+        } else if (!e->negative && e->count > 0 && e->stale_until > now) {
+            // 刷新失败：继续提供旧记录
+            e->expires = now + DNS_STALE_SERVE_MS;
+        } else {
+            e->count = 0;
+            e->negative = TRUE;
+            e->expires = now + DNS_FAIL_TTL_MS;
+            e->stale_until = e->expires;
+        }
+    }
+    LeaveCriticalSection(&s_dnsLock);
+    WakeAllConditionVariable(&s_dnsCond);
+}
+
+// --- DNS 报文 ---
+
+static int dns_build_query(unsigned char* buf, int cap, unsigned short id, const char* host, int qtype) {
+    if (cap < 12) return -1;
+    memset(buf, 0, 12);
+    buf[0] = (unsigned char)(id >> 8); buf[1] = (unsigned char)id;
+    buf[2] = 0x01; // RD
+    buf[5] = 1;    // QDCOUNT
+    int len = 12;
+
+    const char* p = host;
+    while (*p) {
+        const char* dot = strchr(p, '.');
+        int l = dot ? (int)(dot - p) : (int)strlen(p);
+        if (l == 0 || l > 63 || len + l + 1 + 5 > cap) return -1;
+        buf[len++] = (unsigned char)l;
+        memcpy(buf + len, p, l);
+        len += l;
+        if (!dot) break;
+        p = dot + 1;
+    }
+    buf[len++] = 0;
+    buf[len++] = 0; buf[len++] = (unsigned char)qtype;
+    buf[len++] = 0; buf[len++] = 1; // IN
+    return len;
+}
+
+// 解码 (可能压缩的) 域名，返回名字之后的位置；out 为 NULL 时只跳过
+static const unsigned char* dns_read_name(const unsigned char* msg, const unsigned char* end,
+                                          const unsigned char* p, char* out, int cap) {
+    const unsigned char* after = NULL;
+    int len = 0, jumps = 0;
+    while (p < end) {
+        unsigned char l = *p;
+        if (l == 0) {
+            if (out) out[len] = 0;
+            return after ? after : p + 1;
+        }
+        if ((l & 0xC0) == 0xC0) {
+            if (p + 1 >= end || ++jumps > 16) return NULL;
+            if (!after) after = p + 2;
+            p = msg + (((l & 0x3F) << 8) | p[1]);
+            continue;
+        }
+        if (p + 1 + l > end) return NULL;
+        if (out) {
+            if (len + l + 2 > cap) return NULL;
+            if (len > 0) out[len++] = '.';
+            for (int i = 0; i < l; i++) out[len++] = (char)tolower(p[1 + i]);
+        }
+        p += 1 + l;
+    }
+    return NULL;
+}
+
+// 解析应答：追加地址到 addrs，返回 0=成功 (可能无记录), 1=NXDOMAIN, -1=错误 / 截断 / 名字不符
+static int dns_parse_response(const unsigned char* msg, int len, const char* host,
+                              DnsAddr* addrs, int* count, int max, DWORD* ttl_ms, DWORD* neg_ms) {
+    if (len < 12) return -1;
+    const unsigned char* end = msg + len;
+    int flags = (msg[2] << 8) | msg[3];
+    int rcode = flags & 0x0F;
+    if (!(flags & 0x8000) || (flags & 0x0200)) return -1; // 不是应答，或被截断 (TC)
+    if (rcode != 0 && rcode != 3) return -1;
+
+    int qd = (msg[4] << 8) | msg[5];
+    int an = (msg[6] << 8) | msg[7];
+    int ns = (msg[8] << 8) | msg[9];
+    if (qd != 1) return -1;
+
+    char qname[256];
+    const unsigned char* p = dns_read_name(msg, end, msg + 12, qname, sizeof(qname));
+    if (!p || p + 4 > end || strcmp(qname, host) != 0) return -1;
+    p += 4;
+
+    DWORD min_ttl = 0xFFFFFFFF;
+    for (int i = 0; i < an + ns && p; i++) {
+        p = dns_read_name(msg, end, p, NULL, 0);
+        if (!p || p + 10 > end) return -1;
+        int type = (p[0] << 8) | p[1];
+        DWORD ttl = ((DWORD)p[4] << 24) | ((DWORD)p[5] << 16) | ((DWORD)p[6] << 8) | p[7];
+        int rdlen = (p[8] << 8) | p[9];
+        p += 10;
+        if (p + rdlen > end) return -1;
+
+        if (i < an) {
+            int alen = (type == 1) ? 4 : (type == 28 ? 16 : 0);
+            if (alen && rdlen == alen && *count < max) {
+                DnsAddr* a = &addrs[*count];
+                memset(a, 0, sizeof(*a));
+                a->family = (type == 1) ? AF_INET : AF_INET6;
+                memcpy(a->addr, p, alen);
+                (*count)++;
+                if (ttl < min_ttl) min_ttl = ttl;
+            }
+        } else if (type == 6 && neg_ms) {
+            // 权威段的 SOA 决定否定缓存时长 (RFC 2308)
+            DWORD ms = (ttl > DNS_NEG_MAX_MS / 1000) ? DNS_NEG_MAX_MS : ttl * 1000;
+            if (*neg_ms == 0 || ms < *neg_ms) *neg_ms = ms;
+        }
+        p += rdlen;
+    }
+    if (min_ttl != 0xFFFFFFFF && ttl_ms) {
+        DWORD ms = (min_ttl > DNS_MAX_TTL_MS / 1000) ? DNS_MAX_TTL_MS : min_ttl * 1000;
+        if (*ttl_ms == 0 || ms < *ttl_ms) *ttl_ms = ms;
+    }
+    return (rcode == 3) ? 1 : 0;
+}
+
+// --- 专用解析线程 ---
+
+static unsigned __stdcall Thread_DnsLane(void* arg) {
+    DnsLane* lane = (DnsLane*)arg;
+    EnterCriticalSection(&lane->lock);
+    while (!lane->stopping) {
+        DnsJob* job = lane->head;
+        if (!job) {
+            SleepConditionVariableCS(&lane->cond, &lane->lock, INFINITE);
+            continue;
+        }
+        lane->head = job->next;
+        if (!lane->head) lane->tail = NULL;
+        lane->queued--;
+        LeaveCriticalSection(&lane->lock);
+
+        lane->run(job);
+        free(job);
+
+        EnterCriticalSection(&lane->lock);
+    }
+    LeaveCriticalSection(&lane->lock);
+    return 0;
+}
+
+static BOOL dns_lane_ensure(DnsLane* lane) {
+    if (lane->state == 2) return TRUE;
+    if (InterlockedCompareExchange(&lane->state, 1, 0) != 0) {
+        while (lane->state == 1) Sleep(1);
+        return lane->state == 2;
+    }
+
+    InitializeCriticalSection(&lane->lock);
+    InitializeConditionVariable(&lane->cond);
+    lane->head = lane->tail = NULL;
+    lane->queued = 0;
+    lane->stopping = 0;
+    lane->thread_count = 0;
+    for (int i = 0; i < lane->thread_want && i < DNS_LANE_MAX_THREADS; i++) {
+        HANDLE h = (HANDLE)_beginthreadex(NULL, 0, Thread_DnsLane, lane, 0, NULL);
+        if (h) lane->threads[lane->thread_count++] = h;
+    }
+    if (lane->thread_count == 0) {
+        DeleteCriticalSection(&lane->lock);
+        LOG_ERROR("[DNS] Failed to start %s resolver threads", lane->name);
+        InterlockedExchange(&lane->state, 3);
+        return FALSE;
+    }
+    InterlockedExchange(&lane->state, 2);
+    return TRUE;
+}
+
+// 排队失败 (线程不可用 / 队列已满 / 正在停止) 时立即结束在途状态，否则等待者会一直等到超时
+static void dns_lane_submit(DnsLane* lane, const char* host) {
+    DnsJob* job = NULL;
+    if (dns_lane_ensure(lane)) job = (DnsJob*)calloc(1, sizeof(DnsJob));
+    if (!job) { dns_complete(host, FALSE, NULL, 0, 0); return; }
+    strncpy(job->host, host, sizeof(job->host) - 1);
+
+    BOOL ok = FALSE;
+    EnterCriticalSection(&lane->lock);
+    if (!lane->stopping && lane->queued < DNS_LANE_MAX_QUEUED) {
+        if (lane->tail) lane->tail->next = job;
+        else lane->head = job;
+        lane->tail = job;
+        lane->queued++;
+        ok = TRUE;
+        WakeConditionVariable(&lane->cond);
+    }
+    LeaveCriticalSection(&lane->lock);
+
+    if (!ok) {
+        LOG_WARN("[DNS] %s resolver queue full, lookup for %s dropped", lane->name, host);
+        free(job);
+        dns_complete(host, FALSE, NULL, 0, 0);
+    }
+}
+
+// 停止线程并丢弃排队的查询；线程未按时退出 (卡在 getaddrinfo / HTTPS 请求中) 时保留队列与锁
+static void dns_lane_stop(DnsLane* lane) {
+    if (lane->state != 2) return;
+    EnterCriticalSection(&lane->lock);
+    lane->stopping = 1;
+    WakeAllConditionVariable(&lane->cond);
+    LeaveCriticalSection(&lane->lock);
+
+    BOOL bSafe = TRUE;
+    for (int i = 0; i < lane->thread_count; i++) {
+        if (WaitForSingleObject(lane->threads[i], 2000) != WAIT_OBJECT_0) bSafe = FALSE;
+        CloseHandle(lane->threads[i]);
+        lane->threads[i] = NULL;
+    }
+    lane->thread_count = 0;
+    if (!bSafe) {
+        LOG_WARN("[DNS] %s resolver thread did not exit in time, skipping cleanup", lane->name);
+        InterlockedExchange(&lane->state, 3);
+        return;
+    }
+
+    DnsJob* job = lane->head;
+    lane->head = lane->tail = NULL;
+    lane->queued = 0;
+    while (job) {
+        DnsJob* next = job->next;
+        dns_complete(job->host, FALSE, NULL, 0, 0);
+        free(job);
+        job = next;
+    }
+    DeleteCriticalSection(&lane->lock);
+    InterlockedExchange(&lane->state, 0);
+}
+
+// --- 系统解析器后端 ---
+
+static void dns_run_system(DnsJob* job) {
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    int rc = getaddrinfo(job->host, NULL, &hints, &res);
+    if (rc == 0) {
+        DnsAddr addrs[DNS_MAX_ADDRS];
+        int count = dns_collect_addrinfo(res, addrs, DNS_MAX_ADDRS);
+        freeaddrinfo(res);
+        dns_complete(job->host, TRUE, addrs, count, DNS_SYSTEM_TTL_MS);
+    } else {
+        // 域名不存在按否定缓存处理，其余 (如超时) 视为暂时失败
+        dns_complete(job->host, rc == EAI_NONAME, NULL, 0, DNS_NEG_DEFAULT_MS);
+    }
+}
+
+static void dns_start_system(const char* host) {
+    dns_lane_submit(&s_systemLane, host);
+}
+
+// --- DoH 后端 (RFC 8484) ---
+
+BOOL Dns_IsDohUrl(const char* url) {
+    return url && strstr(url, "/dns-query") != NULL;
+}
+
+static BOOL dns_doh_url(char* out, int cap) {
+    const char* url = (g_dnsMode == 2 && strlen(g_dnsServer) > 0) ? g_dnsServer : g_echConfigServer;
+    if (!Dns_IsDohUrl(url)) return FALSE;
+    strncpy(out, url, cap - 1);
+    out[cap - 1] = 0;
+    return TRUE;
+}
+
+// DoH 服务器自身的域名必须走系统解析器，否则查询会递归到自己
+static BOOL dns_is_doh_host(const char* host, const char* url) {
+    const char* p = strstr(url, "://");
+    p = p ? p + 3 : url;
+    size_t n = strcspn(p, ":/");
+    return strlen(host) == n && _strnicmp(host, p, n) == 0;
+}
+
+static void dns_run_doh(DnsJob* job) {
+    char url[256];
+    if (!dns_doh_url(url, sizeof(url))) { dns_start_system(job->host); return; }
+
+    DnsAddr addrs[DNS_MAX_ADDRS];
+    int count = 0, answered = 0;
+    BOOL nx = FALSE;
+    DWORD ttl_ms = 0, neg_ms = 0;
+    static const int qtypes[2] = { 28, 1 };
+
+    for (int i = 0; i < 2 && !s_dohLane.stopping; i++) {
+        unsigned char req[300];
+        int req_len = dns_build_query(req, sizeof(req), 0, job->host, qtypes[i]); // RFC 8484 建议 ID 为 0 以便 HTTP 缓存
+        if (req_len < 0) break;
+
+        size_t resp_len = 0;
+        unsigned char* resp = DohQuery(url, req, req_len, 3000, &resp_len);
+        if (!resp) continue;
+        int r = dns_parse_response(resp, (int)resp_len, job->host, addrs, &count, DNS_MAX_ADDRS, &ttl_ms, &neg_ms);
+        free(resp);
+        if (r < 0) continue;
+        answered++;
+        if (r == 1) nx = TRUE;
+    }
+
+    if (count > 0) dns_complete(job->host, TRUE, addrs, count, ttl_ms);
+    else if (answered == 2 || nx) dns_complete(job->host, TRUE, NULL, 0, neg_ms ? neg_ms : DNS_NEG_DEFAULT_MS);
+    else dns_start_system(job->host);
+}
+
+// --- UDP 后端 ---
+
+static void dns_load_servers() {
+    s_serverCount = 0;
+    s_serversLoaded = GetTickCount64();
+
+    // DnsServer 为逗号分隔的 IPv4 列表时优先使用，否则取系统配置的 DNS 服务器
+    if (g_dnsMode == 1 && strlen(g_dnsServer) > 0) {
+        char list[256];
+        strncpy(list, g_dnsServer, sizeof(list) - 1); list[sizeof(list) - 1] = 0;
+        char* ctx = NULL;
+        char* tok = strtok_s(list, ", ;", &ctx);
+        while (tok && s_serverCount < DNS_MAX_SERVERS) {
+            struct sockaddr_in* sa = &s_servers[s_serverCount];
+            memset(sa, 0, sizeof(*sa));
+            sa->sin_family = AF_INET;
+            sa->sin_port = htons(53);
+            if (inet_pton(AF_INET, tok, &sa->sin_addr) == 1) s_serverCount++;
+            tok = strtok_s(NULL, ", ;", &ctx);
+        }
+        if (s_serverCount > 0) return;
+    }
+
+    ULONG size = 0;
+    if (GetNetworkParams(NULL, &size) != ERROR_BUFFER_OVERFLOW || size == 0) return;
+    FIXED_INFO* info = (FIXED_INFO*)malloc(size);
+    if (!info) return;
+    if (GetNetworkParams(info, &size) == NO_ERROR) {
+        for (IP_ADDR_STRING* ip = &info->DnsServerList; ip && s_serverCount < DNS_MAX_SERVERS; ip = ip->Next) {
+            struct sockaddr_in* sa = &s_servers[s_serverCount];
+            memset(sa, 0, sizeof(*sa));
+            sa->sin_family = AF_INET;
+            sa->sin_port = htons(53);
+            if (inet_pton(AF_INET, ip->IpAddress.String, &sa->sin_addr) == 1 && sa->sin_addr.s_addr != 0) s_serverCount++;
+        }
+    }
+    free(info);
+}
+
+static void dns_udp_send_locked(DnsPending* q) {
+    if (s_serverCount == 0) return;
+    const struct sockaddr_in* sa = &s_servers[q->server % s_serverCount];
+    static const int qtypes[2] = { 28, 1 };
+    for (int i = 0; i < 2; i++) {
+        if (q->done[i]) continue;
+        unsigned char req[300];
+        int len = dns_build_query(req, sizeof(req), q->id[i], q->host, qtypes[i]);
+        if (len > 0) sendto(s_udpSock, (const char*)req, len, 0, (const struct sockaddr*)sa, sizeof(*sa));
+    }
+    q->sent_at = GetTickCount64();
+    q->tries++;
+}
+
+// 查询结束：写入缓存，或记下需要回退到系统解析器的域名 (在锁外提交)
+static void dns_udp_finish_locked(DnsPending* q, BOOL timed_out, char (*fallback)[256], int* fb_count) {
+    q->used = FALSE;
+    if (timed_out || q->servfail) {
+        if (*fb_count < DNS_MAX_PENDING) strcpy(fallback[(*fb_count)++], q->host);
+        return;
+    }
+    // dns_complete 会重新进入同一把锁 (CRITICAL_SECTION 可重入)
+    if (q->count > 0) dns_complete(q->host, TRUE, q->addrs, q->count, q->ttl_ms);
+    else dns_complete(q->host, TRUE, NULL, 0, q->neg_ms ? q->neg_ms : DNS_NEG_DEFAULT_MS);
+}
+
+static BOOL dns_from_server(const struct sockaddr_in* from) {
+    for (int i = 0; i < s_serverCount; i++) {
+        if (s_servers[i].sin_addr.s_addr == from->sin_addr.s_addr && s_servers[i].sin_port == from->sin_port) return TRUE;
+    }
+    return FALSE;
+}
+
+static unsigned __stdcall Thread_DnsUdp(void* arg) {
+    static char fallback[DNS_MAX_PENDING][256];
+    unsigned char buf[1500];
+
+    while (!s_udpStopping) {
+        fd_set rfds;
+        FD_ZERO(&rfds);
+        FD_SET(s_udpSock, &rfds);
+        struct timeval tv = { 0, 200 * 1000 };
+        int n = select(0, &rfds, NULL, NULL, &tv);
+        if (n < 0) { Sleep(100); continue; }
+
+        int fb_count = 0;
+        EnterCriticalSection(&s_dnsLock);
+        if (n > 0) {
+            while (TRUE) {
+                struct sockaddr_in from;
+                int from_len = sizeof(from);
+                int len = recvfrom(s_udpSock, (char*)buf, sizeof(buf), 0, (struct sockaddr*)&from, &from_len);
+                if (len <= 0) break;
+                if (len < 12 || from.sin_family != AF_INET || !dns_from_server(&from)) continue;
+
+                unsigned short id = (unsigned short)((buf[0] << 8) | buf[1]);
+                for (int i = 0; i < DNS_MAX_PENDING; i++) {
+                    DnsPending* q = &s_pending[i];
+                    if (!q->used) continue;
+                    int k = (q->id[0] == id && !q->done[0]) ? 0 : ((q->id[1] == id && !q->done[1]) ? 1 : -1);
+                    if (k < 0) continue;
+
+                    int r = dns_parse_response(buf, len, q->host, q->addrs, &q->count, DNS_MAX_ADDRS, &q->ttl_ms, &q->neg_ms);
+                    if (r < 0) {
+                        // 名字不符的可能是伪造应答，忽略；截断或服务器错误则交给系统解析器
+                        int flags = (buf[2] << 8) | buf[3];
+                        if (!(flags & 0x0200) && (flags & 0x0F) == 0) break;
+                        q->servfail = TRUE;
+                    }
+                    q->done[k] = TRUE;
+                    if (q->servfail || (q->done[0] && q->done[1])) dns_udp_finish_locked(q, FALSE, fallback, &fb_count);
+                    break;
+                }
+            }
+        }
+
+        ULONGLONG now = GetTickCount64();
+        for (int i = 0; i < DNS_MAX_PENDING; i++) {
+            DnsPending* q = &s_pending[i];
+            if (!q->used || now - q->sent_at < DNS_UDP_RETRY_MS) continue;
+            if (q->tries >= DNS_UDP_TRIES) { dns_udp_finish_locked(q, TRUE, fallback, &fb_count); continue; }
+            q->server++; // 重传时轮换服务器
+            dns_udp_send_locked(q);
+        }
+        if (now - s_serversLoaded > DNS_SERVER_REFRESH_MS) dns_load_servers();
+        LeaveCriticalSection(&s_dnsLock);
+
+        for (int i = 0; i < fb_count; i++) dns_start_system(fallback[i]);
+    }
+    return 0;
+}
+
+static BOOL dns_udp_ensure() {
+    if (s_udpState == 2) return TRUE;
+    if (InterlockedCompareExchange(&s_udpState, 1, 0) != 0) {
+        while (s_udpState == 1) Sleep(1);
+        return s_udpState == 2;
+    }
+
+    EnterCriticalSection(&s_dnsLock);
+    dns_load_servers();
+    LeaveCriticalSection(&s_dnsLock);
+
+    SOCKET s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s_serverCount == 0 || s == INVALID_SOCKET) {
+        if (s != INVALID_SOCKET) closesocket(s);
+        LOG_WARN("[DNS] UDP resolver unavailable (no server or socket error), using system resolver");
+        InterlockedExchange(&s_udpState, 3);
+        return FALSE;
+    }
+    u_long nb = 1;
+    ioctlsocket(s, FIONBIO, &nb);
+    s_udpSock = s;
+    s_udpStopping = 0;
+
+    s_udpThread = (HANDLE)_beginthreadex(NULL, 0, Thread_DnsUdp, NULL, 0, NULL);
+    if (!s_udpThread) {
+        closesocket(s_udpSock); s_udpSock = INVALID_SOCKET;
+        InterlockedExchange(&s_udpState, 3);
+        return FALSE;
+    }
+    LOG_INFO("[DNS] UDP resolver started (%d server(s))", s_serverCount);
+    InterlockedExchange(&s_udpState, 2);
+    return TRUE;
+}
+
+static BOOL dns_start_udp(const char* host) {
+    if (!dns_udp_ensure()) return FALSE;
+
+    EnterCriticalSection(&s_dnsLock);
+    DnsPending* q = NULL;
+    for (int i = 0; i < DNS_MAX_PENDING && !q; i++) if (!s_pending[i].used) q = &s_pending[i];
+    if (q) {
+        memset(q, 0, sizeof(*q));
+        q->used = TRUE;
+        strncpy(q->host, host, sizeof(q->host) - 1);
+        // 随机事务 ID (防伪造应答)
+        if (RAND_bytes((unsigned char*)q->id, sizeof(q->id)) != 1) {
+            q->id[0] = (unsigned short)rand(); q->id[1] = (unsigned short)rand();
+        }
+        if (q->id[0] == q->id[1]) q->id[1] ^= 0x5A5A;
+        q->server = 0;
+        dns_udp_send_locked(q);
+    }
+    LeaveCriticalSection(&s_dnsLock);
+    return q != NULL;
+}
+
+// 按 DnsMode 发起一次后台解析 (调用前已把条目标记为 resolving)
+static void dns_start(const char* host) {
+    // 单标签名 (局域网主机名) 依赖系统的后缀搜索与 hosts 文件
+    BOOL single_label = (strchr(host, '.') == NULL);
+
+    if (g_dnsMode == 1 && !single_label && dns_start_udp(host)) return;
+    if (g_dnsMode == 2 && !single_label) {
+        char url[256];
+        if (dns_doh_url(url, sizeof(url)) && !dns_is_doh_host(host, url)) {
+            dns_lane_submit(&s_dohLane, host);
+            return;
+        }
+    }
+    dns_start_system(host);
+}
+
+// --- 对外接口 ---
+
+int Dns_Resolve(const char* host, int port, int timeout_ms, struct addrinfo** out) {
+    *out = NULL;
+    if (!host || !host[0]) return -1;
+    if (dns_numeric(host, port, out)) return *out ? 0 : -1;
+
+    char key[256];
+    dns_lower(key, host, sizeof(key));
+    if (!key[0]) return -1;
+    if (s_dnsState != 2) dns_init_once();
+
+    unsigned int hash = dns_hash(key);
+    ULONGLONG deadline = GetTickCount64() + (ULONGLONG)(timeout_ms > 0 ? timeout_ms : 0);
+    DnsAddr addrs[DNS_MAX_ADDRS];
+    int count = -1;
+    BOOL start = FALSE, waited = FALSE;
+
+    EnterCriticalSection(&s_dnsLock);
+    DnsEntry* e = dns_get_locked(key, hash);
+    if (!e) { LeaveCriticalSection(&s_dnsLock); return -1; }
+    e->waiters++;
+
+    while (TRUE) {
+        ULONGLONG now = GetTickCount64();
+        e->last_used = now;
+
+        if (e->expires > now) {
+            // 有效记录 (或否定缓存)
+            if (!e->negative) { count = e->count; memcpy(addrs, e->addrs, sizeof(DnsAddr) * count); }
+            if (!waited) InterlockedIncrement(&s_statHits);
+            break;
+        }
+        if (!e->negative && e->count > 0 && e->stale_until > now) {
+            // 先用旧记录，后台刷新
+            count = e->count;
+            memcpy(addrs, e->addrs, sizeof(DnsAddr) * count);
+            if (!e->resolving) { e->resolving = TRUE; start = TRUE; }
+            InterlockedIncrement(&s_statStale);
+            break;
+        }
+        if (!e->resolving) {
+            e->resolving = TRUE;
+            InterlockedIncrement(&s_statMisses);
+            LeaveCriticalSection(&s_dnsLock);
+            dns_start(key);
+            EnterCriticalSection(&s_dnsLock);
+            continue; // 系统解析失败可能已同步写回
+        }
+        if (now >= deadline) break;
+        if (!waited) InterlockedIncrement(&s_statCoalesced);
+        waited = TRUE;
+        SleepConditionVariableCS(&s_dnsCond, &s_dnsLock, (DWORD)(deadline - now));
+    }
+    e->waiters--;
+    LeaveCriticalSection(&s_dnsLock);
+
+    if (start) dns_start(key);
+    if (count <= 0) return -1;
+    *out = dns_build_list(addrs, count, port);
+    return *out ? 0 : -1;
+}
+
+void Dns_Flush(void) {
+    if (s_dnsState != 2) return;
+    EnterCriticalSection(&s_dnsLock);
+    for (int b = 0; b < DNS_BUCKETS; b++) {
+        for (DnsEntry* e = s_buckets[b]; e; e = e->next) {
+            if (!e->resolving) { e->expires = 0; e->stale_until = 0; e->count = 0; e->negative = FALSE; }
+        }
+    }
+    LeaveCriticalSection(&s_dnsLock);
+    LOG_INFO("[DNS] Cache flushed (hits %ld, stale %ld, misses %ld, coalesced %ld)",
+        s_statHits, s_statStale, s_statMisses, s_statCoalesced);
+}
+
+void Dns_Cleanup(void) {
+    if (s_udpState == 2) {
+        InterlockedExchange(&s_udpStopping, 1);
+        if (s_udpThread) {
+            WaitForSingleObject(s_udpThread, 2000);
+            CloseHandle(s_udpThread);
+            s_udpThread = NULL;
+        }
+        closesocket(s_udpSock);
+        s_udpSock = INVALID_SOCKET;
+        InterlockedExchange(&s_udpState, 0);
+    }
+    // DoH 线程可能在等待系统解析，先停 DoH
+    dns_lane_stop(&s_dohLane);
+    dns_lane_stop(&s_systemLane);
+}
@@ -1,4 +1,8 @@
 /* src/utils_net.c */
+// [New] 2026-10-16: 增加 Utils_HttpGetEx (规则集下载)
+// [Mod] 2026-10-16: 域名解析改用共享解析器 (utils_dns.c)，新增 DohQuery 供其 DoH 后端使用
+// [Mod] 2026-10-16: 连接阶段改用 Happy Eyeballs 拨号器 (utils_dial.c) 竞速多个地址
+// [Fix] 2026-10-17: DoH 地址已带查询参数时以 & 追加 dns= / name=
 // [Refactor] 2026-01-29: 锁分离优化 (g_configLock -> s_netLock)
 // [Refactor] 2026-01-22: 引入 UtilsNet_InitGlobal 实现 SSL 资源预加载
 // [Fix] 2026-01-28: 增加 HTTP Chunked 解码支持与内存泄漏修复
@@ -105,6 +109,16 @@ static unsigned char* GetCachedECH(const char* domain, size_t* out_len) {
     return ret;
 }
 
+// [New] 2026-10-16: 只检查缓存中是否有可用配置 (不拷贝)，供事件循环判断能否跳过后台预取
+BOOL IsECHConfigCached(const char* domain) {
+    if (!domain) return FALSE;
+    size_t len = 0;
+    unsigned char* cfg = GetCachedECH(domain, &len);
+    if (!cfg) return FALSE;
+    free(cfg);
+    return TRUE;
+}
+
 // 写入缓存
 static void SetCachedECH(const char* domain, const unsigned char* data, size_t len) {
     if (!domain || !data || len == 0) return;
@@ -326,41 +340,18 @@ static char* InternalHttpsGet(const char* url, int timeout_ms, size_t max_size,
 
     if (!g_utils_ctx || s_is_cleaning_up) goto cleanup; 
 
-    struct addrinfo hints;
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_UNSPEC; 
-    hints.ai_socktype = SOCK_STREAM;
-    
-    char portStr[16]; snprintf(portStr, 16, "%d", u.port);
-    if (getaddrinfo(u.host, portStr, &hints, &res) != 0) goto cleanup;
+    // [Mod] 2026-10-16: 经共享解析器 (utils_dns.c) 解析，命中缓存时不再阻塞
+    int remain = timeout_ms - (int)(GetTickCount64() - start_tick);
+    if (remain <= 0 || Dns_Resolve(u.host, u.port, remain, &res) != 0) goto cleanup;
     
-    struct addrinfo *ptr = NULL;
-    for (ptr = res; ptr != NULL; ptr = ptr->ai_next) {
-        if (s_is_cleaning_up) break;
-        ULONGLONG passed = GetTickCount64() - start_tick;
-        if (passed >= (ULONGLONG)timeout_ms) break;
-
-        s = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
-        if (s == INVALID_SOCKET) continue;
-
-        unsigned long on = 1;
-        ioctlsocket(s, FIONBIO, &on);
-
-        int c_res = connect(s, ptr->ai_addr, (int)ptr->ai_addrlen);
-        if (c_res == SOCKET_ERROR) {
-            if (WSAGetLastError() != WSAEWOULDBLOCK) {
-                closesocket(s); s = INVALID_SOCKET; continue;
-            }
-            int remain = timeout_ms - (int)(GetTickCount64() - start_tick);
-            if (remain <= 0) { closesocket(s); s = INVALID_SOCKET; break; }
-            if (WaitSock(s, 1, remain) <= 0) {
-                closesocket(s); s = INVALID_SOCKET; continue; 
-            }
-        }
-        break; 
+    // [Mod] 2026-10-16: 多地址竞速连接 (utils_dial.c)，取代逐个地址串行等待
+    remain = timeout_ms - (int)(GetTickCount64() - start_tick);
+    if (remain > 0 && !s_is_cleaning_up) {
+        char dialKey[300]; snprintf(dialKey, sizeof(dialKey), "%s:%d", u.host, u.port);
+        s = Dial_Race(res, dialKey, remain, 0, NULL, NULL, NULL);
     }
     
-    if (res) { freeaddrinfo(res); res = NULL; }
+    if (res) { Dns_FreeAddrs(res); res = NULL; }
     if (s == INVALID_SOCKET) goto cleanup;
 
     ssl = SSL_new(g_utils_ctx);
@@ -512,7 +503,7 @@ static char* InternalHttpsGet(const char* url, int timeout_ms, size_t max_size,
 cleanup:
     // [Audit Fix] 安全释放 buf，如果 result 指向 buf 的一部分或 buf 本身（本例 result 为新 malloc），则互不影响
     if (buf) free(buf);
-    if (res) freeaddrinfo(res);
+    if (res) Dns_FreeAddrs(res);
     if (ssl) SSL_free(ssl); 
     if (s != INVALID_SOCKET) closesocket(s);
     
@@ -525,6 +516,11 @@ char* Utils_HttpGet(const char* url) {
     return InternalHttpsGet(url, 10000, 4 * 1024 * 1024, NULL);
 }
 
+char* Utils_HttpGetEx(const char* url, int timeout_ms, size_t max_size, size_t* out_len) {
+    if (!url) return NULL;
+    return InternalHttpsGet(url, timeout_ms, max_size, out_len);
+}
+
 static unsigned char* ParseHttpsRData(const unsigned char* ptr, const unsigned char* end, size_t* out_len) {
     if (ptr + 2 > end) return NULL;
     ptr += 2; 
@@ -644,6 +640,19 @@ static void Base64UrlEncode(const unsigned char* src, int len, char* dst) {
     dst[j] = 0;
 }
 
+// [New] 2026-10-16: RFC 8484 GET 查询 (DNS 报文经 base64url 编码)，供共享解析器 (utils_dns.c) 的 DoH 后端使用
+unsigned char* DohQuery(const char* doh_server, const unsigned char* req, int req_len, int timeout_ms, size_t* out_len) {
+    if (!doh_server || !req || req_len <= 0 || req_len > 700 || !out_len) return NULL;
+    *out_len = 0;
+
+    char b64[1024];
+    Base64UrlEncode(req, req_len, b64);
+    char url[2048];
+    char sep = strchr(doh_server, '?') ? '&' : '?';
+    if (snprintf(url, sizeof(url), "%s%cdns=%s", doh_server, sep, b64) >= (int)sizeof(url)) return NULL;
+    return (unsigned char*)InternalHttpsGet(url, timeout_ms, 65536, out_len);
+}
+
 unsigned char* FetchECHConfig(const char* domain, const char* doh_server, size_t* out_len) {
     if (!domain || !doh_server || !out_len) return NULL;
     *out_len = 0;
@@ -681,12 +690,12 @@ unsigned char* FetchECHConfig(const char* domain, const char* doh_server, size_t
         char b64[1024];
         Base64UrlEncode(dns_req, req_len, b64);
         char url[2048];
-        snprintf(url, sizeof(url), "%s?dns=%s", doh_server, b64);
+        snprintf(url, sizeof(url), "%s%cdns=%s", doh_server, strchr(doh_server, '?') ? '&' : '?', b64);
         resp_body = InternalHttpsGet(url, 2000, 65536, &resp_len); 
 
     } else {
         char url[2048]; 
-        if (snprintf(url, sizeof(url), "%s?name=%s&type=65", doh_server, domain) >= sizeof(url)) return NULL;
+        if (snprintf(url, sizeof(url), "%s%cname=%s&type=65", doh_server, strchr(doh_server, '?') ? '&' : '?', domain) >= sizeof(url)) return NULL;
         resp_body = InternalHttpsGet(url, 500, 65536, &resp_len);
     }
 
@@ -14,76 +14,14 @@
 // TCP 测速与节点信息获取
 // --------------------------------------------------------------------------
 
+// [Mod] 2026-10-16: 改用 Happy Eyeballs 拨号器 (utils_dial.c)，多地址并发竞速；
+// 返回胜出连接自身的握手耗时，不计入前面黑洞地址的等待
 int TcpPing(const char* address, int port, int timeout_ms) {
-    SOCKET sockfd = INVALID_SOCKET;
-    int ret = -1;
-    DWORD start_time, end_time;
-
-    struct addrinfo hints, *res = NULL, *ptr = NULL;
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_UNSPEC; // 允许 IPv4 或 IPv6
-    hints.ai_socktype = SOCK_STREAM;
-    
-    char portStr[16];
-    snprintf(portStr, sizeof(portStr), "%d", port);
-
-    // [Warn] getaddrinfo 可能在 DNS 解析时阻塞，请勿在 UI 线程直接调用
-    if (getaddrinfo(address, portStr, &hints, &res) != 0) {
-        return -1;
-    }
-
-    // 遍历所有可能的地址
-    for (ptr = res; ptr != NULL; ptr = ptr->ai_next) {
-        sockfd = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
-        if (sockfd == INVALID_SOCKET) continue;
-
-        // 设置非阻塞
-        unsigned long on = 1;
-        ioctlsocket(sockfd, FIONBIO, &on);
-
-        start_time = GetTickCount();
-        int conn_res = connect(sockfd, ptr->ai_addr, (int)ptr->ai_addrlen);
-
-        if (conn_res == SOCKET_ERROR) {
-            if (WSAGetLastError() != WSAEWOULDBLOCK) {
-                closesocket(sockfd);
-                sockfd = INVALID_SOCKET;
-                continue;
-            }
-        }
-
-        fd_set write_fds, except_fds;
-        FD_ZERO(&write_fds); FD_ZERO(&except_fds);
-        FD_SET(sockfd, &write_fds); FD_SET(sockfd, &except_fds);
-
-        struct timeval tv;
-        tv.tv_sec = timeout_ms / 1000;
-        tv.tv_usec = (timeout_ms % 1000) * 1000;
-
-        int sel_ret = select(0, NULL, &write_fds, &except_fds, &tv);
-
-        if (sel_ret > 0) {
-            if (FD_ISSET(sockfd, &except_fds)) {
-                // Connect failed for this address
-            } else if (FD_ISSET(sockfd, &write_fds)) {
-                int error = 0; int len = sizeof(error);
-                if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, (char*)&error, &len) == 0) {
-                    if (error == 0) {
-                        end_time = GetTickCount();
-                        ret = (int)(end_time - start_time);
-                        if (ret == 0) ret = 1; 
-                        closesocket(sockfd);
-                        break; // Success!
-                    }
-                }
-            }
-        }
-        closesocket(sockfd);
-        sockfd = INVALID_SOCKET;
-    }
-
-    freeaddrinfo(res);
-    return ret;
+    int ms = -1;
+    SOCKET sockfd = Dial_Connect(address, port, timeout_ms, 0, &ms);
+    if (sockfd == INVALID_SOCKET) return -1;
+    closesocket(sockfd);
+    return ms;
 }
 
 void GetNodeDetailInfo(const wchar_t* nodeTag, char* outType, int typeLen, char* outAddr, int addrLen) {
@@ -0,0 +1,424 @@
+/* src/utils_threadpool.c */
+// [New] 2026-10-16: 工作窃取线程池，替代 proxy.c 中的 ThreadPool_* 空实现
+// 设计要点:
+// 1. 每个工作线程持有一个有界双端队列：工作线程内提交的任务压入自己的队尾并从队尾取 (LIFO，缓存友好)，
+//    空闲线程从其他队列的队头窃取 (FIFO)；外部线程的提交按轮询分散到各队列
+// 2. 所有队列都满时拒绝提交 (返回 FALSE 并立即调用 cleanup)，批量测速等场景不会无限堆积
+// 3. 任务可携带取消标签：ThreadPool_Cancel 移除排队中的同标签任务，执行中的任务通过 ThreadPool_IsCancelled 感知
+// 4. cleanup 对每个任务恰好调用一次 (执行完成后、被取消或被拒绝时)
+// [New] 2026-10-16: 后台任务 (GUI 测速、订阅 / 规则集下载) 进入独立的 FIFO 队列，
+// 批量测速不会让数据面任务 (握手解析、DNS) 排队
+// [Fix] 2026-10-16: 出队与 running_tag 的设置在同一把锁内完成，ThreadPool_Cancel 先清空队列再检查执行中的标签，
+// 已出队但尚未开始执行的任务不会漏掉取消标记
+// [Fix] 2026-10-17: 后台任务以阻塞 I/O 为主 (3 秒 TcpPing、订阅下载)，改由独立的 I/O 线程执行，
+// 线程按需创建，上限 TP_IO_WORKERS (不低于 GUI 的并发测速数)，不再占用按 CPU 核心数设定的数据面工作线程
+
+#include "utils.h"
+#include "common.h"
+#include <process.h>
+
+#if defined(_MSC_VER)
+    #define THREAD_LOCAL __declspec(thread)
+#else
+    #define THREAD_LOCAL __thread
+#endif
+
+#define TP_MIN_WORKERS 4
+#define TP_MAX_WORKERS 32
+#define TP_QUEUE_CAP   256 // 每个工作线程的队列容量 (必须为 2 的幂)
+#define TP_QUEUE_MASK  (TP_QUEUE_CAP - 1)
+#define TP_IO_WORKERS 24 // 后台 I/O 线程上限 (>= MAX_CONCURRENT_TESTS)
+
+typedef struct {
+    void (*func)(void*);
+    void* arg;
+    void (*cleanup)(void*);
+    const void* tag;
+} TpTask;
+
+typedef struct {
+    int index;
+    HANDLE thread;
+    CRITICAL_SECTION lock;
+    TpTask ring[TP_QUEUE_CAP];
+    unsigned head; // 窃取端 (最旧)
+    unsigned tail; // 所有者端 (最新)
+
+    // 正在执行的任务 (供取消标记)
+    const void* volatile running_tag;
+    volatile LONG running_cancelled;
+} TpWorker;
+
+static TpWorker* s_workers = NULL;
+static int s_workerCount = 0;
+static HANDLE s_workSem = NULL;        // 计数 = 排队任务数 (被取消的任务会留下多余计数，工作线程空转一次即可)
+static volatile LONG s_submitCursor = 0;
+static volatile LONG s_submitting = 0; // 正在 Submit 中的调用者，Shutdown 需等待其退出
+static volatile LONG s_queued = 0;
+
+// 后台 I/O 线程 (只需执行中的任务信息，不持有队列)
+typedef struct {
+    HANDLE thread;
+    const void* volatile running_tag;
+    volatile LONG running_cancelled;
+} TpIoWorker;
+
+// 后台队列 (复用 TpWorker 的环形队列与锁)，s_ioCount / s_ioIdle 在 s_bg.lock 内访问
+static TpWorker s_bg;
+static HANDLE s_bgSem = NULL;          // 计数 = 后台排队任务数
+static TpIoWorker s_io[TP_IO_WORKERS];
+static int s_ioCount = 0;              // 已创建的 I/O 线程数 (只增不减，直到 Shutdown)
+static int s_ioIdle = 0;               // 正在等待任务的 I/O 线程数
+
+// 0=Uninit, 1=Initializing, 2=Running, 3=Stopping
+static volatile LONG s_tpState = 0;
+
+static THREAD_LOCAL TpWorker* t_self = NULL;
+static THREAD_LOCAL TpIoWorker* t_io = NULL;
+
+// --- 队列操作 (持有 w->lock) ---
+
+static BOOL tp_push(TpWorker* w, const TpTask* t) {
+    BOOL ok = FALSE;
+    EnterCriticalSection(&w->lock);
+    if (w->tail - w->head < TP_QUEUE_CAP) {
+        w->ring[w->tail & TP_QUEUE_MASK] = *t;
+        w->tail++;
+        ok = TRUE;
+    }
+    LeaveCriticalSection(&w->lock);
+    return ok;
+}
+
+// 出队时在队列锁内登记为执行中 (self->running_tag)，使 ThreadPool_Cancel 不会错过刚出队的任务
+static void tp_mark_running(TpWorker* self, const TpTask* t) {
+    self->running_cancelled = 0;
+    self->running_tag = t->tag;
+}
+
+static BOOL tp_pop_tail(TpWorker* w, TpTask* out) {
+    BOOL ok = FALSE;
+    EnterCriticalSection(&w->lock);
+    if (w->tail != w->head) {
+        w->tail--;
+        *out = w->ring[w->tail & TP_QUEUE_MASK];
+        tp_mark_running(w, out);
+        ok = TRUE;
+    }
+    LeaveCriticalSection(&w->lock);
+    return ok;
+}
+
+static BOOL tp_steal_head(TpWorker* w, TpWorker* self, TpTask* out) {
+    BOOL ok = FALSE;
+    EnterCriticalSection(&w->lock);
+    if (w->tail != w->head) {
+        *out = w->ring[w->head & TP_QUEUE_MASK];
+        w->head++;
+        tp_mark_running(self, out);
+        ok = TRUE;
+    }
+    LeaveCriticalSection(&w->lock);
+    return ok;
+}
+
+// 先取自己的队尾，再依次窃取其他线程的队头
+static BOOL tp_take(TpWorker* self, TpTask* out) {
+    if (tp_pop_tail(self, out)) return TRUE;
+    for (int i = 1; i < s_workerCount; i++) {
+        TpWorker* victim = &s_workers[(self->index + i) % s_workerCount];
+        if (tp_steal_head(victim, self, out)) return TRUE;
+    }
+    return FALSE;
+}
+
+// 移除队列中满足条件的任务 (tag 为 NULL 时全部移除)，被移除的任务在锁外调用 cleanup
+static int tp_remove(TpWorker* w, const void* tag) {
+    TpTask removed[TP_QUEUE_CAP];
+    int n = 0;
+
+    EnterCriticalSection(&w->lock);
+    unsigned keep = w->head;
+    for (unsigned i = w->head; i != w->tail; i++) {
+        TpTask* t = &w->ring[i & TP_QUEUE_MASK];
+        if (!tag || t->tag == tag) {
+            removed[n++] = *t;
+        } else {
+            if (keep != i) w->ring[keep & TP_QUEUE_MASK] = *t;
+            keep++;
+        }
+    }
+    w->tail = keep;
+    LeaveCriticalSection(&w->lock);
+
+    for (int i = 0; i < n; i++) {
+        if (removed[i].cleanup) removed[i].cleanup(removed[i].arg);
+    }
+    if (n > 0) InterlockedExchangeAdd(&s_queued, -n);
+    return n;
+}
+
+// --- 工作线程 ---
+
+static unsigned __stdcall ThreadPoolWorker(void* arg) {
+    TpWorker* self = (TpWorker*)arg;
+    t_self = self;
+
+    while (TRUE) {
+        WaitForSingleObject(s_workSem, INFINITE);
+        if (s_tpState != 2) break;
+
+        TpTask t;
+        if (!tp_take(self, &t)) continue; // 对应任务已被取消
+        InterlockedDecrement(&s_queued);
+
+        t.func(t.arg);
+        self->running_tag = NULL;
+        if (t.cleanup) t.cleanup(t.arg);
+    }
+
+    t_self = NULL;
+    Pool_Thread_Cleanup(); // 归还本线程的 16K 缓存块
+    return 0;
+}
+
+// 后台 I/O 线程：只取后台队列，出队与 running_tag 的登记在 s_bg.lock 内完成
+static unsigned __stdcall ThreadPoolIoWorker(void* arg) {
+    TpIoWorker* self = (TpIoWorker*)arg;
+    t_io = self;
+
+    while (TRUE) {
+        EnterCriticalSection(&s_bg.lock);
+        s_ioIdle++;
+        LeaveCriticalSection(&s_bg.lock);
+
+        WaitForSingleObject(s_bgSem, INFINITE);
+
+        TpTask t;
+        BOOL ok = FALSE;
+        EnterCriticalSection(&s_bg.lock);
+        s_ioIdle--;
+        if (s_tpState == 2 && s_bg.tail != s_bg.head) {
+            t = s_bg.ring[s_bg.head & TP_QUEUE_MASK];
+            s_bg.head++;
+            self->running_cancelled = 0;
+            self->running_tag = t.tag;
+            ok = TRUE;
+        }
+        LeaveCriticalSection(&s_bg.lock);
+        if (s_tpState != 2) break;
+        if (!ok) continue; // 对应任务已被取消
+        InterlockedDecrement(&s_queued);
+
+        t.func(t.arg);
+        self->running_tag = NULL;
+        if (t.cleanup) t.cleanup(t.arg);
+    }
+
+    t_io = NULL;
+    Pool_Thread_Cleanup();
+    return 0;
+}
+
+// 入队后台任务；排队数超过空闲 I/O 线程数时补建一个线程 (不超过 TP_IO_WORKERS)
+static BOOL tp_push_background(const TpTask* t) {
+    BOOL ok = FALSE;
+    EnterCriticalSection(&s_bg.lock);
+    if (s_bg.tail - s_bg.head < TP_QUEUE_CAP) {
+        s_bg.ring[s_bg.tail & TP_QUEUE_MASK] = *t;
+        s_bg.tail++;
+        ok = TRUE;
+        if ((int)(s_bg.tail - s_bg.head) > s_ioIdle && s_ioCount < TP_IO_WORKERS) {
+            TpIoWorker* w = &s_io[s_ioCount];
+            memset(w, 0, sizeof(*w));
+            w->thread = (HANDLE)_beginthreadex(NULL, 0, ThreadPoolIoWorker, w, 0, NULL);
+            if (w->thread) s_ioCount++;
+            else if (s_ioCount == 0) LOG_WARN("[ThreadPool] Failed to start I/O thread");
+        }
+        if (s_ioCount == 0) { // 没有任何 I/O 线程可执行，撤回任务
+            s_bg.tail--;
+            ok = FALSE;
+        }
+    }
+    LeaveCriticalSection(&s_bg.lock);
+    return ok;
+}
+
+// --- 对外接口 ---
+
+void ThreadPool_Init(int max_workers) {
+    if (InterlockedCompareExchange(&s_tpState, 1, 0) != 0) {
+        while (s_tpState == 1) Sleep(1);
+        return;
+    }
+
+    if (max_workers <= 0) {
+        // 任务以阻塞 I/O 为主 (测速、DNS、DoH)，线程数取核心数的 2 倍
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        max_workers = (int)si.dwNumberOfProcessors * 2;
+    }
+    if (max_workers < TP_MIN_WORKERS) max_workers = TP_MIN_WORKERS;
+    if (max_workers > TP_MAX_WORKERS) max_workers = TP_MAX_WORKERS;
+
+    s_workSem = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);
+    s_bgSem = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);
+    s_workers = (TpWorker*)calloc(max_workers, sizeof(TpWorker));
+    if (!s_workSem || !s_bgSem || !s_workers) {
+        if (s_workSem) { CloseHandle(s_workSem); s_workSem = NULL; }
+        if (s_bgSem) { CloseHandle(s_bgSem); s_bgSem = NULL; }
+        free(s_workers); s_workers = NULL;
+        InterlockedExchange(&s_tpState, 0);
+        LOG_ERROR("[ThreadPool] Initialization failed (OOM)");
+        return;
+    }
+
+    for (int i = 0; i < max_workers; i++) {
+        s_workers[i].index = i;
+        InitializeCriticalSection(&s_workers[i].lock);
+    }
+    s_workerCount = max_workers;
+
+    memset(&s_bg, 0, sizeof(s_bg));
+    s_bg.index = -1;
+    InitializeCriticalSection(&s_bg.lock);
+    s_ioCount = 0;
+    s_ioIdle = 0;
+
+    // 先置为运行态，工作线程启动后立即可取任务
+    InterlockedExchange(&s_tpState, 2);
+
+    int started = 0;
+    for (int i = 0; i < max_workers; i++) {
+        s_workers[i].thread = (HANDLE)_beginthreadex(NULL, 0, ThreadPoolWorker, &s_workers[i], 0, NULL);
+        if (s_workers[i].thread) started++;
+    }
+    if (started == 0) {
+        LOG_ERROR("[ThreadPool] Failed to start worker threads");
+        ThreadPool_Shutdown();
+        return;
+    }
+    log_msg("[System] Thread Pool: %d workers (work-stealing, %d slots each), up to %d background I/O threads",
+            started, TP_QUEUE_CAP, TP_IO_WORKERS);
+}
+
+static BOOL tp_submit(void (*func)(void*), void* arg, void (*cleanup)(void*), const void* tag, BOOL background) {
+    if (func && s_tpState == 0) ThreadPool_Init(0);
+
+    InterlockedIncrement(&s_submitting);
+    BOOL ok = FALSE;
+    if (func && s_tpState == 2) {
+        TpTask t = { func, arg, cleanup, tag };
+        if (background) {
+            ok = tp_push_background(&t);
+        } else {
+            // 工作线程内提交 (如任务派生子任务) 优先放入自己的队列
+            if (t_self) ok = tp_push(t_self, &t);
+            for (int i = 0; !ok && i < s_workerCount; i++) {
+                LONG n = InterlockedIncrement(&s_submitCursor);
+                ok = tp_push(&s_workers[(unsigned long)n % (unsigned long)s_workerCount], &t);
+            }
+        }
+        if (ok) {
+            InterlockedIncrement(&s_queued);
+            ReleaseSemaphore(background ? s_bgSem : s_workSem, 1, NULL);
+        }
+    }
+    InterlockedDecrement(&s_submitting);
+
+    if (!ok) {
+        if (func && s_tpState == 2) LOG_WARN("[ThreadPool] Queue full, task rejected");
+        // 拒绝时直接执行清理，避免内存泄漏
+        if (cleanup) cleanup(arg);
+    }
+    return ok;
+}
+
+BOOL ThreadPool_SubmitTagged(void (*func)(void*), void* arg, void (*cleanup)(void*), const void* tag) {
+    return tp_submit(func, arg, cleanup, tag, FALSE);
+}
+
+BOOL ThreadPool_Submit(void (*func)(void*), void* arg, void (*cleanup)(void*)) {
+    return tp_submit(func, arg, cleanup, NULL, FALSE);
+}
+
+BOOL ThreadPool_SubmitBackground(void (*func)(void*), void* arg, void (*cleanup)(void*), const void* tag) {
+    return tp_submit(func, arg, cleanup, tag, TRUE);
+}
+
+int ThreadPool_Cancel(const void* tag) {
+    if (!tag || s_tpState != 2) return 0;
+
+    // 先清空所有队列再检查执行中的标签：在某个队列被清空前出队的任务，其标签已在该队列锁内登记
+    int removed = tp_remove(&s_bg, tag);
+    for (int i = 0; i < s_workerCount; i++) removed += tp_remove(&s_workers[i], tag);
+    for (int i = 0; i < s_workerCount; i++) {
+        TpWorker* w = &s_workers[i];
+        if (w->running_tag == tag) InterlockedExchange(&w->running_cancelled, 1);
+    }
+    EnterCriticalSection(&s_bg.lock);
+    for (int i = 0; i < s_ioCount; i++) {
+        if (s_io[i].running_tag == tag) InterlockedExchange(&s_io[i].running_cancelled, 1);
+    }
+    LeaveCriticalSection(&s_bg.lock);
+    return removed;
+}
+
+BOOL ThreadPool_IsCancelled(void) {
+    if (s_tpState != 2) return TRUE;
+    if (t_self) return t_self->running_cancelled != 0;
+    return t_io ? (t_io->running_cancelled != 0) : FALSE;
+}
+
+LONG ThreadPool_GetQueuedCount(void) {
+    return s_queued;
+}
+
+void ThreadPool_Shutdown() {
+    LONG prev = InterlockedCompareExchange(&s_tpState, 3, 2);
+    if (prev != 2) return;
+
+    while (s_submitting > 0) Sleep(1);
+
+    for (int i = 0; i < s_workerCount; i++) InterlockedExchange(&s_workers[i].running_cancelled, 1);
+    ReleaseSemaphore(s_workSem, s_workerCount, NULL);
+    // 已无提交者，s_ioCount 不再变化
+    for (int i = 0; i < s_ioCount; i++) InterlockedExchange(&s_io[i].running_cancelled, 1);
+    if (s_ioCount > 0) ReleaseSemaphore(s_bgSem, s_ioCount, NULL);
+
+    BOOL bSafe = TRUE;
+    for (int i = 0; i < s_workerCount; i++) {
+        if (s_workers[i].thread) {
+            if (WaitForSingleObject(s_workers[i].thread, 5000) == WAIT_TIMEOUT) bSafe = FALSE;
+            CloseHandle(s_workers[i].thread);
+            s_workers[i].thread = NULL;
+        }
+    }
+    for (int i = 0; i < s_ioCount; i++) {
+        if (WaitForSingleObject(s_io[i].thread, 5000) == WAIT_TIMEOUT) bSafe = FALSE;
+        CloseHandle(s_io[i].thread);
+        s_io[i].thread = NULL;
+    }
+    if (!bSafe) {
+        // 仍有任务卡在阻塞调用中，保留队列与锁 (进程即将退出)，避免释放后访问
+        LOG_WARN("[ThreadPool] Worker did not exit in time, skipping cleanup");
+        return;
+    }
+
+    // 未执行的任务只做清理
+    int dropped = tp_remove(&s_bg, NULL);
+    DeleteCriticalSection(&s_bg.lock);
+    for (int i = 0; i < s_workerCount; i++) {
+        dropped += tp_remove(&s_workers[i], NULL);
+        DeleteCriticalSection(&s_workers[i].lock);
+    }
+    if (dropped > 0) log_msg("[System] Thread Pool: dropped %d queued task(s)", dropped);
+
+    free(s_workers); s_workers = NULL;
+    s_workerCount = 0;
+    CloseHandle(s_workSem); s_workSem = NULL;
+    CloseHandle(s_bgSem); s_bgSem = NULL;
+    s_ioCount = 0;
+    s_queued = 0;
+    InterlockedExchange(&s_tpState, 0);
+}
@@ -0,0 +1,93 @@
+/* tests/test_mux_preamble.c */
+// [New] 2026-10-17: 多路复用隧道头 (MuxPool_BuildPreamble) 与 sing-mux 编码的比对
+// 隧道头 = 目标为 sp.mux.sing-box.arpa:444 的代理协议头 + 会话请求 [版本 0][协议]，
+// sing-mux 的协议编号为 h2mux=0, smux=1, yamux=2；本客户端发送 yamux 帧，因此最后两字节必须为 00 02
+
+#include "proxy_internal.h"
+#include <winsock2.h>
+#include <stdio.h>
+#include <string.h>
+
+static int s_failures = 0;
+
+#define CHECK(cond, msg) do { \
+    if (!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, msg); s_failures++; } \
+} while (0)
+
+static void init_session(ProxySession* s, const char* type) {
+    memset(s, 0, sizeof(*s));
+    strcpy(s->config.type, type);
+    strcpy(s->config.user, "01234567-89ab-cdef-0123-456789abcdef");
+    strcpy(s->config.pass, "password");
+    strcpy(s->target_host, "example.com");
+    s->target_port = 443;
+}
+
+// VLESS: 逐字节比对 [版本 0][UUID][附加信息长度 0][命令 1=TCP][端口 444][地址类型 2=域名][长度][域名][00 02]
+static void test_vless_bytes(void) {
+    static const unsigned char uuid[16] = {
+        0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef,
+        0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef
+    };
+    const char* dest = "sp.mux.sing-box.arpa";
+    unsigned char expect[64];
+    int n = 0;
+    expect[n++] = 0x00;
+    memcpy(expect + n, uuid, 16); n += 16;
+    expect[n++] = 0x00;
+    expect[n++] = 0x01;
+    expect[n++] = 0x01; expect[n++] = 0xBC; // 444
+    expect[n++] = 0x02;
+    expect[n++] = (unsigned char)strlen(dest);
+    memcpy(expect + n, dest, strlen(dest)); n += (int)strlen(dest);
+    expect[n++] = 0x00;
+    expect[n++] = 0x02;
+
+    ProxySession s;
+    unsigned char out[MUX_PREAMBLE_MAX];
+    init_session(&s, "vless");
+    int len = MuxPool_BuildPreamble(&s, out);
+
+    CHECK(len == n, "vless preamble length");
+    CHECK(len == n && memcmp(out, expect, n) == 0, "vless preamble bytes");
+    CHECK(strcmp(s.target_host, "example.com") == 0 && s.target_port == 443, "vless target restored");
+}
+
+// Trojan: 代理协议头与直接以多路复用目标构造的结果一致，其后紧跟 00 02
+static void test_trojan_suffix(void) {
+    ProxySession s;
+    unsigned char out[MUX_PREAMBLE_MAX], head[MUX_PREAMBLE_MAX];
+    init_session(&s, "trojan");
+    int len = MuxPool_BuildPreamble(&s, out);
+    CHECK(strcmp(s.target_host, "example.com") == 0 && s.target_port == 443, "trojan target restored");
+
+    strcpy(s.target_host, "sp.mux.sing-box.arpa");
+    s.target_port = 444;
+    int head_len = tunnel_build_proxy_header(&s, head);
+
+    CHECK(head_len > 0 && len == head_len + 2, "trojan preamble length");
+    CHECK(len == head_len + 2 && memcmp(out, head, head_len) == 0, "trojan proxy header");
+    CHECK(len == head_len + 2 && out[head_len] == 0x00 && out[head_len + 1] == 0x02, "trojan session request (00 02)");
+}
+
+// SOCKS5 出站需要逐轮交互，不能作为多路复用隧道
+static void test_socks5_rejected(void) {
+    ProxySession s;
+    unsigned char out[MUX_PREAMBLE_MAX];
+    init_session(&s, "socks");
+    CHECK(MuxPool_BuildPreamble(&s, out) < 0, "socks5 outbound rejected");
+}
+
+int wmain(int argc, wchar_t* argv[]) {
+    (void)argc; (void)argv;
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2, 2), &wsa);
+
+    test_vless_bytes();
+    test_trojan_suffix();
+    test_socks5_rejected();
+
+    WSACleanup();
+    if (s_failures == 0) printf("test_mux_preamble: all passed\n");
+    return s_failures ? 1 : 0;
+}